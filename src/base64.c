@@ -87,3 +87,64 @@ int test_base64(void)
 
 	return err;
 }
+
+
+int bench_base64_encode(struct bench_state *st)
+{
+	int err = 0;
+
+	BENCH_LOOP(st) {
+		size_t olen = st->out_size;
+
+		err = base64_encode(st->in, st->param, (char *)st->out, &olen);
+		if (err)
+			break;
+
+		BENCH_SINK(olen);
+	}
+
+	return err;
+}
+
+
+/* encode the input once, the benchmark decodes it */
+int bench_base64_decode_setup(struct bench_state *st)
+{
+	struct mbuf *mb;
+	size_t olen = st->param * 4 / 3 + 4;
+	int err;
+
+	mb = mbuf_alloc(olen);
+	if (!mb)
+		return ENOMEM;
+
+	err = base64_encode(st->in, st->param, (char *)mb->buf, &olen);
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->end = olen;
+	st->arg = mb;
+
+	return 0;
+}
+
+
+int bench_base64_decode(struct bench_state *st)
+{
+	const struct mbuf *mb = st->arg;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+		size_t olen = st->out_size;
+
+		err = base64_decode((char *)mb->buf, mb->end, st->out, &olen);
+		if (err)
+			break;
+
+		BENCH_SINK(olen);
+	}
+
+	return err;
+}
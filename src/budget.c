@@ -0,0 +1,125 @@
+/**
+ * @file budget.c  Cost budgets for testcases
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "budget"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * TEST_ALLOC_MAX() and friends compare the cost of a region of a
+ * testcase with a maximum. The allocations come from memprof, the
+ * socket syscalls from syscount and the time from the monotonic clock.
+ *
+ * The checks are only made in the perf mode, or with --budgets, e.g.
+ * in CI. A counter that is not available on this platform always
+ * passes.
+ */
+
+
+static bool enabled;
+
+
+static const char *kind_name(enum test_budget_kind kind)
+{
+	switch (kind) {
+
+	case BUDGET_ALLOCS:   return "allocations";
+	case BUDGET_BYTES:    return "bytes allocated";
+	case BUDGET_SYSCALLS: return "socket syscalls";
+	case BUDGET_NSEC:     return "nanoseconds";
+	default:              return "?";
+	}
+}
+
+
+void test_budget_enable(bool enable)
+{
+	enabled = enable;
+}
+
+
+bool test_budget_enabled(void)
+{
+	return enabled;
+}
+
+
+/* Start a budget region, see TEST_BUDGET_BEGIN() */
+void test_budget_begin(struct test_budget *b)
+{
+	if (!b)
+		return;
+
+	memprof_get(&b->mp);
+	b->syscalls = syscount_get();
+	b->nsec     = test_nanoseconds();
+}
+
+
+/**
+ * Check the cost since test_budget_begin() against a maximum
+ *
+ * @param b    Budget region
+ * @param kind What to count
+ * @param max  Maximum
+ * @param file Source file, for the warning
+ * @param line Source line, for the warning
+ *
+ * @return false if the budget is exceeded, otherwise true
+ */
+bool test_budget_check(const struct test_budget *b,
+		       enum test_budget_kind kind, uint64_t max,
+		       const char *file, unsigned line)
+{
+	const uint64_t now = test_nanoseconds();
+	struct memprof mp;
+	uint64_t used;
+
+	if (!enabled || !b)
+		return true;
+
+	switch (kind) {
+
+	case BUDGET_ALLOCS:
+	case BUDGET_BYTES:
+		if (!memprof_supported())
+			return true;
+
+		memprof_get(&mp);
+		used = kind == BUDGET_ALLOCS ? mp.allocs - b->mp.allocs
+			: mp.bytes - b->mp.bytes;
+		break;
+
+	case BUDGET_SYSCALLS:
+		if (!syscount_supported())
+			return true;
+
+		used = syscount_get() - b->syscalls;
+		break;
+
+	case BUDGET_NSEC:
+		used = now - b->nsec;
+		break;
+
+	default:
+		return true;
+	}
+
+	if (used <= max)
+		return true;
+
+	(void)re_fprintf(stderr, "\n");
+	DEBUG_WARNING("budget: %s:%u: %llu %s, the maximum is %llu\n",
+		      file, line, (unsigned long long)used, kind_name(kind),
+		      (unsigned long long)max);
+
+	return false;
+}
@@ -41,3 +41,17 @@ int test_crc32(void)
 
 	return 0;
 }
+
+
+int bench_crc32(struct bench_state *st)
+{
+	BENCH_LOOP(st) {
+		uint32_t crc;
+
+		crc = (uint32_t)crc32(0L, st->in, (unsigned int)st->param);
+
+		BENCH_SINK(crc);
+	}
+
+	return 0;
+}
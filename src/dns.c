@@ -25,7 +25,7 @@ static int mkstr(char **strp)
 	if (!str)
 		return ENOMEM;
 
-	rand_str(str, sz);
+	test_rand_str(str, sz);
 
 	*strp = str;
 
@@ -49,7 +49,7 @@ static int mkrr(struct dnsrr *rr, uint16_t type)
 	switch (type) {
 
 	case DNS_TYPE_A:
-		rr->rdata.a.addr = rand_u32();
+		rr->rdata.a.addr = test_rand_u32();
 		break;
 
 	case DNS_TYPE_NS:
@@ -63,11 +63,11 @@ static int mkrr(struct dnsrr *rr, uint16_t type)
 	case DNS_TYPE_SOA:
 		err |= mkstr(&rr->rdata.soa.mname);
 		err |= mkstr(&rr->rdata.soa.rname);
-		rr->rdata.soa.serial  = rand_u32();
-		rr->rdata.soa.refresh = rand_u32();
-		rr->rdata.soa.retry   = rand_u32();
-		rr->rdata.soa.expire  = rand_u32();
-		rr->rdata.soa.ttlmin  = rand_u32();
+		rr->rdata.soa.serial  = test_rand_u32();
+		rr->rdata.soa.refresh = test_rand_u32();
+		rr->rdata.soa.retry   = test_rand_u32();
+		rr->rdata.soa.expire  = test_rand_u32();
+		rr->rdata.soa.ttlmin  = test_rand_u32();
 		break;
 
 	case DNS_TYPE_PTR:
@@ -75,7 +75,7 @@ static int mkrr(struct dnsrr *rr, uint16_t type)
 		break;
 
 	case DNS_TYPE_MX:
-		rr->rdata.mx.pref = rand_u16();
+		rr->rdata.mx.pref = test_rand_u16();
 		err |= mkstr(&rr->rdata.mx.exchange);
 		break;
 
@@ -84,19 +84,19 @@ static int mkrr(struct dnsrr *rr, uint16_t type)
 		break;
 
 	case DNS_TYPE_AAAA:
-		rand_bytes(rr->rdata.aaaa.addr, 16);
+		test_rand_bytes(rr->rdata.aaaa.addr, 16);
 		break;
 
 	case DNS_TYPE_SRV:
-		rr->rdata.srv.pri    = rand_u16();
-		rr->rdata.srv.weight = rand_u16();
-		rr->rdata.srv.port   = rand_u16();
+		rr->rdata.srv.pri    = test_rand_u16();
+		rr->rdata.srv.weight = test_rand_u16();
+		rr->rdata.srv.port   = test_rand_u16();
 		err |= mkstr(&rr->rdata.srv.target);
 		break;
 
 	case DNS_TYPE_NAPTR:
-		rr->rdata.naptr.order = rand_u16();
-		rr->rdata.naptr.pref  = rand_u16();
+		rr->rdata.naptr.order = test_rand_u16();
+		rr->rdata.naptr.pref  = test_rand_u16();
 		err |= mkstr(&rr->rdata.naptr.flags);
 		err |= mkstr(&rr->rdata.naptr.services);
 		err |= mkstr(&rr->rdata.naptr.regexp);
@@ -191,13 +191,15 @@ static void conn_handler(const struct sa *src, void *arg)
 }
 
 
-static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp)
+static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp,
+			       struct fuzz_ctx *fctx)
 {
 	static const char *srtp_suites =
 		"SRTP_AES128_CM_SHA1_80:"
 		"SRTP_AES128_CM_SHA1_32";
 	struct dtls_test test;
 	struct udp_sock *us = NULL;
+	struct fuzz *fuzz = NULL;
 	struct sa cli, srv;
 	uint8_t fp[20];
 	int err;
@@ -241,6 +243,10 @@ static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp)
 	if (err)
 		goto out;
 
+	err = fuzz_attach_udpsock(&fuzz, us, fctx);
+	if (err)
+		goto out;
+
 	err = dtls_listen(&test.sock_srv, NULL, us, 4, 0, conn_handler, &test);
 	if (err)
 		goto out;
@@ -293,6 +299,7 @@ static int test_dtls_srtp_base(enum tls_method method, bool dtls_srtp)
 	test.sock_cli = mem_deref(test.sock_cli);
 	test.sock_srv = mem_deref(test.sock_srv);
 	test.tls = mem_deref(test.tls);
+	mem_deref(fuzz);
 	mem_deref(us);
 
 	return err;
@@ -324,7 +331,7 @@ int test_dtls(void)
 		return ESKIPPED;
 	}
 	else {
-		err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, false);
+		err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, false, NULL);
 		if (err)
 			return err;
 	}
@@ -333,7 +340,7 @@ int test_dtls(void)
 }
 
 
-int test_dtls_srtp(void)
+static int dtls_srtp(struct fuzz_ctx *fctx)
 {
 	int err = 0;
 
@@ -342,9 +349,21 @@ int test_dtls_srtp(void)
 		return ESKIPPED;
 	}
 
-	err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, true);
+	err = test_dtls_srtp_base(TLS_METHOD_DTLSV1, true, fctx);
 	if (err)
 		return err;
 
 	return 0;
 }
+
+
+int test_dtls_srtp(void)
+{
+	return dtls_srtp(NULL);
+}
+
+
+int test_dtls_srtp_fuzz(struct fuzz_ctx *ctx)
+{
+	return dtls_srtp(ctx);
+}
@@ -0,0 +1,877 @@
+/**
+ * @file fuzzer.c  Fuzzing entry points for the wire decoders
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <dirent.h>
+#endif
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "fuzzer"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * One target per decoder. Each input is copied into a fresh mbuf and
+ * decoded, the result is released again. Decoding errors are the
+ * normal outcome for hostile input and are ignored, what counts are
+ * crashes, leaks and sanitizer reports.
+ *
+ * Build with USE_FUZZER=1 for libFuzzer, or AFL++ with its libFuzzer
+ * driver, and choose the target with RETEST_FUZZ_TARGET. Without it,
+ * "retest --fuzz <target> [file|dir]..." replays a corpus, or mutates
+ * the built-in seeds for --duration seconds, and reports execs/s.
+ */
+
+
+enum {
+	DICT_BSIZE = 32,
+	MAX_LEVELS = 8,
+	MUTATIONS_MAX = 8,
+	MUTATE_EXTRA = 16,         /* bytes that a mutation may add */
+	TEST_MUTATIONS = 256,
+	FILE_MAX = 1048576,
+};
+
+
+typedef int (fuzz_h)(struct mbuf *mb);
+
+struct seed {
+	const char *data;
+	size_t len;
+};
+
+struct target {
+	const char *name;
+	fuzz_h *h;
+	const struct seed *seedv;
+	size_t seedc;
+	const char * const *filev;     /* seed files in data/ */
+	size_t filec;
+};
+
+struct seedent {
+	struct le le;
+	struct mbuf *mb;
+};
+
+#define SEED(s) {s, sizeof(s) - 1}
+
+
+static int fuzz_sip_msg(struct mbuf *mb)
+{
+	struct sip_msg *msg;
+	int err;
+
+	err = sip_msg_decode(&msg, mb);
+	if (!err)
+		mem_deref(msg);
+
+	return err;
+}
+
+
+static int fuzz_stun_msg(struct mbuf *mb)
+{
+	struct stun_msg *msg;
+	int err;
+
+	err = stun_msg_decode(&msg, mb, NULL);
+	if (!err)
+		mem_deref(msg);
+
+	return err;
+}
+
+
+/* compound packet */
+static int fuzz_rtcp(struct mbuf *mb)
+{
+	int err = 0;
+
+	while (mbuf_get_left(mb) >= 4) {
+
+		struct rtcp_msg *msg;
+
+		err = rtcp_decode(&msg, mb);
+		if (err)
+			break;
+
+		mem_deref(msg);
+	}
+
+	return err;
+}
+
+
+static int fuzz_rtp_hdr(struct mbuf *mb)
+{
+	struct rtp_header hdr;
+
+	return rtp_hdr_decode(&hdr, mb);
+}
+
+
+static int fuzz_sdp(struct mbuf *mb)
+{
+	struct sdp_session *sess;
+	struct sa laddr;
+	int err;
+
+	(void)sa_set_str(&laddr, "127.0.0.1", 0);
+
+	err = sdp_session_alloc(&sess, &laddr);
+	if (err)
+		return err;
+
+	err = sdp_decode(sess, mb, true);
+
+	mem_deref(sess);
+
+	return err;
+}
+
+
+static int fuzz_json(struct mbuf *mb)
+{
+	struct odict *od;
+	int err;
+
+	err = json_decode_odict(&od, DICT_BSIZE, (char *)mb->buf, mb->end,
+				MAX_LEVELS);
+	if (!err)
+		mem_deref(od);
+
+	return err;
+}
+
+
+/* as a request, and as a response */
+static int fuzz_http_msg(struct mbuf *mb)
+{
+	struct http_msg *msg;
+	int err;
+
+	err = http_msg_decode(&msg, mb, true);
+	if (!err)
+		mem_deref(msg);
+
+	mb->pos = 0;
+
+	err = http_msg_decode(&msg, mb, false);
+	if (!err)
+		mem_deref(msg);
+
+	return err;
+}
+
+
+static int fuzz_bfcp_msg(struct mbuf *mb)
+{
+	int err = 0;
+
+	while (mbuf_get_left(mb) >= 4) {
+
+		struct bfcp_msg *msg;
+
+		err = bfcp_msg_decode(&msg, mb);
+		if (err)
+			break;
+
+		mem_deref(msg);
+	}
+
+	return err;
+}
+
+
+static int fuzz_dns_rr(struct mbuf *mb)
+{
+	int err = 0;
+
+	while (mbuf_get_left(mb)) {
+
+		struct dnsrr *rr;
+
+		err = dns_rr_decode(mb, &rr, 0);
+		if (err)
+			break;
+
+		mem_deref(rr);
+	}
+
+	return err;
+}
+
+
+static int fuzz_h264_sps(struct mbuf *mb)
+{
+	struct h264_sps sps;
+
+	return h264_sps_decode(&sps, mb->buf, mb->end);
+}
+
+
+static int fuzz_uri(struct mbuf *mb)
+{
+	struct uri uri;
+	struct pl pl;
+
+	pl.p = (char *)mb->buf;
+	pl.l = mb->end;
+
+	return uri_decode(&uri, &pl);
+}
+
+
+static const struct seed seeds_sip[] = {
+	SEED("REGISTER sip:example.com SIP/2.0\r\n"
+	     "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK776asdhds\r\n"
+	     "Max-Forwards: 70\r\n"
+	     "To: Bob <sip:bob@example.com>\r\n"
+	     "From: Bob <sip:bob@example.com>;tag=456248\r\n"
+	     "Call-ID: 843817637684230@998sdasdh09\r\n"
+	     "CSeq: 1826 REGISTER\r\n"
+	     "Contact: <sip:bob@10.0.0.1>;expires=7200\r\n"
+	     "Content-Length: 0\r\n"
+	     "\r\n"),
+	SEED("SIP/2.0 200 OK\r\n"
+	     "Via: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bKnashds8"
+	     ";received=192.0.2.4\r\n"
+	     "To: <sip:alice@atlanta.com>;tag=37GkEhwl6\r\n"
+	     "From: <sip:alice@atlanta.com>;tag=1928301774\r\n"
+	     "Call-ID: a84b4c76e66710\r\n"
+	     "CSeq: 314159 INVITE\r\n"
+	     "Content-Type: application/sdp\r\n"
+	     "Content-Length: 4\r\n"
+	     "\r\n"
+	     "v=0\n"),
+};
+
+static const struct seed seeds_stun[] = {
+	/* Binding request with SOFTWARE and FINGERPRINT */
+	SEED("\x00\x01\x00\x18\x21\x12\xa4\x42"
+	     "\xb7\xe7\xa7\x01\xbc\x34\xd6\x86\xfa\x87\xdf\xae"
+	     "\x80\x22\x00\x0c" "retest fuzz "
+	     "\x80\x28\x00\x04\x5a\x4b\x3c\x2d"),
+	/* Binding response with XOR-MAPPED-ADDRESS */
+	SEED("\x01\x01\x00\x0c\x21\x12\xa4\x42"
+	     "\xb7\xe7\xa7\x01\xbc\x34\xd6\x86\xfa\x87\xdf\xae"
+	     "\x00\x20\x00\x08\x00\x01\xa1\x47\xe1\x12\xa6\x43"),
+};
+
+static const struct seed seeds_rtcp[] = {
+	/* RR with one report block, followed by SDES CNAME */
+	SEED("\x81\xc9\x00\x07\x12\x34\x56\x78"
+	     "\x9a\xbc\xde\xf0\x00\x00\x00\x01\x00\x00\x10\x00"
+	     "\x00\x00\x00\x10\x00\x00\x00\x00\x00\x00\x00\x00"
+	     "\x81\xca\x00\x03\x12\x34\x56\x78"
+	     "\x01\x05" "retst" "\x00\x00"),
+	/* BYE with reason */
+	SEED("\x81\xcb\x00\x03\x12\x34\x56\x78\x04" "done" "\x00\x00\x00"),
+};
+
+static const struct seed seeds_rtp[] = {
+	SEED("\x80\x00\x01\x02\x00\x00\x03\x20\xde\xad\xbe\xef" "payload"),
+	/* two CSRCs and a header extension */
+	SEED("\x92\xe0\x01\x02\x00\x00\x03\x20\xde\xad\xbe\xef"
+	     "\x00\x00\x00\x01\x00\x00\x00\x02"
+	     "\xbe\xde\x00\x01\x10\xaa\x00\x00" "payload"),
+};
+
+static const struct seed seeds_sdp[] = {
+	SEED("v=0\r\n"
+	     "o=- 1 2 IN IP4 10.0.0.1\r\n"
+	     "s=-\r\n"
+	     "c=IN IP4 10.0.0.1\r\n"
+	     "t=0 0\r\n"
+	     "a=group:BUNDLE 0 1\r\n"
+	     "m=audio 5004 RTP/AVP 0 8 101\r\n"
+	     "a=rtpmap:101 telephone-event/8000\r\n"
+	     "a=fmtp:101 0-15\r\n"
+	     "a=sendrecv\r\n"
+	     "m=video 5006 RTP/AVPF 96\r\n"
+	     "a=rtpmap:96 H264/90000\r\n"
+	     "a=fmtp:96 packetization-mode=1\r\n"
+	     "a=rtcp-fb:96 nack pli\r\n"),
+};
+
+static const struct seed seeds_json[] = {
+	SEED("{\"a\":[1,2.5,-3e2,true,false,null],"
+	     "\"b\":{\"c\":\"\\u00e6\\n\"}}"),
+};
+
+static const char * const files_json[] = {
+	"fstab.json",
+	"menu.json",
+	"rfc7159.json",
+	"utf8.json",
+	"webapp.json",
+	"widget.json",
+};
+
+static const struct seed seeds_http[] = {
+	SEED("GET /index.html?x=1 HTTP/1.1\r\n"
+	     "Host: example.com\r\n"
+	     "Upgrade: websocket\r\n"
+	     "Connection: Upgrade\r\n"
+	     "\r\n"),
+	SEED("HTTP/1.1 200 OK\r\n"
+	     "Content-Type: text/plain;charset=UTF-8\r\n"
+	     "Content-Length: 5\r\n"
+	     "\r\n"
+	     "hello"),
+};
+
+static const struct seed seeds_bfcp[] = {
+	/* Hello */
+	SEED("\x20\x0b\x00\x00\x00\x00\x00\x01\x00\x01\x00\x01"),
+	/* FloorRequest with FLOOR-ID */
+	SEED("\x20\x01\x00\x01\x00\x00\x00\x01\x00\x02\x00\x01"
+	     "\x05\x04\x00\x01"),
+};
+
+static const struct seed seeds_dns[] = {
+	/* www.example.com A 10.0.0.1 */
+	SEED("\x03" "www" "\x07" "example" "\x03" "com" "\x00"
+	     "\x00\x01\x00\x01\x00\x00\x0e\x10\x00\x04\x0a\x00\x00\x01"),
+	/* _sip._udp SRV 10 60 5060 sip */
+	SEED("\x04" "_sip" "\x04" "_udp" "\x00"
+	     "\x00\x21\x00\x01\x00\x00\x0e\x10\x00\x0b"
+	     "\x00\x0a\x00\x3c\x13\xc4\x03" "sip" "\x00"),
+};
+
+static const struct seed seeds_h264[] = {
+	/* 4K, from test_h264_sps */
+	SEED("\x64\x00\x33\xac\x2c\xa4\x00\xf0\x01\x0f\xbf\xf0\x00\x10"
+	     "\x00\x15\x20\x20\x20\x28\x00\x00\x1f\x48\x00\x07\x53\x07"
+	     "\x51\x00\x01\xcd\x94\x00\x00\x05\x68\xbc\x37\xe3\x1c\x1d"
+	     "\xa1\x62\xd1\x20"),
+};
+
+static const struct seed seeds_uri[] = {
+	SEED("sip:alice:secret@example.com:5061;transport=tls;lr"
+	     "?subject=project%20x&priority=urgent"),
+	SEED("sips:[2001:db8::1]:5061"),
+};
+
+
+#define TARGET(name, h, seeds) \
+	{name, h, seeds, ARRAY_SIZE(seeds), NULL, 0}
+
+static const struct target targets[] = {
+	TARGET("sip_msg",  fuzz_sip_msg,  seeds_sip),
+	TARGET("stun_msg", fuzz_stun_msg, seeds_stun),
+	TARGET("rtcp",     fuzz_rtcp,     seeds_rtcp),
+	TARGET("rtp_hdr",  fuzz_rtp_hdr,  seeds_rtp),
+	TARGET("sdp",      fuzz_sdp,      seeds_sdp),
+	{"json", fuzz_json, seeds_json, ARRAY_SIZE(seeds_json),
+	 files_json, ARRAY_SIZE(files_json)},
+	TARGET("http_msg", fuzz_http_msg, seeds_http),
+	TARGET("bfcp_msg", fuzz_bfcp_msg, seeds_bfcp),
+	TARGET("dns_rr",   fuzz_dns_rr,   seeds_dns),
+	TARGET("h264_sps", fuzz_h264_sps, seeds_h264),
+	TARGET("uri",      fuzz_uri,      seeds_uri),
+};
+
+
+static const struct target *find_target(const char *name)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(targets); i++) {
+
+		if (0 == str_casecmp(name, targets[i].name))
+			return &targets[i];
+	}
+
+	return NULL;
+}
+
+
+static int target_exec(const struct target *t, const uint8_t *data,
+		       size_t size)
+{
+	struct mbuf *mb;
+
+	mb = mbuf_alloc(size + 1);
+	if (!mb)
+		return ENOMEM;
+
+	(void)mbuf_write_mem(mb, data, size);
+	mb->pos = 0;
+
+	(void)t->h(mb);
+
+	mem_deref(mb);
+
+	return 0;
+}
+
+
+/**
+ * Run one input through a fuzz target
+ *
+ * @param name Name of the target
+ * @param data Input
+ * @param size Size of the input
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fuzzer_exec(const char *name, const uint8_t *data, size_t size)
+{
+	const struct target *t = find_target(name);
+
+	if (!t)
+		return ENOENT;
+
+	return target_exec(t, data, size);
+}
+
+
+void fuzzer_list(void)
+{
+	size_t i;
+
+	(void)re_printf("fuzz targets:\n");
+
+	for (i=0; i<ARRAY_SIZE(targets); i++)
+		(void)re_printf("    %s\n", targets[i].name);
+}
+
+
+static void seedent_destructor(void *arg)
+{
+	struct seedent *se = arg;
+
+	list_unlink(&se->le);
+	mem_deref(se->mb);
+}
+
+
+static struct mbuf *seed_add(struct list *seedl, size_t size)
+{
+	struct seedent *se;
+
+	se = mem_zalloc(sizeof(*se), seedent_destructor);
+	if (!se)
+		return NULL;
+
+	se->mb = mbuf_alloc(size);
+	if (!se->mb) {
+		mem_deref(se);
+		return NULL;
+	}
+
+	list_append(seedl, &se->le, se);
+
+	return se->mb;
+}
+
+
+/* all seeds of a target, built-in and from data/ */
+static int seeds_load(struct list *seedl, const struct target *t)
+{
+	size_t i;
+	int err;
+
+	for (i=0; i<t->seedc; i++) {
+
+		struct mbuf *mb = seed_add(seedl, t->seedv[i].len);
+		if (!mb)
+			return ENOMEM;
+
+		err = mbuf_write_mem(mb, (const uint8_t *)t->seedv[i].data,
+				     t->seedv[i].len);
+		if (err)
+			return err;
+	}
+
+	for (i=0; i<t->filec; i++) {
+
+		char path[256];
+		struct mbuf *mb = seed_add(seedl, 1024);
+		if (!mb)
+			return ENOMEM;
+
+		re_snprintf(path, sizeof(path), "%s/%s", test_datapath(),
+			    t->filev[i]);
+
+		err = test_load_file(mb, path);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+/* flip bits, overwrite, insert or drop bytes, truncate */
+static void mutate(struct mbuf *mb)
+{
+	unsigned i, n = 1 + test_rand_u32() % MUTATIONS_MAX;
+
+	for (i=0; i<n; i++) {
+
+		size_t pos = mb->end ? test_rand_u32() % mb->end : 0;
+
+		switch (test_rand_u32() % 5) {
+
+		case 0:
+			if (mb->end)
+				mb->buf[pos] ^= 1 << (test_rand_u32() % 8);
+			break;
+
+		case 1:
+			if (mb->end)
+				mb->buf[pos] = (uint8_t)test_rand_u32();
+			break;
+
+		case 2:
+			if (mb->end < mb->size) {
+				memmove(mb->buf + pos + 1, mb->buf + pos,
+					mb->end - pos);
+				mb->buf[pos] = (uint8_t)test_rand_u32();
+				++mb->end;
+			}
+			break;
+
+		case 3:
+			if (mb->end) {
+				memmove(mb->buf + pos, mb->buf + pos + 1,
+					mb->end - pos - 1);
+				--mb->end;
+			}
+			break;
+
+		default:
+			mb->end = pos;
+			break;
+		}
+	}
+}
+
+
+/* mutate the seeds in turn, until 'count' runs or 'nsec' have passed */
+static int seeds_mutate(const struct target *t, const struct list *seedl,
+			uint64_t count, uint64_t nsec, uint64_t *execs)
+{
+	const uint64_t start = test_nanoseconds();
+	struct mbuf *mb;
+	struct le *le = NULL;
+	uint64_t n = 0;
+	int err = 0;
+
+	mb = mbuf_alloc(1024);
+	if (!mb)
+		return ENOMEM;
+
+	while (count ? n < count : test_nanoseconds() - start < nsec) {
+
+		const struct seedent *seed;
+
+		le = le && le->next ? le->next : list_head(seedl);
+		if (!le)
+			break;
+
+		seed = le->data;
+
+		mb->pos = 0;
+		mb->end = 0;
+
+		err  = mbuf_resize(mb, seed->mb->end + MUTATE_EXTRA);
+		err |= mbuf_write_mem(mb, seed->mb->buf, seed->mb->end);
+		if (err)
+			break;
+
+		mutate(mb);
+
+		err = target_exec(t, mb->buf, mb->end);
+		if (err)
+			break;
+
+		++n;
+	}
+
+	mem_deref(mb);
+
+	*execs = n;
+
+	return err;
+}
+
+
+static int replay_file(const struct target *t, const char *path,
+		       uint64_t *execs)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(1024);
+	if (!mb)
+		return ENOMEM;
+
+	err = test_load_file(mb, path);
+	if (err) {
+		DEBUG_WARNING("%s: could not load (%m)\n", path, err);
+		goto out;
+	}
+
+	err = target_exec(t, mb->buf, min(mb->end, (size_t)FILE_MAX));
+	if (err)
+		goto out;
+
+	++*execs;
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static int replay_path(const struct target *t, const char *path,
+		       uint64_t *execs)
+{
+#ifndef WIN32
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	int err = 0;
+
+	if (0 != stat(path, &st))
+		return errno;
+
+	if (!S_ISDIR(st.st_mode))
+		return replay_file(t, path, execs);
+
+	dir = opendir(path);
+	if (!dir)
+		return errno;
+
+	while ((de = readdir(dir))) {
+
+		char file[512];
+
+		if (de->d_name[0] == '.')
+			continue;
+
+		re_snprintf(file, sizeof(file), "%s/%s", path, de->d_name);
+
+		if (0 != stat(file, &st) || !S_ISREG(st.st_mode))
+			continue;
+
+		err = replay_file(t, file, execs);
+		if (err)
+			break;
+	}
+
+	(void)closedir(dir);
+
+	return err;
+#else
+	return replay_file(t, path, execs);
+#endif
+}
+
+
+static void print_rate(const char *name, const char *what, uint64_t execs,
+		       uint64_t nsec)
+{
+	(void)re_printf("%-12s %-8s: %10llu execs  %12.0f execs/s\n",
+			name, what, (unsigned long long)execs,
+			nsec ? (double)execs * 1e9 / (double)nsec : 0.0);
+}
+
+
+/**
+ * Replay a corpus through a fuzz target, or mutate its built-in seeds
+ *
+ * @param name     Name of the target
+ * @param pathv    Corpus files or directories
+ * @param pathc    Number of paths, 0 to mutate the built-in seeds
+ * @param duration Mutation time in seconds
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fuzzer_replay(const char *name, char * const *pathv, int pathc,
+		  double duration)
+{
+	const struct target *t = find_target(name);
+	struct list seedl = LIST_INIT;
+	uint64_t start, execs = 0;
+	int i, err = 0;
+
+	if (!t) {
+		(void)re_fprintf(stderr, "no such fuzz target: %s\n", name);
+		fuzzer_list();
+		return ENOENT;
+	}
+
+	start = test_nanoseconds();
+
+	if (pathc) {
+		for (i=0; i<pathc; i++) {
+
+			err = replay_path(t, pathv[i], &execs);
+			if (err)
+				goto out;
+		}
+
+		print_rate(t->name, "corpus", execs,
+			   test_nanoseconds() - start);
+		goto out;
+	}
+
+	err = seeds_load(&seedl, t);
+	if (err)
+		goto out;
+
+	err = seeds_mutate(t, &seedl, 0, (uint64_t)(duration * 1e9), &execs);
+	if (err)
+		goto out;
+
+	print_rate(t->name, "mutated", execs, test_nanoseconds() - start);
+
+ out:
+	list_flush(&seedl);
+
+	return err;
+}
+
+
+/**
+ * Write the seed corpora of all targets, one directory per target
+ *
+ * @param dir Output directory, must exist
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fuzzer_write_seeds(const char *dir)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(targets) && !err; i++) {
+
+		const struct target *t = &targets[i];
+		struct list seedl = LIST_INIT;
+		char path[512];
+		struct le *le;
+		unsigned n = 0;
+
+		re_snprintf(path, sizeof(path), "%s/%s", dir, t->name);
+
+		err = fs_mkdir(path, 0755);
+		if (err == EEXIST)
+			err = 0;
+
+		if (!err)
+			err = seeds_load(&seedl, t);
+
+		for (le = list_head(&seedl); le && !err; le = le->next) {
+
+			struct mbuf *mb = ((struct seedent *)le->data)->mb;
+
+			re_snprintf(path, sizeof(path), "%s/%s/seed-%u",
+				    dir, t->name, n++);
+
+			mb->pos = 0;
+			err = test_write_file(mb, path);
+		}
+
+		list_flush(&seedl);
+	}
+
+	return err;
+}
+
+
+/* every target on its seeds and on mutations of them */
+int test_fuzzer(void)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(targets); i++) {
+
+		const struct target *t = &targets[i];
+		struct list seedl = LIST_INIT;
+		uint64_t execs = 0;
+		struct le *le;
+
+		err = seeds_load(&seedl, t);
+		if (err)
+			goto out;
+
+		for (le = list_head(&seedl); le; le = le->next) {
+
+			const struct seedent *seed = le->data;
+
+			err = target_exec(t, seed->mb->buf, seed->mb->end);
+			if (err)
+				break;
+		}
+
+		if (!err)
+			err = seeds_mutate(t, &seedl, TEST_MUTATIONS, 0,
+					   &execs);
+
+		list_flush(&seedl);
+
+		if (err)
+			goto out;
+
+		TEST_EQUALS(TEST_MUTATIONS, execs);
+	}
+
+ out:
+	return err;
+}
+
+
+#ifdef USE_FUZZER
+static const struct target *fuzz_target;
+
+
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	const char *name = getenv("RETEST_FUZZ_TARGET");
+	(void)argc;
+	(void)argv;
+
+	if (libre_init())
+		abort();
+
+	fuzz_target = name ? find_target(name) : NULL;
+	if (!fuzz_target) {
+		(void)re_fprintf(stderr, "set RETEST_FUZZ_TARGET to one of"
+				 " the targets\n");
+		fuzzer_list();
+		abort();
+	}
+
+	return 0;
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	(void)target_exec(fuzz_target, data, size);
+
+	return 0;
+}
+#endif
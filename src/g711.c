@@ -172,3 +172,45 @@ int test_g711_ulaw(void)
 out:
 	return n ? EINVAL : err;
 }
+
+
+/* the parameter is the number of bytes of 16-bit samples */
+int bench_g711_alaw_encode(struct bench_state *st)
+{
+	const int16_t *pcm = (int16_t *)(void *)st->in;
+	const size_t n = st->param / 2;
+
+	st->items = n;
+
+	BENCH_LOOP(st) {
+		size_t i;
+
+		for (i=0; i<n; i++)
+			st->out[i] = g711_pcm2alaw(pcm[i]);
+
+		BENCH_SINK(st->out);
+	}
+
+	return 0;
+}
+
+
+/* the parameter is the number of encoded samples */
+int bench_g711_ulaw_decode(struct bench_state *st)
+{
+	int16_t *pcm = (int16_t *)(void *)st->out;
+	const size_t n = st->param;
+
+	st->items = n;
+
+	BENCH_LOOP(st) {
+		size_t i;
+
+		for (i=0; i<n; i++)
+			pcm[i] = g711_ulaw2pcm(st->in[i]);
+
+		BENCH_SINK(pcm);
+	}
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+/**
+ * @file hist.c  Latency histogram
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "hist"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * HDR-style log-linear histogram
+ *
+ * Values below SUB_COUNT are recorded exactly. Above that every power
+ * of two is split into SUB_COUNT/2 linear sub-buckets, which gives a
+ * relative error of less than 2/SUB_COUNT (~1.6%) over the whole range.
+ * Values above 2^MAX_BITS are recorded in the last bucket.
+ */
+enum {
+	SUB_BITS   = 7,
+	SUB_COUNT  = 1 << SUB_BITS,
+	SUB_HALF   = SUB_COUNT / 2,
+	MAX_BITS   = 40,           /* ~18 minutes in nanoseconds */
+	MAX_SHIFT  = MAX_BITS - SUB_BITS + 1,
+	BUCKETS    = MAX_SHIFT * SUB_HALF + SUB_COUNT,
+};
+
+
+struct hist {
+	uint64_t countv[BUCKETS];
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	double mean;               /* running mean (Welford)            */
+	double m2;                 /* sum of squared differences        */
+};
+
+
+static unsigned msb64(uint64_t v)
+{
+	unsigned n = 0;
+
+	while (v >>= 1)
+		++n;
+
+	return n;
+}
+
+
+static size_t value_index(uint64_t v)
+{
+	unsigned shift;
+
+	if (v < SUB_COUNT)
+		return (size_t)v;
+
+	shift = msb64(v) - SUB_BITS + 1;
+	if (shift > MAX_SHIFT)
+		return BUCKETS - 1;
+
+	return (size_t)shift * SUB_HALF + (size_t)(v >> shift);
+}
+
+
+/* highest value that is equivalent to bucket index ix */
+static uint64_t index_value(size_t ix)
+{
+	unsigned shift;
+	uint64_t sub;
+
+	if (ix < SUB_COUNT)
+		return ix;
+
+	shift = (unsigned)(ix / SUB_HALF) - 1;
+	sub   = ix - (size_t)shift * SUB_HALF;
+
+	return ((sub + 1) << shift) - 1;
+}
+
+
+int hist_alloc(struct hist **histp)
+{
+	struct hist *hist;
+
+	if (!histp)
+		return EINVAL;
+
+	hist = mem_alloc(sizeof(*hist), NULL);
+	if (!hist)
+		return ENOMEM;
+
+	hist_reset(hist);
+
+	*histp = hist;
+
+	return 0;
+}
+
+
+void hist_reset(struct hist *hist)
+{
+	if (!hist)
+		return;
+
+	memset(hist, 0, sizeof(*hist));
+	hist->min = UINT64_MAX;
+}
+
+
+void hist_record(struct hist *hist, uint64_t value)
+{
+	double delta;
+
+	if (!hist)
+		return;
+
+	++hist->countv[value_index(value)];
+	++hist->count;
+
+	if (value < hist->min)
+		hist->min = value;
+	if (value > hist->max)
+		hist->max = value;
+
+	delta = (double)value - hist->mean;
+	hist->mean += delta / (double)hist->count;
+	hist->m2   += delta * ((double)value - hist->mean);
+}
+
+
+/* Merge the samples of src into dst */
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	double delta, n;
+	size_t i;
+
+	if (!dst || !src || !src->count)
+		return;
+
+	for (i=0; i<BUCKETS; i++)
+		dst->countv[i] += src->countv[i];
+
+	n     = (double)(dst->count + src->count);
+	delta = src->mean - dst->mean;
+
+	dst->m2   += src->m2 + delta * delta *
+		(double)dst->count * (double)src->count / n;
+	dst->mean += delta * (double)src->count / n;
+
+	dst->count += src->count;
+	dst->min    = min(dst->min, src->min);
+	dst->max    = max(dst->max, src->max);
+}
+
+
+uint64_t hist_count(const struct hist *hist)
+{
+	return hist ? hist->count : 0;
+}
+
+
+uint64_t hist_min(const struct hist *hist)
+{
+	return (hist && hist->count) ? hist->min : 0;
+}
+
+
+uint64_t hist_max(const struct hist *hist)
+{
+	return hist ? hist->max : 0;
+}
+
+
+double hist_mean(const struct hist *hist)
+{
+	return hist ? hist->mean : 0.0;
+}
+
+
+double hist_stddev(const struct hist *hist)
+{
+	if (!hist || hist->count < 2)
+		return 0.0;
+
+	return sqrt(hist->m2 / (double)(hist->count - 1));
+}
+
+
+/**
+ * Get the value at a given percentile
+ *
+ * @param hist Histogram
+ * @param pct  Percentile, between 0.0 and 100.0
+ *
+ * @return Highest value equivalent to the percentile, clamped to min/max
+ */
+uint64_t hist_percentile(const struct hist *hist, double pct)
+{
+	uint64_t rank, sum = 0;
+	double r;
+	size_t i;
+
+	if (!hist || !hist->count)
+		return 0;
+
+	if (pct <= 0.0)
+		return hist->min;
+	if (pct >= 100.0)
+		return hist->max;
+
+	r = ceil(pct / 100.0 * (double)hist->count);
+	rank = (uint64_t)r;
+	if (rank == 0)
+		rank = 1;
+
+	for (i=0; i<BUCKETS; i++) {
+
+		sum += hist->countv[i];
+
+		if (sum >= rank) {
+			uint64_t v = index_value(i);
+
+			return min(max(v, hist->min), hist->max);
+		}
+	}
+
+	return hist->max;
+}
+
+
+/* One-line summary, values are printed in [usec] */
+int hist_print(struct re_printf *pf, const struct hist *hist)
+{
+	if (!hist)
+		return 0;
+
+	return re_hprintf(pf,
+			  "min %.2f  p50 %.2f  p90 %.2f  p99 %.2f"
+			  "  p99.9 %.2f  max %.2f  stddev %.2f",
+			  hist_min(hist) / 1000.0,
+			  hist_percentile(hist, 50.0) / 1000.0,
+			  hist_percentile(hist, 90.0) / 1000.0,
+			  hist_percentile(hist, 99.0) / 1000.0,
+			  hist_percentile(hist, 99.9) / 1000.0,
+			  hist_max(hist) / 1000.0,
+			  hist_stddev(hist) / 1000.0);
+}
@@ -265,3 +265,53 @@ int test_hmac_sha256(void)
 
 	return err;
 }
+
+
+int bench_hmac_sha1(struct bench_state *st)
+{
+	static const uint8_t key[20] = "0123456789abcdefghij";
+
+	BENCH_LOOP(st) {
+		uint8_t md[SHA_DIGEST_LENGTH];
+
+		hmac_sha1(key, sizeof(key), st->in, st->param, md, sizeof(md));
+
+		BENCH_SINK(md);
+	}
+
+	return 0;
+}
+
+
+int bench_hmac_sha256_setup(struct bench_state *st)
+{
+	static const uint8_t key[32] = "0123456789abcdefghijklmnopqrstuv";
+	struct hmac *hmac;
+	int err;
+
+	err = hmac_create(&hmac, HMAC_HASH_SHA256, key, sizeof(key));
+	if (err)
+		return err == ENOTSUP ? ESKIPPED : err;
+
+	st->arg = hmac;
+
+	return 0;
+}
+
+
+int bench_hmac_sha256(struct bench_state *st)
+{
+	int err = 0;
+
+	BENCH_LOOP(st) {
+		uint8_t md[SHA256_DIGEST_LENGTH];
+
+		err = hmac_digest(st->arg, md, sizeof(md), st->in, st->param);
+		if (err)
+			break;
+
+		BENCH_SINK(md);
+	}
+
+	return err;
+}
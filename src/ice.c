@@ -45,6 +45,7 @@ struct attrs {
 struct agent {
 	struct icem *icem;
 	struct udp_sock *us;
+	struct fuzz *fuzz;
 	struct sa laddr;
 	struct attrs attr_s;
 	struct attrs attr_m;
@@ -71,6 +72,7 @@ struct agent {
 struct ice_test {
 	struct agent *a;
 	struct agent *b;
+	struct fuzz_ctx *fuzz;     /* NULL if not fuzzing */
 	struct tmr tmr;
 	int err;
 };
@@ -163,6 +165,7 @@ static void agent_destructor(void *arg)
 	struct agent *agent = arg;
 
 	mem_deref(agent->icem);
+	mem_deref(agent->fuzz);
 	mem_deref(agent->us);
 	mem_deref(agent->stun);
 	mem_deref(agent->turn);
@@ -503,6 +506,10 @@ static int agent_alloc(struct agent **agentp, struct ice_test *it,
 	if (err)
 		goto out;
 
+	err = fuzz_attach_udpsock(&agent->fuzz, agent->us, it->fuzz);
+	if (err)
+		goto out;
+
 	lrole = offerer ? ICE_ROLE_CONTROLLING : ICE_ROLE_CONTROLLED;
 	tiebrk = offerer ? 2 : 1;
 
@@ -768,7 +775,8 @@ static void icetest_destructor(void *arg)
 
 static int icetest_alloc(struct ice_test **itp,
 			 enum ice_mode mode_a, bool turn_a,
-			 enum ice_mode mode_b, bool turn_b)
+			 enum ice_mode mode_b, bool turn_b,
+			 struct fuzz_ctx *fuzz)
 {
 	struct ice_test *it;
 	int err;
@@ -777,6 +785,8 @@ static int icetest_alloc(struct ice_test **itp,
 	if (!it)
 		return ENOMEM;
 
+	it->fuzz = fuzz;
+
 	err = agent_alloc(&it->a, it, mode_a, turn_a, "A", 7, true);
 	if (err)
 		goto out;
@@ -796,12 +806,13 @@ static int icetest_alloc(struct ice_test **itp,
 
 
 static int _test_ice_loop(enum ice_mode mode_a, bool turn_a,
-			 enum ice_mode mode_b, bool turn_b)
+			 enum ice_mode mode_b, bool turn_b,
+			 struct fuzz_ctx *fuzz)
 {
 	struct ice_test *it = NULL;
 	int err;
 
-	err = icetest_alloc(&it, mode_a, turn_a, mode_b, turn_b);
+	err = icetest_alloc(&it, mode_a, turn_a, mode_b, turn_b, fuzz);
 	if (err)
 		goto out;
 
@@ -953,5 +964,13 @@ int test_ice_cand(void)
 
 int test_ice_loop(void)
 {
-	return _test_ice_loop(ICE_MODE_FULL, false, ICE_MODE_FULL, false);
+	return _test_ice_loop(ICE_MODE_FULL, false, ICE_MODE_FULL, false,
+			      NULL);
+}
+
+
+int test_ice_loop_fuzz(struct fuzz_ctx *ctx)
+{
+	return _test_ice_loop(ICE_MODE_FULL, false, ICE_MODE_FULL, false,
+			      ctx);
 }
@@ -0,0 +1,339 @@
+/**
+ * @file loopstat.c  Event-loop instrumentation
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+#include <string.h>
+#ifdef __GLIBC__
+#include <dlfcn.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#endif
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "loopstat"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * libre does not expose its main loop, so the polling functions are
+ * interposed here, like the malloc family in memprof.c. Between two
+ * calls the loop dispatches the events of the last wakeup and the
+ * expired timers, so that time is the dispatch time of one iteration.
+ * If the wakeup had a single event, the dispatch time is the handler
+ * time of that fd.
+ *
+ * Timer lateness is measured by a probe timer that re_main_timeout()
+ * runs while the statistics are enabled.
+ *
+ * The interposers are only built with USE_LOOPSTAT, and never in the
+ * fuzzer build. Without them only the probe timer is measured.
+ */
+
+
+#if defined (USE_LOOPSTAT) && defined (__GLIBC__) && !defined (USE_FUZZER)
+#define LOOPSTAT_HOOKS 1
+#endif
+
+
+enum {
+	PROBE_INTERVAL = 10,       /* [ms] */
+};
+
+
+struct loopstat {
+	struct hist *wait;         /* time blocked in poll      [ns] */
+	struct hist *dispatch;     /* time between two polls    [ns] */
+	struct hist *handler;      /* single-event dispatch     [ns] */
+	struct hist *late;         /* probe timer lateness      [ns] */
+	uint64_t wakeups;
+	uint64_t events;
+	uint64_t events_max;
+	uint64_t slow_nsec;        /* slowest single-event dispatch  */
+	int slow_fd;
+};
+
+
+static __thread struct loopstat *cur;
+static __thread uint64_t last_wake;    /* 0 if not in a loop */
+#ifdef LOOPSTAT_HOOKS
+static __thread int last_nev;
+static __thread int last_fd;
+#endif
+static __thread struct tmr probe;
+static __thread uint64_t probe_due;
+
+
+static void destructor(void *arg)
+{
+	struct loopstat *ls = arg;
+
+	if (cur == ls)
+		cur = NULL;
+
+	mem_deref(ls->wait);
+	mem_deref(ls->dispatch);
+	mem_deref(ls->handler);
+	mem_deref(ls->late);
+}
+
+
+int loopstat_alloc(struct loopstat **lsp)
+{
+	struct loopstat *ls;
+	int err;
+
+	if (!lsp)
+		return EINVAL;
+
+	ls = mem_zalloc(sizeof(*ls), destructor);
+	if (!ls)
+		return ENOMEM;
+
+	err  = hist_alloc(&ls->wait);
+	err |= hist_alloc(&ls->dispatch);
+	err |= hist_alloc(&ls->handler);
+	err |= hist_alloc(&ls->late);
+	if (err) {
+		mem_deref(ls);
+		return err;
+	}
+
+	ls->slow_fd = -1;
+
+	*lsp = ls;
+
+	return 0;
+}
+
+
+void loopstat_reset(struct loopstat *ls)
+{
+	if (!ls)
+		return;
+
+	hist_reset(ls->wait);
+	hist_reset(ls->dispatch);
+	hist_reset(ls->handler);
+	hist_reset(ls->late);
+
+	ls->wakeups    = 0;
+	ls->events     = 0;
+	ls->events_max = 0;
+	ls->slow_nsec  = 0;
+	ls->slow_fd    = -1;
+}
+
+
+/**
+ * Record the loop statistics of this thread
+ *
+ * @param ls Loop statistics, or NULL to stop recording
+ */
+void loopstat_enable(struct loopstat *ls)
+{
+	cur       = ls;
+	last_wake = 0;
+}
+
+
+/* True if nothing was recorded, neither by the hooks nor the probe */
+bool loopstat_isempty(const struct loopstat *ls)
+{
+	return !ls || (!ls->wakeups && !hist_count(ls->late));
+}
+
+
+#ifdef LOOPSTAT_HOOKS
+
+static void loop_enter(void)
+{
+	const uint64_t now = test_nanoseconds();
+	uint64_t d;
+
+	if (!last_wake)
+		return;
+
+	d = now - last_wake;
+
+	hist_record(cur->dispatch, d);
+
+	if (last_nev == 1) {
+		hist_record(cur->handler, d);
+
+		if (d > cur->slow_nsec) {
+			cur->slow_nsec = d;
+			cur->slow_fd   = last_fd;
+		}
+	}
+}
+
+
+static void loop_leave(uint64_t start, int nev, int fd)
+{
+	last_wake = test_nanoseconds();
+	last_nev  = nev;
+	last_fd   = fd;
+
+	hist_record(cur->wait, last_wake - start);
+
+	if (nev < 0)
+		return;
+
+	++cur->wakeups;
+	cur->events += (uint64_t)nev;
+	cur->events_max = max(cur->events_max, (uint64_t)nev);
+}
+
+
+#ifdef __linux__
+typedef int (epoll_wait_h)(int epfd, struct epoll_event *events,
+			   int maxevents, int timeout);
+
+
+int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+	       int timeout)
+{
+	static epoll_wait_h *real;
+	uint64_t start;
+	int n;
+
+	if (!real)
+		real = (epoll_wait_h *)dlsym(RTLD_NEXT, "epoll_wait");
+	if (!real) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	if (!cur)
+		return real(epfd, events, maxevents, timeout);
+
+	loop_enter();
+
+	start = test_nanoseconds();
+	n = real(epfd, events, maxevents, timeout);
+
+	loop_leave(start, n, n == 1 ? events[0].data.fd : -1);
+
+	return n;
+}
+#endif
+
+
+typedef int (poll_h)(struct pollfd *fds, nfds_t nfds, int timeout);
+
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	static poll_h *real;
+	uint64_t start;
+	int n, fd = -1;
+
+	if (!real)
+		real = (poll_h *)dlsym(RTLD_NEXT, "poll");
+	if (!real) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	if (!cur)
+		return real(fds, nfds, timeout);
+
+	loop_enter();
+
+	start = test_nanoseconds();
+	n = real(fds, nfds, timeout);
+
+	if (n == 1) {
+		nfds_t i;
+
+		for (i=0; i<nfds; i++) {
+			if (fds[i].revents) {
+				fd = fds[i].fd;
+				break;
+			}
+		}
+	}
+
+	loop_leave(start, n, fd);
+
+	return n;
+}
+
+#endif
+
+
+static void probe_handler(void *arg)
+{
+	const uint64_t now = test_nanoseconds();
+	(void)arg;
+
+	if (cur && now > probe_due)
+		hist_record(cur->late, now - probe_due);
+
+	probe_due = test_nanoseconds() + PROBE_INTERVAL * 1000000ULL;
+	tmr_start(&probe, PROBE_INTERVAL, probe_handler, NULL);
+}
+
+
+/* Start the timer probe, if the statistics are enabled */
+void loopstat_probe_start(void)
+{
+	if (!cur)
+		return;
+
+	probe_due = test_nanoseconds() + PROBE_INTERVAL * 1000000ULL;
+	tmr_start(&probe, PROBE_INTERVAL, probe_handler, NULL);
+}
+
+
+void loopstat_probe_stop(void)
+{
+	tmr_cancel(&probe);
+
+	/* the time after the loop is not dispatch time */
+	last_wake = 0;
+}
+
+
+int loopstat_print(struct re_printf *pf, const struct loopstat *ls)
+{
+	int err = 0;
+
+	if (!ls)
+		return 0;
+
+	if (ls->wakeups) {
+		err  = re_hprintf(pf, "    %llu wakeups, %.2f events/wakeup"
+				  " (max %llu)\n",
+				  (unsigned long long)ls->wakeups,
+				  (double)ls->events / (double)ls->wakeups,
+				  (unsigned long long)ls->events_max);
+
+		err |= re_hprintf(pf, "    poll wait   : %H usec\n",
+				  hist_print, ls->wait);
+		err |= re_hprintf(pf, "    dispatch    : %H usec\n",
+				  hist_print, ls->dispatch);
+	}
+
+	if (hist_count(ls->handler)) {
+		err |= re_hprintf(pf, "    fd handler  : %H usec"
+				  "  (slowest fd %d)\n",
+				  hist_print, ls->handler, ls->slow_fd);
+	}
+
+	if (hist_count(ls->late)) {
+		err |= re_hprintf(pf, "    timer late  : %H usec\n",
+				  hist_print, ls->late);
+	}
+
+	return err;
+}
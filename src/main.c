@@ -22,6 +22,11 @@
 #include <re_dbg.h>
 
 
+enum {
+	FD_LIMIT_BENCH = 65536,
+};
+
+
 #ifdef HAVE_SIGNAL
 static void signal_handler(int num)
 {
@@ -33,28 +38,132 @@ static void signal_handler(int num)
 
 
 #ifdef HAVE_GETOPT
+enum {
+	OPT_JSON = 256,
+	OPT_BASELINE,
+	OPT_THRESHOLD,
+	OPT_COUNTERS,
+	OPT_DURATION,
+	OPT_PIN,
+	OPT_PROFILE,
+	OPT_LOOPSTAT,
+	OPT_FUZZ,
+	OPT_FUZZ_SEEDS,
+	OPT_FUZZ_UDP,
+	OPT_PCAP,
+	OPT_PCAP_SCALE,
+	OPT_SOAK,
+	OPT_SOAK_INTERVAL,
+	OPT_BUDGETS,
+};
+
+
+static const struct option long_options[] = {
+	{"json",      required_argument, NULL, OPT_JSON},
+	{"baseline",  required_argument, NULL, OPT_BASELINE},
+	{"threshold", required_argument, NULL, OPT_THRESHOLD},
+	{"counters",  no_argument,       NULL, OPT_COUNTERS},
+	{"duration",  required_argument, NULL, OPT_DURATION},
+	{"pin",       no_argument,       NULL, OPT_PIN},
+	{"profile",   required_argument, NULL, OPT_PROFILE},
+	{"loopstat",  no_argument,       NULL, OPT_LOOPSTAT},
+	{"fuzz",      required_argument, NULL, OPT_FUZZ},
+	{"fuzz-seeds", required_argument, NULL, OPT_FUZZ_SEEDS},
+	{"fuzz-udp",  required_argument, NULL, OPT_FUZZ_UDP},
+	{"pcap",      required_argument, NULL, OPT_PCAP},
+	{"pcap-scale", required_argument, NULL, OPT_PCAP_SCALE},
+	{"soak",      required_argument, NULL, OPT_SOAK},
+	{"soak-interval", required_argument, NULL, OPT_SOAK_INTERVAL},
+	{"budgets",   no_argument,       NULL, OPT_BUDGETS},
+	{NULL,        0,                 NULL, 0}
+};
+
+
 static void usage(void)
 {
-	(void)re_fprintf(stderr, "Usage: retest [-rotalp] [-hmv]"
+	(void)re_fprintf(stderr, "Usage: retest [-roipbtal] [-hmsv]"
 			 " <testcase>\n");
+	(void)re_fprintf(stderr, "       retest --fuzz <target>"
+			 " [file|dir]...\n");
 
 	(void)re_fprintf(stderr, "\ntest group options:\n");
 	(void)re_fprintf(stderr, "\t-r        Run regular tests\n");
 	(void)re_fprintf(stderr, "\t-o        Run OOM memory tests\n");
+	(void)re_fprintf(stderr, "\t-i        Run OOM tests for every"
+			 " allocation index\n");
 	(void)re_fprintf(stderr, "\t-p        Run performance tests\n");
-	(void)re_fprintf(stderr, "\t-t        Run tests in multi-threads\n");
+	(void)re_fprintf(stderr, "\t-b        Run benchmarks\n");
+	(void)re_fprintf(stderr, "\t-t        Run tests in multi-threads,"
+			 " or scale <testcase> over 1..N threads\n");
 	(void)re_fprintf(stderr, "\t-a        Run all tests (default)\n");
 	(void)re_fprintf(stderr, "\t-l        List all testcases and exit\n");
 
+	(void)re_fprintf(stderr, "\nperformance options:\n");
+	(void)re_fprintf(stderr, "\t--json <file>      Write results"
+			 " as JSON\n");
+	(void)re_fprintf(stderr, "\t--baseline <file>  Compare results"
+			 " with a JSON baseline\n");
+	(void)re_fprintf(stderr, "\t--threshold <pct>  Max slowdown vs."
+			 " baseline (default 10)\n");
+	(void)re_fprintf(stderr, "\t--counters         Collect CPU"
+			 " performance counters\n");
+	(void)re_fprintf(stderr, "\t--profile <file>   Write sampled"
+			 " stacks in folded format\n");
+	(void)re_fprintf(stderr, "\t--budgets          Check the cost"
+			 " budgets also outside of -p\n");
+
+	(void)re_fprintf(stderr, "\nscaling options:\n");
+	(void)re_fprintf(stderr, "\t--duration <sec>   Duration of each"
+			 " step (default 2)\n");
+	(void)re_fprintf(stderr, "\t--pin              Pin threads"
+			 " to CPUs\n");
+
+	(void)re_fprintf(stderr, "\nsoak options:\n");
+	(void)re_fprintf(stderr, "\t--soak <sec>       Loop <testcase>, or"
+			 " the soak set, and check for growth\n");
+	(void)re_fprintf(stderr, "\t--soak-interval <s> Sampling interval"
+			 " (default 1/32 of the duration)\n");
+
+	(void)re_fprintf(stderr, "\ncapture options:\n");
+	(void)re_fprintf(stderr, "\t--pcap <file>      Replay a capture"
+			 " into the decoders, or with -b\n"
+			 "\t                   into bench_pcap_decode\n");
+	(void)re_fprintf(stderr, "\t--pcap-scale <x>   Replay over loopback,"
+			 " <x> times the original speed\n");
+
+	(void)re_fprintf(stderr, "\nfuzzing options:\n");
+	(void)re_fprintf(stderr, "\t--fuzz <target>    Replay the corpus,"
+			 " or mutate the seeds for --duration\n");
+	(void)re_fprintf(stderr, "\t--fuzz-seeds <dir> Write the seed"
+			 " corpus of all targets\n");
+	(void)re_fprintf(stderr, "\t--fuzz-udp <pct>   Loop the UDP tests"
+			 " with <pct> of packets mutated\n");
+
 	(void)re_fprintf(stderr, "\ncommon options:\n");
 	(void)re_fprintf(stderr, "\t-d <path> Path to data files\n");
+	(void)re_fprintf(stderr, "\t-f <n>    Run regular tests in <n>"
+			 " forked processes,\n"
+			 "\t          and -i in <n> workers\n");
 	(void)re_fprintf(stderr, "\t-h        Help\n");
+	(void)re_fprintf(stderr, "\t-j <n>    Run regular tests in <n>"
+			 " parallel threads\n");
 	(void)re_fprintf(stderr, "\t-m <met>  Async polling method to use\n");
+	(void)re_fprintf(stderr, "\t-s <seed> Seed of the random numbers,"
+			 " to replay a run\n");
+	(void)re_fprintf(stderr, "\t--loopstat Event-loop statistics"
+			 " per regular test\n");
 	(void)re_fprintf(stderr, "\t-v        Verbose output\n");
 }
 #endif
 
 
+static void print_failed(int err)
+{
+	(void)re_fprintf(stderr, "Failed (%m) -- replay with -s %llu\n", err,
+			 (unsigned long long)test_rand_seed());
+}
+
+
 static void dbg_handler(int level, const char *p, size_t len, void *arg)
 {
 	(void)level;
@@ -69,13 +178,29 @@ int main(int argc, char *argv[])
 	struct memstat mstat;
 	bool do_reg = false;
 	bool do_oom = false;
+	bool do_oom_index = false;
 	bool do_perf = false;
+	bool do_bench = false;
 	bool do_all = true;    /* run all tests is default */
 	bool do_list = false;
 	bool do_thread = false;
 	enum dbg_flags flags;
 	bool verbose = false;
 	const char *name = NULL;
+	const char *json = NULL;
+	const char *baseline = NULL;
+	const char *fuzz = NULL;
+	const char *fuzz_seeds = NULL;
+	unsigned fuzz_udp = 0;
+	const char *pcap = NULL;
+	double pcap_scale = 0;
+	double soak = 0;
+	double soak_interval = 0;
+	double threshold = 10.0;
+	double duration = 0;
+	bool pin = false;
+	bool seed_set = false;
+	uint64_t seed = 0;
 	enum poll_method method = poll_method_best();
 	int err = 0;
 
@@ -88,7 +213,8 @@ int main(int argc, char *argv[])
 
 #ifdef HAVE_GETOPT
 	for (;;) {
-		const int c = getopt(argc, argv, "hropaltvm:d:");
+		const int c = getopt_long(argc, argv, "hroipbaltvm:d:j:f:s:",
+					  long_options, NULL);
 		if (0 > c)
 			break;
 
@@ -109,11 +235,21 @@ int main(int argc, char *argv[])
 			do_all = false;
 			break;
 
+		case 'i':
+			do_oom_index = true;
+			do_all = false;
+			break;
+
 		case 'p':
 			do_perf = true;
 			do_all = false;
 			break;
 
+		case 'b':
+			do_bench = true;
+			do_all = false;
+			break;
+
 		case 'a':
 			do_all = true;
 			break;
@@ -148,17 +284,108 @@ int main(int argc, char *argv[])
 		case 'd':
 			test_set_datapath(optarg);
 			break;
+
+		case 'f':
+			test_set_shards(atoi(optarg));
+			break;
+
+		case 'j':
+			test_set_jobs(atoi(optarg));
+			break;
+
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			seed_set = true;
+			break;
+
+		case OPT_JSON:
+			json = optarg;
+			break;
+
+		case OPT_BASELINE:
+			baseline = optarg;
+			break;
+
+		case OPT_THRESHOLD:
+			threshold = atof(optarg);
+			break;
+
+		case OPT_COUNTERS:
+			test_perf_set_counters(true);
+			break;
+
+		case OPT_DURATION:
+			duration = atof(optarg);
+			break;
+
+		case OPT_PIN:
+			pin = true;
+			break;
+
+		case OPT_PROFILE:
+			test_perf_set_profile(optarg);
+			break;
+
+		case OPT_LOOPSTAT:
+			test_set_loopstat(true);
+			break;
+
+		case OPT_FUZZ:
+			fuzz = optarg;
+			do_all = false;
+			break;
+
+		case OPT_FUZZ_SEEDS:
+			fuzz_seeds = optarg;
+			do_all = false;
+			break;
+
+		case OPT_PCAP:
+			pcap = optarg;
+			do_all = false;
+			break;
+
+		case OPT_PCAP_SCALE:
+			pcap_scale = atof(optarg);
+			break;
+
+		case OPT_SOAK:
+			soak = atof(optarg);
+			if (soak <= 0) {
+				usage();
+				return -2;
+			}
+			do_all = false;
+			break;
+
+		case OPT_BUDGETS:
+			test_budget_enable(true);
+			break;
+
+		case OPT_SOAK_INTERVAL:
+			soak_interval = atof(optarg);
+			break;
+
+		case OPT_FUZZ_UDP:
+			fuzz_udp = atoi(optarg);
+			if (!fuzz_udp || fuzz_udp > 100) {
+				usage();
+				return -2;
+			}
+			do_all = false;
+			break;
 		}
 	}
 
 	argc -= optind;
 
-	if (argc < 0 || argc > 1) {
+	/* in fuzzing mode the arguments are the corpus */
+	if (argc < 0 || (argc > 1 && !fuzz)) {
 		usage();
 		return -2;
 	}
 
-	if (argc >= 1) {
+	if (argc >= 1 && !fuzz) {
 		name = argv[optind];
 		printf("single testcase: %s\n", name);
 	}
@@ -185,6 +412,10 @@ int main(int argc, char *argv[])
 	if (err)
 		goto out;
 
+	/* enough for the many-connection benchmarks */
+	if (do_bench)
+		test_set_fd_limit(FD_LIMIT_BENCH);
+
 	err = poll_method_set(method);
 	if (err) {
 		DEBUG_WARNING("could not set polling method '%s' (%m)\n",
@@ -199,6 +430,8 @@ int main(int argc, char *argv[])
 
 	dbg_handler_set(NULL, 0);
 
+	test_rand_set_seed(seed_set ? seed : rand_u64());
+
 	if (do_all) {
 		do_reg = true;
 		do_oom = true;
@@ -207,6 +440,48 @@ int main(int argc, char *argv[])
 
 	if (do_list) {
 		test_listcases();
+		fuzzer_list();
+		goto out;
+	}
+
+	if (fuzz_seeds) {
+		err = fuzzer_write_seeds(fuzz_seeds);
+		if (err)
+			DEBUG_WARNING("could not write seeds (%m)\n", err);
+		goto out;
+	}
+
+	if (fuzz) {
+		re_printf("using random seed %llu\n",
+			  (unsigned long long)test_rand_seed());
+
+		err = fuzzer_replay(fuzz, &argv[optind], argc,
+				    duration ? duration : 1.0);
+		if (err)
+			print_failed(err);
+		goto out;
+	}
+
+	test_pcap_set_file(pcap);
+
+	if (pcap && !do_bench) {
+		err = test_pcap_replay(pcap, pcap_scale);
+		goto out;
+	}
+
+	if (soak > 0) {
+		err = test_soak(name, soak, soak_interval);
+		if (err)
+			print_failed(err);
+		goto out;
+	}
+
+	if (fuzz_udp) {
+		re_printf("using random seed %llu\n",
+			  (unsigned long long)test_rand_seed());
+
+		err = test_fuzz_udp(duration ? duration : 10.0, fuzz_udp,
+				    verbose);
 		goto out;
 	}
 
@@ -219,31 +494,54 @@ int main(int argc, char *argv[])
 
 	if (verbose) {
 		re_printf("using datapath '%s'\n", test_datapath());
+		re_printf("using random seed %llu\n",
+			  (unsigned long long)test_rand_seed());
 	}
 
 	if (do_reg) {
 		err = test_reg(name, verbose);
 		if (err)
-			(void)re_fprintf(stderr, "Failed (%m)\n", err);
+			print_failed(err);
 	}
 
 	if (do_oom) {
 		err = test_oom(name, verbose);
 		if (err)
-			(void)re_fprintf(stderr, "Failed (%m)\n", err);
+			print_failed(err);
+	}
+
+	if (do_oom_index) {
+		err = test_oom_index(name, verbose);
+		if (err)
+			print_failed(err);
 	}
 
+	if (do_perf || do_bench)
+		test_perf_set_report(json, baseline, threshold);
+
 	if (do_perf) {
 		err = test_perf(name, verbose);
 		if (err)
-			(void)re_fprintf(stderr, "Failed (%m)\n", err);
+			print_failed(err);
+	}
+
+	if (do_bench) {
+		err = test_bench(name, verbose);
+		if (err)
+			print_failed(err);
 	}
 
 	if (do_thread) {
 #ifdef HAVE_PTHREAD
-		err = test_multithread();
+		test_scaling_set(duration, pin);
+
+		/* -t with a testcase */
+		if (name && !do_all)
+			err = test_scaling(name, verbose);
+		else
+			err = test_multithread();
 		if (err)
-			(void)re_fprintf(stderr, "Failed (%m)\n", err);
+			print_failed(err);
 #else
 		(void)re_fprintf(stderr, "no support for threads\n");
 		err = ENOSYS;
@@ -0,0 +1,300 @@
+/**
+ * @file memprof.c  Allocation profiling
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <re.h>
+#include "test.h"
+
+
+/*
+ * libre's memstat only tracks the blocks in use, so the number of
+ * allocations made by a testcase cannot be derived from it. Instead
+ * the malloc family is interposed here and counted per thread.
+ *
+ * Live bytes are counted with the usable size of each block, so that
+ * free() can subtract the same amount. A block freed by another thread
+ * is subtracted there, so only the difference between two snapshots
+ * taken on the same thread is meaningful.
+ *
+ * This relies on the glibc __libc_* entry points and is only built
+ * with USE_MEMPROF. A sanitizer has its own allocator, so the profile
+ * is also off in sanitizer builds. Without the profile all counters
+ * stay at zero.
+ */
+#if defined (__SANITIZE_ADDRESS__) || defined (__SANITIZE_THREAD__)
+#define MEMPROF_SANITIZER 1
+#elif defined (__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) \
+	|| __has_feature(memory_sanitizer)
+#define MEMPROF_SANITIZER 1
+#endif
+#endif
+
+#if defined (USE_MEMPROF) && defined (__GLIBC__) && \
+	!defined (MEMPROF_SANITIZER) && !defined (USE_FUZZER)
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+extern void *__libc_pvalloc(size_t size);
+extern void __libc_free(void *ptr);
+
+
+static __thread struct memprof prof;
+static __thread uint64_t fail_countdown;   /* 0 is disabled */
+static __thread bool fail_hit;
+
+
+/* true if this allocation must fail, see memprof_fail_at() */
+static inline bool inject_fail(void)
+{
+	if (!fail_countdown || --fail_countdown)
+		return false;
+
+	fail_hit = true;
+
+	return true;
+}
+
+
+static inline void account_alloc(void *p, size_t size)
+{
+	++prof.allocs;
+	prof.bytes += size;
+
+	prof.cur += (int64_t)malloc_usable_size(p);
+	if (prof.cur > prof.peak)
+		prof.peak = prof.cur;
+}
+
+
+static inline void account_free(void *p)
+{
+	++prof.frees;
+	prof.cur -= (int64_t)malloc_usable_size(p);
+}
+
+
+void *malloc(size_t size)
+{
+	void *p;
+
+	if (inject_fail())
+		return NULL;
+
+	p = __libc_malloc(size);
+
+	if (p)
+		account_alloc(p, size);
+
+	return p;
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *p;
+
+	if (inject_fail())
+		return NULL;
+
+	p = __libc_calloc(nmemb, size);
+
+	if (p)
+		account_alloc(p, nmemb * size);
+
+	return p;
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	size_t old = ptr ? malloc_usable_size(ptr) : 0;
+	void *p;
+
+	/* realloc(ptr, 0) is a free, it can not fail */
+	if (size && inject_fail())
+		return NULL;
+
+	p = __libc_realloc(ptr, size);
+
+	if (p) {
+		if (ptr)
+			++prof.frees;
+		prof.cur -= (int64_t)old;
+		account_alloc(p, size);
+	}
+	else if (ptr && !size) {
+		/* glibc freed the block and returned NULL */
+		++prof.frees;
+		prof.cur -= (int64_t)old;
+	}
+
+	return p;
+}
+
+
+/* the aligned allocations are freed with free(), so count them too */
+void *memalign(size_t alignment, size_t size)
+{
+	void *p;
+
+	if (inject_fail())
+		return NULL;
+
+	p = __libc_memalign(alignment, size);
+
+	if (p)
+		account_alloc(p, size);
+
+	return p;
+}
+
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *p;
+
+	if (!alignment || (alignment & (alignment - 1)) ||
+	    alignment % sizeof(void *))
+		return EINVAL;
+
+	p = memalign(alignment, size);
+	if (!p)
+		return ENOMEM;
+
+	*memptr = p;
+
+	return 0;
+}
+
+
+void *valloc(size_t size)
+{
+	void *p;
+
+	if (inject_fail())
+		return NULL;
+
+	p = __libc_valloc(size);
+
+	if (p)
+		account_alloc(p, size);
+
+	return p;
+}
+
+
+void *pvalloc(size_t size)
+{
+	void *p;
+
+	if (inject_fail())
+		return NULL;
+
+	p = __libc_pvalloc(size);
+
+	if (p)
+		account_alloc(p, size);
+
+	return p;
+}
+
+
+void free(void *ptr)
+{
+	if (ptr)
+		account_free(ptr);
+
+	__libc_free(ptr);
+}
+
+
+bool memprof_supported(void)
+{
+	return true;
+}
+
+
+void memprof_get(struct memprof *mp)
+{
+	if (mp)
+		*mp = prof;
+}
+
+
+/* Start a new peak measurement from the current live bytes */
+void memprof_reset_peak(void)
+{
+	prof.peak = prof.cur;
+}
+
+
+/**
+ * Let the n-th allocation on this thread from now on fail
+ *
+ * @param n Allocation index starting at 1, or 0 to disable
+ */
+void memprof_fail_at(uint64_t n)
+{
+	fail_countdown = n;
+	fail_hit = false;
+}
+
+
+/* true if the allocation set with memprof_fail_at() has failed */
+bool memprof_fail_hit(void)
+{
+	return fail_hit;
+}
+
+
+#else
+
+
+bool memprof_supported(void)
+{
+	return false;
+}
+
+
+void memprof_get(struct memprof *mp)
+{
+	if (mp)
+		memset(mp, 0, sizeof(*mp));
+}
+
+
+void memprof_reset_peak(void)
+{
+}
+
+
+void memprof_fail_at(uint64_t n)
+{
+	(void)n;
+}
+
+
+bool memprof_fail_hit(void)
+{
+	return false;
+}
+
+
+#endif
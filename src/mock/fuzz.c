@@ -13,10 +13,36 @@
 #include <re_dbg.h>
 
 
+/*
+ * The UDP helper mutates a copy of each outgoing packet and each
+ * incoming packet in place. A packet is picked with the configured
+ * rate, then one of the enabled strategies is applied. The choices
+ * come from the seeded test PRNG, so a run can be replayed with -s.
+ *
+ * Tests opt in with fuzz_attach_udpsock(), which does nothing unless
+ * the "--fuzz-udp" run mode passes them a context. The counts of each
+ * fuzzer are added to that context when the fuzzer is freed.
+ */
+
+
+enum {
+	LAYER_FUZZ = -1000,
+	SPLICE_MAX = 64,           /* bytes kept from the previous packet */
+	LENGTH_WINDOW = 16,        /* where to look for length fields */
+};
+
+
 struct fuzz {
 	struct tcp_helper *th;
 	struct tcp_conn *tc;
+	struct udp_helper *uh;
+	struct udp_sock *us;
+	struct fuzz_conf conf;
+	struct fuzz_ctx *ctx;
+	uint8_t splice[SPLICE_MAX];
+	size_t splice_len;
 	size_t packet_count;
+	size_t mutated_count;
 };
 
 
@@ -24,8 +50,15 @@ static void destructor(void *data)
 {
 	struct fuzz *fuzz = data;
 
+	if (fuzz->ctx) {
+		fuzz->ctx->packets += fuzz->packet_count;
+		fuzz->ctx->mutated += fuzz->mutated_count;
+	}
+
 	mem_deref(fuzz->th);
 	mem_deref(fuzz->tc);
+	mem_deref(fuzz->uh);
+	mem_deref(fuzz->us);
 }
 
 
@@ -41,11 +74,11 @@ static void apply_fuzzing(struct fuzz *fuzz, struct mbuf *mb)
 
 	++fuzz->packet_count;
 
-	pos = rand_u16() % len;
-	bit = rand_u16() % 8;
+	pos = test_rand_u16() % len;
+	bit = test_rand_u16() % 8;
 
 	/* percent change of corrupt packet */
-	flip = ((rand_u16() % 100) < 33);
+	flip = ((test_rand_u16() % 100) < 33);
 
 	if (flip) {
 		re_printf("### flipped bit on pos %zu\n", pos);
@@ -56,6 +89,146 @@ static void apply_fuzzing(struct fuzz *fuzz, struct mbuf *mb)
 }
 
 
+static enum fuzz_strategy pick_strategy(const struct fuzz *fuzz,
+					bool can_dup)
+{
+	unsigned mask = fuzz->conf.strategies ? fuzz->conf.strategies
+		: FUZZ_ALL;
+	unsigned n = 0, i;
+
+	if (!can_dup)
+		mask &= ~FUZZ_DUPLICATE;
+
+	for (i=0; i<FUZZ_COUNT; i++) {
+		if (mask & (1u << i))
+			++n;
+	}
+
+	if (!n)
+		return 0;
+
+	n = test_rand_u32() % n;
+
+	for (i=0; i<FUZZ_COUNT; i++) {
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		if (n-- == 0)
+			break;
+	}
+
+	return 1u << i;
+}
+
+
+/* a 16-bit field near the start, e.g. the STUN, RTCP or DTLS length */
+static void tamper_length(uint8_t *p, size_t len)
+{
+	size_t pos;
+	uint16_t v;
+
+	if (len < 2)
+		return;
+
+	pos = test_rand_u32() % min(len - 1, (size_t)LENGTH_WINDOW);
+	v   = (uint16_t)(p[pos] << 8 | p[pos + 1]);
+
+	switch (test_rand_u32() % 4) {
+
+	case 0:
+		v = 0;
+		break;
+
+	case 1:
+		v = 0xffff;
+		break;
+
+	case 2:
+		v = (test_rand_u32() & 1) ? v + 1 : v - 1;
+		break;
+
+	default:
+		v = test_rand_u16();
+		break;
+	}
+
+	p[pos]     = v >> 8;
+	p[pos + 1] = v & 0xff;
+}
+
+
+/* copy a byte range of the previous packet over this one */
+static void splice(struct fuzz *fuzz, uint8_t *p, size_t len)
+{
+	size_t pos, n;
+
+	if (!fuzz->splice_len)
+		return;
+
+	pos = test_rand_u32() % len;
+	n   = 1 + test_rand_u32() % fuzz->splice_len;
+	n   = min(n, len - pos);
+
+	memcpy(p + pos, fuzz->splice, n);
+}
+
+
+/*
+ * Mutate the packet in mb, from mb->pos to mb->end.
+ *
+ * @return true if the packet should be duplicated
+ */
+static bool mutate_packet(struct fuzz *fuzz, struct mbuf *mb, bool can_dup)
+{
+	uint8_t *p = mbuf_buf(mb);
+	const size_t len = mbuf_get_left(mb);
+	bool dup = false;
+
+	if (len == 0)
+		return false;
+
+	++fuzz->packet_count;
+
+	if (test_rand_u32() % 100 < fuzz->conf.rate) {
+
+		++fuzz->mutated_count;
+
+		switch (pick_strategy(fuzz, can_dup)) {
+
+		case FUZZ_BITFLIP:
+			p[test_rand_u32() % len] ^= 1 << (test_rand_u32() % 8);
+			break;
+
+		case FUZZ_TRUNCATE:
+			mb->end = mb->pos + test_rand_u32() % len;
+			break;
+
+		case FUZZ_DUPLICATE:
+			dup = true;
+			break;
+
+		case FUZZ_LENGTH:
+			tamper_length(p, len);
+			break;
+
+		case FUZZ_SPLICE:
+			splice(fuzz, p, len);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	/* remember the start of this packet for the next splice */
+	fuzz->splice_len = min(mbuf_get_left(mb), sizeof(fuzz->splice));
+	memcpy(fuzz->splice, mbuf_buf(mb), fuzz->splice_len);
+
+	return dup;
+}
+
+
 static bool helper_send_handler(int *err, struct mbuf *mb, void *arg)
 {
 	struct fuzz *fuzz = arg;
@@ -108,3 +281,102 @@ int fuzz_register_tcpconn(struct fuzz **fuzzp, struct tcp_conn *tc)
 
 	return err;
 }
+
+
+/* the sender may keep its buffer for retransmissions, mutate a copy */
+static bool udp_helper_send_handler(int *err, struct sa *dst,
+				    struct mbuf *mb, void *arg)
+{
+	struct fuzz *fuzz = arg;
+	struct mbuf *mbc;
+	bool dup;
+
+	mbc = mbuf_alloc(mbuf_get_left(mb));
+	if (!mbc) {
+		*err = ENOMEM;
+		return true;
+	}
+
+	(void)mbuf_write_mem(mbc, mbuf_buf(mb), mbuf_get_left(mb));
+	mbc->pos = 0;
+
+	dup = mutate_packet(fuzz, mbc, true);
+
+	*err = udp_send_helper(fuzz->us, dst, mbc, fuzz->uh);
+	if (!*err && dup) {
+		mbc->pos = 0;
+		*err = udp_send_helper(fuzz->us, dst, mbc, fuzz->uh);
+	}
+
+	mem_deref(mbc);
+
+	return true;
+}
+
+
+static bool udp_helper_recv_handler(struct sa *src, struct mbuf *mb,
+				    void *arg)
+{
+	struct fuzz *fuzz = arg;
+	(void)src;
+
+	(void)mutate_packet(fuzz, mb, false);
+
+	return false;
+}
+
+
+/**
+ * Fuzz the packets that a UDP socket sends and receives
+ *
+ * @param fuzzp Pointer to allocated fuzzer
+ * @param us    UDP socket
+ * @param conf  Mutation rate and strategies
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int fuzz_register_udpsock(struct fuzz **fuzzp, struct udp_sock *us,
+			  const struct fuzz_conf *conf)
+{
+	struct fuzz *fuzz;
+	int err;
+
+	if (!fuzzp || !us || !conf || conf->rate > 100)
+		return EINVAL;
+
+	fuzz = mem_zalloc(sizeof(*fuzz), destructor);
+	if (!fuzz)
+		return ENOMEM;
+
+	fuzz->us   = mem_ref(us);
+	fuzz->conf = *conf;
+
+	err = udp_register_helper(&fuzz->uh, us, LAYER_FUZZ,
+				  udp_helper_send_handler,
+				  udp_helper_recv_handler, fuzz);
+	if (err)
+		mem_deref(fuzz);
+	else
+		*fuzzp = fuzz;
+
+	return err;
+}
+
+
+/* Fuzz a test socket if the test was given a context */
+int fuzz_attach_udpsock(struct fuzz **fuzzp, struct udp_sock *us,
+			struct fuzz_ctx *ctx)
+{
+	int err;
+
+	if (!ctx)
+		return 0;
+
+	err = fuzz_register_udpsock(fuzzp, us, &ctx->conf);
+	if (err)
+		return err;
+
+	(*fuzzp)->ctx = ctx;
+
+	return 0;
+}
@@ -14,76 +14,326 @@
 #include <re_dbg.h>
 
 
+/*
+ * The NAT-box is installed on the sockets of the external hosts, so
+ * "receive" is the outbound direction (internal -> external) and
+ * "send" is the inbound direction. The local address of the socket is
+ * the external endpoint.
+ *
+ * Bindings are hashed by the internal endpoint (plus the external
+ * endpoint for dependent mapping) and by the external port. Timeouts
+ * are checked on lookup and by a sweep timer, so that refreshing a
+ * binding on every packet does not touch the timer list.
+ */
+
+
 enum {
-	LAYER_NAT = -1000
+	LAYER_NAT = -1000,
+	HASH_SIZE = 1024,
+	PORT_MIN = 1024,
+	SWEEP_MIN = 100,           /* [ms] */
+};
+
+
+struct natsock {
+	struct le le;
+	struct nat *nat;
+	struct udp_helper *uh;
+	struct udp_sock *us;
+	struct sa laddr;           /* the external endpoint */
 };
 
+struct binding {
+	struct le he_int;
+	struct le he_ext;
+	struct list perml;         /* external endpoints, for filtering */
+	struct nat *nat;
+	struct sa int_addr;
+	struct sa ext_dst;         /* for dependent mapping */
+	uint16_t ext_port;
+	uint64_t last;             /* last outbound packet [ms] */
+};
 
-static void nat_binding_add(struct nat *nat, const struct sa *addr)
+struct perm {
+	struct le le;
+	struct sa addr;
+};
+
+
+static int behaviour_flags(enum nat_behaviour b)
 {
-	if (!nat || !addr)
-		return;
+	switch (b) {
 
-	if (nat->bindingc >= ARRAY_SIZE(nat->bindingv)) {
-		DEBUG_WARNING("NAT-box at max capacity\n");
-		return;
+	case NAT_ADDR_DEPENDENT:
+		return SA_ADDR;
+
+	case NAT_ADDR_PORT_DEPENDENT:
+		return SA_ALL;
+
+	default:
+		return 0;
 	}
+}
+
 
-	nat->bindingv[nat->bindingc++] = *addr;
+static void binding_destructor(void *arg)
+{
+	struct binding *b = arg;
+
+	hash_unlink(&b->he_int);
+	hash_unlink(&b->he_ext);
+	list_flush(&b->perml);
+
+	--b->nat->bindingc;
 }
 
 
-static struct sa *nat_binding_find_addr(struct nat *nat, const struct sa *addr)
+static uint32_t int_key(const struct nat *nat, const struct sa *int_addr,
+			const struct sa *dst)
 {
-	unsigned i;
+	const int flags = behaviour_flags(nat->mapping);
+	uint32_t key = sa_hash(int_addr, SA_ALL);
+
+	if (flags)
+		key ^= sa_hash(dst, flags);
+
+	return key;
+}
+
+
+static bool expired(const struct binding *b, uint64_t now)
+{
+	const struct nat *nat = b->nat;
+
+	return nat->timeout && now - b->last > nat->timeout;
+}
+
+
+struct lookup {
+	const struct sa *int_addr;
+	const struct sa *dst;
+	int flags;
+};
+
+
+static bool int_cmp_handler(struct le *le, void *arg)
+{
+	const struct binding *b = le->data;
+	const struct lookup *lk = arg;
+
+	if (!sa_cmp(&b->int_addr, lk->int_addr, SA_ALL))
+		return false;
+
+	return !lk->flags || sa_cmp(&b->ext_dst, lk->dst, lk->flags);
+}
+
+
+static struct binding *binding_find_int(struct nat *nat,
+					const struct sa *int_addr,
+					const struct sa *dst, uint64_t now)
+{
+	struct binding *b;
+	struct lookup lk;
+
+	lk.int_addr = int_addr;
+	lk.dst      = dst;
+	lk.flags    = behaviour_flags(nat->mapping);
+
+	b = list_ledata(hash_lookup(nat->ht_int, int_key(nat, int_addr, dst),
+				    int_cmp_handler, &lk));
+	if (b && expired(b, now)) {
+		++nat->n_expired;
+		b = mem_deref(b);
+	}
+
+	return b;
+}
+
+
+static bool ext_cmp_handler(struct le *le, void *arg)
+{
+	const struct binding *b = le->data;
+	const uint16_t *port = arg;
+
+	return b->ext_port == *port;
+}
 
-	if (!nat || !addr)
-		return NULL;
 
-	for (i=0; i<nat->bindingc; i++) {
+static struct binding *binding_find_ext(struct nat *nat, uint16_t port,
+					uint64_t now)
+{
+	struct binding *b;
 
-		if (sa_cmp(addr, &nat->bindingv[i], SA_ALL))
-			return &nat->bindingv[i];
+	b = list_ledata(hash_lookup(nat->ht_ext, port,
+				    ext_cmp_handler, &port));
+	if (b && expired(b, now)) {
+		++nat->n_expired;
+		b = mem_deref(b);
 	}
 
-	return NULL;
+	return b;
 }
 
 
-static struct sa *nat_binding_find(struct nat *nat, uint16_t port)
+/* keep the internal port if it is free, like most NATs do */
+static uint16_t port_alloc(struct nat *nat, uint16_t port)
 {
 	unsigned i;
 
-	if (!nat || !port)
+	if (port && !binding_find_ext(nat, port, tmr_jiffies()))
+		return port;
+
+	for (i=0; i<65536 - PORT_MIN; i++) {
+
+		port = nat->port_next++;
+		if (nat->port_next < PORT_MIN)
+			nat->port_next = PORT_MIN;
+
+		if (port >= PORT_MIN &&
+		    !binding_find_ext(nat, port, tmr_jiffies()))
+			return port;
+	}
+
+	return 0;
+}
+
+
+static struct binding *binding_create(struct nat *nat,
+				      const struct sa *int_addr,
+				      const struct sa *dst, uint64_t now)
+{
+	struct binding *b;
+	uint16_t port;
+
+	if (nat->type == NAT_FIREWALL)
+		port = sa_port(int_addr);
+	else
+		port = port_alloc(nat, sa_port(int_addr));
+
+	if (!port) {
+		DEBUG_WARNING("NAT-box at max capacity\n");
+		return NULL;
+	}
+
+	b = mem_zalloc(sizeof(*b), binding_destructor);
+	if (!b)
 		return NULL;
 
-	for (i=0; i<nat->bindingc; i++) {
+	b->nat      = nat;
+	b->int_addr = *int_addr;
+	b->ext_dst  = *dst;
+	b->ext_port = port;
+	b->last     = now;
+
+	hash_append(nat->ht_int, int_key(nat, int_addr, dst), &b->he_int, b);
+	hash_append(nat->ht_ext, port, &b->he_ext, b);
+	++nat->bindingc;
+
+	return b;
+}
+
+
+static bool perm_cmp_handler(struct le *le, void *arg)
+{
+	const struct perm *perm = le->data;
+	const struct lookup *lk = arg;
+
+	return sa_cmp(&perm->addr, lk->dst, lk->flags);
+}
+
+
+static bool permitted(const struct binding *b, const struct sa *src)
+{
+	struct lookup lk;
 
-		if (port == sa_port(&nat->bindingv[i]))
-			return &nat->bindingv[i];
+	lk.dst   = src;
+	lk.flags = behaviour_flags(b->nat->filtering);
+
+	if (!lk.flags)
+		return true;
+
+	return NULL != list_apply(&b->perml, true, perm_cmp_handler, &lk);
+}
+
+
+static void perm_add(struct binding *b, const struct sa *dst)
+{
+	struct perm *perm;
+
+	if (!behaviour_flags(b->nat->filtering) || permitted(b, dst))
+		return;
+
+	perm = mem_zalloc(sizeof(*perm), NULL);
+	if (!perm)
+		return;
+
+	perm->addr = *dst;
+	list_append(&b->perml, &perm->le, perm);
+}
+
+
+/* outbound packet from an internal endpoint, creates or refreshes */
+static struct binding *outbound(struct nat *nat, const struct sa *int_addr,
+				const struct sa *dst)
+{
+	const uint64_t now = tmr_jiffies();
+	struct binding *b;
+
+	b = binding_find_int(nat, int_addr, dst, now);
+	if (!b) {
+		b = binding_create(nat, int_addr, dst, now);
+		if (!b)
+			return NULL;
+	}
+
+	b->last = now;
+	perm_add(b, dst);
+
+	return b;
+}
+
+
+/* inbound packet to an external port, NULL if dropped */
+static struct binding *inbound(struct nat *nat, uint16_t port,
+			       const struct sa *src)
+{
+	struct binding *b;
+
+	b = binding_find_ext(nat, port, tmr_jiffies());
+	if (!b)
+		return NULL;
+
+	if (!permitted(b, src)) {
+		++nat->n_filtered;
+		return NULL;
 	}
 
-	return NULL;
+	return b;
 }
 
 
 static bool nat_helper_send(int *err, struct sa *dst,
 			    struct mbuf *mb, void *arg)
 {
-	struct nat *nat = arg;
-	struct sa *cli;
+	struct natsock *ns = arg;
+	struct binding *b;
 	(void)mb;
 
-	cli = nat_binding_find(nat, sa_port(dst));
+	b = inbound(ns->nat, sa_port(dst), &ns->laddr);
 
 #if 0
-	re_printf("nat: send INGRESS %J -> %J\n", dst, cli);
+	re_printf("nat: send INGRESS %J -> %J\n", dst,
+		  b ? &b->int_addr : NULL);
 #endif
 
-	if (cli) {
-		*dst = *cli;
+	if (b) {
+		*dst = b->int_addr;
 		return false;
 	}
+	else if (ns->nat->filtering != NAT_ENDPOINT_INDEPENDENT) {
+		/* filtered or expired, silently dropped */
+		return true;
+	}
 	else {
 		*err = ENOTCONN;
 		DEBUG_WARNING("nat: binding to %J not found\n", dst);
@@ -94,16 +344,17 @@ static bool nat_helper_send(int *err, struct sa *dst,
 
 static bool nat_helper_recv(struct sa *src, struct mbuf *mb, void *arg)
 {
-	struct nat *nat = arg;
+	struct natsock *ns = arg;
+	struct binding *b;
 	struct sa map;
 	(void)mb;
 
-	if (!nat_binding_find(nat, sa_port(src))) {
-		nat_binding_add(nat, src);
-	}
+	b = outbound(ns->nat, src, &ns->laddr);
+	if (!b)
+		return true;
 
-	map = nat->public_addr;
-	sa_set_port(&map, sa_port(src));
+	map = ns->nat->public_addr;
+	sa_set_port(&map, b->ext_port);
 
 #if 0
 	re_printf("nat: recv EGRESS %J -> %J\n", src, &map);
@@ -118,14 +369,12 @@ static bool nat_helper_recv(struct sa *src, struct mbuf *mb, void *arg)
 static bool firewall_egress(int *err, struct sa *dst,
 			    struct mbuf *mb, void *arg)
 {
-	struct nat *nat = arg;
-	(void)err;
+	struct natsock *ns = arg;
 	(void)mb;
 
 	/* add egress mapping to external addr */
-	if (!nat_binding_find_addr(nat, dst)) {
-		nat_binding_add(nat, dst);
-	}
+	if (!outbound(ns->nat, &ns->laddr, dst))
+		*err = ENOMEM;
 
 	return false;
 }
@@ -134,11 +383,11 @@ static bool firewall_egress(int *err, struct sa *dst,
 static bool firewall_ingress(struct sa *src,
 			     struct mbuf *mb, void *arg)
 {
-	struct nat *nat = arg;
+	struct natsock *ns = arg;
 	(void)mb;
 
 	/* check if external address has a mapping */
-	if (!nat_binding_find_addr(nat, src)) {
+	if (!inbound(ns->nat, sa_port(&ns->laddr), src)) {
 
 		DEBUG_NOTICE("firewall: drop 1 packet from %J\n", src);
 		return true;
@@ -148,26 +397,68 @@ static bool firewall_ingress(struct sa *src,
 }
 
 
-static void nat_destructor(void *arg)
+static bool sweep_handler(struct le *le, void *arg)
+{
+	struct binding *b = le->data;
+	const uint64_t *now = arg;
+
+	if (expired(b, *now)) {
+		++b->nat->n_expired;
+		mem_deref(b);
+	}
+
+	return false;
+}
+
+
+static void sweep_timeout(void *arg)
 {
 	struct nat *nat = arg;
+	uint64_t now = tmr_jiffies();
 
-	mem_deref(nat->uh);
-	mem_deref(nat->us);
+	(void)hash_apply(nat->ht_ext, sweep_handler, &now);
+
+	tmr_start(&nat->tmr, max(nat->timeout / 2, (uint32_t)SWEEP_MIN),
+		  sweep_timeout, nat);
 }
 
 
-/* inbound NAT */
-int nat_alloc(struct nat **natp, enum natbox_type type,
-	      struct udp_sock *us, const struct sa *public_addr)
+static void natsock_destructor(void *arg)
 {
-	struct nat *nat;
-	int err = 0;
+	struct natsock *ns = arg;
 
-	if (!natp || !us)
-		return EINVAL;
+	list_unlink(&ns->le);
+	mem_deref(ns->uh);
+	mem_deref(ns->us);
+}
 
-	if (type == NAT_INBOUND_SNAT && !public_addr)
+
+static void nat_destructor(void *arg)
+{
+	struct nat *nat = arg;
+
+	tmr_cancel(&nat->tmr);
+	list_flush(&nat->sockl);
+	hash_flush(nat->ht_int);
+	mem_deref(nat->ht_int);
+	mem_deref(nat->ht_ext);
+}
+
+
+/**
+ * Install the NAT-box on another socket, sharing the bindings
+ *
+ * @param nat NAT-box
+ * @param us  UDP socket of an external host
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int nat_attach(struct nat *nat, struct udp_sock *us)
+{
+	struct natsock *ns;
+	int err;
+
+	if (!nat || !us)
 		return EINVAL;
 
 	if (udp_helper_find(us, LAYER_NAT)) {
@@ -176,34 +467,80 @@ int nat_alloc(struct nat **natp, enum natbox_type type,
 		return EPROTO;
 	}
 
-	nat = mem_zalloc(sizeof(*nat), nat_destructor);
-	if (!nat)
+	ns = mem_zalloc(sizeof(*ns), natsock_destructor);
+	if (!ns)
 		return ENOMEM;
 
-	nat->type = type;
-	if (public_addr)
-		nat->public_addr = *public_addr;
-	nat->us = mem_ref(us);
+	ns->nat = nat;
+	ns->us  = mem_ref(us);
 
-	switch (type) {
+	list_append(&nat->sockl, &ns->le, ns);
+
+	err = udp_local_get(us, &ns->laddr);
+	if (err)
+		goto out;
+
+	switch (nat->type) {
 
 	case NAT_INBOUND_SNAT:
-		err = udp_register_helper(&nat->uh, us, LAYER_NAT,
+		err = udp_register_helper(&ns->uh, us, LAYER_NAT,
 					  nat_helper_send,
-					  nat_helper_recv, nat);
+					  nat_helper_recv, ns);
 		break;
 
 	case NAT_FIREWALL:
-		err = udp_register_helper(&nat->uh, us, LAYER_NAT,
+		err = udp_register_helper(&ns->uh, us, LAYER_NAT,
 					  firewall_egress,
-					  firewall_ingress, nat);
+					  firewall_ingress, ns);
 		break;
 
 	default:
-		DEBUG_WARNING("invalid NAT type %d\n", type);
+		DEBUG_WARNING("invalid NAT type %d\n", nat->type);
 		err = ENOTSUP;
 		break;
 	}
+
+ out:
+	if (err)
+		mem_deref(ns);
+
+	return err;
+}
+
+
+/* inbound NAT */
+int nat_alloc(struct nat **natp, enum natbox_type type,
+	      struct udp_sock *us, const struct sa *public_addr)
+{
+	struct nat *nat;
+	int err = 0;
+
+	if (!natp || !us)
+		return EINVAL;
+
+	if (type == NAT_INBOUND_SNAT && !public_addr)
+		return EINVAL;
+
+	nat = mem_zalloc(sizeof(*nat), nat_destructor);
+	if (!nat)
+		return ENOMEM;
+
+	nat->type = type;
+	if (public_addr)
+		nat->public_addr = *public_addr;
+	nat->port_next = PORT_MIN;
+
+	/* the firewall keeps its strict filtering by default */
+	nat->mapping   = NAT_ENDPOINT_INDEPENDENT;
+	nat->filtering = type == NAT_FIREWALL ? NAT_ADDR_PORT_DEPENDENT
+		: NAT_ENDPOINT_INDEPENDENT;
+
+	err  = hash_alloc(&nat->ht_int, HASH_SIZE);
+	err |= hash_alloc(&nat->ht_ext, HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = nat_attach(nat, us);
 	if (err)
 		goto out;
 
@@ -215,3 +552,49 @@ int nat_alloc(struct nat **natp, enum natbox_type type,
 
 	return err;
 }
+
+
+/**
+ * Set the mapping and filtering behaviour (RFC 4787)
+ *
+ * The firewall does not translate, only its filtering can be changed.
+ *
+ * @param nat       NAT-box
+ * @param mapping   Mapping behaviour
+ * @param filtering Filtering behaviour
+ */
+void nat_set_behaviour(struct nat *nat, enum nat_behaviour mapping,
+		       enum nat_behaviour filtering)
+{
+	if (!nat)
+		return;
+
+	/* existing bindings were hashed with the old mapping */
+	hash_flush(nat->ht_int);
+
+	if (nat->type != NAT_FIREWALL)
+		nat->mapping = mapping;
+
+	nat->filtering = filtering;
+}
+
+
+/**
+ * Set the binding timeout, refreshed by outbound packets
+ *
+ * @param nat     NAT-box
+ * @param timeout Timeout in [ms], 0 to keep the bindings forever
+ */
+void nat_set_timeout(struct nat *nat, uint32_t timeout)
+{
+	if (!nat)
+		return;
+
+	nat->timeout = timeout;
+
+	if (timeout)
+		tmr_start(&nat->tmr, max(timeout / 2, (uint32_t)SWEEP_MIN),
+			  sweep_timeout, nat);
+	else
+		tmr_cancel(&nat->tmr);
+}
@@ -0,0 +1,343 @@
+/**
+ * @file mock/netem.c Mock network impairment
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "mock/netem"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+
+/*
+ * Egress impairment, like netem(8) but with libre timers. The helper
+ * takes every outgoing packet, decides on loss and duplication, and
+ * queues it with a departure time from the delay, the jitter and the
+ * token bucket. Reordered packets skip the delay. The random numbers
+ * come from the seeded test PRNG, so a run can be replayed with -s.
+ *
+ * To impair both directions, attach one helper to each socket.
+ */
+
+
+enum {
+	LAYER_NETEM = -1000,
+	QUEUE_LIMIT = 1000,
+	BURST_DEFAULT = 1500,      /* [bytes] */
+};
+
+
+struct packet {
+	struct le le;
+	struct sa dst;
+	struct mbuf *mb;
+	uint64_t due;              /* [ms] */
+};
+
+
+static void packet_destructor(void *arg)
+{
+	struct packet *pkt = arg;
+
+	list_unlink(&pkt->le);
+	mem_deref(pkt->mb);
+}
+
+
+/* uniform random number in [0, 1) */
+static double rand_unit(void)
+{
+	return (double)(test_rand_u64() >> 11) / 9007199254740992.0;
+}
+
+
+static bool rand_event(double p)
+{
+	return p > 0 && rand_unit() < p;
+}
+
+
+/* standard normal distribution, Box-Muller */
+static double rand_normal(void)
+{
+	double u1, u2;
+
+	do {
+		u1 = rand_unit();
+	} while (u1 <= 0);
+
+	u2 = rand_unit();
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+static uint64_t packet_delay(const struct netem *ne)
+{
+	const struct netem_conf *conf = &ne->conf;
+	double d = conf->delay;
+
+	if (conf->jitter) {
+		switch (conf->dist) {
+
+		case NETEM_NORMAL:
+			d += rand_normal() * conf->jitter;
+			break;
+
+		default:
+			d += (2.0 * rand_unit() - 1.0) * conf->jitter;
+			break;
+		}
+	}
+
+	return d > 0 ? (uint64_t)(d + 0.5) : 0;
+}
+
+
+/* Gilbert-Elliott: change state, then lose with the state's probability */
+static bool packet_lost(struct netem *ne)
+{
+	const struct netem_conf *conf = &ne->conf;
+
+	if (ne->bad) {
+		if (rand_event(conf->loss_r))
+			ne->bad = false;
+	}
+	else {
+		if (rand_event(conf->loss_p))
+			ne->bad = true;
+	}
+
+	return rand_event(ne->bad ? conf->loss_bad : conf->loss_good);
+}
+
+
+/* time to wait for the token bucket [ms] */
+static uint64_t bucket_wait(struct netem *ne, size_t len, uint64_t now)
+{
+	const struct netem_conf *conf = &ne->conf;
+	const double burst = conf->burst ? conf->burst : BURST_DEFAULT;
+	double wait;
+
+	if (!conf->rate)
+		return 0;
+
+	ne->tokens += (double)(now - ne->tb_last) * conf->rate / 8000.0;
+	ne->tokens  = min(ne->tokens, burst);
+	ne->tb_last = now;
+
+	/* a negative balance is the backlog of the queue */
+	ne->tokens -= (double)len;
+	if (ne->tokens >= 0)
+		return 0;
+
+	wait = ceil(-ne->tokens * 8000.0 / conf->rate);
+
+	return (uint64_t)wait;
+}
+
+
+static void timeout(void *arg);
+
+
+static void schedule(struct netem *ne)
+{
+	const struct packet *pkt = list_ledata(list_head(&ne->pktl));
+	uint64_t now;
+
+	if (!pkt) {
+		tmr_cancel(&ne->tmr);
+		return;
+	}
+
+	now = tmr_jiffies();
+
+	tmr_start(&ne->tmr, pkt->due > now ? pkt->due - now : 0,
+		  timeout, ne);
+}
+
+
+static void timeout(void *arg)
+{
+	struct netem *ne = arg;
+	const uint64_t now = tmr_jiffies();
+	struct le *le;
+
+	while ((le = list_head(&ne->pktl))) {
+
+		struct packet *pkt = le->data;
+		int err;
+
+		if (pkt->due > now)
+			break;
+
+		err = udp_send_helper(ne->us, &pkt->dst, pkt->mb, ne->uh);
+		if (err) {
+			DEBUG_WARNING("send to %J failed (%m)\n",
+				      &pkt->dst, err);
+		}
+
+		++ne->n_sent;
+
+		mem_deref(pkt);
+	}
+
+	schedule(ne);
+}
+
+
+/* insert in order of departure, most packets go to the tail */
+static void enqueue(struct netem *ne, struct packet *pkt)
+{
+	struct le *le;
+
+	for (le = ne->pktl.tail; le; le = le->prev) {
+
+		const struct packet *p = le->data;
+
+		if (p->due <= pkt->due) {
+			list_insert_after(&ne->pktl, le, &pkt->le, pkt);
+			return;
+		}
+	}
+
+	list_prepend(&ne->pktl, &pkt->le, pkt);
+}
+
+
+static int packet_add(struct netem *ne, const struct sa *dst,
+		      const struct mbuf *mb, uint64_t now)
+{
+	const size_t len = mbuf_get_left(mb);
+	struct packet *pkt;
+	uint64_t delay;
+
+	if (list_count(&ne->pktl) >= (ne->conf.limit ? ne->conf.limit
+				      : QUEUE_LIMIT)) {
+		++ne->n_dropped;
+		return 0;
+	}
+
+	pkt = mem_zalloc(sizeof(*pkt), packet_destructor);
+	if (!pkt)
+		return ENOMEM;
+
+	pkt->dst = *dst;
+	pkt->mb  = mbuf_alloc(len);
+	if (!pkt->mb) {
+		mem_deref(pkt);
+		return ENOMEM;
+	}
+
+	(void)mbuf_write_mem(pkt->mb, mbuf_buf(mb), len);
+	pkt->mb->pos = 0;
+
+	if (ne->conf.delay && rand_event(ne->conf.reorder)) {
+		++ne->n_reordered;
+		delay = 0;
+	}
+	else {
+		delay = packet_delay(ne);
+	}
+
+	pkt->due = now + delay + bucket_wait(ne, len, now);
+
+	enqueue(ne, pkt);
+
+	return 0;
+}
+
+
+static bool netem_send_handler(int *err, struct sa *dst,
+			       struct mbuf *mb, void *arg)
+{
+	struct netem *ne = arg;
+	const uint64_t now = tmr_jiffies();
+
+	if (packet_lost(ne)) {
+		++ne->n_lost;
+		return true;
+	}
+
+	*err = packet_add(ne, dst, mb, now);
+
+	if (!*err && rand_event(ne->conf.dup)) {
+		++ne->n_duplicated;
+		*err = packet_add(ne, dst, mb, now);
+	}
+
+	schedule(ne);
+
+	return true;
+}
+
+
+static void netem_destructor(void *arg)
+{
+	struct netem *ne = arg;
+
+	tmr_cancel(&ne->tmr);
+	list_flush(&ne->pktl);
+	mem_deref(ne->uh);
+	mem_deref(ne->us);
+}
+
+
+/**
+ * Attach a network impairment helper to the egress path of a UDP socket
+ *
+ * @param nep  Pointer to allocated impairment helper
+ * @param us   UDP socket
+ * @param conf Impairment configuration
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int netem_alloc(struct netem **nep, struct udp_sock *us,
+		const struct netem_conf *conf)
+{
+	struct netem *ne;
+	int err;
+
+	if (!nep || !us || !conf)
+		return EINVAL;
+
+	ne = mem_zalloc(sizeof(*ne), netem_destructor);
+	if (!ne)
+		return ENOMEM;
+
+	ne->us = mem_ref(us);
+
+	netem_set(ne, conf);
+
+	err = udp_register_helper(&ne->uh, us, LAYER_NETEM,
+				  netem_send_handler, NULL, ne);
+	if (err)
+		mem_deref(ne);
+	else
+		*nep = ne;
+
+	return err;
+}
+
+
+/* Change the configuration, queued packets keep their departure time */
+void netem_set(struct netem *ne, const struct netem_conf *conf)
+{
+	if (!ne || !conf)
+		return;
+
+	ne->conf    = *conf;
+	ne->tokens  = conf->burst ? conf->burst : BURST_DEFAULT;
+	ne->tb_last = tmr_jiffies();
+	ne->bad     = false;
+}
@@ -17,6 +17,287 @@
 #define LOCAL_SECURE_PORT 0
 
 
+/*
+ * Location table, hashed by the address-of-record. Each AOR has a
+ * list of contact bindings, which expire on their own timers. A
+ * REGISTER with a Call-ID and CSeq that the binding has already seen
+ * is a retransmission, it gets the same reply but changes nothing.
+ */
+
+enum {
+	AOR_HASH_SIZE   = 1024,
+	EXPIRES_DEFAULT = 3600,    /* [s] */
+};
+
+struct aor {
+	struct le he;
+	struct list bindl;
+	struct sip_server *srv;
+	char *uri;
+};
+
+struct binding {
+	struct le le;
+	struct tmr tmr;
+	struct aor *aor;
+	char *contact;             /* URI of the contact */
+	char *callid;
+	uint32_t cseq;
+};
+
+struct reg_ctx {
+	struct aor *aor;
+	const struct sip_msg *msg;
+	uint32_t expires;          /* [s] */
+	int err;
+};
+
+
+static void aor_destructor(void *arg)
+{
+	struct aor *aor = arg;
+
+	hash_unlink(&aor->he);
+	list_flush(&aor->bindl);
+	mem_deref(aor->uri);
+}
+
+
+static void binding_destructor(void *arg)
+{
+	struct binding *b = arg;
+
+	tmr_cancel(&b->tmr);
+	list_unlink(&b->le);
+	--b->aor->srv->bindingc;
+	mem_deref(b->contact);
+	mem_deref(b->callid);
+}
+
+
+static bool aor_cmp_handler(struct le *le, void *arg)
+{
+	const struct aor *aor = le->data;
+	const struct pl *uri = arg;
+
+	return 0 == pl_strcasecmp(uri, aor->uri);
+}
+
+
+static uint32_t aor_hash(const struct pl *uri)
+{
+	return hash_joaat_ci(uri->p, uri->l);
+}
+
+
+static struct aor *aor_find(const struct sip_server *srv,
+			    const struct pl *uri)
+{
+	return list_ledata(hash_lookup(srv->ht_aor, aor_hash(uri),
+				       aor_cmp_handler, (void *)uri));
+}
+
+
+static int aor_alloc(struct aor **aorp, struct sip_server *srv,
+		     const struct pl *uri)
+{
+	struct aor *aor;
+	int err;
+
+	aor = mem_zalloc(sizeof(*aor), aor_destructor);
+	if (!aor)
+		return ENOMEM;
+
+	aor->srv = srv;
+
+	err = pl_strdup(&aor->uri, uri);
+	if (err) {
+		mem_deref(aor);
+		return err;
+	}
+
+	hash_append(srv->ht_aor, aor_hash(uri), &aor->he, aor);
+
+	*aorp = aor;
+
+	return 0;
+}
+
+
+static void binding_timeout(void *arg)
+{
+	struct binding *b = arg;
+	struct aor *aor = b->aor;
+
+	++aor->srv->n_expired;
+
+	mem_deref(b);
+
+	if (list_isempty(&aor->bindl))
+		mem_deref(aor);
+}
+
+
+static struct binding *binding_find(const struct aor *aor,
+				    const struct pl *contact)
+{
+	struct le *le;
+
+	for (le = aor->bindl.head; le; le = le->next) {
+
+		struct binding *b = le->data;
+
+		if (0 == pl_strcasecmp(contact, b->contact))
+			return b;
+	}
+
+	return NULL;
+}
+
+
+static int binding_update(struct reg_ctx *ctx, const struct pl *contact,
+			  uint32_t expires)
+{
+	const struct sip_msg *msg = ctx->msg;
+	struct aor *aor = ctx->aor;
+	struct binding *b;
+	int err;
+
+	b = binding_find(aor, contact);
+	if (b) {
+		if (0 == pl_strcmp(&msg->callid, b->callid) &&
+		    msg->cseq.num <= b->cseq) {
+			++aor->srv->n_retrans;
+			return 0;
+		}
+
+		if (!expires) {
+			mem_deref(b);
+			return 0;
+		}
+
+		b->callid = mem_deref(b->callid);
+		err = pl_strdup(&b->callid, &msg->callid);
+		if (err)
+			return err;
+	}
+	else {
+		if (!expires)
+			return 0;
+
+		b = mem_zalloc(sizeof(*b), binding_destructor);
+		if (!b)
+			return ENOMEM;
+
+		b->aor = aor;
+		++aor->srv->bindingc;
+		list_append(&aor->bindl, &b->le, b);
+
+		err  = pl_strdup(&b->contact, contact);
+		err |= pl_strdup(&b->callid, &msg->callid);
+		if (err) {
+			mem_deref(b);
+			return err;
+		}
+	}
+
+	b->cseq = msg->cseq.num;
+	tmr_start(&b->tmr, expires * 1000ULL, binding_timeout, b);
+
+	return 0;
+}
+
+
+static bool contact_handler(const struct sip_hdr *hdr,
+			    const struct sip_msg *msg, void *arg)
+{
+	struct reg_ctx *ctx = arg;
+	uint32_t expires = ctx->expires;
+	struct sip_addr addr;
+	struct pl pl;
+	(void)msg;
+
+	/* Contact: * with Expires: 0 removes all bindings */
+	if (0 == pl_strcmp(&hdr->val, "*")) {
+
+		if (!expires)
+			list_flush(&ctx->aor->bindl);
+
+		return false;
+	}
+
+	ctx->err = sip_addr_decode(&addr, &hdr->val);
+	if (ctx->err)
+		return true;
+
+	if (0 == msg_param_decode(&addr.params, "expires", &pl))
+		expires = pl_u32(&pl);
+
+	ctx->err = binding_update(ctx, &addr.auri, expires);
+
+	return ctx->err != 0;
+}
+
+
+static int register_handler(struct sip_server *srv,
+			    const struct sip_msg *msg)
+{
+	struct reg_ctx ctx;
+	struct mbuf *mb = NULL;
+	struct le *le;
+	int err;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	ctx.msg     = msg;
+	ctx.expires = pl_isset(&msg->expires) ? pl_u32(&msg->expires)
+		: EXPIRES_DEFAULT;
+
+	ctx.aor = aor_find(srv, &msg->to.auri);
+	if (!ctx.aor) {
+		err = aor_alloc(&ctx.aor, srv, &msg->to.auri);
+		if (err)
+			return err;
+	}
+
+	(void)sip_msg_hdr_apply(msg, true, SIP_HDR_CONTACT,
+				contact_handler, &ctx);
+	if (ctx.err) {
+		err = sip_reply(srv->sip, msg, 400, "Bad Contact");
+		goto out;
+	}
+
+	mb = mbuf_alloc(256);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* the reply lists all current bindings of the AOR */
+	for (le = ctx.aor->bindl.head; le; le = le->next) {
+
+		const struct binding *b = le->data;
+
+		err = mbuf_printf(mb, "Contact: <%s>;expires=%llu\r\n",
+				  b->contact,
+				  tmr_get_expire(&b->tmr) / 1000);
+		if (err)
+			goto out;
+	}
+
+	err = sip_replyf(srv->sip, msg, 200, "OK",
+			 "%bContent-Length: 0\r\n\r\n", mb->buf, mb->end);
+
+ out:
+	if (list_isempty(&ctx.aor->bindl))
+		mem_deref(ctx.aor);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
 static bool sip_msg_handler(const struct sip_msg *msg, void *arg)
 {
 	struct sip_server *srv = arg;
@@ -33,7 +314,7 @@ static bool sip_msg_handler(const struct sip_msg *msg, void *arg)
 	if (srv->terminate)
 		err = sip_reply(srv->sip, msg, 503, "Server Error");
 	else
-		err = sip_reply(srv->sip, msg, 200, "OK");
+		err = register_handler(srv, msg);
 
 	if (err) {
 		DEBUG_WARNING("could not reply: %m\n", err);
@@ -56,6 +337,9 @@ static void destructor(void *arg)
 
 	sip_close(srv->sip, false);
 	mem_deref(srv->sip);
+
+	hash_flush(srv->ht_aor);
+	mem_deref(srv->ht_aor);
 }
 
 
@@ -73,6 +357,10 @@ int sip_server_alloc(struct sip_server **srvp)
 	if (!srv)
 		return ENOMEM;
 
+	err = hash_alloc(&srv->ht_aor, AOR_HASH_SIZE);
+	if (err)
+		goto out;
+
 	err  = sa_set_str(&laddr,  "127.0.0.1", LOCAL_PORT);
 	err |= sa_set_str(&laddrs, "127.0.0.1", LOCAL_SECURE_PORT);
 	if (err)
@@ -3,6 +3,15 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#ifndef WIN32
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re.h>
 #include "test.h"
 
@@ -14,6 +23,7 @@
 
 enum {
 	TCP_MAX_LENGTH = 2048,
+	MT_POLL        = 10,       /* [ms] */
 };
 
 
@@ -23,6 +33,8 @@ static void process_msg(struct stunserver *stun,
 			struct mbuf *mb)
 {
 	struct stun_msg *msg;
+	const uint8_t *key = NULL;
+	size_t keylen = 0;
 	bool fp = false;
 	int err;
 	(void)dst;
@@ -47,15 +59,28 @@ static void process_msg(struct stunserver *stun,
 		TEST_EQUALS(0, stun_msg_chk_fingerprint(msg));
 	}
 
+	/* and MESSAGE-INTEGRITY, if the server has a key */
+	if (stun->key && stun_msg_attr(msg, STUN_ATTR_MSG_INTEGRITY)) {
+
+		key    = stun->key;
+		keylen = stun->keylen;
+
+		if (stun_msg_chk_mi(msg, key, keylen)) {
+			(void)stun_ereply(proto, sock, src, 0, msg, 401,
+					  "Unauthorized", NULL, 0, fp, 0);
+			goto out;
+		}
+	}
+
 	err = stun_reply(proto, sock, src,
-			 0, msg, NULL, 0, fp, 2,
+			 0, msg, key, keylen, fp, 2,
 			 STUN_ATTR_MAPPED_ADDR, src,
 			 STUN_ATTR_XOR_MAPPED_ADDR, src);
 
  out:
 	if (err) {
 		(void)stun_ereply(proto, sock, src, 0, msg, 400,
-				  "Bad Request", NULL, 0, fp, 0);
+				  "Bad Request", key, keylen, fp, 0);
 	}
 
 	mem_deref(msg);
@@ -258,3 +283,255 @@ const struct sa *stunserver_addr(const struct stunserver *stun, int proto)
 
 	return NULL;
 }
+
+
+/*
+ * Multithreaded UDP server. Each thread runs its own re_thread loop
+ * with a socket on the same port, bound with SO_REUSEPORT, so that the
+ * kernel spreads the clients over the threads by their address. The
+ * sockets are bound before the threads start, so that no request is
+ * lost. The threads poll for the stop flag.
+ */
+
+struct stunsrv_thread {
+	struct stunserver_mt *mt;
+#ifdef HAVE_PTHREAD
+	pthread_t tid;
+#endif
+	struct tmr tmr;
+	int fd;
+	bool started;
+	uint64_t nrecv;
+	uint64_t cpu_nsec;
+	int err;
+};
+
+
+#ifdef HAVE_PTHREAD
+static void mt_poll(void *arg)
+{
+	struct stunsrv_thread *thr = arg;
+
+	if (thr->mt->stop)
+		re_cancel();
+	else
+		tmr_start(&thr->tmr, MT_POLL, mt_poll, thr);
+}
+
+
+static void *mt_thread_handler(void *arg)
+{
+	struct stunsrv_thread *thr = arg;
+	struct stunserver *stun = NULL;
+	int err;
+
+	err = re_thread_init();
+	if (err) {
+		(void)close(thr->fd);
+		goto out;
+	}
+
+	stun = mem_zalloc(sizeof(*stun), stunserver_destructor);
+	if (!stun) {
+		(void)close(thr->fd);
+		err = ENOMEM;
+		goto close;
+	}
+
+	stun->laddr  = thr->mt->laddr;
+	stun->key    = thr->mt->key;
+	stun->keylen = thr->mt->keylen;
+
+	/* the socket owns the descriptor from here */
+	err = udp_listen_fd(&stun->us, thr->fd, stunserver_udp_recv, stun);
+	if (err) {
+		(void)close(thr->fd);
+		goto close;
+	}
+
+	tmr_init(&thr->tmr);
+	tmr_start(&thr->tmr, MT_POLL, mt_poll, thr);
+
+	err = re_main(NULL);
+
+	tmr_cancel(&thr->tmr);
+
+	thr->nrecv = stun->nrecv;
+
+ close:
+	mem_deref(stun);
+	thr->cpu_nsec = test_cpu_nanoseconds();
+	re_thread_close();
+
+ out:
+	thr->fd  = -1;
+	thr->err = err;
+
+	return NULL;
+}
+#endif
+
+
+static int reuseport_socket(int *fdp, const struct sa *laddr)
+{
+#if defined (HAVE_PTHREAD) && defined (SO_REUSEPORT)
+	const int one = 1;
+	int fd, err;
+
+	fd = socket(sa_af(laddr), SOCK_DGRAM, IPPROTO_UDP);
+	if (fd < 0)
+		return errno;
+
+	if (0 != setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one))
+	    || 0 != bind(fd, &laddr->u.sa, laddr->len)) {
+		err = errno;
+		goto out;
+	}
+
+	err = net_sockopt_blocking_set(fd, false);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		(void)close(fd);
+	else
+		*fdp = fd;
+
+	return err;
+#else
+	(void)fdp;
+	(void)laddr;
+
+	return ENOSYS;
+#endif
+}
+
+
+static void stunserver_mt_destructor(void *arg)
+{
+	struct stunserver_mt *mt = arg;
+
+	stunserver_mt_stop(mt);
+
+	mem_deref(mt->thrv);
+}
+
+
+/**
+ * Allocate a multithreaded STUN server, UDP only
+ *
+ * @param mtp      Pointer to allocated server
+ * @param nthreads Number of threads, each with its own socket
+ * @param key      Key for MESSAGE-INTEGRITY (optional)
+ * @param keylen   Length of the key
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stunserver_mt_alloc(struct stunserver_mt **mtp, unsigned nthreads,
+			const uint8_t *key, size_t keylen)
+{
+	struct stunserver_mt *mt;
+	unsigned i;
+	int err = 0;
+
+	if (!mtp || !nthreads)
+		return EINVAL;
+
+	mt = mem_zalloc(sizeof(*mt), stunserver_mt_destructor);
+	if (!mt)
+		return ENOMEM;
+
+	mt->thrv = mem_zalloc(nthreads * sizeof(*mt->thrv), NULL);
+	if (!mt->thrv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	mt->key    = key;
+	mt->keylen = keylen;
+
+	for (i=0; i<nthreads; i++)
+		mt->thrv[i].fd = -1;
+
+	mt->nthreads = nthreads;
+
+	(void)sa_set_str(&mt->laddr, "127.0.0.1", 0);
+
+	/* the first socket gets a port, the others share it */
+	for (i=0; i<nthreads; i++) {
+
+		struct stunsrv_thread *thr = &mt->thrv[i];
+
+		thr->mt = mt;
+
+		err = reuseport_socket(&thr->fd, &mt->laddr);
+		if (err)
+			goto out;
+
+		if (i == 0) {
+			mt->laddr.len = sizeof(mt->laddr.u);
+
+			if (0 != getsockname(thr->fd, &mt->laddr.u.sa,
+					     &mt->laddr.len)) {
+				err = errno;
+				goto out;
+			}
+		}
+	}
+
+#ifdef HAVE_PTHREAD
+	for (i=0; i<nthreads; i++) {
+
+		struct stunsrv_thread *thr = &mt->thrv[i];
+
+		err = pthread_create(&thr->tid, NULL, mt_thread_handler, thr);
+		if (err)
+			goto out;
+
+		thr->started = true;
+	}
+#endif
+
+ out:
+	if (err)
+		mem_deref(mt);
+	else
+		*mtp = mt;
+
+	return err;
+}
+
+
+/* Stop and join the threads, and sum up their counters */
+void stunserver_mt_stop(struct stunserver_mt *mt)
+{
+	unsigned i;
+
+	if (!mt || !mt->thrv)
+		return;
+
+	mt->stop = true;
+
+	for (i=0; i<mt->nthreads; i++) {
+
+		struct stunsrv_thread *thr = &mt->thrv[i];
+
+#ifdef HAVE_PTHREAD
+		if (thr->started) {
+			pthread_join(thr->tid, NULL);
+			thr->started = false;
+
+			mt->nrecv    += thr->nrecv;
+			mt->cpu_nsec += thr->cpu_nsec;
+
+			if (thr->err && !mt->err)
+				mt->err = thr->err;
+		}
+#endif
+		if (thr->fd >= 0) {
+			(void)close(thr->fd);
+			thr->fd = -1;
+		}
+	}
+}
@@ -12,17 +12,93 @@
 #include <re_dbg.h>
 
 
+struct srvconn {
+	struct le le;
+	struct tcp_server *srv;
+	struct tcp_conn *tc;
+};
+
+
 static void destructor(void *arg)
 {
 	struct tcp_server *srv = arg;
 
+	list_flush(&srv->connl);
 	mem_deref(srv->ts);
 }
 
 
+static void srvconn_destructor(void *arg)
+{
+	struct srvconn *conn = arg;
+
+	list_unlink(&conn->le);
+	--conn->srv->connc;
+	mem_deref(conn->tc);
+}
+
+
+static void srvconn_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct srvconn *conn = arg;
+	struct tcp_server *srv = conn->srv;
+	int err;
+
+	++srv->n_recv;
+	srv->bytes += mbuf_get_left(mb);
+
+	if (srv->behavior != BEHAVIOR_ECHO)
+		return;
+
+	++srv->n_send;
+
+	err = tcp_send(conn->tc, mb);
+	if (err) {
+		DEBUG_WARNING("echo failed (%m)\n", err);
+		mem_deref(conn);
+	}
+}
+
+
+static void srvconn_close_handler(int err, void *arg)
+{
+	struct srvconn *conn = arg;
+	(void)err;
+
+	mem_deref(conn);
+}
+
+
+static int srvconn_accept(struct tcp_server *srv)
+{
+	struct srvconn *conn;
+	int err;
+
+	conn = mem_zalloc(sizeof(*conn), srvconn_destructor);
+	if (!conn)
+		return ENOMEM;
+
+	conn->srv = srv;
+	++srv->connc;
+	list_append(&srv->connl, &conn->le, conn);
+
+	err = tcp_accept(&conn->tc, srv->ts, NULL, srvconn_recv_handler,
+			 srvconn_close_handler, conn);
+	if (err) {
+		mem_deref(conn);
+		return err;
+	}
+
+	++srv->n_accept;
+
+	return 0;
+}
+
+
 static void tcp_conn_handler(const struct sa *peer, void *arg)
 {
 	struct tcp_server *srv = arg;
+	int err;
 	(void)peer;
 
 	switch (srv->behavior) {
@@ -31,6 +107,15 @@ static void tcp_conn_handler(const struct sa *peer, void *arg)
 		tcp_reject(srv->ts);
 		break;
 
+	case BEHAVIOR_ECHO:
+	case BEHAVIOR_SINK:
+		err = srvconn_accept(srv);
+		if (err) {
+			DEBUG_WARNING("accept failed (%m)\n", err);
+			tcp_reject(srv->ts);
+		}
+		break;
+
 	default:
 		DEBUG_WARNING("behavior not implemented\n");
 		break;
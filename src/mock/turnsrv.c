@@ -13,86 +13,250 @@
 #include <re_dbg.h>
 
 
+/*
+ * Each allocation has its own relay socket and is found by the 5-tuple
+ * of the client, i.e. the transport and the source address. The
+ * permissions and channels of an allocation are hashed by peer address
+ * and channel number, and expire like in RFC 5766 unless refreshed.
+ */
+
+
 enum {
 	TCP_MAX_LENGTH = 2048,
+	ALLOC_HASH_SIZE = 256,
+	PEER_HASH_SIZE = 16,
+	LIFETIME_DEFAULT = 600,      /* [s] */
+	LIFETIME_MAX = 3600,         /* [s] */
+	PERM_LIFETIME = 300,         /* [s] */
+	CHAN_LIFETIME = 600,         /* [s] */
+	CHAN_NUMB_MIN = 0x4000,
+	CHAN_NUMB_MAX = 0x7fff,
+};
+
+
+struct allocation {
+	struct le he;                  /* by client address */
+	struct tmr tmr;
+	struct turnserver *turn;
+	struct sa cli;
+	int proto;
+	void *sock;                    /* UDP socket or TCP connection */
+	struct udp_sock *us_relay;
+	struct sa relay;
+	struct hash *ht_perm;
+	struct hash *ht_numb;
+	struct hash *ht_peer;
 };
 
+struct perm {
+	struct le he;
+	struct tmr tmr;
+	struct sa peer;
+};
+
+struct channel {
+	struct le he_numb;
+	struct le he_peer;
+	struct tmr tmr;
+	struct sa peer;
+	uint16_t nr;
+};
+
+struct tcpconn {
+	struct le le;
+	struct turnserver *turn;
+	struct tcp_conn *tc;
+	struct sa paddr;
+	struct mbuf *mb;
+};
 
-static struct channel *find_channel_numb(struct turnserver *tt, uint16_t nr)
+
+static void alloc_destructor(void *arg)
 {
-	size_t i;
+	struct allocation *al = arg;
 
-	if (!tt)
-		return NULL;
+	tmr_cancel(&al->tmr);
+	hash_unlink(&al->he);
 
-	for (i=0; i<tt->chanc; i++) {
+	/* the channels are unlinked from ht_peer by their destructor */
+	hash_flush(al->ht_perm);
+	hash_flush(al->ht_numb);
 
-		if (tt->chanv[i].nr == nr)
-			return &tt->chanv[i];
-	}
+	mem_deref(al->ht_perm);
+	mem_deref(al->ht_numb);
+	mem_deref(al->ht_peer);
+	mem_deref(al->us_relay);
+
+	--al->turn->allocc;
+}
+
+
+static void perm_destructor(void *arg)
+{
+	struct perm *perm = arg;
+
+	tmr_cancel(&perm->tmr);
+	hash_unlink(&perm->he);
+}
+
+
+static void chan_destructor(void *arg)
+{
+	struct channel *chan = arg;
+
+	tmr_cancel(&chan->tmr);
+	hash_unlink(&chan->he_numb);
+	hash_unlink(&chan->he_peer);
+}
+
+
+static bool alloc_cmp_handler(struct le *le, void *arg)
+{
+	const struct allocation *al = le->data;
+	const struct allocation *key = arg;
+
+	return al->proto == key->proto &&
+		sa_cmp(&al->cli, &key->cli, SA_ALL);
+}
+
+
+static struct allocation *find_allocation(const struct turnserver *turn,
+					  int proto, const struct sa *cli)
+{
+	struct allocation key;
+
+	key.proto = proto;
+	key.cli   = *cli;
+
+	return list_ledata(hash_lookup(turn->ht_alloc, sa_hash(cli, SA_ALL),
+				       alloc_cmp_handler, &key));
+}
+
+
+static bool numb_cmp_handler(struct le *le, void *arg)
+{
+	const struct channel *chan = le->data;
+	const uint16_t *nr = arg;
+
+	return chan->nr == *nr;
+}
+
+
+static struct channel *find_channel_numb(const struct allocation *al,
+					 uint16_t nr)
+{
+	return list_ledata(hash_lookup(al->ht_numb, nr,
+				       numb_cmp_handler, &nr));
+}
+
+
+static bool peer_cmp_handler(struct le *le, void *arg)
+{
+	const struct channel *chan = le->data;
 
-	return NULL;
+	return sa_cmp(&chan->peer, arg, SA_ALL);
 }
 
 
-static struct channel *find_channel_peer(struct turnserver *tt,
+static struct channel *find_channel_peer(const struct allocation *al,
 					 const struct sa *peer)
 {
-	size_t i;
+	return list_ledata(hash_lookup(al->ht_peer, sa_hash(peer, SA_ALL),
+				       peer_cmp_handler, (void *)peer));
+}
 
-	if (!tt)
-		return NULL;
 
-	for (i=0; i<tt->chanc; i++) {
+static bool perm_cmp_handler(struct le *le, void *arg)
+{
+	const struct perm *perm = le->data;
+
+	return sa_cmp(&perm->peer, arg, SA_ADDR);
+}
 
-		if (sa_cmp(&tt->chanv[i].peer, peer, SA_ALL))
-			return &tt->chanv[i];
-	}
 
-	return NULL;
+static struct perm *find_permission(const struct allocation *al,
+				    const struct sa *peer)
+{
+	return list_ledata(hash_lookup(al->ht_perm, sa_hash(peer, SA_ADDR),
+				       perm_cmp_handler, (void *)peer));
 }
 
 
-static int add_permission(struct turnserver *tt, const struct sa *peer)
+static void perm_timeout(void *arg)
 {
-	int err = 0;
+	struct perm *perm = arg;
 
-	TEST_ASSERT(tt->permc < ARRAY_SIZE(tt->permv));
-	tt->permv[tt->permc] = *peer;
-	++tt->permc;
- out:
-	return err;
+	mem_deref(perm);
 }
 
 
-static struct sa *find_permission(struct turnserver *tt,
-				  const struct sa *peer)
+/* install or refresh the permission for the address of a peer */
+static int add_permission(struct allocation *al, const struct sa *peer)
 {
-	size_t i;
+	struct perm *perm;
 
-	if (!tt)
-		return NULL;
+	perm = find_permission(al, peer);
+	if (!perm) {
+		perm = mem_zalloc(sizeof(*perm), perm_destructor);
+		if (!perm)
+			return ENOMEM;
 
-	for (i=0; i<tt->permc; i++) {
+		perm->peer = *peer;
 
-		if (sa_cmp(&tt->permv[i], peer, SA_ADDR))
-			return &tt->permv[i];
+		hash_append(al->ht_perm, sa_hash(peer, SA_ADDR),
+			    &perm->he, perm);
 	}
 
-	return NULL;
+	tmr_start(&perm->tmr, PERM_LIFETIME * 1000, perm_timeout, perm);
+
+	return 0;
+}
+
+
+static void chan_timeout(void *arg)
+{
+	struct channel *chan = arg;
+
+	mem_deref(chan);
+}
+
+
+static void alloc_timeout(void *arg)
+{
+	struct allocation *al = arg;
+
+	++al->turn->n_expired;
+
+	mem_deref(al);
+}
+
+
+/* send to the client, over the transport of the allocation */
+static int client_send(struct allocation *al, struct mbuf *mb)
+{
+	if (al->proto == IPPROTO_TCP)
+		return tcp_send(al->sock, mb);
+	else
+		return udp_send(al->sock, &al->cli, mb);
 }
 
 
 /* Receive packet on the "relayed" address -- relay to the client */
 static void relay_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 {
-	struct turnserver *turn = arg;
+	struct allocation *al = arg;
+	struct turnserver *turn = al->turn;
 	struct channel *chan;
 	int err = 0;
 
 	++turn->n_recv;
 
-	chan = find_channel_peer(turn, src);
+	if (!find_permission(al, src)) {
+		++turn->n_noperm;
+		return;
+	}
+
+	chan = find_channel_peer(al, src);
 	if (chan) {
 		uint16_t len = mbuf_get_left(mb);
 		size_t start;
@@ -108,13 +272,20 @@ static void relay_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 		(void)mbuf_write_u16(mb, htons(chan->nr));
 		(void)mbuf_write_u16(mb, htons(len));
 
+		/* ChannelData over TCP is padded to 4 bytes */
+		if (al->proto == IPPROTO_TCP) {
+			mb->pos = mb->end;
+			while (len++ & 0x03)
+				err |= mbuf_write_u8(mb, 0x00);
+		}
+
 		mb->pos = start;
 
-		err = udp_send(turn->us, &turn->cli, mb);
+		err |= client_send(al, mb);
 	}
 	else {
-		err = stun_indication(IPPROTO_UDP, turn->us,
-				      &turn->cli, 0, STUN_METHOD_DATA,
+		err = stun_indication(al->proto, al->sock,
+				      &al->cli, 0, STUN_METHOD_DATA,
 				      NULL, 0, false, 2,
 				      STUN_ATTR_XOR_PEER_ADDR, src,
 				      STUN_ATTR_DATA, mb);
@@ -126,19 +297,141 @@ static void relay_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 }
 
 
+static uint32_t lifetime_get(const struct stun_msg *msg)
+{
+	const struct stun_attr *attr;
+
+	attr = stun_msg_attr(msg, STUN_ATTR_LIFETIME);
+	if (!attr)
+		return LIFETIME_DEFAULT;
+
+	return min(attr->v.lifetime, (uint32_t)LIFETIME_MAX);
+}
+
+
+static int allocation_create(struct allocation **alp,
+			     struct turnserver *turn, int proto, void *sock,
+			     const struct sa *src)
+{
+	struct allocation *al;
+	struct sa laddr;
+	int err;
+
+	al = mem_zalloc(sizeof(*al), alloc_destructor);
+	if (!al)
+		return ENOMEM;
+
+	al->turn  = turn;
+	al->cli   = *src;
+	al->proto = proto;
+	al->sock  = sock;
+
+	hash_append(turn->ht_alloc, sa_hash(src, SA_ALL), &al->he, al);
+	++turn->allocc;
+
+	err  = hash_alloc(&al->ht_perm, PEER_HASH_SIZE);
+	err |= hash_alloc(&al->ht_numb, PEER_HASH_SIZE);
+	err |= hash_alloc(&al->ht_peer, PEER_HASH_SIZE);
+	if (err)
+		goto out;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	if (err)
+		goto out;
+
+	err = udp_listen(&al->us_relay, &laddr, relay_udp_recv, al);
+	if (err)
+		goto out;
+
+	err = udp_local_get(al->us_relay, &al->relay);
+	if (err)
+		goto out;
+
+	udp_rxbuf_presz_set(al->us_relay, 4);
+
+ out:
+	if (err)
+		mem_deref(al);
+	else
+		*alp = al;
+
+	return err;
+}
+
+
+struct perm_arg {
+	struct allocation *al;
+	int err;
+};
+
+
+static bool perm_attr_handler(const struct stun_attr *attr, void *arg)
+{
+	struct perm_arg *pa = arg;
+
+	if (attr->type != STUN_ATTR_XOR_PEER_ADDR)
+		return false;
+
+	pa->err = add_permission(pa->al, &attr->v.xor_peer_addr);
+
+	return pa->err != 0;
+}
+
+
+/* bind a channel, or refresh it. Returns 400 for a conflicting binding */
+static uint16_t bind_channel(struct allocation *al, uint16_t nr,
+			     const struct sa *peer)
+{
+	struct channel *chan, *other;
+
+	if (nr < CHAN_NUMB_MIN || nr > CHAN_NUMB_MAX)
+		return 400;
+
+	chan  = find_channel_numb(al, nr);
+	other = find_channel_peer(al, peer);
+	if (chan != other)
+		return 400;
+
+	if (!chan) {
+		chan = mem_zalloc(sizeof(*chan), chan_destructor);
+		if (!chan)
+			return 500;
+
+		chan->nr   = nr;
+		chan->peer = *peer;
+
+		hash_append(al->ht_numb, nr, &chan->he_numb, chan);
+		hash_append(al->ht_peer, sa_hash(peer, SA_ALL),
+			    &chan->he_peer, chan);
+	}
+
+	tmr_start(&chan->tmr, CHAN_LIFETIME * 1000, chan_timeout, chan);
+
+	/* a channel binding also installs a permission */
+	if (add_permission(al, peer))
+		return 500;
+
+	return 0;
+}
+
+
 static void process_msg(struct turnserver *turn, int proto, void *sock,
 			const struct sa *src, struct mbuf *mb)
 {
 	struct stun_msg *msg = NULL;
-	struct sa laddr;
+	struct allocation *al;
+	uint16_t scode = 0;
+	const char *reason = NULL;
 	int err = 0;
 
+	al = find_allocation(turn, proto, src);
+
 	if (stun_msg_decode(&msg, mb, NULL)) {
 
 		uint16_t numb, len;
 		struct channel *chan;
 
-		if (!turn->us_relay)
+		if (!al)
 			return;
 
 		++turn->n_raw;
@@ -151,14 +444,15 @@ static void process_msg(struct turnserver *turn, int proto, void *sock,
 				      mbuf_get_left(mb), len);
 		}
 
-		chan = find_channel_numb(turn, numb);
+		chan = find_channel_numb(al, numb);
 		if (!chan) {
 			DEBUG_WARNING("channel not found: numb=%u\n", numb);
 			return;
 		}
 
 		/* relay data from channel to peer */
-		(void)udp_send(turn->us_relay, &chan->peer, mb);
+		mb->end = mb->pos + min(len, mbuf_get_left(mb));
+		(void)udp_send(al->us_relay, &chan->peer, mb);
 		return;
 	}
 
@@ -168,52 +462,80 @@ static void process_msg(struct turnserver *turn, int proto, void *sock,
 		  stun_method_name(stun_msg_method(msg)));
 #endif
 
+	/* all methods except Allocate need an allocation */
+	if (!al && stun_msg_method(msg) != STUN_METHOD_ALLOCATE) {
+		scode  = 437;
+		reason = "Allocation Mismatch";
+		goto out;
+	}
+
 	switch (stun_msg_method(msg)) {
 
-	case STUN_METHOD_ALLOCATE:
-		/* Max 1 allocation for now */
+	case STUN_METHOD_ALLOCATE: {
+		uint32_t lifetime = lifetime_get(msg);
+
 		++turn->n_allocate;
 
-		if (turn->us_relay) {
-			err = EALREADY;
+		if (al) {
+			scode  = 437;
+			reason = "Allocation Mismatch";
 			goto out;
 		}
 
-		turn->cli = *src;
-
-		err = sa_set_str(&laddr, "127.0.0.1", 0);
+		err = allocation_create(&al, turn, proto, sock, src);
 		if (err)
 			goto out;
 
-		err = udp_listen(&turn->us_relay, &laddr,
-				 relay_udp_recv, turn);
-		if (err)
-			goto out;
-
-		err = udp_local_get(turn->us_relay, &turn->relay);
-		if (err)
-			goto out;
+		turn->relay = al->relay;
 
-		udp_rxbuf_presz_set(turn->us_relay, 4);
+		tmr_start(&al->tmr, lifetime * 1000, alloc_timeout, al);
 
 		err = stun_reply(proto, sock, src, 0,
 				 msg, NULL, 0, false,
-				 2,
+				 3,
 				 STUN_ATTR_XOR_MAPPED_ADDR, src,
-				 STUN_ATTR_XOR_RELAY_ADDR, &turn->relay);
+				 STUN_ATTR_XOR_RELAY_ADDR, &al->relay,
+				 STUN_ATTR_LIFETIME, &lifetime);
+	}
+		break;
+
+	case STUN_METHOD_REFRESH: {
+		uint32_t lifetime = lifetime_get(msg);
+
+		++turn->n_refresh;
+
+		err = stun_reply(proto, sock, src, 0,
+				 msg, NULL, 0, false,
+				 1,
+				 STUN_ATTR_LIFETIME, &lifetime);
+
+		if (lifetime)
+			tmr_start(&al->tmr, lifetime * 1000,
+				  alloc_timeout, al);
+		else
+			mem_deref(al);
+	}
 		break;
 
 	case STUN_METHOD_CREATEPERM: {
-		struct stun_attr *peer;
+		struct perm_arg pa;
 
 		++turn->n_createperm;
 
-		peer = stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR);
-		TEST_ASSERT(peer != NULL);
+		if (!stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR)) {
+			scode  = 400;
+			reason = "Bad Request";
+			goto out;
+		}
+
+		pa.al  = al;
+		pa.err = 0;
 
-		add_permission(turn, &peer->v.xor_peer_addr);
+		(void)stun_msg_attr_apply(msg, perm_attr_handler, &pa);
+		err = pa.err;
+		if (err)
+			goto out;
 
-		/* todo: install permissions and check them */
 		err = stun_reply(proto, sock, src, 0,
 				 msg, NULL, 0, false,
 				 0);
@@ -225,19 +547,21 @@ static void process_msg(struct turnserver *turn, int proto, void *sock,
 
 		++turn->n_chanbind;
 
-		TEST_ASSERT(turn->us_relay != NULL);
-
 		chnr = stun_msg_attr(msg, STUN_ATTR_CHANNEL_NUMBER);
 		peer = stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR);
 		if (!chnr || !peer) {
 			DEBUG_WARNING("CHANBIND: missing chnr/peer attrib\n");
+			scode  = 400;
+			reason = "Bad Request";
 			goto out;
 		}
 
-		TEST_ASSERT(turn->chanc < ARRAY_SIZE(turn->chanv));
-		turn->chanv[turn->chanc].nr   = chnr->v.channel_number;
-		turn->chanv[turn->chanc].peer = peer->v.xor_peer_addr;
-		++turn->chanc;
+		scode = bind_channel(al, chnr->v.channel_number,
+				     &peer->v.xor_peer_addr);
+		if (scode) {
+			reason = scode == 400 ? "Bad Request" : "Server Error";
+			goto out;
+		}
 
 		err = stun_reply(proto, sock, src, 0,
 				 msg, NULL, 0, false,
@@ -250,8 +574,6 @@ static void process_msg(struct turnserver *turn, int proto, void *sock,
 
 		++turn->n_send;
 
-		TEST_ASSERT(turn->us_relay != NULL);
-
 		peer = stun_msg_attr(msg, STUN_ATTR_XOR_PEER_ADDR);
 		data = stun_msg_attr(msg, STUN_ATTR_DATA);
 
@@ -261,13 +583,13 @@ static void process_msg(struct turnserver *turn, int proto, void *sock,
 		}
 
 		/* check for valid Permission */
-		if (!find_permission(turn, &peer->v.xor_peer_addr)) {
+		if (!find_permission(al, &peer->v.xor_peer_addr)) {
 			DEBUG_NOTICE("no permission to peer %j\n",
 				     &peer->v.xor_peer_addr);
 			goto out;
 		}
 
-		err = udp_send(turn->us_relay, &peer->v.xor_peer_addr,
+		err = udp_send(al->us_relay, &peer->v.xor_peer_addr,
 			       &data->v.data);
 	}
 		break;
@@ -279,13 +601,15 @@ static void process_msg(struct turnserver *turn, int proto, void *sock,
 		break;
 	}
 
-	if (err)
-		goto out;
-
  out:
-	if (err && stun_msg_class(msg) == STUN_CLASS_REQUEST) {
+	if (err && !scode) {
+		scode  = 500;
+		reason = "Server Error";
+	}
+
+	if (scode && stun_msg_class(msg) == STUN_CLASS_REQUEST) {
 		(void)stun_ereply(proto, sock, src, 0, msg,
-				  500, "Server Error",
+				  scode, reason,
 				  NULL, 0, false, 0);
 	}
 
@@ -304,14 +628,14 @@ static void srv_udp_recv(const struct sa *src, struct mbuf *mb, void *arg)
 
 static void tcp_estab_handler(void *arg)
 {
-	struct turnserver *turn = arg;
-	(void)turn;
+	struct tcpconn *conn = arg;
+	(void)conn;
 }
 
 
 static void tcp_recv_handler(struct mbuf *mb, void *arg)
 {
-	struct turnserver *conn = arg;
+	struct tcpconn *conn = arg;
 	int err = 0;
 
 	if (conn->mb) {
@@ -370,7 +694,7 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 
 		conn->mb->end = pos + len;
 
-		process_msg(conn, IPPROTO_TCP, conn->tc, &conn->paddr,
+		process_msg(conn->turn, IPPROTO_TCP, conn->tc, &conn->paddr,
 			    conn->mb);
 
 		/* 4 byte alignment */
@@ -393,30 +717,50 @@ static void tcp_recv_handler(struct mbuf *mb, void *arg)
 }
 
 
+static void tcpconn_destructor(void *arg)
+{
+	struct tcpconn *conn = arg;
+
+	/* the allocation is deleted with the connection */
+	mem_deref(find_allocation(conn->turn, IPPROTO_TCP, &conn->paddr));
+
+	list_unlink(&conn->le);
+	mem_deref(conn->tc);
+	mem_deref(conn->mb);
+}
+
+
 static void tcp_close_handler(int err, void *arg)
 {
-	struct turnserver *turn = arg;
+	struct tcpconn *conn = arg;
 	(void)err;
 
-	turn->tc = mem_deref(turn->tc);
+	mem_deref(conn);
 }
 
 
 static void tcp_conn_handler(const struct sa *peer, void *arg)
 {
 	struct turnserver *turn = arg;
-	int err = 0;
+	struct tcpconn *conn;
+	int err;
 
-	if (turn->tc) {
+	conn = mem_zalloc(sizeof(*conn), tcpconn_destructor);
+	if (!conn) {
 		tcp_reject(turn->ts);
+		return;
 	}
-	else {
-		err = tcp_accept(&turn->tc, turn->ts, tcp_estab_handler,
-				 tcp_recv_handler, tcp_close_handler, turn);
-		if (err)
-			tcp_reject(turn->ts);
 
-		turn->paddr = *peer;
+	conn->turn  = turn;
+	conn->paddr = *peer;
+
+	list_append(&turn->tcl, &conn->le, conn);
+
+	err = tcp_accept(&conn->tc, turn->ts, tcp_estab_handler,
+			 tcp_recv_handler, tcp_close_handler, conn);
+	if (err) {
+		tcp_reject(turn->ts);
+		mem_deref(conn);
 	}
 }
 
@@ -425,11 +769,11 @@ static void destructor(void *arg)
 {
 	struct turnserver *turn = arg;
 
+	list_flush(&turn->tcl);
+	hash_flush(turn->ht_alloc);
+	mem_deref(turn->ht_alloc);
 	mem_deref(turn->us);
-	mem_deref(turn->us_relay);
-	mem_deref(turn->tc);
 	mem_deref(turn->ts);
-	mem_deref(turn->mb);
 }
 
 
@@ -446,6 +790,10 @@ int turnserver_alloc(struct turnserver **turnp)
 	if (!turn)
 		return ENOMEM;
 
+	err = hash_alloc(&turn->ht_alloc, ALLOC_HASH_SIZE);
+	if (err)
+		goto out;
+
 	err = sa_set_str(&laddr, "127.0.0.1", 0);
 	if (err)
 		goto out;
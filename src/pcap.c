@@ -0,0 +1,1310 @@
+/**
+ * @file pcap.c  Replay of captured traffic
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "pcap"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * Reads classic pcap and pcapng files, and keeps the UDP payloads over
+ * IPv4 and IPv6. The link layer can be Ethernet (with VLAN tags), raw
+ * IP, BSD loopback or Linux cooked capture. Each payload is classified
+ * by its first byte as in RFC 7983, text is taken as SIP.
+ *
+ * The payloads are then replayed either straight into the decoders, as
+ * fast as possible, or over loopback sockets with the original timing,
+ * scaled by a factor. Both modes record the decode latency per protocol.
+ */
+
+
+enum {
+	PCAP_MAGIC       = 0xa1b2c3d4,
+	PCAP_MAGIC_NSEC  = 0xa1b23c4d,
+	PCAPNG_SHB       = 0x0a0d0d0a,
+	PCAPNG_IDB       = 1,
+	PCAPNG_SPB       = 3,
+	PCAPNG_EPB       = 6,
+	PCAPNG_BOM       = 0x1a2b3c4d,
+	PCAPNG_IF_MAX    = 16,
+	PCAPNG_TSRESOL   = 9,
+
+	DLT_NULL         = 0,
+	DLT_EN10MB       = 1,
+	DLT_RAW          = 101,
+	DLT_LINUX_SLL    = 113,
+	DLT_IPV4         = 228,
+	DLT_IPV6         = 229,
+	DLT_LINUX_SLL2   = 276,
+
+	ETHERTYPE_IPV4   = 0x0800,
+	ETHERTYPE_IPV6   = 0x86dd,
+	ETHERTYPE_VLAN   = 0x8100,
+	ETHERTYPE_QINQ   = 0x88a8,
+
+	DRAIN_MS         = 1000,
+};
+
+
+struct pcap_if {
+	uint16_t linktype;
+	uint64_t tsdiv;            /* timestamp units per second */
+};
+
+struct replay {
+	struct pcap *pcap;
+	struct udp_sock *us_tx;
+	struct udp_sock *us_rx;
+	struct sa rx;
+	struct tmr tmr;
+	struct le *next;
+	struct hist *lag;          /* send time vs. schedule [ns] */
+	uint64_t start;            /* [ns] */
+	uint64_t ts0;              /* [ns] */
+	double scale;
+	uint64_t n_sent;
+	int err;
+};
+
+
+static const char *proto_names[PCAP_PROTO_COUNT] = {
+	"stun", "dtls", "rtp", "rtcp", "sip", "other"
+};
+
+
+static uint16_t rd16(const uint8_t *p, bool be)
+{
+	return be ? (uint16_t)(p[0] << 8 | p[1])
+		: (uint16_t)(p[1] << 8 | p[0]);
+}
+
+
+static uint32_t rd32(const uint8_t *p, bool be)
+{
+	return be ? (uint32_t)rd16(p, true) << 16 | rd16(p + 2, true)
+		: (uint32_t)rd16(p + 2, false) << 16 | rd16(p, false);
+}
+
+
+/* RFC 7983, with RTP/RTCP split as in RFC 5761 */
+enum pcap_proto pcap_classify(const uint8_t *p, size_t len)
+{
+	if (len < 1)
+		return PCAP_OTHER;
+
+	if (p[0] <= 3)
+		return len >= 20 ? PCAP_STUN : PCAP_OTHER;
+
+	if (p[0] >= 20 && p[0] <= 63)
+		return PCAP_DTLS;
+
+	if (p[0] >= 128 && p[0] <= 191) {
+
+		if (len < 2)
+			return PCAP_OTHER;
+
+		return (p[1] >= 192 && p[1] <= 223) ? PCAP_RTCP : PCAP_RTP;
+	}
+
+	if ((p[0] >= 'A' && p[0] <= 'Z') || (p[0] >= 'a' && p[0] <= 'z'))
+		return PCAP_SIP;
+
+	return PCAP_OTHER;
+}
+
+
+const char *pcap_proto_name(enum pcap_proto proto)
+{
+	return proto < PCAP_PROTO_COUNT ? proto_names[proto] : "?";
+}
+
+
+static void pkt_destructor(void *arg)
+{
+	struct pcap_pkt *pkt = arg;
+
+	list_unlink(&pkt->le);
+	mem_deref(pkt->mb);
+}
+
+
+static void pcap_destructor(void *arg)
+{
+	struct pcap *pcap = arg;
+	int i;
+
+	list_flush(&pcap->pktl);
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++)
+		mem_deref(pcap->histv[i]);
+}
+
+
+static int pkt_add(struct pcap *pcap, uint64_t ts,
+		   const uint8_t *p, size_t len)
+{
+	struct pcap_pkt *pkt;
+
+	pkt = mem_zalloc(sizeof(*pkt), pkt_destructor);
+	if (!pkt)
+		return ENOMEM;
+
+	pkt->ts    = ts;
+	pkt->proto = pcap_classify(p, len);
+
+	pkt->mb = mbuf_alloc(len ? len : 1);
+	if (!pkt->mb) {
+		mem_deref(pkt);
+		return ENOMEM;
+	}
+
+	(void)mbuf_write_mem(pkt->mb, p, len);
+	pkt->mb->pos = 0;
+
+	list_append(&pcap->pktl, &pkt->le, pkt);
+
+	++pcap->pktc;
+	++pcap->countv[pkt->proto];
+	pcap->bytes += len;
+
+	return 0;
+}
+
+
+/* UDP in IPv4 or IPv6, fragments and extension headers are skipped */
+static int ip_decode(struct pcap *pcap, uint64_t ts,
+		     const uint8_t *p, size_t len)
+{
+	size_t hlen;
+	uint16_t ulen;
+
+	if (len < 1)
+		goto skip;
+
+	switch (p[0] >> 4) {
+
+	case 4:
+		if (len < 20)
+			goto skip;
+
+		hlen = (p[0] & 0x0f) * 4;
+		if (hlen < 20 || len < hlen)
+			goto skip;
+
+		/* MF flag or a fragment offset */
+		if (p[9] != IPPROTO_UDP || (rd16(p + 6, true) & 0x3fff))
+			goto skip;
+
+		len = min(len, (size_t)rd16(p + 2, true));
+		break;
+
+	case 6:
+		hlen = 40;
+		if (len < hlen || p[6] != IPPROTO_UDP)
+			goto skip;
+
+		len = min(len, hlen + rd16(p + 4, true));
+		break;
+
+	default:
+		goto skip;
+	}
+
+	if (len < hlen + 8)
+		goto skip;
+
+	p   += hlen;
+	len -= hlen;
+
+	ulen = rd16(p + 4, true);
+	if (ulen < 8 || ulen > len)
+		goto skip;
+
+	return pkt_add(pcap, ts, p + 8, ulen - 8);
+
+ skip:
+	++pcap->n_skipped;
+	return 0;
+}
+
+
+static int frame_decode(struct pcap *pcap, uint16_t linktype, uint64_t ts,
+			const uint8_t *p, size_t len)
+{
+	uint16_t type;
+	size_t off;
+
+	switch (linktype) {
+
+	case DLT_EN10MB:
+		off = 12;
+		for (;;) {
+			if (len < off + 2)
+				goto skip;
+
+			type = rd16(p + off, true);
+			if (type != ETHERTYPE_VLAN && type != ETHERTYPE_QINQ)
+				break;
+
+			off += 4;
+		}
+		off += 2;
+		break;
+
+	case DLT_LINUX_SLL:
+		if (len < 16)
+			goto skip;
+
+		type = rd16(p + 14, true);
+		off  = 16;
+		break;
+
+	case DLT_LINUX_SLL2:
+		if (len < 20)
+			goto skip;
+
+		type = rd16(p, true);
+		off  = 20;
+		break;
+
+	case DLT_NULL:
+	case DLT_RAW:
+	case DLT_IPV4:
+	case DLT_IPV6:
+		/* the IP version tells the rest */
+		off  = linktype == DLT_NULL ? 4 : 0;
+		type = 0;
+		break;
+
+	default:
+		goto skip;
+	}
+
+	if (len < off)
+		goto skip;
+
+	if (type && type != ETHERTYPE_IPV4 && type != ETHERTYPE_IPV6)
+		goto skip;
+
+	return ip_decode(pcap, ts, p + off, len - off);
+
+ skip:
+	++pcap->n_skipped;
+	return 0;
+}
+
+
+static int pcap_classic(struct pcap *pcap, const uint8_t *p, size_t len)
+{
+	bool be, nsec;
+	uint16_t linktype;
+	uint32_t magic;
+	size_t off;
+	int err = 0;
+
+	if (len < 24)
+		return EBADMSG;
+
+	magic = rd32(p, true);
+	be    = magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC;
+	magic = rd32(p, be);
+	nsec  = magic == PCAP_MAGIC_NSEC;
+
+	if (magic != PCAP_MAGIC && !nsec)
+		return EBADMSG;
+
+	linktype = (uint16_t)rd32(p + 20, be);
+
+	for (off = 24; off + 16 <= len && !err; ) {
+
+		const uint64_t sec  = rd32(p + off, be);
+		const uint64_t frac = rd32(p + off + 4, be);
+		const size_t caplen = rd32(p + off + 8, be);
+
+		off += 16;
+		if (caplen > len - off) {
+			pcap->truncated = true;
+			break;
+		}
+
+		err = frame_decode(pcap, linktype,
+				   sec * 1000000000ULL +
+				   (nsec ? frac : frac * 1000),
+				   p + off, caplen);
+
+		off += caplen;
+	}
+
+	return err;
+}
+
+
+/* if_tsresol, microseconds by default */
+static uint64_t idb_tsdiv(const uint8_t *opt, size_t len, bool be)
+{
+	uint64_t div = 1000000;
+
+	while (len >= 4) {
+
+		const uint16_t code = rd16(opt, be);
+		const uint16_t olen = rd16(opt + 2, be);
+		const size_t plen = 4 + ((olen + 3) & ~3u);
+
+		if (code == 0 || plen > len)
+			break;
+
+		if (code == PCAPNG_TSRESOL && olen >= 1) {
+
+			const uint8_t v = opt[4] & 0x7f;
+			unsigned i;
+
+			div = 1;
+			for (i=0; i<v && div < 1000000000000ULL; i++)
+				div *= (opt[4] & 0x80) ? 2 : 10;
+		}
+
+		opt += plen;
+		len -= plen;
+	}
+
+	return div;
+}
+
+
+static uint64_t ts_nsec(uint64_t ts, uint64_t div)
+{
+	return ts / div * 1000000000ULL +
+		ts % div * 1000000000ULL / div;
+}
+
+
+static int pcap_ng(struct pcap *pcap, const uint8_t *p, size_t len)
+{
+	struct pcap_if ifv[PCAPNG_IF_MAX];
+	unsigned ifc = 0;
+	bool be = false;
+	size_t off;
+	int err = 0;
+
+	for (off = 0; off + 12 <= len && !err; ) {
+
+		const uint8_t *b = p + off;
+		uint32_t type, blen;
+
+		if (rd32(b, true) == PCAPNG_SHB) {
+
+			be  = rd32(b + 8, true) == PCAPNG_BOM;
+			ifc = 0;
+
+			if (rd32(b + 8, be) != PCAPNG_BOM)
+				return EBADMSG;
+		}
+		else if (off == 0) {
+			return EBADMSG;
+		}
+
+		type = rd32(b, be);
+		blen = rd32(b + 4, be);
+
+		if (blen < 12 || blen > len - off) {
+			pcap->truncated = true;
+			break;
+		}
+
+		switch (type) {
+
+		case PCAPNG_IDB:
+			if (blen < 20 || ifc >= PCAPNG_IF_MAX)
+				break;
+
+			ifv[ifc].linktype = rd16(b + 8, be);
+			ifv[ifc].tsdiv    = idb_tsdiv(b + 16, blen - 20, be);
+			++ifc;
+			break;
+
+		case PCAPNG_EPB: {
+			uint32_t ifx, caplen;
+			uint64_t ts;
+
+			if (blen < 32)
+				break;
+
+			ifx    = rd32(b + 8, be);
+			ts     = (uint64_t)rd32(b + 12, be) << 32 |
+				rd32(b + 16, be);
+			caplen = rd32(b + 20, be);
+
+			if (ifx >= ifc || caplen > blen - 32) {
+				++pcap->n_skipped;
+				break;
+			}
+
+			err = frame_decode(pcap, ifv[ifx].linktype,
+					   ts_nsec(ts, ifv[ifx].tsdiv),
+					   b + 28, caplen);
+		}
+			break;
+
+		case PCAPNG_SPB:
+			if (blen < 16 || ifc < 1) {
+				++pcap->n_skipped;
+				break;
+			}
+
+			/* no timestamp, and the snap length of interface 0 */
+			err = frame_decode(pcap, ifv[0].linktype, 0, b + 12,
+					   min(rd32(b + 8, be), blen - 16));
+			break;
+
+		default:
+			break;
+		}
+
+		off += blen;
+	}
+
+	return err;
+}
+
+
+/**
+ * Parse a pcap or pcapng capture
+ *
+ * @param pcapp Pointer to allocated capture
+ * @param buf   Capture file contents
+ * @param len   Length of the capture file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pcap_alloc(struct pcap **pcapp, const uint8_t *buf, size_t len)
+{
+	struct pcap *pcap;
+	int i, err;
+
+	if (!pcapp || !buf)
+		return EINVAL;
+
+	pcap = mem_zalloc(sizeof(*pcap), pcap_destructor);
+	if (!pcap)
+		return ENOMEM;
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++) {
+		err = hist_alloc(&pcap->histv[i]);
+		if (err)
+			goto out;
+	}
+
+	if (len >= 4 && rd32(buf, true) == PCAPNG_SHB)
+		err = pcap_ng(pcap, buf, len);
+	else
+		err = pcap_classic(pcap, buf, len);
+
+ out:
+	if (err)
+		mem_deref(pcap);
+	else
+		*pcapp = pcap;
+
+	return err;
+}
+
+
+int pcap_load(struct pcap **pcapp, const char *filename)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(65536);
+	if (!mb)
+		return ENOMEM;
+
+	err = test_load_file(mb, filename);
+	if (err)
+		goto out;
+
+	err = pcap_alloc(pcapp, mb->buf, mb->end);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static void pcap_reset(struct pcap *pcap)
+{
+	int i;
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++) {
+		hist_reset(pcap->histv[i]);
+		pcap->errv[i] = 0;
+	}
+
+	pcap->n_recv = 0;
+}
+
+
+/* walk the record headers of a DTLS datagram */
+static int dtls_decode(struct mbuf *mb)
+{
+	while (mbuf_get_left(mb)) {
+
+		uint16_t len;
+
+		if (mbuf_get_left(mb) < 13)
+			return EBADMSG;
+
+		if (mbuf_read_u8(mb) < 20 || mbuf_read_u8(mb) != 0xfe)
+			return EBADMSG;
+
+		mbuf_advance(mb, 9);
+		len = ntohs(mbuf_read_u16(mb));
+
+		if (mbuf_get_left(mb) < len)
+			return EBADMSG;
+
+		mbuf_advance(mb, len);
+	}
+
+	return 0;
+}
+
+
+static int decode(enum pcap_proto proto, struct mbuf *mb)
+{
+	struct rtp_header hdr;
+	struct stun_msg *stun;
+	struct rtcp_msg *rtcp;
+	struct sip_msg *sip;
+	int err = 0;
+
+	switch (proto) {
+
+	case PCAP_STUN:
+		err = stun_msg_decode(&stun, mb, NULL);
+		if (!err)
+			mem_deref(stun);
+		break;
+
+	case PCAP_DTLS:
+		err = dtls_decode(mb);
+		break;
+
+	case PCAP_RTP:
+		err = rtp_hdr_decode(&hdr, mb);
+		break;
+
+	case PCAP_RTCP:
+		/* compound packet */
+		while (!err && mbuf_get_left(mb) >= 4) {
+
+			err = rtcp_decode(&rtcp, mb);
+			if (!err)
+				mem_deref(rtcp);
+		}
+		break;
+
+	case PCAP_SIP:
+		err = sip_msg_decode(&sip, mb);
+		if (!err)
+			mem_deref(sip);
+		break;
+
+	default:
+		break;
+	}
+
+	return err;
+}
+
+
+static void decode_timed(struct pcap *pcap, enum pcap_proto proto,
+			 struct mbuf *mb)
+{
+	uint64_t t0;
+	int err;
+
+	if (proto == PCAP_OTHER)
+		return;
+
+	t0  = test_nanoseconds();
+	err = decode(proto, mb);
+	hist_record(pcap->histv[proto], test_nanoseconds() - t0);
+
+	if (err)
+		++pcap->errv[proto];
+}
+
+
+/**
+ * Run all packets through the decoders, as fast as possible
+ *
+ * @param pcap Capture
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pcap_replay_decode(struct pcap *pcap)
+{
+	struct le *le;
+
+	if (!pcap)
+		return EINVAL;
+
+	pcap_reset(pcap);
+
+	for (le = pcap->pktl.head; le; le = le->next) {
+
+		struct pcap_pkt *pkt = le->data;
+
+		pkt->mb->pos = 0;
+		decode_timed(pcap, pkt->proto, pkt->mb);
+	}
+
+	return 0;
+}
+
+
+/* as fast as possible, without timing, for the benchmark */
+static unsigned decode_all(const struct pcap *pcap)
+{
+	struct le *le;
+	unsigned n = 0;
+
+	for (le = pcap->pktl.head; le; le = le->next) {
+
+		struct pcap_pkt *pkt = le->data;
+
+		pkt->mb->pos = 0;
+		if (0 == decode(pkt->proto, pkt->mb))
+			++n;
+	}
+
+	return n;
+}
+
+
+static void replay_destructor(void *arg)
+{
+	struct replay *rp = arg;
+
+	tmr_cancel(&rp->tmr);
+	mem_deref(rp->us_tx);
+	mem_deref(rp->us_rx);
+	mem_deref(rp->lag);
+}
+
+
+static uint64_t replay_due(const struct replay *rp,
+			   const struct pcap_pkt *pkt)
+{
+	const uint64_t ts = pkt->ts > rp->ts0 ? pkt->ts - rp->ts0 : 0;
+
+	return (uint64_t)((double)ts / rp->scale);
+}
+
+
+static bool replay_done(const struct replay *rp)
+{
+	return !rp->next && rp->pcap->n_recv >= rp->n_sent;
+}
+
+
+static void drain_timeout(void *arg)
+{
+	(void)arg;
+
+	re_cancel();
+}
+
+
+static void replay_timeout(void *arg)
+{
+	struct replay *rp = arg;
+	const uint64_t now = test_nanoseconds() - rp->start;
+	uint64_t due;
+
+	while (rp->next) {
+
+		struct pcap_pkt *pkt = rp->next->data;
+		int err;
+
+		due = replay_due(rp, pkt);
+		if (due > now)
+			break;
+
+		pkt->mb->pos = 0;
+
+		err = udp_send(rp->us_tx, &rp->rx, pkt->mb);
+		if (err) {
+			rp->err = err;
+			re_cancel();
+			return;
+		}
+
+		hist_record(rp->lag, now - due);
+		++rp->n_sent;
+
+		rp->next = rp->next->next;
+	}
+
+	if (rp->next) {
+		due = replay_due(rp, rp->next->data);
+		tmr_start(&rp->tmr, (due - now + 999999) / 1000000,
+			  replay_timeout, rp);
+	}
+	else if (replay_done(rp)) {
+		re_cancel();
+	}
+	else {
+		tmr_start(&rp->tmr, DRAIN_MS, drain_timeout, rp);
+	}
+}
+
+
+static void replay_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct replay *rp = arg;
+	struct pcap *pcap = rp->pcap;
+	(void)src;
+
+	decode_timed(pcap, pcap_classify(mbuf_buf(mb), mbuf_get_left(mb)),
+		     mb);
+
+	++pcap->n_recv;
+
+	if (replay_done(rp))
+		re_cancel();
+}
+
+
+/**
+ * Send all packets over loopback with the original timing, and decode
+ * them on reception
+ *
+ * @param pcap    Capture
+ * @param scale   Speed-up of the original timing, e.g. 2 for half the time
+ * @param lagp    Optional histogram of the send time lag [ns]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int pcap_replay_socket(struct pcap *pcap, double scale, struct hist *lagp)
+{
+	struct replay *rp;
+	struct pcap_pkt *last;
+	struct sa laddr;
+	uint64_t duration;
+	int err;
+
+	if (!pcap || scale <= 0)
+		return EINVAL;
+
+	pcap_reset(pcap);
+
+	if (!pcap->pktc)
+		return 0;
+
+	rp = mem_zalloc(sizeof(*rp), replay_destructor);
+	if (!rp)
+		return ENOMEM;
+
+	rp->pcap  = pcap;
+	rp->scale = scale;
+	rp->next  = pcap->pktl.head;
+	rp->ts0   = ((struct pcap_pkt *)rp->next->data)->ts;
+
+	err = hist_alloc(&rp->lag);
+	if (err)
+		goto out;
+
+	(void)sa_set_str(&laddr, "127.0.0.1", 0);
+
+	err  = udp_listen(&rp->us_rx, &laddr, replay_recv, rp);
+	err |= udp_listen(&rp->us_tx, &laddr, NULL, NULL);
+	if (err)
+		goto out;
+
+	err = udp_local_get(rp->us_rx, &rp->rx);
+	if (err)
+		goto out;
+
+	(void)udp_sockbuf_set(rp->us_rx, 4 * 1024 * 1024);
+
+	last = pcap->pktl.tail->data;
+	duration = replay_due(rp, last) / 1000000;
+
+	rp->start = test_nanoseconds();
+	tmr_start(&rp->tmr, 0, replay_timeout, rp);
+
+	err = re_main_timeout((uint32_t)min(duration + 2 * DRAIN_MS,
+					    (uint64_t)UINT32_MAX));
+	if (err)
+		goto out;
+
+	err = rp->err;
+	if (err)
+		goto out;
+
+	if (lagp)
+		hist_merge(lagp, rp->lag);
+
+ out:
+	mem_deref(rp);
+
+	return err;
+}
+
+
+int pcap_report(struct re_printf *pf, const struct pcap *pcap)
+{
+	int i, err = 0;
+
+	if (!pcap)
+		return 0;
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++) {
+
+		const struct hist *h = pcap->histv[i];
+		const double mean = hist_mean(h);
+
+		if (!pcap->countv[i])
+			continue;
+
+		err |= re_hprintf(pf, "%-6s %8u packets", proto_names[i],
+				  pcap->countv[i]);
+
+		if (hist_count(h)) {
+			err |= re_hprintf(pf, "  %10.0f packets/s  %u errors"
+					  "\n       decode usec: %H",
+					  mean > 0 ? 1e9 / mean : 0.0,
+					  pcap->errv[i], hist_print, h);
+		}
+
+		err |= re_hprintf(pf, "\n");
+	}
+
+	return err;
+}
+
+
+/**
+ * Replay a capture file, into the decoders or, with a timing scale, over
+ * loopback sockets
+ *
+ * @param filename Capture file
+ * @param scale    Speed-up of the original timing, 0 for no sockets
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_pcap_replay(const char *filename, double scale)
+{
+	struct pcap *pcap = NULL;
+	struct hist *lag = NULL;
+	uint64_t start, nsec;
+	int err;
+
+	err = pcap_load(&pcap, filename);
+	if (err) {
+		DEBUG_WARNING("%s: could not load capture (%m)\n",
+			      filename, err);
+		return err;
+	}
+
+	(void)re_printf("%s: %u UDP packets, %llu bytes, %u skipped%s\n",
+			filename, pcap->pktc, (unsigned long long)pcap->bytes,
+			pcap->n_skipped, pcap->truncated ? ", truncated" : "");
+
+	start = test_nanoseconds();
+
+	if (scale > 0) {
+		err = hist_alloc(&lag);
+		if (err)
+			goto out;
+
+		err = pcap_replay_socket(pcap, scale, lag);
+	}
+	else {
+		err = pcap_replay_decode(pcap);
+	}
+	if (err)
+		goto out;
+
+	nsec = test_nanoseconds() - start;
+
+	if (scale > 0) {
+		(void)re_printf("loopback x%.2f: %u of %u received,"
+				" %.0f packets/s\n"
+				"send lag usec: %H\n",
+				scale, pcap->n_recv, pcap->pktc,
+				pcap->n_recv * 1e9 / nsec, hist_print, lag);
+	}
+	else {
+		(void)re_printf("decode: %.0f packets/s\n",
+				pcap->pktc * 1e9 / nsec);
+	}
+
+	(void)re_printf("%H", pcap_report, pcap);
+
+ out:
+	mem_deref(lag);
+	mem_deref(pcap);
+
+	return err;
+}
+
+
+static const char *pcap_file;
+
+
+void test_pcap_set_file(const char *filename)
+{
+	pcap_file = filename;
+}
+
+
+/* decode the capture given with --pcap, all packets per iteration */
+int bench_pcap_decode(struct bench_state *st)
+{
+	const struct pcap *pcap = st->arg;
+
+	BENCH_LOOP(st) {
+		BENCH_SINK(decode_all(pcap));
+	}
+
+	return 0;
+}
+
+
+int bench_pcap_setup(struct bench_state *st)
+{
+	struct pcap *pcap;
+	int err;
+
+	if (!pcap_file)
+		return ESKIPPED;
+
+	err = pcap_load(&pcap, pcap_file);
+	if (err)
+		return err;
+
+	if (!pcap->pktc) {
+		mem_deref(pcap);
+		return ESKIPPED;
+	}
+
+	st->items = pcap->pktc;
+	st->bytes = pcap->bytes;
+	st->arg   = pcap;
+
+	return 0;
+}
+
+
+/*
+ * Testcode
+ */
+
+
+enum {
+	TEST_PORT_A = 5060,
+	TEST_PORT_B = 5062,
+	TEST_INTERVAL = 1000000,   /* [ns] */
+};
+
+
+static const char test_sip[] =
+	"OPTIONS sip:bob@10.0.0.2 SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK74bf9\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: <sip:alice@10.0.0.1>;tag=9fxced76sl\r\n"
+	"To: <sip:bob@10.0.0.2>\r\n"
+	"Call-ID: 3848276298220188511@10.0.0.1\r\n"
+	"CSeq: 1 OPTIONS\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+
+static int build_payload(struct mbuf *mb, enum pcap_proto proto)
+{
+	int err = 0;
+
+	switch (proto) {
+
+	case PCAP_STUN:
+		err |= mbuf_write_u16(mb, htons(0x0001));
+		err |= mbuf_write_u16(mb, 0);
+		err |= mbuf_write_u32(mb, htonl(0x2112a442));  /* cookie */
+		err |= mbuf_fill(mb, 0x42, 12);
+		break;
+
+	case PCAP_DTLS:
+		/* handshake record, DTLS 1.2 */
+		err |= mbuf_write_u8(mb, 22);
+		err |= mbuf_write_u16(mb, htons(0xfefd));
+		err |= mbuf_fill(mb, 0, 8);
+		err |= mbuf_write_u16(mb, htons(4));
+		err |= mbuf_fill(mb, 0xaa, 4);
+		break;
+
+	case PCAP_RTP:
+		err |= mbuf_write_u8(mb, 0x80);
+		err |= mbuf_write_u8(mb, 0);
+		err |= mbuf_write_u16(mb, htons(1));
+		err |= mbuf_write_u32(mb, htonl(160));
+		err |= mbuf_write_u32(mb, htonl(0xdeadbeef));
+		err |= mbuf_fill(mb, 0xd5, 160);
+		break;
+
+	case PCAP_RTCP:
+		/* RR without report blocks */
+		err |= mbuf_write_u8(mb, 0x80);
+		err |= mbuf_write_u8(mb, 201);
+		err |= mbuf_write_u16(mb, htons(1));
+		err |= mbuf_write_u32(mb, htonl(0xdeadbeef));
+		break;
+
+	case PCAP_SIP:
+		err |= mbuf_write_str(mb, test_sip);
+		break;
+
+	default:
+		err |= mbuf_write_str(mb, "\r\n\r\n");
+		break;
+	}
+
+	return err;
+}
+
+
+/* Ethernet, IPv4 and UDP, or TCP that the reader must skip */
+static int build_frame(struct mbuf *mb, enum pcap_proto proto, bool tcp)
+{
+	struct mbuf *pl;
+	size_t hlen = tcp ? 20 : 8;
+	int err;
+
+	pl = mbuf_alloc(256);
+	if (!pl)
+		return ENOMEM;
+
+	err = build_payload(pl, proto);
+	if (err)
+		goto out;
+
+	err |= mbuf_fill(mb, 0x02, 12);
+	err |= mbuf_write_u16(mb, htons(ETHERTYPE_IPV4));
+
+	err |= mbuf_write_u8(mb, 0x45);
+	err |= mbuf_write_u8(mb, 0);
+	err |= mbuf_write_u16(mb, htons(20 + hlen + pl->end));
+	err |= mbuf_write_u32(mb, 0);
+	err |= mbuf_write_u8(mb, 64);
+	err |= mbuf_write_u8(mb, tcp ? IPPROTO_TCP : IPPROTO_UDP);
+	err |= mbuf_write_u16(mb, 0);
+	err |= mbuf_write_u32(mb, htonl(0x0a000001));
+	err |= mbuf_write_u32(mb, htonl(0x0a000002));
+
+	err |= mbuf_write_u16(mb, htons(TEST_PORT_A));
+	err |= mbuf_write_u16(mb, htons(TEST_PORT_B));
+	if (tcp) {
+		err |= mbuf_fill(mb, 0, 8);
+		err |= mbuf_write_u8(mb, 0x50);
+		err |= mbuf_fill(mb, 0, 7);
+	}
+	else {
+		err |= mbuf_write_u16(mb, htons(8 + pl->end));
+		err |= mbuf_write_u16(mb, 0);
+	}
+
+	err |= mbuf_write_mem(mb, pl->buf, pl->end);
+
+ out:
+	mem_deref(pl);
+
+	return err;
+}
+
+
+/* one packet of each protocol, and one TCP packet */
+static int build_capture(struct mbuf *mb, bool ng)
+{
+	struct mbuf *frame;
+	int i, err;
+
+	frame = mbuf_alloc(512);
+	if (!frame)
+		return ENOMEM;
+
+	/* native byte order, as written by libpcap */
+	if (ng) {
+		err  = mbuf_write_u32(mb, PCAPNG_SHB);
+		err |= mbuf_write_u32(mb, 28);
+		err |= mbuf_write_u32(mb, PCAPNG_BOM);
+		err |= mbuf_write_u16(mb, 1);
+		err |= mbuf_write_u16(mb, 0);
+		err |= mbuf_write_u32(mb, 0xffffffff);
+		err |= mbuf_write_u32(mb, 0xffffffff);
+		err |= mbuf_write_u32(mb, 28);
+
+		/* with nanosecond timestamps */
+		err |= mbuf_write_u32(mb, PCAPNG_IDB);
+		err |= mbuf_write_u32(mb, 32);
+		err |= mbuf_write_u16(mb, DLT_EN10MB);
+		err |= mbuf_write_u16(mb, 0);
+		err |= mbuf_write_u32(mb, 65535);
+		err |= mbuf_write_u16(mb, PCAPNG_TSRESOL);
+		err |= mbuf_write_u16(mb, 1);
+		err |= mbuf_write_u8(mb, 9);
+		err |= mbuf_fill(mb, 0, 3);
+		err |= mbuf_write_u32(mb, 0);          /* opt_endofopt */
+		err |= mbuf_write_u32(mb, 32);
+	}
+	else {
+		err  = mbuf_write_u32(mb, PCAP_MAGIC);
+		err |= mbuf_write_u16(mb, 2);
+		err |= mbuf_write_u16(mb, 4);
+		err |= mbuf_write_u32(mb, 0);
+		err |= mbuf_write_u32(mb, 0);
+		err |= mbuf_write_u32(mb, 65535);
+		err |= mbuf_write_u32(mb, DLT_EN10MB);
+	}
+	if (err)
+		goto out;
+
+	for (i=0; i<=PCAP_PROTO_COUNT; i++) {
+
+		const uint64_t ts = 1000000000ULL + i * TEST_INTERVAL;
+
+		frame->pos = 0;
+		frame->end = 0;
+
+		err = build_frame(frame, i % PCAP_PROTO_COUNT,
+				  i == PCAP_PROTO_COUNT);
+		if (err)
+			goto out;
+
+		if (ng) {
+			const size_t padded = frame->end +
+				(4 - frame->end % 4) % 4;
+
+			err |= mbuf_write_u32(mb, PCAPNG_EPB);
+			err |= mbuf_write_u32(mb, 32 + padded);
+			err |= mbuf_write_u32(mb, 0);
+			err |= mbuf_write_u32(mb, (uint32_t)(ts >> 32));
+			err |= mbuf_write_u32(mb, (uint32_t)ts);
+			err |= mbuf_write_u32(mb, frame->end);
+			err |= mbuf_write_u32(mb, frame->end);
+			err |= mbuf_write_mem(mb, frame->buf, frame->end);
+			err |= mbuf_fill(mb, 0, padded - frame->end);
+			err |= mbuf_write_u32(mb, 32 + padded);
+		}
+		else {
+			err |= mbuf_write_u32(mb, (uint32_t)(ts / 1000000000));
+			err |= mbuf_write_u32(mb, (uint32_t)(ts % 1000000000
+							     / 1000));
+			err |= mbuf_write_u32(mb, frame->end);
+			err |= mbuf_write_u32(mb, frame->end);
+			err |= mbuf_write_mem(mb, frame->buf, frame->end);
+		}
+		if (err)
+			goto out;
+	}
+
+ out:
+	mem_deref(frame);
+
+	return err;
+}
+
+
+static int test_pcap_base(bool ng)
+{
+	struct pcap *pcap = NULL;
+	struct pcap_pkt *pkt;
+	struct mbuf *mb;
+	int i, err;
+
+	mb = mbuf_alloc(2048);
+	if (!mb)
+		return ENOMEM;
+
+	err = build_capture(mb, ng);
+	if (err)
+		goto out;
+
+	err = pcap_alloc(&pcap, mb->buf, mb->end);
+	if (err)
+		goto out;
+
+	TEST_EQUALS(PCAP_PROTO_COUNT, pcap->pktc);
+	TEST_EQUALS(1, pcap->n_skipped);
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++)
+		TEST_EQUALS(1, pcap->countv[i]);
+
+	TEST_ASSERT(!pcap->truncated);
+
+	pkt = list_ledata(list_head(&pcap->pktl));
+	TEST_ASSERT(pkt->ts == 1000000000ULL);
+	pkt = list_ledata(list_tail(&pcap->pktl));
+	TEST_ASSERT(pkt->ts == 1000000000ULL +
+		    (PCAP_PROTO_COUNT - 1) * TEST_INTERVAL);
+
+	err = pcap_replay_decode(pcap);
+	TEST_ERR(err);
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++) {
+
+		TEST_EQUALS(0, pcap->errv[i]);
+
+		if (i != PCAP_OTHER)
+			TEST_ASSERT(hist_count(pcap->histv[i]) == 1);
+	}
+
+	err = pcap_replay_socket(pcap, 1.0, NULL);
+	TEST_ERR(err);
+
+	TEST_EQUALS(PCAP_PROTO_COUNT, pcap->n_recv);
+
+	for (i=0; i<PCAP_PROTO_COUNT; i++)
+		TEST_EQUALS(0, pcap->errv[i]);
+
+	/* a cut capture keeps the packets before the cut */
+	pcap = mem_deref(pcap);
+	err = pcap_alloc(&pcap, mb->buf, mb->end - 8);
+	TEST_ERR(err);
+	TEST_EQUALS(PCAP_PROTO_COUNT, pcap->pktc);
+	TEST_ASSERT(pcap->truncated);
+
+	pcap = mem_deref(pcap);
+	err = pcap_alloc(&pcap, (const uint8_t *)"junk", 4);
+	TEST_EQUALS(EBADMSG, err);
+	err = 0;
+
+ out:
+	mem_deref(pcap);
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int test_pcap(void)
+{
+	int err;
+
+	err = test_pcap_base(false);
+	TEST_ERR(err);
+
+	err = test_pcap_base(true);
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
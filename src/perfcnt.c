@@ -0,0 +1,372 @@
+/**
+ * @file perfcnt.c  Performance counters
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "perfcnt"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * The counters are opened as two groups, one with the hardware events
+ * from the PMU and one with software events from the kernel. Inside
+ * a VM the PMU is often missing, then only the software group is used.
+ * Hardware events that are not supported by the CPU are skipped.
+ */
+
+
+static const char *namev[PERFCNT_MAX] = {
+	"cycles",
+	"instructions",
+	"l1d_misses",
+	"llc_misses",
+	"branch_misses",
+	"task_clock_ns",
+	"context_switches",
+	"page_faults",
+};
+
+
+#ifdef __linux__
+
+
+enum {
+	GROUP_HW = 0,
+	GROUP_SW,
+	GROUP_MAX,
+};
+
+
+static const struct event {
+	enum perfcnt_id id;
+	unsigned group;
+	uint32_t type;
+	uint64_t config;
+} eventv[PERFCNT_MAX] = {
+	{PERFCNT_CYCLES,       GROUP_HW, PERF_TYPE_HARDWARE,
+	 PERF_COUNT_HW_CPU_CYCLES},
+	{PERFCNT_INSTRUCTIONS, GROUP_HW, PERF_TYPE_HARDWARE,
+	 PERF_COUNT_HW_INSTRUCTIONS},
+	{PERFCNT_L1D_MISSES,   GROUP_HW, PERF_TYPE_HW_CACHE,
+	 PERF_COUNT_HW_CACHE_L1D |
+	 (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+	{PERFCNT_LLC_MISSES,   GROUP_HW, PERF_TYPE_HARDWARE,
+	 PERF_COUNT_HW_CACHE_MISSES},
+	{PERFCNT_BRANCH_MISSES, GROUP_HW, PERF_TYPE_HARDWARE,
+	 PERF_COUNT_HW_BRANCH_MISSES},
+	{PERFCNT_TASK_CLOCK,   GROUP_SW, PERF_TYPE_SOFTWARE,
+	 PERF_COUNT_SW_TASK_CLOCK},
+	{PERFCNT_CTX_SWITCHES, GROUP_SW, PERF_TYPE_SOFTWARE,
+	 PERF_COUNT_SW_CONTEXT_SWITCHES},
+	{PERFCNT_PAGE_FAULTS,  GROUP_SW, PERF_TYPE_SOFTWARE,
+	 PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+
+struct perfcnt {
+	int fdv[PERFCNT_MAX];          /* -1 if not available          */
+	int leaderv[GROUP_MAX];        /* group leader fd, or -1       */
+	unsigned posv[PERFCNT_MAX];    /* position in the group read   */
+	unsigned nv[GROUP_MAX];        /* number of events per group   */
+};
+
+
+static void destructor(void *arg)
+{
+	struct perfcnt *pc = arg;
+	size_t i;
+
+	for (i=0; i<PERFCNT_MAX; i++) {
+		if (pc->fdv[i] >= 0)
+			(void)close(pc->fdv[i]);
+	}
+}
+
+
+static int event_open(const struct event *ev, int group_fd)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+
+	attr.size           = sizeof(attr);
+	attr.type           = ev->type;
+	attr.config         = ev->config;
+	attr.disabled       = group_fd < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	attr.read_format    = PERF_FORMAT_GROUP |
+		PERF_FORMAT_TOTAL_TIME_ENABLED |
+		PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	/* context switches happen in the kernel, try to include it */
+	if (ev->type == PERF_TYPE_SOFTWARE) {
+		int fd;
+
+		attr.exclude_kernel = 0;
+
+		fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1,
+				  group_fd, 0);
+		if (fd >= 0 || errno != EACCES)
+			return fd;
+
+		attr.exclude_kernel = 1;
+	}
+
+	return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+
+/**
+ * Open the performance counters for the calling thread
+ *
+ * @param pcp Pointer to allocated counters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int perfcnt_alloc(struct perfcnt **pcp)
+{
+	struct perfcnt *pc;
+	unsigned n = 0;
+	size_t i;
+	int err = 0;
+
+	if (!pcp)
+		return EINVAL;
+
+	pc = mem_zalloc(sizeof(*pc), destructor);
+	if (!pc)
+		return ENOMEM;
+
+	for (i=0; i<PERFCNT_MAX; i++)
+		pc->fdv[i] = -1;
+	for (i=0; i<GROUP_MAX; i++)
+		pc->leaderv[i] = -1;
+
+	for (i=0; i<PERFCNT_MAX; i++) {
+
+		const struct event *ev = &eventv[i];
+		int fd;
+
+		fd = event_open(ev, pc->leaderv[ev->group]);
+		if (fd < 0) {
+			err = errno;
+			continue;
+		}
+
+		if (pc->leaderv[ev->group] < 0)
+			pc->leaderv[ev->group] = fd;
+
+		pc->fdv[ev->id]  = fd;
+		pc->posv[ev->id] = pc->nv[ev->group]++;
+		++n;
+	}
+
+	if (!n) {
+		DEBUG_WARNING("no performance counters available (%m)\n",
+			      err);
+		mem_deref(pc);
+		return err ? err : ENOSYS;
+	}
+
+	if (pc->leaderv[GROUP_HW] < 0) {
+		DEBUG_NOTICE("hardware counters not available (%m),"
+			     " using software counters\n", err);
+	}
+
+	*pcp = pc;
+
+	return 0;
+}
+
+
+/* Zero all counters, does not enable them */
+void perfcnt_reset(struct perfcnt *pc)
+{
+	size_t i;
+
+	if (!pc)
+		return;
+
+	for (i=0; i<GROUP_MAX; i++) {
+		if (pc->leaderv[i] >= 0)
+			(void)ioctl(pc->leaderv[i], PERF_EVENT_IOC_RESET,
+				    PERF_IOC_FLAG_GROUP);
+	}
+}
+
+
+void perfcnt_enable(struct perfcnt *pc)
+{
+	size_t i;
+
+	if (!pc)
+		return;
+
+	for (i=0; i<GROUP_MAX; i++) {
+		if (pc->leaderv[i] >= 0)
+			(void)ioctl(pc->leaderv[i], PERF_EVENT_IOC_ENABLE,
+				    PERF_IOC_FLAG_GROUP);
+	}
+}
+
+
+void perfcnt_disable(struct perfcnt *pc)
+{
+	size_t i;
+
+	if (!pc)
+		return;
+
+	for (i=GROUP_MAX; i>0; i--) {
+		if (pc->leaderv[i-1] >= 0)
+			(void)ioctl(pc->leaderv[i-1], PERF_EVENT_IOC_DISABLE,
+				    PERF_IOC_FLAG_GROUP);
+	}
+}
+
+
+/**
+ * Read the counters accumulated since the last reset
+ *
+ * If the kernel had to multiplex the counters, the values are scaled
+ * to the time the group was enabled.
+ *
+ * @param pc  Performance counters
+ * @param val Returned counter values
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int perfcnt_read(const struct perfcnt *pc, struct perfcnt_val *val)
+{
+	size_t i, g;
+
+	if (!pc || !val)
+		return EINVAL;
+
+	memset(val, 0, sizeof(*val));
+
+	for (g=0; g<GROUP_MAX; g++) {
+
+		uint64_t buf[3 + PERFCNT_MAX];
+		double scale = 1.0;
+		ssize_t n;
+
+		if (pc->leaderv[g] < 0)
+			continue;
+
+		n = read(pc->leaderv[g], buf, sizeof(buf));
+		if (n < (ssize_t)(3 + pc->nv[g]) * (ssize_t)sizeof(uint64_t))
+			return n < 0 ? errno : EPROTO;
+
+		/* buf: nr, time_enabled, time_running, values.. */
+		if (buf[2] && buf[2] < buf[1])
+			scale = (double)buf[1] / (double)buf[2];
+
+		for (i=0; i<PERFCNT_MAX; i++) {
+
+			double v;
+
+			if (pc->fdv[i] < 0 || eventv[i].group != g)
+				continue;
+
+			v = (double)buf[3 + pc->posv[i]] * scale;
+
+			val->v[i]     = (uint64_t)v;
+			val->valid[i] = true;
+		}
+	}
+
+	return 0;
+}
+
+
+#else
+
+
+int perfcnt_alloc(struct perfcnt **pcp)
+{
+	(void)pcp;
+
+	return ENOSYS;
+}
+
+
+void perfcnt_reset(struct perfcnt *pc)
+{
+	(void)pc;
+}
+
+
+void perfcnt_enable(struct perfcnt *pc)
+{
+	(void)pc;
+}
+
+
+void perfcnt_disable(struct perfcnt *pc)
+{
+	(void)pc;
+}
+
+
+int perfcnt_read(const struct perfcnt *pc, struct perfcnt_val *val)
+{
+	(void)pc;
+	(void)val;
+
+	return ENOSYS;
+}
+
+
+#endif
+
+
+const char *perfcnt_name(enum perfcnt_id id)
+{
+	return id < PERFCNT_MAX ? namev[id] : "?";
+}
+
+
+/* Per-iteration summary, with the IPC if available */
+int perfcnt_print(struct re_printf *pf, const struct perfcnt_val *val,
+		  uint64_t n)
+{
+	const double d = n ? (double)n : 1.0;
+	int err = 0;
+	size_t i;
+
+	if (!val)
+		return 0;
+
+	if (val->valid[PERFCNT_CYCLES] && val->valid[PERFCNT_INSTRUCTIONS] &&
+	    val->v[PERFCNT_CYCLES]) {
+		err |= re_hprintf(pf, "ipc %.2f",
+				  (double)val->v[PERFCNT_INSTRUCTIONS] /
+				  (double)val->v[PERFCNT_CYCLES]);
+	}
+
+	for (i=0; i<PERFCNT_MAX; i++) {
+
+		if (!val->valid[i])
+			continue;
+
+		err |= re_hprintf(pf, "  %s %.1f", namev[i],
+				  (double)val->v[i] / d);
+	}
+
+	return err;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file prng.c  Seeded pseudo-random numbers
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <re.h>
+#include "test.h"
+
+
+/*
+ * xoshiro256** with one state per thread, so there is no shared state
+ * between test threads. The harness starts a new stream before each
+ * testcase, derived from the run seed and the testcase name, so that a
+ * testcase sees the same numbers in the serial, threaded and forked
+ * runners. Threads that never start a stream get one from a counter.
+ *
+ * A new seed starts a new epoch, which invalidates the streams of all
+ * threads, not only the one that sets the seed.
+ */
+
+
+static uint64_t seed;
+static uint32_t epoch = 1;
+static uint32_t thread_count;
+static __thread uint64_t state[4];
+static __thread uint32_t state_epoch;  /* 0 if no stream */
+
+
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+static void stream_init(uint64_t id)
+{
+	uint64_t x = seed ^ id;
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(state); i++)
+		state[i] = splitmix64(&x);
+
+	state_epoch = epoch;
+}
+
+
+/**
+ * Set the seed of the run, before any thread is started
+ *
+ * @param s Seed
+ */
+void test_rand_set_seed(uint64_t s)
+{
+	seed = s;
+	thread_count = 0;
+	__sync_add_and_fetch(&epoch, 1);
+}
+
+
+uint64_t test_rand_seed(void)
+{
+	return seed;
+}
+
+
+/**
+ * Start the random stream of a testcase in the calling thread
+ *
+ * @param name Testcase name
+ * @param ix   Index of the stream within the testcase, e.g. the thread
+ */
+void test_rand_stream(const char *name, uint32_t ix)
+{
+	uint64_t id = (uint64_t)hash_joaat_str(name) << 32 | ix;
+
+	stream_init(id);
+}
+
+
+uint64_t test_rand_u64(void)
+{
+	uint64_t r, t;
+
+	if (state_epoch != epoch)
+		stream_init(__sync_add_and_fetch(&thread_count, 1));
+
+	r = rotl(state[1] * 5, 7) * 9;
+	t = state[1] << 17;
+
+	state[2] ^= state[0];
+	state[3] ^= state[1];
+	state[1] ^= state[2];
+	state[0] ^= state[3];
+	state[2] ^= t;
+	state[3] = rotl(state[3], 45);
+
+	return r;
+}
+
+
+uint32_t test_rand_u32(void)
+{
+	return (uint32_t)(test_rand_u64() >> 32);
+}
+
+
+uint16_t test_rand_u16(void)
+{
+	return (uint16_t)(test_rand_u64() >> 48);
+}
+
+
+void test_rand_bytes(uint8_t *p, size_t size)
+{
+	while (size) {
+
+		uint64_t r = test_rand_u64();
+		size_t n = min(size, sizeof(r));
+
+		memcpy(p, &r, n);
+
+		p    += n;
+		size -= n;
+	}
+}
+
+
+/* Random alphanumeric string, NULL-terminated */
+void test_rand_str(char *str, size_t size)
+{
+	static const char alphabet[] =
+		"abcdefghijklmnopqrstuvwxyz"
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		"0123456789";
+
+	if (!str || !size)
+		return;
+
+	while (--size)
+		*str++ = alphabet[test_rand_u32() % (sizeof(alphabet) - 1)];
+
+	*str = '\0';
+}
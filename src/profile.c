@@ -0,0 +1,346 @@
+/**
+ * @file profile.c  Sampling profiler
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+#include <string.h>
+#include <stdlib.h>
+#ifdef __GLIBC__
+#include <signal.h>
+#include <sys/time.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+#endif
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "profile"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+/*
+ * SIGPROF is raised by setitimer() every 1/hz seconds of CPU time, and
+ * the handler stores the stack from backtrace() in a preallocated
+ * array. Samples are only taken while a label is set, i.e. inside the
+ * timed region of a testcase. The stacks are symbolized with dladdr()
+ * when written, one line per unique stack in the folded format of
+ * flamegraph.pl ("label;outer;..;inner count").
+ *
+ * backtrace() is called once before arming the timer, so that it does
+ * not allocate memory inside the signal handler.
+ */
+#ifdef __GLIBC__
+
+
+enum {
+	MAX_DEPTH   = 48,
+	MAX_SAMPLES = 32768,
+	SKIP_FRAMES = 2,          /* signal handler and trampoline */
+};
+
+
+struct sample {
+	const char *label;
+	int depth;
+	void *pcv[MAX_DEPTH];
+};
+
+
+static struct {
+	struct sample *samplev;
+	volatile int n;
+	volatile int dropped;
+	const char * volatile label;
+	struct sigaction oldact;
+	bool running;
+} prof;
+
+
+static void sigprof_handler(int sig)
+{
+	struct sample *s;
+	const char *label = prof.label;
+	const int saved_errno = errno;
+	int ix;
+	(void)sig;
+
+	if (!label || !prof.samplev)
+		goto out;
+
+	/* the signal can hit several threads at the same time */
+	ix = __sync_fetch_and_add(&prof.n, 1);
+	if (ix >= MAX_SAMPLES) {
+		__sync_fetch_and_add(&prof.dropped, 1);
+		goto out;
+	}
+
+	s = &prof.samplev[ix];
+
+	s->label = label;
+	s->depth = backtrace(s->pcv, MAX_DEPTH);
+
+ out:
+	/* the interrupted code may be checking errno */
+	errno = saved_errno;
+}
+
+
+/**
+ * Start the sampling profiler
+ *
+ * @param hz Sampling frequency in Hz
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int profile_start(unsigned hz)
+{
+	struct sigaction act;
+	struct itimerval itv;
+	void *dummy[2];
+
+	if (!hz || hz > 1000000)
+		return EINVAL;
+
+	if (prof.running)
+		return EALREADY;
+
+	prof.samplev = mem_alloc(MAX_SAMPLES * sizeof(*prof.samplev), NULL);
+	if (!prof.samplev)
+		return ENOMEM;
+
+	prof.n       = 0;
+	prof.dropped = 0;
+	prof.label   = NULL;
+
+	/* load the unwinder now, it may allocate */
+	(void)backtrace(dummy, ARRAY_SIZE(dummy));
+
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = sigprof_handler;
+	act.sa_flags   = SA_RESTART;
+	sigemptyset(&act.sa_mask);
+
+	if (sigaction(SIGPROF, &act, &prof.oldact) < 0) {
+		int err = errno;
+		prof.samplev = mem_deref(prof.samplev);
+		return err;
+	}
+
+	memset(&itv, 0, sizeof(itv));
+	itv.it_interval.tv_usec = 1000000 / hz;
+	itv.it_value = itv.it_interval;
+
+	if (setitimer(ITIMER_PROF, &itv, NULL) < 0) {
+		int err = errno;
+		(void)sigaction(SIGPROF, &prof.oldact, NULL);
+		prof.samplev = mem_deref(prof.samplev);
+		return err;
+	}
+
+	prof.running = true;
+
+	return 0;
+}
+
+
+/* Stop sampling, the samples are kept until profile_write() */
+void profile_stop(void)
+{
+	struct sigaction act;
+	struct itimerval itv;
+
+	if (!prof.running)
+		return;
+
+	memset(&itv, 0, sizeof(itv));
+	(void)setitimer(ITIMER_PROF, &itv, NULL);
+
+	/* discard a SIGPROF that is still pending, the default action
+	   would terminate the process */
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = SIG_IGN;
+	sigemptyset(&act.sa_mask);
+	(void)sigaction(SIGPROF, &act, NULL);
+
+	(void)sigaction(SIGPROF, &prof.oldact, NULL);
+
+	prof.label   = NULL;
+	prof.running = false;
+}
+
+
+/**
+ * Set the label of the following samples, normally the testcase name
+ *
+ * @param label Label (must stay valid), or NULL to pause sampling
+ */
+void profile_set_label(const char *label)
+{
+	prof.label = label;
+}
+
+
+static int print_frame(struct re_printf *pf, void *pc)
+{
+	Dl_info info;
+
+	memset(&info, 0, sizeof(info));
+
+	if (!dladdr(pc, &info))
+		return re_hprintf(pf, ";%p", pc);
+
+	if (info.dli_sname)
+		return re_hprintf(pf, ";%s", info.dli_sname);
+
+	if (info.dli_fname) {
+		const char *base = strrchr(info.dli_fname, '/');
+
+		return re_hprintf(pf, ";%s+0x%zx",
+				  base ? base + 1 : info.dli_fname,
+				  (size_t)((char *)pc -
+					   (char *)info.dli_fbase));
+	}
+
+	return re_hprintf(pf, ";%p", pc);
+}
+
+
+/* folded stack of one sample, outermost frame first */
+static int print_sample(struct re_printf *pf, const struct sample *s)
+{
+	int i, err;
+
+	err = re_hprintf(pf, "%s", s->label);
+
+	for (i = s->depth - 1; i >= SKIP_FRAMES; i--)
+		err |= print_frame(pf, s->pcv[i]);
+
+	return err;
+}
+
+
+static int str_cmp_qsort(const void *p1, const void *p2)
+{
+	const char * const *s1 = p1;
+	const char * const *s2 = p2;
+
+	return strcmp(*s1, *s2);
+}
+
+
+/**
+ * Write the samples as folded stacks
+ *
+ * @param filename Output file
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int profile_write(const char *filename)
+{
+	struct mbuf *mb = NULL;
+	char **linev = NULL;
+	size_t i, n;
+	int err = 0;
+
+	if (!filename)
+		return EINVAL;
+
+	if (prof.running)
+		profile_stop();
+
+	n = (size_t)min(prof.n, MAX_SAMPLES);
+
+	linev = mem_zalloc(max(n, (size_t)1) * sizeof(*linev), NULL);
+	mb = mbuf_alloc(8192);
+	if (!linev || !mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<n; i++) {
+		err = re_sdprintf(&linev[i], "%H", print_sample,
+				  &prof.samplev[i]);
+		if (err)
+			goto out;
+	}
+
+	qsort(linev, n, sizeof(*linev), str_cmp_qsort);
+
+	/* one line per unique stack, with the number of samples */
+	for (i=0; i<n; ) {
+
+		size_t j = i + 1;
+
+		while (j < n && 0 == strcmp(linev[i], linev[j]))
+			++j;
+
+		err = mbuf_printf(mb, "%s %zu\n", linev[i], j - i);
+		if (err)
+			goto out;
+
+		i = j;
+	}
+
+	mb->pos = 0;
+
+	err = test_write_file(mb, filename);
+	if (err) {
+		DEBUG_WARNING("could not write %s (%m)\n", filename, err);
+		goto out;
+	}
+
+	re_fprintf(stderr, "profile: %zu samples (%d dropped)"
+		   " written to %s\n", n, prof.dropped, filename);
+
+ out:
+	if (linev) {
+		for (i=0; i<n; i++)
+			mem_deref(linev[i]);
+	}
+
+	mem_deref(linev);
+	mem_deref(mb);
+
+	prof.samplev = mem_deref(prof.samplev);
+	prof.n = 0;
+
+	return err;
+}
+
+
+#else
+
+
+int profile_start(unsigned hz)
+{
+	(void)hz;
+
+	return ENOSYS;
+}
+
+
+void profile_stop(void)
+{
+}
+
+
+void profile_set_label(const char *label)
+{
+	(void)label;
+}
+
+
+int profile_write(const char *filename)
+{
+	(void)filename;
+
+	return ENOSYS;
+}
+
+
+#endif
@@ -0,0 +1,483 @@
+/**
+ * @file report.c  Machine-readable performance report
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <re.h>
+#include "test.h"
+
+
+#define DEBUG_MODULE "report"
+#define DEBUG_LEVEL 5
+#include <re_dbg.h>
+
+
+enum {
+	REPORT_VERSION = 1,
+	DICT_BSIZE     = 32,
+	MAX_LEVELS     = 8,
+};
+
+
+struct perf_report {
+	struct odict *dict;      /* top-level object        */
+	struct odict *testv;     /* array of testcases      */
+	struct odict *last;      /* last testcase (no ref)  */
+	unsigned testc;
+};
+
+
+/*
+ * One-sided critical values of Student's t-distribution, alpha=0.01,
+ * indexed by degrees of freedom (1..30). Above that the normal
+ * distribution is used.
+ */
+static const double t_crit[30] = {
+	31.821, 6.965, 4.541, 3.747, 3.365, 3.143, 2.998, 2.896,
+	 2.821, 2.764, 2.718, 2.681, 2.650, 2.624, 2.602, 2.583,
+	 2.567, 2.552, 2.539, 2.528, 2.518, 2.508, 2.500, 2.492,
+	 2.485, 2.479, 2.473, 2.467, 2.462, 2.457
+};
+#define T_CRIT_NORMAL 2.326
+
+
+static void destructor(void *arg)
+{
+	struct perf_report *rep = arg;
+
+	mem_deref(rep->testv);
+	mem_deref(rep->dict);
+}
+
+
+static int host_info(struct odict **hostp)
+{
+	struct odict *host = NULL;
+	char *kernel = NULL;
+	int err;
+
+	err = odict_alloc(&host, DICT_BSIZE);
+	if (err)
+		return err;
+
+	err  = odict_entry_add(host, "os", ODICT_STRING, sys_os_get());
+	err |= odict_entry_add(host, "arch", ODICT_STRING, sys_arch_get());
+	err |= odict_entry_add(host, "libre", ODICT_STRING,
+			       sys_libre_version_get());
+	if (err)
+		goto out;
+
+	if (0 == re_sdprintf(&kernel, "%H", sys_kernel_get, NULL)) {
+		err = odict_entry_add(host, "kernel", ODICT_STRING, kernel);
+		if (err)
+			goto out;
+	}
+
+#ifdef HAVE_UNISTD_H
+	{
+		char hostname[256] = "";
+
+		if (0 == gethostname(hostname, sizeof(hostname) - 1)) {
+			err = odict_entry_add(host, "hostname", ODICT_STRING,
+					      hostname);
+			if (err)
+				goto out;
+		}
+
+		err = odict_entry_add(host, "ncpu", ODICT_INT,
+				      (int64_t)sysconf(_SC_NPROCESSORS_ONLN));
+		if (err)
+			goto out;
+	}
+#endif
+
+	err = odict_entry_add(host, "timestamp", ODICT_INT,
+			      (int64_t)time(NULL));
+
+ out:
+	mem_deref(kernel);
+	if (err)
+		mem_deref(host);
+	else
+		*hostp = host;
+
+	return err;
+}
+
+
+int perf_report_alloc(struct perf_report **repp)
+{
+	struct perf_report *rep;
+	struct odict *host = NULL;
+	int err;
+
+	if (!repp)
+		return EINVAL;
+
+	rep = mem_zalloc(sizeof(*rep), destructor);
+	if (!rep)
+		return ENOMEM;
+
+	err  = odict_alloc(&rep->dict, DICT_BSIZE);
+	err |= odict_alloc(&rep->testv, DICT_BSIZE);
+	if (err)
+		goto out;
+
+	err = host_info(&host);
+	if (err)
+		goto out;
+
+	err  = odict_entry_add(rep->dict, "version", ODICT_INT,
+			       (int64_t)REPORT_VERSION);
+	err |= odict_entry_add(rep->dict, "host", ODICT_OBJECT, host);
+	err |= odict_entry_add(rep->dict, "tests", ODICT_ARRAY, rep->testv);
+	if (err)
+		goto out;
+
+ out:
+	mem_deref(host);
+	if (err)
+		mem_deref(rep);
+	else
+		*repp = rep;
+
+	return err;
+}
+
+
+/**
+ * Add the result of one testcase to the report
+ *
+ * @param rep    Performance report
+ * @param name   Testcase name
+ * @param hist   Histogram with the per-iteration timing [nsec]
+ * @param allocs Number of allocations per iteration
+ * @param bytes  Number of bytes allocated per iteration
+ * @param peak   Peak live bytes during the measurement
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int perf_report_add(struct perf_report *rep, const char *name,
+		    const struct hist *hist, double allocs, double bytes,
+		    uint64_t peak)
+{
+	struct odict *o = NULL;
+	char key[16];
+	int err;
+
+	if (!rep || !name || !hist)
+		return EINVAL;
+
+	err = odict_alloc(&o, DICT_BSIZE);
+	if (err)
+		return err;
+
+	err |= odict_entry_add(o, "name", ODICT_STRING, name);
+	err |= odict_entry_add(o, "iterations", ODICT_INT,
+			       (int64_t)hist_count(hist));
+	err |= odict_entry_add(o, "mean_ns", ODICT_DOUBLE, hist_mean(hist));
+	err |= odict_entry_add(o, "stddev_ns", ODICT_DOUBLE,
+			       hist_stddev(hist));
+	err |= odict_entry_add(o, "min_ns", ODICT_INT,
+			       (int64_t)hist_min(hist));
+	err |= odict_entry_add(o, "p50_ns", ODICT_INT,
+			       (int64_t)hist_percentile(hist, 50.0));
+	err |= odict_entry_add(o, "p90_ns", ODICT_INT,
+			       (int64_t)hist_percentile(hist, 90.0));
+	err |= odict_entry_add(o, "p99_ns", ODICT_INT,
+			       (int64_t)hist_percentile(hist, 99.0));
+	err |= odict_entry_add(o, "p999_ns", ODICT_INT,
+			       (int64_t)hist_percentile(hist, 99.9));
+	err |= odict_entry_add(o, "max_ns", ODICT_INT,
+			       (int64_t)hist_max(hist));
+	err |= odict_entry_add(o, "allocs_per_iter", ODICT_DOUBLE, allocs);
+	err |= odict_entry_add(o, "bytes_per_iter", ODICT_DOUBLE, bytes);
+	err |= odict_entry_add(o, "peak_bytes", ODICT_INT, (int64_t)peak);
+	if (err)
+		goto out;
+
+	re_snprintf(key, sizeof(key), "%u", rep->testc);
+
+	err = odict_entry_add(rep->testv, key, ODICT_OBJECT, o);
+	if (err)
+		goto out;
+
+	rep->last = o;
+	++rep->testc;
+
+ out:
+	mem_deref(o);
+
+	return err;
+}
+
+
+/**
+ * Add hardware/software counters to the last testcase in the report
+ *
+ * @param rep Performance report
+ * @param val Counter values of all iterations
+ * @param n   Number of iterations
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int perf_report_add_counters(struct perf_report *rep,
+			     const struct perfcnt_val *val, uint64_t n)
+{
+	struct odict *o = NULL;
+	size_t i;
+	int err;
+
+	if (!rep || !val || !n)
+		return EINVAL;
+
+	if (!rep->last)
+		return ENOENT;
+
+	err = odict_alloc(&o, DICT_BSIZE);
+	if (err)
+		return err;
+
+	for (i=0; i<PERFCNT_MAX; i++) {
+
+		if (!val->valid[i])
+			continue;
+
+		err = odict_entry_add(o, perfcnt_name((enum perfcnt_id)i),
+				      ODICT_DOUBLE,
+				      (double)val->v[i] / (double)n);
+		if (err)
+			goto out;
+	}
+
+	if (val->valid[PERFCNT_CYCLES] && val->valid[PERFCNT_INSTRUCTIONS] &&
+	    val->v[PERFCNT_CYCLES]) {
+
+		err = odict_entry_add(o, "ipc", ODICT_DOUBLE,
+				      (double)val->v[PERFCNT_INSTRUCTIONS] /
+				      (double)val->v[PERFCNT_CYCLES]);
+		if (err)
+			goto out;
+	}
+
+	err = odict_entry_add(rep->last, "counters_per_iter", ODICT_OBJECT, o);
+
+ out:
+	mem_deref(o);
+
+	return err;
+}
+
+
+int perf_report_write(const struct perf_report *rep, const char *filename)
+{
+	struct mbuf *mb;
+	int err;
+
+	if (!rep || !filename)
+		return EINVAL;
+
+	mb = mbuf_alloc(8192);
+	if (!mb)
+		return ENOMEM;
+
+	err = mbuf_printf(mb, "%H\n", json_encode_odict, rep->dict);
+	if (err)
+		goto out;
+
+	mb->pos = 0;
+
+	err = test_write_file(mb, filename);
+	if (err) {
+		DEBUG_WARNING("could not write %s (%m)\n", filename, err);
+		goto out;
+	}
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+static double entry_number(const struct odict *o, const char *key)
+{
+	const struct odict_entry *e = odict_lookup(o, key);
+
+	if (!e)
+		return 0.0;
+
+	switch (e->type) {
+
+	case ODICT_INT:    return (double)e->u.integer;
+	case ODICT_DOUBLE: return e->u.dbl;
+	default:           return 0.0;
+	}
+}
+
+
+static const struct odict *find_testcase(const struct odict *testv,
+					 const char *name)
+{
+	struct le *le;
+
+	for (le = testv->lst.head; le; le = le->next) {
+
+		const struct odict_entry *e = le->data;
+
+		if (e->type != ODICT_OBJECT)
+			continue;
+
+		if (0 == str_cmp(name, odict_string(e->u.odict, "name")))
+			return e->u.odict;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * Welch's t-test for a slowdown of the mean, from the summary
+ * statistics of the baseline (0) and the current run (1).
+ */
+static bool is_significant(double m0, double s0, double n0,
+			   double m1, double s1, double n1, double *tp)
+{
+	double v0, v1, se, df, t, crit;
+
+	if (n0 < 2 || n1 < 2)
+		return false;
+
+	v0 = s0 * s0 / n0;
+	v1 = s1 * s1 / n1;
+	se = sqrt(v0 + v1);
+
+	if (se <= 0.0) {
+		*tp = 0.0;
+		return m1 > m0;
+	}
+
+	t  = (m1 - m0) / se;
+	df = (v0 + v1) * (v0 + v1) /
+		(v0 * v0 / (n0 - 1) + v1 * v1 / (n1 - 1));
+
+	if (df >= 1.0 && df <= 30.0)
+		crit = t_crit[(size_t)df - 1];
+	else if (df < 1.0)
+		crit = t_crit[0];
+	else
+		crit = T_CRIT_NORMAL;
+
+	*tp = t;
+
+	return t > crit;
+}
+
+
+/**
+ * Compare a report with a stored baseline
+ *
+ * A testcase is a regression if the mean is significantly slower than
+ * in the baseline, and the slowdown is larger than the threshold.
+ *
+ * @param rep       Performance report of the current run
+ * @param filename  JSON file with the baseline report
+ * @param threshold Max allowed slowdown in percent
+ * @param nregp     Returns the number of regressions
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int perf_report_compare(const struct perf_report *rep, const char *filename,
+			double threshold, unsigned *nregp)
+{
+	const struct odict_entry *base_tests;
+	struct odict *base = NULL;
+	struct mbuf *mb;
+	unsigned nreg = 0;
+	struct le *le;
+	int err;
+
+	if (!rep || !filename)
+		return EINVAL;
+
+	mb = mbuf_alloc(8192);
+	if (!mb)
+		return ENOMEM;
+
+	err = test_load_file(mb, filename);
+	if (err) {
+		DEBUG_WARNING("could not load baseline %s (%m)\n",
+			      filename, err);
+		goto out;
+	}
+
+	err = json_decode_odict(&base, DICT_BSIZE, (char *)mb->buf, mb->end,
+				MAX_LEVELS);
+	if (err) {
+		DEBUG_WARNING("could not decode baseline %s (%m)\n",
+			      filename, err);
+		goto out;
+	}
+
+	base_tests = odict_get_type(base, ODICT_ARRAY, "tests");
+	if (!base_tests) {
+		DEBUG_WARNING("baseline %s has no tests\n", filename);
+		err = EPROTO;
+		goto out;
+	}
+
+	re_fprintf(stderr, "\ncompared with baseline %s"
+		   " (threshold %.1f%%):\n", filename, threshold);
+
+	for (le = rep->testv->lst.head; le; le = le->next) {
+
+		const struct odict_entry *e = le->data;
+		const struct odict *cur = e->u.odict;
+		const struct odict *old;
+		const char *name = odict_string(cur, "name");
+		double m0, m1, pct, t = 0.0;
+		bool signif, regress;
+
+		old = find_testcase(base_tests->u.odict, name);
+		if (!old) {
+			re_fprintf(stderr, "%-32s: not in baseline\n", name);
+			continue;
+		}
+
+		m0 = entry_number(old, "mean_ns");
+		m1 = entry_number(cur, "mean_ns");
+		if (m0 <= 0.0)
+			continue;
+
+		pct = 100.0 * (m1 - m0) / m0;
+
+		signif = is_significant(m0, entry_number(old, "stddev_ns"),
+					entry_number(old, "iterations"),
+					m1, entry_number(cur, "stddev_ns"),
+					entry_number(cur, "iterations"), &t);
+
+		regress = signif && pct > threshold;
+		if (regress)
+			++nreg;
+
+		re_fprintf(stderr, "%-32s: %10.2f -> %10.2f usec  %+7.1f%%"
+			   "  t=%7.2f%s\n",
+			   name, m0 / 1000.0, m1 / 1000.0, pct, t,
+			   regress ? "  \x1b[31mREGRESSION\x1b[;m" : "");
+	}
+
+	if (nregp)
+		*nregp = nreg;
+
+ out:
+	mem_deref(base);
+	mem_deref(mb);
+
+	return err;
+}
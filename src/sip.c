@@ -528,6 +528,7 @@ int test_sip_parse(void)
 	const char hdr_callid[] = "a84b4c76e66710@pc33.atlanta.com";
 	struct mbuf *mb;
 	struct sip_msg *msg = NULL;
+	struct test_budget bud;
 	int err = EINVAL;
 
 	mb = mbuf_alloc(1024);
@@ -541,11 +542,18 @@ int test_sip_parse(void)
 		goto out;
 
 	mbuf_set_pos(mb, 0);
+
+	TEST_BUDGET_BEGIN(bud);
+
 	err = sip_msg_decode(&msg, mb);
 	if (err) {
 		goto out;
 	}
 
+	/* the message, its header table and one block per header */
+	TEST_ALLOC_MAX(bud, 16);
+	TEST_BYTES_MAX(bud, 4096);
+
 	/* Max-Forwards */
 	err = pl_strcmp(&msg->maxfwd, hdr_maxf);
 	if (err)
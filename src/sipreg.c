@@ -31,7 +31,7 @@ static void exit_handler(void *arg)
 }
 
 
-static int sipstack_fixture(struct sip **sipp)
+static int sipstack_fixture(struct sip **sipp, uint32_t htsz)
 {
 	struct sa laddr, laddrs;
 	struct sip *sip = NULL;
@@ -44,7 +44,8 @@ static int sipstack_fixture(struct sip **sipp)
 	(void)sa_set_str(&laddr, "127.0.0.1", LOCAL_PORT);
 	(void)sa_set_str(&laddrs, "127.0.0.1", LOCAL_SECURE_PORT);
 
-	err = sip_alloc(&sip, NULL, 32, 32, 32, "retest", exit_handler, NULL);
+	err = sip_alloc(&sip, NULL, htsz, htsz, htsz, "retest",
+			exit_handler, NULL);
 	if (err)
 		goto out;
 
@@ -123,7 +124,7 @@ static int reg_test(enum sip_transp tp)
 	if (err)
 		goto out;
 
-	err = sipstack_fixture(&sip);
+	err = sipstack_fixture(&sip, 32);
 	if (err)
 		goto out;
 
@@ -181,3 +182,352 @@ int test_sipreg_tls(void)
 	return reg_test(SIP_TRANSP_TLS);
 }
 #endif
+
+
+/*
+ * Registration storm, as after a network outage: all clients register
+ * with the mock registrar at the same time, and then unregister. The
+ * client transaction table is sized for the number of clients. Over
+ * UDP a storm can overflow the socket buffers, the retransmissions
+ * show up as n_retrans at the registrar.
+ */
+
+enum {
+	LOAD_CLIENTS = 64,
+	LOAD_EXPIRES = 600,        /* [s]  */
+	LOAD_TIMEOUT = 10000,      /* [ms] */
+	LOAD_POLL    = 1,          /* [ms] */
+};
+
+struct regload;
+
+struct loadreg {
+	struct regload *rl;
+	struct sipreg *reg;
+	uint64_t start;            /* [ns] */
+	bool ok;
+};
+
+struct regload {
+	struct sip_server *srv;
+	struct sip *sip;
+	struct loadreg *regv;
+	size_t regc;
+	size_t n_ok;
+	struct hist *hist;         /* latency of the 200 OK [ns] */
+	struct tmr tmr;
+	enum sip_transp tp;
+	int64_t mem;               /* live bytes of all registrations */
+	int err;
+};
+
+
+static void regload_destructor(void *arg)
+{
+	struct regload *rl = arg;
+	size_t i;
+
+	tmr_cancel(&rl->tmr);
+
+	for (i=0; i<rl->regc; i++)
+		mem_deref(rl->regv[i].reg);
+
+	mem_deref(rl->regv);
+
+	sip_close(rl->sip, true);
+	mem_deref(rl->sip);
+
+	mem_deref(rl->srv);
+	mem_deref(rl->hist);
+}
+
+
+static void load_complete(struct regload *rl, int err)
+{
+	rl->err = err;
+	re_cancel();
+}
+
+
+static void load_resp_handler(int err, const struct sip_msg *msg,
+			      void *arg)
+{
+	struct loadreg *lr = arg;
+	struct regload *rl = lr->rl;
+
+	if (err) {
+		load_complete(rl, err);
+		return;
+	}
+
+	TEST_EQUALS(200, msg->scode);
+	TEST_EQUALS(rl->tp, msg->tp);
+
+	if (lr->ok)
+		return;
+
+	lr->ok = true;
+	hist_record(rl->hist, test_nanoseconds() - lr->start);
+
+	if (++rl->n_ok >= rl->regc)
+		re_cancel();
+
+ out:
+	if (err)
+		load_complete(rl, err);
+}
+
+
+static int regload_alloc(struct regload **rlp, size_t regc)
+{
+	struct regload *rl;
+	uint32_t htsz = 32;
+	int err;
+
+	rl = mem_zalloc(sizeof(*rl), regload_destructor);
+	if (!rl)
+		return ENOMEM;
+
+	rl->regv = mem_zalloc(regc * sizeof(*rl->regv), NULL);
+	if (!rl->regv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	rl->regc = regc;
+
+	while (htsz < regc)
+		htsz *= 2;
+
+	err = hist_alloc(&rl->hist);
+	if (err)
+		goto out;
+
+	err = sip_server_alloc(&rl->srv);
+	if (err)
+		goto out;
+
+	err = sipstack_fixture(&rl->sip, htsz);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		mem_deref(rl);
+	else
+		*rlp = rl;
+
+	return err;
+}
+
+
+/* register all clients at once, and wait for all 200 OK */
+static int regload_storm(struct regload *rl, enum sip_transp tp)
+{
+	struct memprof mp_start, mp_stop;
+	char reg_uri[256];
+	size_t i;
+	int err;
+
+	rl->tp   = tp;
+	rl->n_ok = 0;
+	rl->err  = 0;
+
+	err = sip_server_uri(rl->srv, reg_uri, sizeof(reg_uri), tp);
+	if (err)
+		return err;
+
+	memprof_get(&mp_start);
+
+	for (i=0; i<rl->regc; i++) {
+
+		struct loadreg *lr = &rl->regv[i];
+		char aor[64], cuser[32];
+
+		re_snprintf(cuser, sizeof(cuser), "user%zu", i);
+		re_snprintf(aor, sizeof(aor), "sip:%s@test", cuser);
+
+		lr->rl    = rl;
+		lr->ok    = false;
+		lr->start = test_nanoseconds();
+
+		err = sipreg_register(&lr->reg, rl->sip, reg_uri, aor, NULL,
+				      aor, LOAD_EXPIRES, cuser, NULL, 0, 0,
+				      NULL, NULL, false,
+				      load_resp_handler, lr, NULL, NULL);
+		if (err)
+			return err;
+	}
+
+	err = re_main_timeout(LOAD_TIMEOUT);
+	if (err)
+		return err;
+
+	if (rl->err)
+		return rl->err;
+
+	memprof_get(&mp_stop);
+
+	rl->mem = mp_stop.cur - mp_start.cur;
+
+	return 0;
+}
+
+
+static void unregister_poll(void *arg)
+{
+	struct regload *rl = arg;
+
+	if (rl->srv->bindingc)
+		tmr_start(&rl->tmr, LOAD_POLL, unregister_poll, rl);
+	else
+		re_cancel();
+}
+
+
+/* the clients unregister when they are destroyed */
+static int regload_unregister(struct regload *rl)
+{
+	size_t i;
+	int err;
+
+	for (i=0; i<rl->regc; i++)
+		rl->regv[i].reg = mem_deref(rl->regv[i].reg);
+
+	tmr_start(&rl->tmr, LOAD_POLL, unregister_poll, rl);
+
+	err = re_main_timeout(LOAD_TIMEOUT);
+
+	tmr_cancel(&rl->tmr);
+
+	return err;
+}
+
+
+static int load_test(enum sip_transp tp)
+{
+	struct regload *rl = NULL;
+	int err;
+
+	err = regload_alloc(&rl, LOAD_CLIENTS);
+	TEST_ERR(err);
+
+	err = regload_storm(rl, tp);
+	TEST_ERR(err);
+
+	TEST_EQUALS(LOAD_CLIENTS, rl->n_ok);
+	TEST_EQUALS(LOAD_CLIENTS, hist_count(rl->hist));
+	TEST_EQUALS(LOAD_CLIENTS, rl->srv->bindingc);
+	TEST_ASSERT(rl->srv->n_register_req >= LOAD_CLIENTS);
+
+	err = regload_unregister(rl);
+	TEST_ERR(err);
+
+	TEST_EQUALS(0, rl->srv->bindingc);
+	TEST_EQUALS(0, rl->srv->n_expired);
+
+ out:
+	mem_deref(rl);
+
+	return err;
+}
+
+
+int test_sipreg_load(void)
+{
+	int err;
+
+	err = load_test(SIP_TRANSP_UDP);
+	if (err)
+		return err;
+
+	err = load_test(SIP_TRANSP_TCP);
+	if (err)
+		return err;
+
+#ifdef USE_TLS
+	err = load_test(SIP_TRANSP_TLS);
+	if (err)
+		return err;
+#endif
+
+	return err;
+}
+
+
+/*
+ * The parameter is the number of clients. Each iteration is a storm
+ * and its unregistration, i.e. two REGISTER transactions per client.
+ */
+int bench_sipreg_setup(struct bench_state *st)
+{
+	struct regload *rl;
+	int err;
+
+	err = regload_alloc(&rl, st->param);
+	if (err)
+		return err;
+
+	st->bytes = 0;
+	st->items = 2 * st->param;
+	st->arg   = rl;
+
+	return 0;
+}
+
+
+void bench_sipreg_teardown(struct bench_state *st)
+{
+	const struct regload *rl = st->arg;
+
+	if (!rl || !hist_count(rl->hist))
+		return;
+
+	re_printf("%-36s  200 OK latency: %H usec\n", "",
+		  hist_print, rl->hist);
+
+	re_printf("%-36s  %lld bytes/registration"
+		  "  %u retransmissions  %u expired\n", "",
+		  memprof_supported() ? rl->mem / (int64_t)rl->regc : 0LL,
+		  rl->srv->n_retrans, rl->srv->n_expired);
+}
+
+
+static int bench_sipreg(struct bench_state *st, enum sip_transp tp)
+{
+	struct regload *rl = st->arg;
+	int err;
+
+	BENCH_LOOP(st) {
+
+		err = regload_storm(rl, tp);
+		if (err)
+			return err;
+
+		err = regload_unregister(rl);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+int bench_sipreg_udp(struct bench_state *st)
+{
+	return bench_sipreg(st, SIP_TRANSP_UDP);
+}
+
+
+int bench_sipreg_tcp(struct bench_state *st)
+{
+	return bench_sipreg(st, SIP_TRANSP_TCP);
+}
+
+
+#ifdef USE_TLS
+int bench_sipreg_tls(struct bench_state *st)
+{
+	return bench_sipreg(st, SIP_TRANSP_TLS);
+}
+#endif
@@ -9,6 +9,7 @@ SRCS	+= aes.c
 SRCS	+= aubuf.c
 SRCS	+= auresamp.c
 SRCS	+= base64.c
+SRCS	+= budget.c
 SRCS	+= bfcp.c
 SRCS	+= conf.c
 SRCS	+= crc32.c
@@ -17,9 +18,11 @@ SRCS	+= dsp.c
 SRCS	+= dtmf.c
 SRCS	+= fir.c
 SRCS	+= fmt.c
+SRCS	+= fuzzer.c
 SRCS	+= g711.c
 SRCS	+= h264.c
 SRCS	+= hash.c
+SRCS	+= hist.c
 SRCS	+= hmac.c
 SRCS	+= http.c
 SRCS	+= httpauth.c
@@ -27,13 +30,19 @@ SRCS	+= ice.c
 SRCS	+= jbuf.c
 SRCS	+= json.c
 SRCS	+= list.c
-SRCS	+= main.c
+SRCS	+= loopstat.c
 SRCS	+= mbuf.c
 SRCS	+= md5.c
 SRCS	+= mem.c
+SRCS	+= memprof.c
 SRCS	+= mqueue.c
 SRCS	+= odict.c
+SRCS	+= pcap.c
+SRCS	+= perfcnt.c
+SRCS	+= prng.c
+SRCS	+= profile.c
 SRCS	+= remain.c
+SRCS	+= report.c
 SRCS	+= rtmp.c
 SRCS	+= rtp.c
 SRCS	+= rtcp.c
@@ -47,6 +56,7 @@ SRCS	+= sipsess.c
 SRCS	+= srtp.c
 SRCS	+= stun.c
 SRCS	+= sys.c
+SRCS	+= syscount.c
 SRCS	+= tcp.c
 SRCS	+= telev.c
 SRCS	+= test.c
@@ -68,6 +78,11 @@ endif
 
 SRCS	+= util.c
 
+# libFuzzer provides main()
+ifeq ($(USE_FUZZER),)
+SRCS	+= main.c
+endif
+
 # Mock servers
 SRCS	+= mock/pf.c
 SRCS	+= mock/sipsrv.c
@@ -76,3 +91,4 @@ SRCS	+= mock/turnsrv.c
 SRCS	+= mock/nat.c
 SRCS	+= mock/tcpsrv.c
 SRCS	+= mock/fuzz.c
+SRCS	+= mock/netem.c
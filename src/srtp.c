@@ -318,6 +318,64 @@ static int test_srtcp_keys(void)
 #endif
 
 
+/*
+ * The crypto backend may allocate per packet, e.g. OpenSSL 3 when an
+ * HMAC context is reset. The allocation budget of the SRTP loop only
+ * applies if a second use of the primitives does not allocate.
+ */
+static bool crypto_allocates(enum srtp_suite suite)
+{
+	static const uint8_t key[16], iv[16], data[32];
+	const bool gcm = suite == SRTP_AES_128_GCM ||
+		suite == SRTP_AES_256_GCM;
+	struct hmac *hmac = NULL;
+	struct aes *aes = NULL;
+	struct memprof mp_start, mp_stop;
+	uint8_t out[32];
+	unsigned i;
+	int err;
+
+	memset(&mp_start, 0, sizeof(mp_start));
+	memset(&mp_stop, 0, sizeof(mp_stop));
+
+	err = aes_alloc(&aes, gcm ? AES_MODE_GCM : AES_MODE_CTR,
+			key, 128, iv);
+	if (err)
+		goto out;
+
+	if (!gcm) {
+		err = hmac_create(&hmac, HMAC_HASH_SHA1, key, sizeof(key));
+		if (err)
+			goto out;
+	}
+
+	/* the first use may set up the backend */
+	for (i=0; i<2; i++) {
+
+		memprof_get(&mp_start);
+
+		err = aes_set_iv(aes, iv);
+		if (!err)
+			err = aes_encr(aes, out, data, sizeof(data));
+		if (!err && gcm)
+			err = aes_get_authtag(aes, out, 16);
+		if (!err && !gcm)
+			err = hmac_digest(hmac, out, 20, data, sizeof(data));
+
+		memprof_get(&mp_stop);
+
+		if (err)
+			break;
+	}
+
+ out:
+	mem_deref(hmac);
+	mem_deref(aes);
+
+	return err || mp_stop.allocs != mp_start.allocs;
+}
+
+
 static int test_srtp_loop(size_t offset, enum srtp_suite suite, uint16_t seq)
 {
 	struct srtp *ctx_tx = NULL, *ctx_rx = NULL;
@@ -325,6 +383,8 @@ static int test_srtp_loop(size_t offset, enum srtp_suite suite, uint16_t seq)
 	const size_t key_len = get_keylen(suite);
 	const size_t salt_len = get_saltlen(suite);
 	const size_t tag_len = get_taglen(suite);
+	struct test_budget bud;
+	bool allocates;
 	unsigned i;
 	int err = 0;
 
@@ -337,6 +397,8 @@ static int test_srtp_loop(size_t offset, enum srtp_suite suite, uint16_t seq)
 		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
 	};
 
+	memset(&bud, 0, sizeof(bud));
+
 	mb = mbuf_alloc(offset + 32);
 	if (!mb)
 		return ENOMEM;
@@ -346,11 +408,18 @@ static int test_srtp_loop(size_t offset, enum srtp_suite suite, uint16_t seq)
 	if (err)
 		goto out;
 
+	/* the probe allocates, keep it out of the budget */
+	allocates = crypto_allocates(suite);
+
 	for (i=0; i<10; i++) {
 		struct rtp_header hdr;
 		uint8_t hdrbuf[12];
 		size_t end;
 
+		/* the first packet sets up the streams and the buffer */
+		if (i == 1)
+			TEST_BUDGET_BEGIN(bud);
+
 		mb->pos = mb->end = offset;
 
 		memset(&hdr, 0, sizeof(hdr));
@@ -400,6 +469,13 @@ static int test_srtp_loop(size_t offset, enum srtp_suite suite, uint16_t seq)
 			    mbuf_buf(mb), mbuf_get_left(mb));
 	}
 
+	if (err)
+		goto out;
+
+	/* libre does not allocate per packet */
+	if (!allocates)
+		TEST_ALLOC_MAX(bud, 0);
+
  out:
 	mem_deref(ctx_tx);
 	mem_deref(ctx_rx);
@@ -1054,6 +1130,247 @@ static int test_unencrypted_srtcp(void)
 }
 
 
+/*
+ * Bursts of packets
+ *
+ * libre protects one packet per call. burst_protect() gives the same
+ * semantics as a batch API on top of that: the packets may belong to
+ * different SSRCs and are processed in order, and a packet that fails
+ * does not stop the others. The tests check that a burst gives the
+ * same output as the single-packet path.
+ */
+
+enum burst_op {
+	BURST_RTP_ENCRYPT,
+	BURST_RTP_DECRYPT,
+	BURST_RTCP_ENCRYPT,
+	BURST_RTCP_DECRYPT,
+};
+
+enum {
+	BURST_SIZE = 50,
+	BURST_SSRCS = 3,
+};
+
+
+/* returns the first error, errv has the result of each packet */
+static int burst_protect(struct srtp *srtp, enum burst_op op,
+		      struct mbuf * const *mbv, int *errv, size_t n)
+{
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<n; i++) {
+
+		struct mbuf *mb = mbv[i];
+
+		switch (op) {
+
+		case BURST_RTP_ENCRYPT:
+			errv[i] = srtp_encrypt(srtp, mb);
+			break;
+
+		case BURST_RTP_DECRYPT:
+			errv[i] = srtp_decrypt(srtp, mb);
+			break;
+
+		case BURST_RTCP_ENCRYPT:
+			errv[i] = srtcp_encrypt(srtp, mb);
+			break;
+
+		case BURST_RTCP_DECRYPT:
+			errv[i] = srtcp_decrypt(srtp, mb);
+			break;
+
+		default:
+			errv[i] = EINVAL;
+			break;
+		}
+
+		if (errv[i] && !err)
+			err = errv[i];
+	}
+
+	return err;
+}
+
+
+static int srtp_ctx_alloc(struct srtp **srtpp, enum srtp_suite suite)
+{
+	static const uint8_t master_key[32+14] = {
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+	};
+
+	return srtp_alloc(srtpp, suite, master_key,
+			  get_keylen(suite) + get_saltlen(suite), 0);
+}
+
+
+/* packet i of a burst, for one of BURST_SSRCS interleaved streams */
+static int burst_packet(struct mbuf **mbp, size_t i, bool rtcp)
+{
+	static const uint32_t ssrcv[BURST_SSRCS] = {
+		0x01020304, 0x11223344, SSRC
+	};
+	const size_t len = 20 + 8 * i;
+	struct mbuf *mb;
+	uint8_t payload[20 + 8 * BURST_SIZE];
+	int err;
+
+	mb = mbuf_alloc(RTP_HEADER_SIZE + len + 32);
+	if (!mb)
+		return ENOMEM;
+
+	test_rand_bytes(payload, len);
+
+	if (rtcp) {
+		err  = mbuf_write_u8(mb, RTCP_VERSION << 6);
+		err |= mbuf_write_u8(mb, RTCP_APP);
+		err |= mbuf_write_u16(mb, htons((uint16_t)((len + 8)/4 - 1)));
+		err |= mbuf_write_u32(mb, htonl(ssrcv[i % BURST_SSRCS]));
+	}
+	else {
+		struct rtp_header hdr;
+
+		memset(&hdr, 0, sizeof(hdr));
+
+		hdr.ver  = RTP_VERSION;
+		hdr.seq  = (uint16_t)(i / BURST_SSRCS);
+		hdr.ssrc = ssrcv[i % BURST_SSRCS];
+
+		err = rtp_hdr_encode(mb, &hdr);
+	}
+
+	err |= mbuf_write_mem(mb, payload, len);
+	if (err) {
+		mem_deref(mb);
+		return err;
+	}
+
+	mb->pos = 0;
+	*mbp = mb;
+
+	return 0;
+}
+
+
+static struct mbuf *burst_dup(const struct mbuf *mb)
+{
+	struct mbuf *dup;
+
+	dup = mbuf_alloc(mb->size);
+	if (!dup)
+		return NULL;
+
+	(void)mbuf_write_mem(dup, mb->buf, mb->end);
+	dup->pos = 0;
+
+	return dup;
+}
+
+
+static int test_burst(enum srtp_suite suite, bool rtcp)
+{
+	const enum burst_op enc = rtcp ? BURST_RTCP_ENCRYPT
+		: BURST_RTP_ENCRYPT;
+	const enum burst_op dec = rtcp ? BURST_RTCP_DECRYPT
+		: BURST_RTP_DECRYPT;
+	struct srtp *tx_single = NULL, *tx_burst = NULL, *rx = NULL;
+	struct mbuf *ptv[BURST_SIZE], *mbv[BURST_SIZE], *refv[BURST_SIZE];
+	int errv[BURST_SIZE];
+	const size_t bad = 7;
+	size_t i;
+	int e, err;
+
+	memset(ptv, 0, sizeof(ptv));
+	memset(mbv, 0, sizeof(mbv));
+	memset(refv, 0, sizeof(refv));
+
+	err  = srtp_ctx_alloc(&tx_single, suite);
+	err |= srtp_ctx_alloc(&tx_burst, suite);
+	err |= srtp_ctx_alloc(&rx, suite);
+	if (err)
+		goto out;
+
+	test_rand_stream("srtp_burst", suite);
+
+	for (i=0; i<BURST_SIZE; i++) {
+
+		err = burst_packet(&ptv[i], i, rtcp);
+		if (err)
+			goto out;
+
+		mbv[i]  = burst_dup(ptv[i]);
+		refv[i] = burst_dup(ptv[i]);
+		if (!mbv[i] || !refv[i]) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	/* the single-packet path is the reference */
+	for (i=0; i<BURST_SIZE; i++) {
+
+		err = burst_protect(tx_single, enc, &refv[i], &errv[i], 1);
+		TEST_ERR(err);
+	}
+
+	err = burst_protect(tx_burst, enc, mbv, errv, BURST_SIZE);
+	TEST_ERR(err);
+
+	for (i=0; i<BURST_SIZE; i++) {
+		TEST_EQUALS(0, mbv[i]->pos);
+		TEST_MEMCMP(refv[i]->buf, refv[i]->end,
+			    mbv[i]->buf, mbv[i]->end);
+	}
+
+	/* one bad packet must not affect the rest of the burst */
+	mbv[bad]->buf[mbv[bad]->end - 1] ^= 0x55;
+
+	e = burst_protect(rx, dec, mbv, errv, BURST_SIZE);
+	TEST_EQUALS(EAUTH, e);
+
+	for (i=0; i<BURST_SIZE; i++) {
+
+		if (i == bad) {
+			TEST_EQUALS(EAUTH, errv[i]);
+			continue;
+		}
+
+		TEST_EQUALS(0, errv[i]);
+		TEST_MEMCMP(ptv[i]->buf, ptv[i]->end,
+			    mbv[i]->buf, mbv[i]->end);
+	}
+
+	/* a replayed burst is rejected packet by packet */
+	e = burst_protect(rx, dec, refv, errv, BURST_SIZE);
+	TEST_EQUALS(EALREADY, e);
+
+	for (i=0; i<BURST_SIZE; i++) {
+		if (i != bad)
+			TEST_EQUALS(EALREADY, errv[i]);
+	}
+
+ out:
+	for (i=0; i<BURST_SIZE; i++) {
+		mem_deref(ptv[i]);
+		mem_deref(mbv[i]);
+		mem_deref(refv[i]);
+	}
+
+	mem_deref(tx_single);
+	mem_deref(tx_burst);
+	mem_deref(rx);
+
+	return err;
+}
+
+
 static bool have_srtp(void)
 {
 	static const uint8_t nullkey[30];
@@ -1210,3 +1527,467 @@ int test_srtcp_gcm(void)
 
 	return err;
 }
+
+
+/*
+ * The benchmarks run for each suite in bench_srtp_suitev, with a
+ * payload of param bytes. The burst benchmarks protect BURST_SIZE
+ * packets per iteration, their Mitems/s is packets like for the
+ * single-packet benchmarks. burst_protect() is a loop over the
+ * single-packet calls, so they are only the baseline for a batch API
+ * in libre and show no speedup by themselves.
+ *
+ * The decrypt benchmarks decrypt a ring of packets that were encrypted
+ * in the setup. The replay protection rejects a packet that was seen
+ * before, so a new receive context is used every time the ring wraps.
+ */
+
+enum {
+	BENCH_RING = 1024,
+	BENCH_OVERHEAD = 32,
+};
+
+static const enum srtp_suite bench_suitev[] = {
+	SRTP_AES_CM_128_HMAC_SHA1_32,
+	SRTP_AES_CM_128_HMAC_SHA1_80,
+	SRTP_AES_256_CM_HMAC_SHA1_32,
+	SRTP_AES_256_CM_HMAC_SHA1_80,
+	SRTP_AES_128_GCM,
+	SRTP_AES_256_GCM,
+};
+
+const char * const bench_srtp_suitev[] = {
+	"aes128_sha1_32",
+	"aes128_sha1_80",
+	"aes256_sha1_32",
+	"aes256_sha1_80",
+	"aes128_gcm",
+	"aes256_gcm",
+	NULL
+};
+
+struct bench_srtp {
+	struct srtp *srtp;
+	struct mbuf *mb;
+	struct mbuf *mbv[BURST_SIZE];
+	int errv[BURST_SIZE];
+	enum srtp_suite suite;
+	uint8_t *ring;         /* BENCH_RING encrypted packets */
+	size_t len;            /* length of one encrypted packet */
+	unsigned ix;           /* next packet in the ring */
+	uint16_t seq;
+};
+
+
+static void bench_srtp_destructor(void *arg)
+{
+	struct bench_srtp *bs = arg;
+	size_t i;
+
+	mem_deref(bs->srtp);
+	mem_deref(bs->mb);
+	mem_deref(bs->ring);
+
+	for (i=0; i<BURST_SIZE; i++)
+		mem_deref(bs->mbv[i]);
+}
+
+
+static int bench_alloc(struct bench_srtp **bsp, struct bench_state *st)
+{
+	struct bench_srtp *bs;
+	int err;
+
+	if (st->variant >= ARRAY_SIZE(bench_suitev))
+		return EINVAL;
+
+	bs = mem_zalloc(sizeof(*bs), bench_srtp_destructor);
+	if (!bs)
+		return ENOMEM;
+
+	bs->suite = bench_suitev[st->variant];
+
+	bs->mb = mbuf_alloc(RTP_HEADER_SIZE + st->param + BENCH_OVERHEAD);
+	if (!bs->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = srtp_ctx_alloc(&bs->srtp, bs->suite);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		mem_deref(bs);
+	else
+		*bsp = bs;
+
+	return err;
+}
+
+
+/* write the next RTP packet, with a payload of param bytes */
+static int bench_rtp_packet(struct bench_srtp *bs, struct mbuf *mb,
+			    const struct bench_state *st)
+{
+	struct rtp_header hdr;
+	int err;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.ver  = RTP_VERSION;
+	hdr.seq  = bs->seq++;
+	hdr.ssrc = SSRC;
+
+	mb->pos = mb->end = 0;
+	err  = rtp_hdr_encode(mb, &hdr);
+	err |= mbuf_write_mem(mb, st->in, st->param);
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+/* write an RTCP packet, the payload of param bytes is opaque to SRTCP */
+static int bench_rtcp_packet(struct mbuf *mb, const struct bench_state *st)
+{
+	int err;
+
+	mb->pos = mb->end = 0;
+	err  = mbuf_write_u8(mb, RTCP_VERSION << 6);
+	err |= mbuf_write_u8(mb, RTCP_APP);
+	err |= mbuf_write_u16(mb, htons((uint16_t)((st->param + 8)/4 - 1)));
+	err |= mbuf_write_u32(mb, htonl(SSRC));
+	err |= mbuf_write_mem(mb, st->in, st->param);
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+/* encrypt BENCH_RING packets for the decrypt benchmarks */
+static int bench_ring_setup(struct bench_state *st, bool rtcp)
+{
+	struct bench_srtp *bs;
+	struct srtp *tx = NULL;
+	unsigned i;
+	int err;
+
+	err = bench_alloc(&bs, st);
+	if (err)
+		return err;
+
+	err = srtp_ctx_alloc(&tx, bs->suite);
+	if (err)
+		goto out;
+
+	for (i=0; i<BENCH_RING; i++) {
+
+		struct mbuf *mb = bs->mb;
+
+		if (rtcp) {
+			err  = bench_rtcp_packet(mb, st);
+			err |= srtcp_encrypt(tx, mb);
+		}
+		else {
+			err  = bench_rtp_packet(bs, mb, st);
+			err |= srtp_encrypt(tx, mb);
+		}
+		if (err)
+			goto out;
+
+		if (!bs->ring) {
+			bs->len  = mb->end;
+			bs->ring = mem_alloc(BENCH_RING * bs->len, NULL);
+			if (!bs->ring) {
+				err = ENOMEM;
+				goto out;
+			}
+		}
+
+		memcpy(&bs->ring[i * bs->len], mb->buf, bs->len);
+	}
+
+ out:
+	mem_deref(tx);
+
+	if (err)
+		mem_deref(bs);
+	else
+		st->arg = bs;
+
+	return err;
+}
+
+
+/* start over with a new receive context if n packets are not left */
+static int bench_ring_rewind(struct bench_srtp *bs, unsigned n)
+{
+	if (bs->ix + n <= BENCH_RING)
+		return 0;
+
+	bs->ix = 0;
+	bs->srtp = mem_deref(bs->srtp);
+
+	return srtp_ctx_alloc(&bs->srtp, bs->suite);
+}
+
+
+/* copy the next packet from the ring into the buffer */
+static int bench_ring_next(struct bench_srtp *bs, struct mbuf *mb)
+{
+	int err;
+
+	mb->pos = mb->end = 0;
+	err = mbuf_write_mem(mb, &bs->ring[bs->ix++ * bs->len], bs->len);
+
+	mb->pos = 0;
+
+	return err;
+}
+
+
+/* the burst benchmarks protect BURST_SIZE packets per iteration */
+static int bench_burst_alloc(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	size_t i;
+
+	for (i=0; i<BURST_SIZE; i++) {
+
+		bs->mbv[i] = mbuf_alloc(bs->mb->size);
+		if (!bs->mbv[i])
+			return ENOMEM;
+	}
+
+	st->items = BURST_SIZE;
+	st->bytes = BURST_SIZE * st->param;
+
+	return 0;
+}
+
+
+int bench_srtp_setup(struct bench_state *st)
+{
+	struct bench_srtp *bs;
+	int err;
+
+	err = bench_alloc(&bs, st);
+	if (err)
+		return err;
+
+	st->arg = bs;
+
+	return 0;
+}
+
+
+int bench_srtcp_setup(struct bench_state *st)
+{
+	return bench_srtp_setup(st);
+}
+
+
+int bench_srtp_decrypt_setup(struct bench_state *st)
+{
+	return bench_ring_setup(st, false);
+}
+
+
+int bench_srtp_burst_setup(struct bench_state *st)
+{
+	int err;
+
+	err = bench_srtp_setup(st);
+	if (err)
+		return err;
+
+	return bench_burst_alloc(st);
+}
+
+
+int bench_srtp_burst_decrypt_setup(struct bench_state *st)
+{
+	int err;
+
+	err = bench_ring_setup(st, false);
+	if (err)
+		return err;
+
+	return bench_burst_alloc(st);
+}
+
+
+int bench_srtcp_decrypt_setup(struct bench_state *st)
+{
+	return bench_ring_setup(st, true);
+}
+
+
+/* encrypt one RTP packet with a payload of param bytes per iteration */
+int bench_srtp_encrypt(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+
+		err  = bench_rtp_packet(bs, bs->mb, st);
+		err |= srtp_encrypt(bs->srtp, bs->mb);
+		if (err)
+			break;
+
+		BENCH_SINK(bs->mb->buf);
+	}
+
+	return err;
+}
+
+
+/* decrypt one SRTP packet with a payload of param bytes per iteration */
+int bench_srtp_decrypt(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+
+		err  = bench_ring_rewind(bs, 1);
+		err |= bench_ring_next(bs, bs->mb);
+		err |= srtp_decrypt(bs->srtp, bs->mb);
+		if (err)
+			break;
+
+		BENCH_SINK(bs->mb->buf);
+	}
+
+	return err;
+}
+
+
+/* encrypt one RTCP packet with a payload of param bytes per iteration */
+int bench_srtcp_encrypt(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+
+		err  = bench_rtcp_packet(bs->mb, st);
+		err |= srtcp_encrypt(bs->srtp, bs->mb);
+		if (err)
+			break;
+
+		BENCH_SINK(bs->mb->buf);
+	}
+
+	return err;
+}
+
+
+/* decrypt one SRTCP packet with a payload of param bytes per iteration */
+int bench_srtcp_decrypt(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+
+		err  = bench_ring_rewind(bs, 1);
+		err |= bench_ring_next(bs, bs->mb);
+		err |= srtcp_decrypt(bs->srtp, bs->mb);
+		if (err)
+			break;
+
+		BENCH_SINK(bs->mb->buf);
+	}
+
+	return err;
+}
+
+
+
+/* encrypt a burst of RTP packets per iteration */
+int bench_srtp_burst_encrypt(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	size_t i;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+
+		for (i=0; i<BURST_SIZE && !err; i++)
+			err = bench_rtp_packet(bs, bs->mbv[i], st);
+		if (err)
+			break;
+
+		err = burst_protect(bs->srtp, BURST_RTP_ENCRYPT, bs->mbv,
+				 bs->errv, BURST_SIZE);
+		if (err)
+			break;
+
+		BENCH_SINK(bs->mbv[0]->buf);
+	}
+
+	return err;
+}
+
+
+/* decrypt a burst of SRTP packets per iteration */
+int bench_srtp_burst_decrypt(struct bench_state *st)
+{
+	struct bench_srtp *bs = st->arg;
+	size_t i;
+	int err = 0;
+
+	BENCH_LOOP(st) {
+
+		err = bench_ring_rewind(bs, BURST_SIZE);
+		for (i=0; i<BURST_SIZE && !err; i++)
+			err = bench_ring_next(bs, bs->mbv[i]);
+		if (err)
+			break;
+
+		err = burst_protect(bs->srtp, BURST_RTP_DECRYPT, bs->mbv,
+				 bs->errv, BURST_SIZE);
+		if (err)
+			break;
+
+		BENCH_SINK(bs->mbv[0]->buf);
+	}
+
+	return err;
+}
+
+
+int test_srtp_burst(void)
+{
+	static const enum srtp_suite suitev[] = {
+		SRTP_AES_CM_128_HMAC_SHA1_32,
+		SRTP_AES_CM_128_HMAC_SHA1_80,
+		SRTP_AES_256_CM_HMAC_SHA1_32,
+		SRTP_AES_256_CM_HMAC_SHA1_80,
+		SRTP_AES_128_GCM,
+		SRTP_AES_256_GCM,
+	};
+	size_t i;
+	int err = 0;
+
+	if (!have_srtp()) {
+		(void)re_printf("skipping SRTP burst test\n");
+		return ESKIPPED;
+	}
+
+	for (i=0; i<ARRAY_SIZE(suitev); i++) {
+
+		err  = test_burst(suitev[i], false);
+		err |= test_burst(suitev[i], true);
+		if (err)
+			break;
+	}
+
+	return err;
+}
@@ -4,6 +4,9 @@
  * Copyright (C) 2010 Creytiv.com
  */
 #include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include <re.h>
 #include "test.h"
 
@@ -596,3 +599,640 @@ int test_stun(void)
 
 	return err;
 }
+
+
+/*
+ * Many clients behind one NAT, each sending a Binding Request to two
+ * STUN servers. The mapped addresses show the mapping behaviour, and
+ * a packet from the wrong server shows the filtering behaviour.
+ */
+
+enum {
+	NAT_CLIENTS = 128,
+	NAT_TIMEOUT = 5,          /* [ms] */
+};
+
+struct nattest;
+struct natcli;
+
+struct natreq {
+	struct natcli *cli;
+	unsigned ix;
+};
+
+struct natcli {
+	struct nattest *nt;
+	struct udp_sock *us;
+	struct natreq reqv[2];
+	struct sa mapv[2];
+};
+
+struct nattest {
+	struct stunserver *srvv[2];
+	struct stun *stun;
+	struct natcli cliv[NAT_CLIENTS];
+	size_t n_resp;
+	int err;
+};
+
+
+static void nattest_destructor(void *arg)
+{
+	struct nattest *nt = arg;
+	size_t i;
+
+	mem_deref(nt->stun);
+
+	for (i=0; i<ARRAY_SIZE(nt->cliv); i++)
+		mem_deref(nt->cliv[i].us);
+
+	mem_deref(nt->srvv[0]);
+	mem_deref(nt->srvv[1]);
+}
+
+
+static void nat_resp_handler(int err, uint16_t scode, const char *reason,
+			     const struct stun_msg *msg, void *arg)
+{
+	struct natreq *nr = arg;
+	struct nattest *nt = nr->cli->nt;
+	struct stun_attr *attr;
+	(void)reason;
+
+	if (err)
+		goto out;
+
+	TEST_EQUALS(0, scode);
+
+	attr = stun_msg_attr(msg, STUN_ATTR_XOR_MAPPED_ADDR);
+	TEST_ASSERT(attr != NULL);
+
+	nr->cli->mapv[nr->ix] = attr->v.sa;
+
+	++nt->n_resp;
+
+ out:
+	if (err) {
+		nt->err = err;
+		re_cancel();
+	}
+	else if (nt->n_resp >= 2 * ARRAY_SIZE(nt->cliv)) {
+		re_cancel();
+	}
+}
+
+
+static void nat_recv_handler(const struct sa *src, struct mbuf *mb,
+			     void *arg)
+{
+	struct natcli *cli = arg;
+	(void)src;
+
+	(void)stun_recv(cli->nt->stun, mb);
+}
+
+
+static void wait_handler(void *arg)
+{
+	(void)arg;
+	re_cancel();
+}
+
+
+static int test_stun_nat_behaviour(enum nat_behaviour behaviour)
+{
+	struct nattest *nt;
+	struct nat *nat = NULL;
+	struct sa laddr, public_addr;
+	struct mbuf *mb = NULL;
+	struct tmr tmr;
+	size_t i, n_filtered;
+	unsigned j;
+	int err;
+
+	tmr_init(&tmr);
+
+	nt = mem_zalloc(sizeof(*nt), nattest_destructor);
+	if (!nt)
+		return ENOMEM;
+
+	err  = stunserver_alloc(&nt->srvv[0]);
+	err |= stunserver_alloc(&nt->srvv[1]);
+	TEST_ERR(err);
+
+	err = stun_alloc(&nt->stun, NULL, NULL, NULL);
+	TEST_ERR(err);
+
+	err  = sa_set_str(&laddr, "127.0.0.1", 0);
+	err |= sa_set_str(&public_addr, "4.5.6.7", 0);
+	TEST_ERR(err);
+
+	err = nat_alloc(&nat, NAT_INBOUND_SNAT, nt->srvv[0]->us,
+			&public_addr);
+	TEST_ERR(err);
+
+	err = nat_attach(nat, nt->srvv[1]->us);
+	TEST_ERR(err);
+
+	nat_set_behaviour(nat, behaviour, behaviour);
+
+	for (i=0; i<ARRAY_SIZE(nt->cliv); i++) {
+
+		struct natcli *cli = &nt->cliv[i];
+
+		cli->nt = nt;
+
+		err = udp_listen(&cli->us, &laddr, nat_recv_handler, cli);
+		TEST_ERR(err);
+
+		for (j=0; j<ARRAY_SIZE(cli->reqv); j++) {
+
+			cli->reqv[j].cli = cli;
+			cli->reqv[j].ix  = j;
+
+			err = stun_request(NULL, nt->stun, IPPROTO_UDP,
+					   cli->us,
+					   stunserver_addr(nt->srvv[j],
+							   IPPROTO_UDP),
+					   0, STUN_METHOD_BINDING, NULL, 0,
+					   false, nat_resp_handler,
+					   &cli->reqv[j], 0);
+			TEST_ERR(err);
+		}
+	}
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	err = nt->err;
+	TEST_ERR(err);
+
+	/* mapping */
+	for (i=0; i<ARRAY_SIZE(nt->cliv); i++) {
+
+		const struct natcli *cli = &nt->cliv[i];
+
+		TEST_SACMP(&public_addr, &cli->mapv[0], SA_ADDR);
+		TEST_SACMP(&public_addr, &cli->mapv[1], SA_ADDR);
+
+		if (behaviour == NAT_ENDPOINT_INDEPENDENT) {
+			TEST_SACMP(&cli->mapv[0], &cli->mapv[1], SA_ALL);
+		}
+		else {
+			TEST_ASSERT(!sa_cmp(&cli->mapv[0], &cli->mapv[1],
+					    SA_ALL));
+		}
+	}
+
+	TEST_EQUALS((behaviour == NAT_ENDPOINT_INDEPENDENT ? 1 : 2)
+		    * NAT_CLIENTS, nat->bindingc);
+
+	/* filtering: the 2nd server sends to the mapping for the 1st */
+	mb = mbuf_alloc(16);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_str(mb, "hello");
+	TEST_ERR(err);
+
+	mb->pos = 0;
+	n_filtered = nat->n_filtered;
+
+	err = udp_send(nt->srvv[1]->us, &nt->cliv[0].mapv[0], mb);
+	TEST_ERR(err);
+
+	TEST_EQUALS(behaviour == NAT_ENDPOINT_INDEPENDENT ? 0 : 1,
+		    nat->n_filtered - n_filtered);
+
+	/* timeout: an idle binding is gone */
+	if (behaviour != NAT_ENDPOINT_INDEPENDENT) {
+
+		nat_set_timeout(nat, NAT_TIMEOUT);
+
+		tmr_start(&tmr, 2 * NAT_TIMEOUT, wait_handler, NULL);
+		err = re_main_timeout(100);
+		TEST_ERR(err);
+
+		mb->pos = 0;
+		err = udp_send(nt->srvv[0]->us, &nt->cliv[0].mapv[0], mb);
+		TEST_ERR(err);
+
+		TEST_ASSERT(nat->n_expired >= 1);
+	}
+
+ out:
+	tmr_cancel(&tmr);
+	mem_deref(mb);
+	mem_deref(nat);
+	mem_deref(nt);
+
+	return err;
+}
+
+
+int test_stun_nat(void)
+{
+	int err;
+
+	err = test_stun_nat_behaviour(NAT_ENDPOINT_INDEPENDENT);
+	if (err)
+		return err;
+
+	err = test_stun_nat_behaviour(NAT_ADDR_PORT_DEPENDENT);
+	if (err)
+		return err;
+
+	return err;
+}
+
+
+/*
+ * STUN Binding load against the multithreaded mock server. The
+ * parameter is the number of server threads. Each bench thread is a
+ * client with a window of requests in flight, so the loop is event
+ * driven and st->iterations is the number of transactions. Every
+ * request is encoded and every response decoded, which makes this a
+ * yardstick for stun_msg_encode() and stun_msg_decode().
+ */
+
+enum {
+	LOAD_WINDOW  = 16,
+	LOAD_RTX     = 100,        /* [ms] */
+	LOAD_TIMEOUT = 10000,      /* [ms] */
+};
+
+static const uint8_t load_key[] = "retest-stun-load";
+
+/* shared by the bench threads of one run */
+struct stunload {
+	struct stunserver_mt *srv;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;     /* for the totals below */
+#endif
+	struct hist *hist;         /* round-trip time of all clients [ns] */
+	uint64_t cpu_nsec;         /* CPU time of all clients */
+	uint64_t n_req;
+	uint64_t n_rtx;
+};
+
+struct loadcli {
+	struct stunload *sl;       /* not a reference, owned by the run */
+	struct hist *hist;
+	uint64_t cpu_nsec;
+	uint64_t n_req;
+	uint64_t n_rtx;
+};
+
+struct loadslot {
+	uint8_t tid[STUN_TID_SIZE];
+	uint64_t start;            /* [ns] */
+	bool busy;
+};
+
+struct loadrun {
+	struct loadcli *cli;
+	struct udp_sock *us;
+	struct mbuf *mb;
+	struct tmr tmr;
+	struct loadslot slotv[LOAD_WINDOW];
+	const struct sa *srv;
+	uint64_t sent;
+	uint64_t done;
+	uint64_t total;
+	bool mi;
+	int err;
+};
+
+
+static void stunload_report(struct stunload *sl)
+{
+	double cpu_srv;
+
+	stunserver_mt_stop(sl->srv);
+
+	cpu_srv = sl->srv->nrecv ?
+		(double)sl->srv->cpu_nsec / (double)sl->srv->nrecv : 0;
+
+	re_printf("%-36s  rtt: %H usec\n", "", hist_print, sl->hist);
+	re_printf("%-36s  cpu/req: client %.0f ns  server %.0f ns"
+		  "  %llu retransmissions\n", "",
+		  (double)sl->cpu_nsec / (double)sl->n_req, cpu_srv,
+		  (unsigned long long)sl->n_rtx);
+}
+
+
+/* the run has ended when all threads are torn down */
+static void stunload_destructor(void *arg)
+{
+	struct stunload *sl = arg;
+
+	if (sl->srv && sl->n_req)
+		stunload_report(sl);
+
+	mem_deref(sl->srv);
+	mem_deref(sl->hist);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&sl->mutex);
+#endif
+}
+
+
+static void loadcli_destructor(void *arg)
+{
+	struct loadcli *cli = arg;
+
+	mem_deref(cli->hist);
+}
+
+
+static int send_request(struct loadrun *lr, const struct loadslot *ls)
+{
+	struct mbuf *mb = lr->mb;
+	int err;
+
+	mb->pos = 0;
+	mb->end = 0;
+
+	if (lr->mi) {
+		err = stun_msg_encode(mb, STUN_METHOD_BINDING,
+				      STUN_CLASS_REQUEST, ls->tid, NULL,
+				      load_key, sizeof(load_key) - 1,
+				      true, 0x20, 1,
+				      STUN_ATTR_USERNAME, "retest");
+	}
+	else {
+		err = stun_msg_encode(mb, STUN_METHOD_BINDING,
+				      STUN_CLASS_REQUEST, ls->tid, NULL,
+				      NULL, 0, false, 0x20, 0);
+	}
+	if (err)
+		return err;
+
+	mb->pos = 0;
+
+	return udp_send(lr->us, lr->srv, mb);
+}
+
+
+/* the first byte of the transaction ID is the slot */
+static int new_request(struct loadrun *lr, struct loadslot *ls)
+{
+	test_rand_bytes(ls->tid, sizeof(ls->tid));
+	ls->tid[0] = (uint8_t)(ls - lr->slotv);
+
+	ls->start = test_nanoseconds();
+	ls->busy  = true;
+
+	++lr->sent;
+
+	return send_request(lr, ls);
+}
+
+
+static void load_abort(struct loadrun *lr, int err)
+{
+	lr->err = err;
+	re_cancel();
+}
+
+
+static void rtx_handler(void *arg)
+{
+	struct loadrun *lr = arg;
+	const uint64_t now = test_nanoseconds();
+	size_t i;
+	int err;
+
+	tmr_start(&lr->tmr, LOAD_RTX, rtx_handler, lr);
+
+	for (i=0; i<ARRAY_SIZE(lr->slotv); i++) {
+
+		const struct loadslot *ls = &lr->slotv[i];
+
+		if (!ls->busy || now - ls->start < LOAD_RTX * 1000000ULL)
+			continue;
+
+		++lr->cli->n_rtx;
+
+		err = send_request(lr, ls);
+		if (err) {
+			load_abort(lr, err);
+			return;
+		}
+	}
+}
+
+
+static void load_recv_handler(const struct sa *src, struct mbuf *mb,
+			      void *arg)
+{
+	struct loadrun *lr = arg;
+	struct stun_msg *msg = NULL;
+	struct loadslot *ls;
+	const uint8_t *rtid;
+	int err;
+	(void)src;
+
+	err = stun_msg_decode(&msg, mb, NULL);
+	if (err)
+		goto out;
+
+	TEST_EQUALS(STUN_CLASS_SUCCESS_RESP, stun_msg_class(msg));
+
+	if (lr->mi) {
+		err  = stun_msg_chk_mi(msg, load_key, sizeof(load_key) - 1);
+		err |= stun_msg_chk_fingerprint(msg);
+		TEST_ERR(err);
+	}
+
+	rtid = stun_msg_tid(msg);
+	ls   = &lr->slotv[rtid[0] % LOAD_WINDOW];
+
+	/* a late response to a retransmission */
+	if (!ls->busy || memcmp(ls->tid, rtid, sizeof(ls->tid)))
+		goto out;
+
+	ls->busy = false;
+	hist_record(lr->cli->hist, test_nanoseconds() - ls->start);
+
+	++lr->done;
+
+	if (lr->sent < lr->total)
+		err = new_request(lr, ls);
+	else if (lr->done >= lr->total)
+		re_cancel();
+
+ out:
+	mem_deref(msg);
+
+	if (err)
+		load_abort(lr, err);
+}
+
+
+static int stun_load(struct bench_state *st, bool mi)
+{
+	struct loadcli *cli = st->arg;
+	struct loadrun lr;
+	struct sa laddr;
+	uint64_t cpu;
+	size_t i;
+	int err;
+
+	memset(&lr, 0, sizeof(lr));
+
+	lr.cli   = cli;
+	lr.srv   = &cli->sl->srv->laddr;
+	lr.total = st->iterations;
+	lr.mi    = mi;
+
+	tmr_init(&lr.tmr);
+
+	lr.mb = mbuf_alloc(256);
+	if (!lr.mb)
+		return ENOMEM;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	if (err)
+		goto out;
+
+	err = udp_listen(&lr.us, &laddr, load_recv_handler, &lr);
+	if (err)
+		goto out;
+
+	cpu = test_cpu_nanoseconds();
+
+	for (i=0; i<ARRAY_SIZE(lr.slotv) && lr.sent < lr.total; i++) {
+
+		err = new_request(&lr, &lr.slotv[i]);
+		if (err)
+			goto out;
+	}
+
+	tmr_start(&lr.tmr, LOAD_RTX, rtx_handler, &lr);
+
+	err = re_main_timeout(LOAD_TIMEOUT);
+	if (err)
+		goto out;
+
+	if (lr.err) {
+		err = lr.err;
+		goto out;
+	}
+
+	cli->cpu_nsec += test_cpu_nanoseconds() - cpu;
+	cli->n_req    += lr.done;
+
+ out:
+	tmr_cancel(&lr.tmr);
+	mem_deref(lr.us);
+	mem_deref(lr.mb);
+
+	return err;
+}
+
+
+/* One server per run, with param threads */
+int bench_stun_shared(void **sharedp, size_t param)
+{
+	struct stunload *sl;
+	int err;
+
+	if (!sharedp)
+		return EINVAL;
+
+	sl = mem_zalloc(sizeof(*sl), stunload_destructor);
+	if (!sl)
+		return ENOMEM;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&sl->mutex, NULL);
+#endif
+
+	err = hist_alloc(&sl->hist);
+	if (err)
+		goto out;
+
+	err = stunserver_mt_alloc(&sl->srv, (unsigned)param,
+				  load_key, sizeof(load_key) - 1);
+	if (err)
+		goto out;
+
+ out:
+	if (err)
+		mem_deref(sl);
+	else
+		*sharedp = sl;
+
+	return err;
+}
+
+
+int bench_stun_setup(struct bench_state *st)
+{
+	struct loadcli *cli;
+	int err;
+
+	if (!st->shared)
+		return EINVAL;
+
+	cli = mem_zalloc(sizeof(*cli), loadcli_destructor);
+	if (!cli)
+		return ENOMEM;
+
+	cli->sl = st->shared;
+
+	err = hist_alloc(&cli->hist);
+	if (err)
+		goto out;
+
+	st->bytes = 0;
+
+ out:
+	if (err)
+		mem_deref(cli);
+	else
+		st->arg = cli;
+
+	return err;
+}
+
+
+/* Each thread adds its client to the totals of the run */
+void bench_stun_teardown(struct bench_state *st)
+{
+	struct loadcli *cli = st->arg;
+	struct stunload *sl;
+
+	if (!cli)
+		return;
+
+	sl = cli->sl;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&sl->mutex);
+#endif
+	hist_merge(sl->hist, cli->hist);
+
+	sl->cpu_nsec += cli->cpu_nsec;
+	sl->n_req    += cli->n_req;
+	sl->n_rtx    += cli->n_rtx;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&sl->mutex);
+#endif
+}
+
+
+int bench_stun_binding(struct bench_state *st)
+{
+	return stun_load(st, false);
+}
+
+
+/* with MESSAGE-INTEGRITY and FINGERPRINT */
+int bench_stun_binding_mi(struct bench_state *st)
+{
+	return stun_load(st, true);
+}
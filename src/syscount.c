@@ -0,0 +1,137 @@
+/**
+ * @file syscount.c  Counting of socket syscalls
+ *
+ * Copyright (C) 2010 Creytiv.com
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+#include <sys/types.h>
+#ifdef __GLIBC__
+#include <dlfcn.h>
+#include <sys/socket.h>
+#endif
+#include <re.h>
+#include "test.h"
+
+
+/*
+ * The socket I/O of libre goes through send/sendto and recv/recvfrom.
+ * With USE_SYSCOUNT these are interposed here, like the polling
+ * functions in loopstat.c, and passed on to the next definition with
+ * dlsym(RTLD_NEXT), so that libc and any sanitizer interceptors still
+ * see the calls. The count is per thread.
+ */
+#if defined (USE_SYSCOUNT) && defined (__GLIBC__) && !defined (USE_FUZZER)
+
+
+typedef ssize_t (send_h)(int fd, const void *buf, size_t len, int flags);
+typedef ssize_t (sendto_h)(int fd, const void *buf, size_t len, int flags,
+			   __CONST_SOCKADDR_ARG addr, socklen_t addrlen);
+typedef ssize_t (recv_h)(int fd, void *buf, size_t len, int flags);
+typedef ssize_t (recvfrom_h)(int fd, void *buf, size_t len, int flags,
+			     __SOCKADDR_ARG addr, socklen_t *addrlen);
+
+
+static __thread uint64_t count;
+
+
+ssize_t send(int fd, const void *buf, size_t len, int flags)
+{
+	static send_h *real;
+
+	if (!real)
+		real = (send_h *)dlsym(RTLD_NEXT, "send");
+	if (!real) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	++count;
+
+	return real(fd, buf, len, flags);
+}
+
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+	       __CONST_SOCKADDR_ARG addr, socklen_t addrlen)
+{
+	static sendto_h *real;
+
+	if (!real)
+		real = (sendto_h *)dlsym(RTLD_NEXT, "sendto");
+	if (!real) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	++count;
+
+	return real(fd, buf, len, flags, addr, addrlen);
+}
+
+
+ssize_t recv(int fd, void *buf, size_t len, int flags)
+{
+	static recv_h *real;
+
+	if (!real)
+		real = (recv_h *)dlsym(RTLD_NEXT, "recv");
+	if (!real) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	++count;
+
+	return real(fd, buf, len, flags);
+}
+
+
+ssize_t recvfrom(int fd, void *buf, size_t len, int flags,
+		 __SOCKADDR_ARG addr, socklen_t *addrlen)
+{
+	static recvfrom_h *real;
+
+	if (!real)
+		real = (recvfrom_h *)dlsym(RTLD_NEXT, "recvfrom");
+	if (!real) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	++count;
+
+	return real(fd, buf, len, flags, addr, addrlen);
+}
+
+
+bool syscount_supported(void)
+{
+	return true;
+}
+
+
+/* Number of socket syscalls made by this thread */
+uint64_t syscount_get(void)
+{
+	return count;
+}
+
+
+#else
+
+
+bool syscount_supported(void)
+{
+	return false;
+}
+
+
+uint64_t syscount_get(void)
+{
+	return 0;
+}
+
+
+#endif
@@ -227,3 +227,430 @@ int test_tcp(void)
 
 	return err;
 }
+
+
+/*
+ * Echo and sink load. Each client keeps at most 'window' bytes in
+ * flight, and sends the payload in chunks until it has sent 'total'
+ * bytes. The socket syscalls of the echo phase are counted with
+ * syscount.c. Without it, the calls to tcp_send() and the receive
+ * handler on both sides are counted instead, which is an upper bound
+ * on the send() and recv() calls.
+ */
+
+enum {
+	TCP_PENDING_MAX = 256,     /* connects in progress */
+	TCP_TIMEOUT     = 20000,   /* [ms] */
+	TCP_POLL        = 1,       /* [ms] */
+	TCP_BULK_WINDOW = 262144,  /* [bytes] */
+	TCP_CONN_MSG    = 256,     /* [bytes] */
+	TCP_FD_EXTRA    = 64,
+};
+
+struct tcpload;
+
+struct tcpcli {
+	struct tcpload *tl;
+	struct tcp_conn *tc;
+	uint64_t sent;
+	uint64_t rcvd;
+	uint64_t total;
+	uint32_t crc_tx;
+	uint32_t crc_rx;
+};
+
+struct tcpload {
+	struct tcp_server *srv;
+	struct tcpcli *cliv;
+	size_t clic;
+	struct mbuf *mb;           /* one chunk of payload */
+	size_t window;
+	size_t next;               /* next client to connect */
+	size_t pending;
+	size_t estab;
+	size_t done;
+	struct tmr tmr;
+	bool verify;
+	uint64_t accept_nsec;      /* time to accept all clients */
+	uint64_t n_send;
+	uint64_t n_recv;
+	uint64_t n_syscalls;       /* socket syscalls while echoing */
+	uint64_t bytes;            /* bytes echoed */
+	int err;
+};
+
+
+static void tcpload_destructor(void *arg)
+{
+	struct tcpload *tl = arg;
+	size_t i;
+
+	tmr_cancel(&tl->tmr);
+
+	for (i=0; i<tl->clic; i++)
+		mem_deref(tl->cliv[i].tc);
+
+	mem_deref(tl->cliv);
+	mem_deref(tl->mb);
+	mem_deref(tl->srv);
+}
+
+
+static void tcpload_abort(struct tcpload *tl, int err)
+{
+	tl->err = err;
+	re_cancel();
+}
+
+
+static int tcpcli_send(struct tcpcli *cli)
+{
+	struct tcpload *tl = cli->tl;
+	struct mbuf *mb = tl->mb;
+	int err;
+
+	while (cli->sent < cli->total &&
+	       cli->sent - cli->rcvd + mb->end <= tl->window) {
+
+		mb->pos = 0;
+
+		if (tl->verify)
+			cli->crc_tx = (uint32_t)crc32(cli->crc_tx, mb->buf,
+						      (uint32_t)mb->end);
+
+		++tl->n_send;
+
+		err = tcp_send(cli->tc, mb);
+		if (err)
+			return err;
+
+		cli->sent += mb->end;
+	}
+
+	return 0;
+}
+
+
+static void tcpcli_recv_handler(struct mbuf *mb, void *arg)
+{
+	struct tcpcli *cli = arg;
+	struct tcpload *tl = cli->tl;
+	const size_t n = mbuf_get_left(mb);
+	int err;
+
+	++tl->n_recv;
+
+	if (tl->verify)
+		cli->crc_rx = (uint32_t)crc32(cli->crc_rx, mbuf_buf(mb),
+					      (uint32_t)n);
+
+	cli->rcvd += n;
+	tl->bytes += n;
+
+	if (cli->rcvd >= cli->total) {
+		if (++tl->done >= tl->clic)
+			re_cancel();
+		return;
+	}
+
+	err = tcpcli_send(cli);
+	if (err)
+		tcpload_abort(tl, err);
+}
+
+
+static void tcpcli_close_handler(int err, void *arg)
+{
+	struct tcpcli *cli = arg;
+
+	tcpload_abort(cli->tl, err ? err : ECONNRESET);
+}
+
+
+static int tcpload_connect_next(struct tcpload *tl);
+
+
+/* the server may not have accepted all connections yet */
+static void accept_poll(void *arg)
+{
+	struct tcpload *tl = arg;
+
+	if (tl->srv->n_accept >= tl->clic)
+		re_cancel();
+	else
+		tmr_start(&tl->tmr, TCP_POLL, accept_poll, tl);
+}
+
+
+static void tcpcli_estab_handler(void *arg)
+{
+	struct tcpcli *cli = arg;
+	struct tcpload *tl = cli->tl;
+	int err;
+
+	--tl->pending;
+
+	if (++tl->estab >= tl->clic) {
+		accept_poll(tl);
+		return;
+	}
+
+	err = tcpload_connect_next(tl);
+	if (err)
+		tcpload_abort(tl, err);
+}
+
+
+static int tcpload_connect_next(struct tcpload *tl)
+{
+	int err;
+
+	while (tl->pending < TCP_PENDING_MAX && tl->next < tl->clic) {
+
+		struct tcpcli *cli = &tl->cliv[tl->next++];
+
+		cli->tl = tl;
+
+		err = tcp_connect(&cli->tc, &tl->srv->laddr,
+				  tcpcli_estab_handler, tcpcli_recv_handler,
+				  tcpcli_close_handler, cli);
+		if (err)
+			return err;
+
+		++tl->pending;
+	}
+
+	return 0;
+}
+
+
+/* connect all clients, with at most TCP_PENDING_MAX in progress */
+static int tcpload_alloc(struct tcpload **tlp, enum behavior behavior,
+			 size_t clic, size_t chunk, size_t window)
+{
+	struct tcpload *tl;
+	uint64_t start;
+	int err;
+
+	tl = mem_zalloc(sizeof(*tl), tcpload_destructor);
+	if (!tl)
+		return ENOMEM;
+
+	tl->cliv = mem_zalloc(clic * sizeof(*tl->cliv), NULL);
+	tl->mb   = mbuf_alloc(chunk);
+	if (!tl->cliv || !tl->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	tl->clic   = clic;
+	tl->window = window;
+
+	tl->mb->end = chunk;
+	test_rand_bytes(tl->mb->buf, chunk);
+
+	err = tcp_server_alloc(&tl->srv, behavior);
+	if (err)
+		goto out;
+
+	start = test_nanoseconds();
+
+	err = tcpload_connect_next(tl);
+	if (err)
+		goto out;
+
+	err = re_main_timeout(TCP_TIMEOUT);
+	if (err)
+		goto out;
+
+	if (tl->err) {
+		err = tl->err;
+		goto out;
+	}
+
+	tl->accept_nsec = test_nanoseconds() - start;
+
+ out:
+	if (err)
+		mem_deref(tl);
+	else
+		*tlp = tl;
+
+	return err;
+}
+
+
+/* every client sends 'total' more bytes and waits for the echo */
+static int tcpload_echo(struct tcpload *tl, uint64_t total)
+{
+	const uint64_t sc = syscount_get();
+	size_t i;
+	int err;
+
+	tl->done = 0;
+
+	for (i=0; i<tl->clic; i++) {
+
+		struct tcpcli *cli = &tl->cliv[i];
+
+		cli->total += total;
+
+		err = tcpcli_send(cli);
+		if (err)
+			return err;
+	}
+
+	err = re_main_timeout(TCP_TIMEOUT);
+
+	/* both sides run in the event loop of this thread */
+	tl->n_syscalls += syscount_get() - sc;
+
+	if (err)
+		return err;
+
+	return tl->err;
+}
+
+
+static void sink_poll(void *arg)
+{
+	struct tcpload *tl = arg;
+
+	if (tl->srv->bytes >= tl->cliv[0].total)
+		re_cancel();
+	else
+		tmr_start(&tl->tmr, TCP_POLL, sink_poll, tl);
+}
+
+
+int test_tcp_echo(void)
+{
+	struct tcpload *tl = NULL;
+	struct tcpcli *cli;
+	int err;
+
+	/* echo, with a window smaller than the transfer */
+	err = tcpload_alloc(&tl, BEHAVIOR_ECHO, 1, 4096, 16384);
+	TEST_ERR(err);
+
+	tl->verify = true;
+
+	err = tcpload_echo(tl, 65536);
+	TEST_ERR(err);
+
+	cli = &tl->cliv[0];
+
+	TEST_EQUALS(65536, cli->rcvd);
+	TEST_EQUALS(cli->crc_tx, cli->crc_rx);
+	TEST_EQUALS(1, tl->srv->n_accept);
+	TEST_EQUALS(65536, tl->srv->bytes);
+
+	tl = mem_deref(tl);
+
+	/* sink, no window since nothing comes back */
+	err = tcpload_alloc(&tl, BEHAVIOR_SINK, 1, 4096, 65536);
+	TEST_ERR(err);
+
+	cli = &tl->cliv[0];
+	cli->total = 65536;
+
+	err = tcpcli_send(cli);
+	TEST_ERR(err);
+
+	tmr_start(&tl->tmr, TCP_POLL, sink_poll, tl);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	TEST_EQUALS(65536, tl->srv->bytes);
+	TEST_EQUALS(0, tl->srv->n_send);
+	TEST_EQUALS(0, cli->rcvd);
+
+ out:
+	mem_deref(tl);
+
+	return err;
+}
+
+
+/* socket syscalls on both sides, per MB of payload */
+static double calls_per_mb(const struct tcpload *tl)
+{
+	const struct tcp_server *srv = tl->srv;
+	uint64_t calls;
+
+	if (!srv->bytes)
+		return 0;
+
+	if (syscount_supported())
+		calls = tl->n_syscalls;
+	else
+		calls = tl->n_send + tl->n_recv + srv->n_send + srv->n_recv;
+
+	return (double)calls * 1048576.0 / (double)srv->bytes;
+}
+
+
+/* One connection, the parameter is the chunk size */
+int bench_tcp_bulk_setup(struct bench_state *st)
+{
+	struct tcpload *tl;
+	int err;
+
+	err = tcpload_alloc(&tl, BEHAVIOR_ECHO, 1, st->param,
+			    max(st->param, (size_t)TCP_BULK_WINDOW));
+	if (err)
+		return err;
+
+	st->arg = tl;
+
+	return 0;
+}
+
+
+int bench_tcp_bulk(struct bench_state *st)
+{
+	return tcpload_echo(st->arg, st->iterations * st->param);
+}
+
+
+/* Many connections, the parameter is the number of connections */
+int bench_tcp_conns_setup(struct bench_state *st)
+{
+	struct tcpload *tl;
+	int err;
+
+	if (2 * st->param + TCP_FD_EXTRA > test_fd_limit())
+		return ESKIPPED;
+
+	err = tcpload_alloc(&tl, BEHAVIOR_ECHO, st->param, TCP_CONN_MSG,
+			    TCP_CONN_MSG);
+	if (err)
+		return err;
+
+	st->bytes = st->param * TCP_CONN_MSG;
+	st->items = st->param;
+	st->arg   = tl;
+
+	return 0;
+}
+
+
+int bench_tcp_conns(struct bench_state *st)
+{
+	return tcpload_echo(st->arg, st->iterations * TCP_CONN_MSG);
+}
+
+
+void bench_tcp_teardown(struct bench_state *st)
+{
+	const struct tcpload *tl = st->arg;
+
+	if (!tl)
+		return;
+
+	re_printf("%-36s  %.0f accepts/s  %.1f %s/MB\n", "",
+		  (double)tl->clic * 1e9 / (double)max(tl->accept_nsec, 1ULL),
+		  calls_per_mb(tl),
+		  syscount_supported() ? "syscalls" : "send+recv calls");
+}
@@ -3,6 +3,9 @@
  *
  * Copyright (C) 2010 Creytiv.com
  */
+#if defined (__linux__) && !defined (_GNU_SOURCE)
+#define _GNU_SOURCE 1
+#endif
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -15,8 +18,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
+#ifdef HAVE_SETRLIMIT
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_FORK
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #endif
 #include <re.h>
 #include "test.h"
@@ -71,6 +86,7 @@ static const struct test tests[] = {
 	TEST(test_fmt_str_error),
 	TEST(test_fmt_unicode),
 	TEST(test_fmt_unicode_decode),
+	TEST(test_fuzzer),
 	TEST(test_g711_alaw),
 	TEST(test_g711_ulaw),
 	TEST(test_h264),
@@ -104,6 +120,7 @@ static const struct test tests[] = {
 	TEST(test_mqueue),
 	TEST(test_odict),
 	TEST(test_odict_array),
+	TEST(test_pcap),
 	TEST(test_remain),
 	TEST(test_rtmp_play),
 	TEST(test_rtmp_publish),
@@ -134,6 +151,7 @@ static const struct test tests[] = {
 	TEST(test_sipevent),
 	TEST(test_sipreg_udp),
 	TEST(test_sipreg_tcp),
+	TEST(test_sipreg_load),
 #ifdef USE_TLS
 	TEST(test_sipreg_tls),
 #endif
@@ -142,14 +160,17 @@ static const struct test tests[] = {
 	TEST(test_srtcp),
 	TEST(test_srtp_gcm),
 	TEST(test_srtcp_gcm),
+	TEST(test_srtp_burst),
 	TEST(test_stun_req),
 	TEST(test_stun_resp),
 	TEST(test_stun_reqltc),
 	TEST(test_stun),
+	TEST(test_stun_nat),
 	TEST(test_sys_div),
 	TEST(test_sys_endian),
 	TEST(test_sys_rand),
 	TEST(test_tcp),
+	TEST(test_tcp_echo),
 	TEST(test_telev),
 #ifdef USE_TLS
 	TEST(test_tls),
@@ -160,7 +181,9 @@ static const struct test tests[] = {
 	TEST(test_tmr),
 	TEST(test_turn),
 	TEST(test_turn_tcp),
+	TEST(test_turn_load),
 	TEST(test_udp),
+	TEST(test_udp_netem),
 	TEST(test_uri),
 	TEST(test_uri_encode),
 	TEST(test_uri_headers),
@@ -180,6 +203,59 @@ static const struct test tests[] = {
 };
 
 
+static const struct bench benches[] = {
+	BENCH(bench_base64_encode, NULL, NULL, 64, 65536, 1),
+	BENCH(bench_base64_decode, bench_base64_decode_setup, NULL,
+	      64, 65536, 1),
+	BENCH(bench_crc32, NULL, NULL, 64, 65536, 1),
+	BENCH(bench_g711_alaw_encode, NULL, NULL, 320, 5120, 1),
+	BENCH(bench_g711_ulaw_decode, NULL, NULL, 160, 2560, 1),
+	BENCH(bench_hmac_sha1, NULL, NULL, 64, 65536, 1),
+	BENCH(bench_hmac_sha256, bench_hmac_sha256_setup, NULL,
+	      64, 65536, 1),
+	BENCH(bench_pcap_decode, bench_pcap_setup, NULL, 1, 1, 1),
+	BENCH(bench_sipreg_udp, bench_sipreg_setup, bench_sipreg_teardown,
+	      256, 4096, 1),
+	BENCH(bench_sipreg_tcp, bench_sipreg_setup, bench_sipreg_teardown,
+	      256, 4096, 1),
+#ifdef USE_TLS
+	BENCH(bench_sipreg_tls, bench_sipreg_setup, bench_sipreg_teardown,
+	      256, 4096, 1),
+#endif
+	BENCH_VARIANTS(bench_srtcp_decrypt, bench_srtcp_decrypt_setup, NULL,
+		       20, 1400, 1, bench_srtp_suitev),
+	BENCH_VARIANTS(bench_srtcp_encrypt, bench_srtcp_setup, NULL,
+		       20, 1400, 1, bench_srtp_suitev),
+	BENCH_VARIANTS(bench_srtp_burst_decrypt,
+		       bench_srtp_burst_decrypt_setup, NULL,
+		       20, 1400, 1, bench_srtp_suitev),
+	BENCH_VARIANTS(bench_srtp_burst_encrypt, bench_srtp_burst_setup, NULL,
+		       20, 1400, 1, bench_srtp_suitev),
+	BENCH_VARIANTS(bench_srtp_decrypt, bench_srtp_decrypt_setup, NULL,
+		       20, 1400, 1, bench_srtp_suitev),
+	BENCH_VARIANTS(bench_srtp_encrypt, bench_srtp_setup, NULL,
+		       20, 1400, 1, bench_srtp_suitev),
+	BENCH_SHARED(bench_stun_binding, bench_stun_shared,
+		     bench_stun_setup, bench_stun_teardown, 1, 4, 0),
+	BENCH_SHARED(bench_stun_binding_mi, bench_stun_shared,
+		     bench_stun_setup, bench_stun_teardown, 1, 4, 0),
+	BENCH(bench_tcp_bulk, bench_tcp_bulk_setup, bench_tcp_teardown,
+	      1024, 65536, 1),
+	BENCH(bench_tcp_conns, bench_tcp_conns_setup, bench_tcp_teardown,
+	      256, 16384, 1),
+	BENCH(bench_vidconv, bench_vidconv_setup, NULL, 160, 2560, 1),
+};
+
+
+/* run a testcase with its own random stream */
+static int test_exec(const struct test *test)
+{
+	test_rand_stream(test->name, 0);
+
+	return test->exec();
+}
+
+
 #ifdef DATA_PATH
 static char datapath[256] = DATA_PATH;
 #else
@@ -188,6 +264,29 @@ static char datapath[256] = "./data";
 
 
 static uint32_t timeout_override;
+static unsigned parallel_jobs = 1;
+static unsigned parallel_shards = 1;
+static bool loopstat_enabled;
+static unsigned fd_limit = 1024;    /* default of the libre main loop */
+
+
+static struct {
+	const char *json;
+	const char *baseline;
+	double threshold;
+	bool counters;
+	const char *profile;
+} perf_cfg = {NULL, NULL, 10.0, false, NULL};
+
+
+enum { PROFILE_HZ = 997 };    /* prime, to avoid aliasing with timers */
+
+
+static struct {
+	uint32_t duration_ms;
+	unsigned ncpu;
+	bool pin;
+} scale_cfg = {2000, 1, false};
 
 
 static const struct test *find_test(const char *name)
@@ -235,7 +334,7 @@ static int testcase_oom(const struct test *test, int levels, bool verbose)
 
 		mem_threshold_set(i);
 
-		err = test->exec();
+		err = test_exec(test);
 		if (err == 0) {
 			/* success, stop now */
 			break;
@@ -312,290 +411,2710 @@ int test_oom(const char *name, bool verbose)
 }
 
 
-static int test_unit(const char *name, bool verbose)
+#if defined (HAVE_FORK) && defined (HAVE_PTHREAD)
+/*
+ * OOM tests by allocation index
+ *
+ * The testcase is first run once to count its allocations, then once
+ * for every allocation index with exactly that allocation failing.
+ * After each run the testcase must not have leaked any memory blocks.
+ * The leaks are counted with the allocation profile, not with the
+ * libre memory statistics, which need a MEM_DEBUG build of libre. A
+ * first run without a failure sets up what libc and the crypto
+ * library allocate once.
+ *
+ * The runs are spread over forked workers, worker k takes the indices
+ * k, k+n, k+2n, .. (times the stride). A worker that crashes or hangs
+ * is reported and replaced by a new one that continues with its next
+ * index. Testcases with more than OOM_INDEX_MAX allocations are
+ * sampled with a stride.
+ */
+
+enum {
+	OOM_TIMEOUT   = 10000,       /* max time per run [ms] */
+	OOM_INDEX_MAX = 20000,
+};
+
+struct oom_msg {
+	uint64_t ix;
+	int32_t err;
+	int32_t hit;
+	int64_t blocks;
+};
+
+struct oom_run {
+	const struct test *test;
+	uint64_t count;             /* allocations in a normal run */
+	uint64_t stride;
+	unsigned nworkers;
+	unsigned leaks;
+	unsigned crashes;
+	unsigned hangs;
+	unsigned errors;
+	bool verbose;
+};
+
+struct oom_worker {
+	pid_t pid;
+	int fd;                     /* read end, -1 if no child  */
+	uint64_t next;              /* next index to finish      */
+	uint64_t ts;                /* start of the current run  */
+	bool killed;
+};
+
+
+static void oom_child(const struct oom_run *run, const struct oom_worker *w,
+		      int fd)
 {
-	size_t skipv[ARRAY_SIZE(tests)] = {0};
-	size_t i;
-	int err = 0;
+	const uint64_t step = run->stride * run->nworkers;
+	uint64_t ix;
+	int err;
 
-	if (name) {
-		const struct test *test = find_test(name);
-		if (!test) {
-			(void)re_fprintf(stderr, "no such test: %s\n", name);
-			return ENOENT;
-		}
+	err = re_thread_init();
+	if (err)
+		_exit(1);
 
-		err = test->exec();
-		if (err) {
-			DEBUG_WARNING("%s: test failed (%m)\n", name, err);
-			return err;
-		}
-	}
-	else {
-		unsigned n_skipped = 0;
+	(void)test_exec(run->test);
 
-		for (i=0; i<ARRAY_SIZE(tests); i++) {
+	for (ix = w->next; ix <= run->count; ix += step) {
 
-			if (verbose) {
-				re_printf("test %u -- %s\n",
-					  i, tests[i].name);
-			}
+		struct memprof mp_start, mp_stop;
+		struct oom_msg msg;
 
-			err = tests[i].exec();
-			if (err) {
-				if (err == ESKIPPED || err == ENOSYS) {
+		memset(&msg, 0, sizeof(msg));
 
-					skipv[n_skipped] = i;
+		memprof_get(&mp_start);
 
-					++n_skipped;
-					err = 0;
-					continue;
-				}
+		memprof_fail_at(ix);
+		msg.err = test_exec(run->test);
+		msg.hit = memprof_fail_hit();
+		memprof_fail_at(0);
 
-				DEBUG_WARNING("%s: test failed (%m)\n",
-					      tests[i].name, err);
-				return err;
-			}
-		}
+		memprof_get(&mp_stop);
 
-		if (n_skipped) {
-			re_fprintf(stderr, "skipped:%u\n", n_skipped);
+		msg.ix     = ix;
+		msg.blocks = (int64_t)(mp_stop.allocs - mp_start.allocs) -
+			(int64_t)(mp_stop.frees - mp_start.frees);
 
-			/* show any skipped testcase */
-			for (i=0; i<n_skipped; i++) {
-				size_t ix = skipv[i];
-				re_fprintf(stderr, "skip %s\n",
-					   tests[ix].name );
-			}
-		}
+		if (write(fd, &msg, sizeof(msg)) != (ssize_t)sizeof(msg))
+			break;
 	}
 
-	return err;
+	re_thread_close();
+
+	(void)fflush(NULL);
+	_exit(0);
 }
 
 
-static uint64_t tmr_microseconds(void)
+static int oom_start(const struct oom_run *run, struct oom_worker *w)
 {
-	struct timeval now;
-	uint64_t usec;
+	int fds[2];
+	pid_t pid;
 
-	if (0 != gettimeofday(&now, NULL)) {
-		DEBUG_WARNING("jiffies: gettimeofday() failed (%m)\n", errno);
-		return 0;
+	if (pipe(fds) < 0)
+		return errno;
+
+	(void)fflush(NULL);
+
+	pid = fork();
+	if (pid < 0) {
+		int err = errno;
+		(void)close(fds[0]);
+		(void)close(fds[1]);
+		return err;
+	}
+	else if (pid == 0) {
+		(void)close(fds[0]);
+		oom_child(run, w, fds[1]);
 	}
 
-	usec  = (uint64_t)now.tv_sec * (uint64_t)1000000;
-	usec += now.tv_usec;
+	(void)close(fds[1]);
 
-	return usec;
+	w->pid    = pid;
+	w->fd     = fds[0];
+	w->ts     = test_nanoseconds();
+	w->killed = false;
+
+	return 0;
 }
 
 
-/* baseunits here is [usec] (micro-seconds) */
-static int testcase_perf(const struct test *test, double *usec_avgp)
+/* the worker has exited, the run at the next index did not finish */
+static void oom_reap(struct oom_run *run, struct oom_worker *w)
 {
-#define DRYRUN_MIN        2
-#define DRYRUN_MAX      100
-#define DRYRUN_USEC 10*1000
+	int status = 0;
 
-#define REPEATS_MIN         3
-#define REPEATS_MAX      1000
-#define REPEATS_USEC 100*1000
+	(void)close(w->fd);
+	w->fd = -1;
 
-	uint64_t usec_start, usec_stop;
-	double usec_avg;
-	size_t i, n;
-	int err = 0;
+	(void)waitpid(w->pid, &status, 0);
 
-	/* dry run */
-	usec_start = tmr_microseconds();
-	for (i = 1; i <= DRYRUN_MAX; i++) {
+	if (w->next > run->count)
+		return;
 
-		err = test->exec();
-		if (err)
-			return err;
+	if (w->killed) {
+		DEBUG_WARNING("oom: %s: allocation %llu of %llu:"
+			      " timed out\n", run->test->name,
+			      (unsigned long long)w->next,
+			      (unsigned long long)run->count);
+		++run->hangs;
+	}
+	else {
+		DEBUG_WARNING("oom: %s: allocation %llu of %llu:"
+			      " crashed (%s %d)\n", run->test->name,
+			      (unsigned long long)w->next,
+			      (unsigned long long)run->count,
+			      WIFSIGNALED(status) ? "signal" : "status",
+			      WIFSIGNALED(status) ? WTERMSIG(status)
+			      : WEXITSTATUS(status));
+		++run->crashes;
+	}
 
-		usec_stop = tmr_microseconds();
+	w->next += run->stride * run->nworkers;
+	if (w->next <= run->count) {
 
-		if ((usec_stop - usec_start) > DRYRUN_USEC)
-			break;
+		int err = oom_start(run, w);
+		if (err) {
+			DEBUG_WARNING("oom: could not restart worker (%m)\n",
+				      err);
+		}
 	}
+}
 
-	usec_avg = 1.0 * (usec_stop - usec_start) / (double)i;
 
-	n = usec_avg ? (REPEATS_USEC / usec_avg) : 0;
-	n = min(REPEATS_MAX, max(n, REPEATS_MIN));
+static void oom_recv(struct oom_run *run, struct oom_worker *w)
+{
+	struct oom_msg msg;
+	ssize_t n;
 
-	/* now for the real measurement */
-	usec_start = tmr_microseconds();
-	for (i=0; i<n; i++) {
-		err = test->exec();
-		if (err)
-			return err;
-	}
-	usec_stop = tmr_microseconds();
+	n = read(w->fd, &msg, sizeof(msg));
+	if (n < 0 && errno == EINTR)
+		return;
 
-	if (usec_stop <= usec_start) {
-		DEBUG_WARNING("perf: cannot measure, test is too fast\n");
-		return EINVAL;
+	if (n != (ssize_t)sizeof(msg)) {
+		oom_reap(run, w);
+		return;
 	}
 
-	usec_avg = (1.0 * (usec_stop - usec_start)) / i;
+	if (msg.blocks > 0) {
+		DEBUG_WARNING("oom: %s: allocation %llu of %llu:"
+			      " %lld memory blocks leaked\n", run->test->name,
+			      (unsigned long long)msg.ix,
+			      (unsigned long long)run->count,
+			      (long long)msg.blocks);
+		++run->leaks;
+	}
 
-	if (usec_avgp)
-		*usec_avgp = usec_avg;
+	if (msg.hit && msg.err && msg.err != ENOMEM) {
+		++run->errors;
 
-	re_printf("%-32s:  %10.2f usec  [%6u repeats]\n",
-		  test->name, usec_avg, i);
+		if (run->verbose) {
+			re_fprintf(stderr, "    allocation %llu:"
+				   " error code %m\n",
+				   (unsigned long long)msg.ix, msg.err);
+		}
+	}
 
-	return 0;
+	w->next = msg.ix + run->stride * run->nworkers;
+	w->ts   = test_nanoseconds();
 }
 
 
-struct timing {
-	const struct test *test;
-	uint64_t nsec_avg;
-};
+static int testcase_oom_index(const struct test *test, unsigned nworkers,
+			      bool verbose)
+{
+	struct oom_worker *workerv;
+	struct pollfd *pfdv = NULL;
+	struct oom_worker **pwv = NULL;
+	struct memprof mp_start, mp_stop;
+	struct oom_run run;
+	uint64_t start;
+	unsigned i;
+	int err;
 
+	memset(&run, 0, sizeof(run));
+	run.test    = test;
+	run.verbose = verbose;
 
-/*
- * The comparison function must return an integer less than, equal to,
- * or greater than zero if the first argument  is  considered to  be
- * respectively  less  than,  equal  to, or greater than the second.
- *
- * If two members compare as equal, their order in the sorted array
- * is undefined.
- */
-static int timing_cmp(const void *p1, const void *p2)
-{
-	const struct timing *v1 = p1;
-	const struct timing *v2 = p2;
+	/* count the allocations of a normal run */
+	memprof_get(&mp_start);
+	err = test_exec(test);
+	memprof_get(&mp_stop);
 
-	if (v1->nsec_avg < v2->nsec_avg)
-		return 1;
-	else if (v1->nsec_avg > v2->nsec_avg)
-		return -1;
-	else
+	if (err == ESKIPPED || err == ENOSYS)
 		return 0;
-}
+	else if (err) {
+		DEBUG_WARNING("oom: %s: test failed (%m)\n", test->name, err);
+		return err;
+	}
 
+	run.count  = mp_stop.allocs - mp_start.allocs;
+	run.stride = (run.count + OOM_INDEX_MAX - 1) / OOM_INDEX_MAX;
+	run.stride = max(run.stride, 1ULL);
 
-int test_perf(const char *name, bool verbose)
-{
-	int err = 0;
-	unsigned i;
-	(void)verbose;
+	if (!run.count)
+		return 0;
 
-	if (name) {
-		const struct test *test;
+	nworkers = (unsigned)min((uint64_t)nworkers, run.count);
+	run.nworkers = nworkers;
 
-		test = find_test(name);
-		if (!test) {
-			(void)re_fprintf(stderr, "no such test: %s\n", name);
-			return ENOENT;
-		}
+	workerv = mem_zalloc(nworkers * sizeof(*workerv), NULL);
+	pfdv    = mem_zalloc(nworkers * sizeof(*pfdv), NULL);
+	pwv     = mem_zalloc(nworkers * sizeof(*pwv), NULL);
+	if (!workerv || !pfdv || !pwv) {
+		err = ENOMEM;
+		goto out;
+	}
 
-		err = testcase_perf(test, NULL);
-		if (err)
-			return err;
+	for (i=0; i<nworkers; i++)
+		workerv[i].fd = -1;
+
+	start = test_nanoseconds();
+
+	for (i=0; i<nworkers; i++) {
+
+		workerv[i].next = 1 + i * run.stride;
+
+		err = oom_start(&run, &workerv[i]);
+		if (err) {
+			DEBUG_WARNING("oom: fork failed (%m)\n", err);
+			goto out;
+		}
 	}
-	else {
-		struct timing timingv[ARRAY_SIZE(tests)];
 
-		memset(&timingv, 0, sizeof(timingv));
+	for (;;) {
+		const uint64_t now = test_nanoseconds();
+		nfds_t n = 0;
+		int r;
 
-		/* All test cases */
-		for (i=0; i<ARRAY_SIZE(tests); i++) {
+		for (i=0; i<nworkers; i++) {
 
-			struct timing *tim = &timingv[i];
-			double usec_avg;
+			struct oom_worker *w = &workerv[i];
 
-			tim->test = &tests[i];
+			if (w->fd < 0)
+				continue;
 
-			err = testcase_perf(&tests[i],
-					    &usec_avg);
-			if (err) {
-				if (err == ESKIPPED || err == ENOSYS) {
-					re_printf("skipped: %s\n",
-						  tests[i].name);
-					tim->test = NULL;
-					continue;
-				}
-				DEBUG_WARNING("perf: %s failed (%m)\n",
-					      tests[i].name, err);
-				return err;
+			if (!w->killed &&
+			    now - w->ts > OOM_TIMEOUT * 1000000ULL) {
+				(void)kill(w->pid, SIGKILL);
+				w->killed = true;
 			}
 
-			tim->nsec_avg = 1000.0 * usec_avg;
+			pfdv[n].fd      = w->fd;
+			pfdv[n].events  = POLLIN;
+			pfdv[n].revents = 0;
+			pwv[n]          = w;
+			++n;
 		}
 
-		/* sort the timing table by average time */
-		qsort(timingv, ARRAY_SIZE(timingv), sizeof(timingv[0]),
-		      timing_cmp);
-
-		re_fprintf(stderr,
-			   "\nsorted by average timing (slowest on top):\n");
+		if (!n)
+			break;
 
-		for (i=0; i<ARRAY_SIZE(timingv); i++) {
+		r = poll(pfdv, n, 100);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
 
-			struct timing *tim = &timingv[i];
-			double usec_avg = tim->nsec_avg / 1000.0;
+			err = errno;
+			goto out;
+		}
 
-			if (!tim->test)
-				continue;
+		for (i=0; i<n; i++) {
 
-			re_fprintf(stderr, "%-32s: %10.2f usec\n",
-				   tim->test->name, usec_avg);
+			if (pfdv[i].revents & (POLLIN | POLLHUP | POLLERR))
+				oom_recv(&run, pwv[i]);
 		}
-		re_fprintf(stderr, "\n");
 	}
 
-	return 0;
-}
+	if (verbose) {
+		(void)re_fprintf(stderr, "  %-24s: %6llu allocs%s"
+				 "  %u leaks  %u crashes  %u hangs"
+				 "  %u other errors  [%.2f sec]\n",
+				 test->name, (unsigned long long)run.count,
+				 run.stride > 1 ? " (sampled)" : "",
+				 run.leaks, run.crashes, run.hangs,
+				 run.errors,
+				 (test_nanoseconds() - start) / 1e9);
+	}
 
+	if (run.leaks || run.crashes)
+		err = EFAULT;
 
-int test_reg(const char *name, bool verbose)
-{
-	int err;
+ out:
+	if (workerv) {
+		for (i=0; i<nworkers; i++) {
 
-	timeout_override = 10000;
+			struct oom_worker *w = &workerv[i];
 
-	(void)re_fprintf(stderr, "regular tests:       ");
-	err = test_unit(name, verbose);
-	if (err)
-		return err;
-	(void)re_fprintf(stderr, "\x1b[32mOK\x1b[;m\n");
+			if (w->fd < 0)
+				continue;
 
-	return err;
-}
+			(void)kill(w->pid, SIGKILL);
+			(void)close(w->fd);
+			(void)waitpid(w->pid, NULL, 0);
+		}
+	}
 
+	mem_deref(pwv);
+	mem_deref(pfdv);
+	mem_deref(workerv);
 
-#ifdef HAVE_PTHREAD
-struct thread {
-	const struct test *test;
-	pthread_t tid;
-	int err;
-};
+	return err;
+}
+#endif
 
 
-static void *thread_handler(void *arg)
+/**
+ * Run the OOM tests by allocation index, in forked workers
+ *
+ * @param name    Name of a single testcase, or NULL for all
+ * @param verbose True for a summary per testcase
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_oom_index(const char *name, bool verbose)
 {
-	struct thread *thr = arg;
-	int err;
+#if defined (HAVE_FORK) && defined (HAVE_PTHREAD)
+	unsigned nworkers = parallel_shards;
+	unsigned failed = 0;
+	size_t i;
+	int err = 0;
 
-	err = re_thread_init();
-	if (err) {
-		DEBUG_WARNING("thread: re_thread_init failed %m\n", err);
-		thr->err = err;
-		return NULL;
+	if (!memprof_supported()) {
+		(void)re_fprintf(stderr, "no support for allocation"
+				 " profiling\n");
+		return ENOSYS;
 	}
 
-	err = thr->test->exec();
-	if (err) {
-		if (err == ESKIPPED) {
-			err = 0;
-		}
-		else {
+#ifdef _SC_NPROCESSORS_ONLN
+	if (nworkers <= 1)
+		nworkers = (unsigned)max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+#endif
+
+	(void)re_fprintf(stderr, "oom tests by allocation index"
+			 " (%u workers): \n", nworkers);
+
+	if (name) {
+		const struct test *test = find_test(name);
+		if (!test) {
+			(void)re_fprintf(stderr, "no such test: %s\n", name);
+			return ENOENT;
+		}
+
+		err = testcase_oom_index(test, nworkers, verbose);
+	}
+	else {
+		/* All test cases, report all failures */
+		for (i=0; i<ARRAY_SIZE(tests); i++) {
+
+			int e = testcase_oom_index(&tests[i], nworkers,
+						   verbose);
+			if (e == EFAULT) {
+				++failed;
+				continue;
+			}
+			else if (e) {
+				err = e;
+				break;
+			}
+		}
+
+		if (!err && failed) {
+			DEBUG_WARNING("oom: %u testcases leaked or crashed\n",
+				      failed);
+			err = EFAULT;
+		}
+	}
+
+	if (err) {
+		DEBUG_WARNING("oom: %m\n", err);
+	}
+	else {
+		(void)re_fprintf(stderr, "\x1b[32mOK\x1b[;m\t\n");
+	}
+
+	return err;
+#else
+	(void)name;
+	(void)verbose;
+
+	(void)re_fprintf(stderr, "no support for fork\n");
+
+	return ENOSYS;
+#endif
+}
+
+
+static void print_skipped(const size_t *skipv, unsigned n_skipped)
+{
+	unsigned i;
+
+	if (!n_skipped)
+		return;
+
+	re_fprintf(stderr, "skipped:%u\n", n_skipped);
+
+	/* show any skipped testcase */
+	for (i=0; i<n_skipped; i++) {
+		size_t ix = skipv[i];
+		re_fprintf(stderr, "skip %s\n",
+			   tests[ix].name );
+	}
+}
+
+
+struct result {
+	int err;
+	uint64_t nsec;
+	uint64_t allocs;
+	uint64_t bytes;
+	int64_t blocks;            /* blocks not freed, if known */
+	uint64_t peak;             /* peak live bytes            */
+};
+
+
+/* allocation profile of one testcase, per iteration */
+struct alloc_stat {
+	const char *name;
+	double allocs;
+	double bytes;
+	uint64_t peak;
+};
+
+
+enum { ALLOC_TABLE_MAX = 10 };
+
+
+/* peak live bytes between two snapshots, see memprof_reset_peak() */
+static uint64_t peak_bytes(const struct memprof *start,
+			   const struct memprof *stop)
+{
+	return stop->peak > start->cur ? (uint64_t)(stop->peak - start->cur)
+		: 0;
+}
+
+
+static int alloc_cmp(const void *p1, const void *p2)
+{
+	const struct alloc_stat *v1 = p1;
+	const struct alloc_stat *v2 = p2;
+
+	if (v1->bytes < v2->bytes)
+		return 1;
+	else if (v1->bytes > v2->bytes)
+		return -1;
+	else
+		return 0;
+}
+
+
+/* print the most allocation-hungry testcases, sorts the array */
+static void print_alloc_table(struct alloc_stat *statv, size_t n)
+{
+	size_t i;
+
+	if (!memprof_supported() || !n)
+		return;
+
+	qsort(statv, n, sizeof(statv[0]), alloc_cmp);
+
+	re_fprintf(stderr, "\nmost allocation-hungry tests"
+		   " (per iteration):\n");
+	re_fprintf(stderr, "%-32s  %10s  %12s  %12s\n",
+		   "", "allocs", "bytes", "peak bytes");
+
+	for (i=0; i<min(n, (size_t)ALLOC_TABLE_MAX); i++) {
+
+		const struct alloc_stat *st = &statv[i];
+
+		if (!st->name || !st->allocs)
+			break;
+
+		re_fprintf(stderr, "%-32s: %10.1f  %12.1f  %12llu\n",
+			   st->name, st->allocs, st->bytes,
+			   (unsigned long long)st->peak);
+	}
+	re_fprintf(stderr, "\n");
+}
+
+
+/* report the results in the order of the testcases */
+static int report_results(const struct result *resultv, bool verbose,
+			  uint64_t *sump)
+{
+	size_t skipv[ARRAY_SIZE(tests)] = {0};
+	unsigned n_skipped = 0;
+	uint64_t sum = 0;
+	size_t i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(tests); i++) {
+
+		const struct result *res = &resultv[i];
+
+		sum += res->nsec;
+
+		if (verbose) {
+			re_printf("test %zu -- %s  [%.3f ms]\n",
+				  i, tests[i].name, res->nsec / 1e6);
+		}
+
+		if (res->err == ESKIPPED || res->err == ENOSYS) {
+			skipv[n_skipped++] = i;
+			continue;
+		}
+
+		if (res->err) {
+			DEBUG_WARNING("%s: test failed (%m)\n",
+				      tests[i].name, res->err);
+			if (!err)
+				err = res->err;
+		}
+	}
+
+	print_skipped(skipv, n_skipped);
+
+	if (verbose) {
+		struct alloc_stat statv[ARRAY_SIZE(tests)];
+
+		for (i=0; i<ARRAY_SIZE(tests); i++) {
+			statv[i].name   = tests[i].name;
+			statv[i].allocs = (double)resultv[i].allocs;
+			statv[i].bytes  = (double)resultv[i].bytes;
+			statv[i].peak   = resultv[i].peak;
+		}
+
+		print_alloc_table(statv, ARRAY_SIZE(statv));
+	}
+
+	if (sump)
+		*sump = sum;
+
+	return err;
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * Parallel test runner
+ *
+ * Every worker thread has its own queue of pending testcases, which is
+ * filled round-robin before the workers are started. A worker takes
+ * testcases from the front of its own queue, and when that is empty
+ * it steals from the back of the queue of the other workers.
+ */
+
+struct worker {
+	struct runner *runner;
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	size_t queue[ARRAY_SIZE(tests)];
+	size_t head;                       /* next testcase to run      */
+	size_t tail;                       /* end of pending testcases  */
+	unsigned id;
+	unsigned n_run;
+	unsigned n_stolen;
+	bool started;
+};
+
+struct runner {
+	struct worker *workerv;
+	unsigned workerc;
+	struct result resultv[ARRAY_SIZE(tests)];
+};
+
+
+static bool worker_pop(struct worker *w, size_t *ixp)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&w->mutex);
+	if (w->head < w->tail) {
+		*ixp = w->queue[w->head++];
+		found = true;
+	}
+	pthread_mutex_unlock(&w->mutex);
+
+	return found;
+}
+
+
+static bool worker_steal(struct worker *victim, size_t *ixp)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&victim->mutex);
+	if (victim->head < victim->tail) {
+		*ixp = victim->queue[--victim->tail];
+		found = true;
+	}
+	pthread_mutex_unlock(&victim->mutex);
+
+	return found;
+}
+
+
+static bool worker_next(struct worker *w, size_t *ixp)
+{
+	const struct runner *run = w->runner;
+	unsigned i;
+
+	if (worker_pop(w, ixp))
+		return true;
+
+	for (i=1; i<run->workerc; i++) {
+
+		struct worker *victim;
+
+		victim = &run->workerv[(w->id + i) % run->workerc];
+
+		if (worker_steal(victim, ixp)) {
+			++w->n_stolen;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+static void *worker_handler(void *arg)
+{
+	struct worker *w = arg;
+	size_t ix;
+	int err;
+
+	err = re_thread_init();
+	if (err) {
+		/* the pending testcases are stolen by the other workers */
+		DEBUG_WARNING("worker %u: re_thread_init failed (%m)\n",
+			      w->id, err);
+		return NULL;
+	}
+
+	while (worker_next(w, &ix)) {
+
+		struct result *res = &w->runner->resultv[ix];
+		struct memprof mp_start, mp_stop;
+		uint64_t start = test_nanoseconds();
+
+		memprof_reset_peak();
+		memprof_get(&mp_start);
+
+		res->err  = test_exec(&tests[ix]);
+		res->nsec = test_nanoseconds() - start;
+
+		memprof_get(&mp_stop);
+
+		res->allocs = mp_stop.allocs - mp_start.allocs;
+		res->bytes  = mp_stop.bytes  - mp_start.bytes;
+		res->peak   = peak_bytes(&mp_start, &mp_stop);
+
+		++w->n_run;
+	}
+
+	re_thread_close();
+
+	return NULL;
+}
+
+
+static int test_unit_parallel(unsigned jobs, bool verbose)
+{
+	struct runner *run;
+	unsigned n_stolen = 0;
+	uint64_t start, sum = 0;
+	size_t i;
+	int err = 0;
+
+	run = mem_zalloc(sizeof(*run), NULL);
+	if (!run)
+		return ENOMEM;
+
+	run->workerc = min(jobs, (unsigned)ARRAY_SIZE(tests));
+	run->workerv = mem_zalloc(run->workerc * sizeof(*run->workerv),
+				  NULL);
+	if (!run->workerv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<run->workerc; i++) {
+
+		struct worker *w = &run->workerv[i];
+
+		w->runner = run;
+		w->id     = (unsigned)i;
+		pthread_mutex_init(&w->mutex, NULL);
+	}
+
+	for (i=0; i<ARRAY_SIZE(tests); i++) {
+
+		struct worker *w = &run->workerv[i % run->workerc];
+
+		w->queue[w->tail++] = i;
+		run->resultv[i].err = ECANCELED;   /* not run yet */
+	}
+
+	start = test_nanoseconds();
+
+	for (i=0; i<run->workerc; i++) {
+
+		struct worker *w = &run->workerv[i];
+
+		err = pthread_create(&w->tid, NULL, worker_handler, w);
+		if (err) {
+			DEBUG_WARNING("pthread_create failed (%m)\n", err);
+			continue;
+		}
+
+		w->started = true;
+	}
+
+	for (i=0; i<run->workerc; i++) {
+
+		struct worker *w = &run->workerv[i];
+
+		if (w->started)
+			pthread_join(w->tid, NULL);
+
+		pthread_mutex_destroy(&w->mutex);
+
+		n_stolen += w->n_stolen;
+	}
+
+	err = report_results(run->resultv, verbose, &sum);
+
+	re_fprintf(stderr, "%u workers: %.2f sec wall, %.2f sec test time,"
+		   " %u stolen  ",
+		   run->workerc, (test_nanoseconds() - start) / 1e9,
+		   sum / 1e9, n_stolen);
+
+ out:
+	mem_deref(run->workerv);
+	mem_deref(run);
+
+	return err;
+}
+#endif
+
+
+#if defined (HAVE_FORK) && defined (HAVE_PTHREAD)
+/*
+ * Forked test runner
+ *
+ * The testcases are split into shards, and every shard runs in its own
+ * child process. The child streams one result per testcase back over a
+ * pipe. A child that crashes, or is killed because a testcase timed
+ * out, is restarted with the next testcase of the shard.
+ *
+ * The child uses re_thread_init() to get a fresh main loop instead of
+ * the one inherited from the parent.
+ */
+
+enum {
+	SHARD_TIMEOUT = 60000,       /* max time per testcase [ms] */
+	SHARD_POLL    = 100,
+};
+
+struct shard_msg {
+	uint32_t ix;
+	int32_t err;
+	uint64_t nsec;
+	uint64_t allocs;
+	uint64_t bytes;
+	int64_t blocks;
+	uint64_t peak;
+};
+
+struct shard {
+	pid_t pid;
+	int fd;                            /* read end, -1 if no child  */
+	size_t ixv[ARRAY_SIZE(tests)];
+	size_t ixc;
+	size_t next;                       /* next testcase to finish   */
+	uint64_t ts;                       /* start of current testcase */
+	bool killed;
+	unsigned restarts;
+};
+
+
+static void shard_child(const struct shard *sh, int fd)
+{
+	size_t i;
+	int err;
+
+	err = re_thread_init();
+	if (err) {
+		DEBUG_WARNING("shard: re_thread_init failed (%m)\n", err);
+		_exit(1);
+	}
+
+	for (i=sh->next; i<sh->ixc; i++) {
+
+		struct shard_msg msg;
+		struct memprof mp_start, mp_stop;
+		struct memstat ms_start, ms_stop;
+		uint64_t start;
+		size_t ix = sh->ixv[i];
+
+		memset(&msg, 0, sizeof(msg));
+		memset(&ms_start, 0, sizeof(ms_start));
+		memset(&ms_stop, 0, sizeof(ms_stop));
+
+		(void)mem_get_stat(&ms_start);
+		memprof_reset_peak();
+		memprof_get(&mp_start);
+		start = test_nanoseconds();
+
+		msg.ix  = (uint32_t)ix;
+		msg.err = test_exec(&tests[ix]);
+
+		msg.nsec = test_nanoseconds() - start;
+		memprof_get(&mp_stop);
+		(void)mem_get_stat(&ms_stop);
+
+		msg.allocs = mp_stop.allocs - mp_start.allocs;
+		msg.bytes  = mp_stop.bytes  - mp_start.bytes;
+		msg.peak   = peak_bytes(&mp_start, &mp_stop);
+		msg.blocks = (int64_t)ms_stop.blocks_cur -
+			(int64_t)ms_start.blocks_cur;
+
+		/* the message is smaller than PIPE_BUF, so it is atomic */
+		if (write(fd, &msg, sizeof(msg)) != (ssize_t)sizeof(msg))
+			break;
+	}
+
+	re_thread_close();
+
+	(void)fflush(NULL);
+	_exit(0);
+}
+
+
+static int shard_start(struct shard *sh)
+{
+	int fds[2];
+	pid_t pid;
+
+	if (pipe(fds) < 0)
+		return errno;
+
+	/* do not duplicate buffered output into the child */
+	(void)fflush(NULL);
+
+	pid = fork();
+	if (pid < 0) {
+		int err = errno;
+		(void)close(fds[0]);
+		(void)close(fds[1]);
+		return err;
+	}
+	else if (pid == 0) {
+		(void)close(fds[0]);
+		shard_child(sh, fds[1]);
+	}
+
+	(void)close(fds[1]);
+
+	sh->pid    = pid;
+	sh->fd     = fds[0];
+	sh->ts     = test_nanoseconds();
+	sh->killed = false;
+
+	return 0;
+}
+
+
+/* the child has exited, record the testcase it did not finish */
+static void shard_reap(struct shard *sh, struct result *resultv)
+{
+	int status = 0;
+
+	(void)close(sh->fd);
+	sh->fd = -1;
+
+	(void)waitpid(sh->pid, &status, 0);
+
+	if (sh->next >= sh->ixc)
+		return;
+
+	if (sh->killed) {
+		DEBUG_WARNING("%s: timed out after %u ms, killed\n",
+			      tests[sh->ixv[sh->next]].name, SHARD_TIMEOUT);
+		resultv[sh->ixv[sh->next]].err = ETIMEDOUT;
+	}
+	else {
+		if (WIFSIGNALED(status)) {
+			DEBUG_WARNING("%s: crashed (signal %d)\n",
+				      tests[sh->ixv[sh->next]].name,
+				      WTERMSIG(status));
+		}
+		else {
+			DEBUG_WARNING("%s: child exited (status %d)\n",
+				      tests[sh->ixv[sh->next]].name,
+				      WEXITSTATUS(status));
+		}
+		resultv[sh->ixv[sh->next]].err = EFAULT;
+	}
+
+	resultv[sh->ixv[sh->next]].nsec = test_nanoseconds() - sh->ts;
+
+	/* continue with the rest of the shard in a new child */
+	++sh->next;
+	if (sh->next < sh->ixc) {
+
+		int err = shard_start(sh);
+		if (err) {
+			DEBUG_WARNING("shard: could not restart (%m)\n", err);
+			return;
+		}
+
+		++sh->restarts;
+	}
+}
+
+
+static void shard_recv(struct shard *sh, struct result *resultv)
+{
+	struct shard_msg msg;
+	ssize_t n;
+
+	n = read(sh->fd, &msg, sizeof(msg));
+	if (n < 0 && errno == EINTR)
+		return;
+
+	if (n != (ssize_t)sizeof(msg) || msg.ix >= ARRAY_SIZE(tests)) {
+		shard_reap(sh, resultv);
+		return;
+	}
+
+	resultv[msg.ix].err    = msg.err;
+	resultv[msg.ix].nsec   = msg.nsec;
+	resultv[msg.ix].allocs = msg.allocs;
+	resultv[msg.ix].bytes  = msg.bytes;
+	resultv[msg.ix].blocks = msg.blocks;
+	resultv[msg.ix].peak   = msg.peak;
+
+	if (msg.blocks > 0) {
+		DEBUG_WARNING("%s: %lld memory blocks not freed\n",
+			      tests[msg.ix].name, (long long)msg.blocks);
+	}
+
+	++sh->next;
+	sh->ts = test_nanoseconds();
+}
+
+
+static int test_unit_fork(unsigned nshards, bool verbose)
+{
+	struct result resultv[ARRAY_SIZE(tests)];
+	struct pollfd pfdv[ARRAY_SIZE(tests)];
+	struct shard *shardv;
+	uint64_t start, sum = 0, allocs = 0, bytes = 0;
+	unsigned restarts = 0;
+	size_t i;
+	int err = 0;
+
+	nshards = min(nshards, (unsigned)ARRAY_SIZE(tests));
+
+	shardv = mem_zalloc(nshards * sizeof(*shardv), NULL);
+	if (!shardv)
+		return ENOMEM;
+
+	memset(resultv, 0, sizeof(resultv));
+
+	for (i=0; i<nshards; i++)
+		shardv[i].fd = -1;
+
+	for (i=0; i<ARRAY_SIZE(tests); i++) {
+
+		struct shard *sh = &shardv[i % nshards];
+
+		sh->ixv[sh->ixc++] = i;
+		resultv[i].err = ECANCELED;   /* not run yet */
+	}
+
+	start = test_nanoseconds();
+
+	for (i=0; i<nshards; i++) {
+
+		err = shard_start(&shardv[i]);
+		if (err) {
+			DEBUG_WARNING("shard: fork failed (%m)\n", err);
+			goto out;
+		}
+	}
+
+	for (;;) {
+		struct shard *pshv[ARRAY_SIZE(tests)];
+		const uint64_t now = test_nanoseconds();
+		nfds_t n = 0;
+		int r;
+
+		for (i=0; i<nshards; i++) {
+
+			struct shard *sh = &shardv[i];
+
+			if (sh->fd < 0)
+				continue;
+
+			/* kill the child if the testcase hangs */
+			if (!sh->killed &&
+			    now - sh->ts > SHARD_TIMEOUT * 1000000ULL) {
+				(void)kill(sh->pid, SIGKILL);
+				sh->killed = true;
+			}
+
+			pfdv[n].fd      = sh->fd;
+			pfdv[n].events  = POLLIN;
+			pfdv[n].revents = 0;
+			pshv[n]         = sh;
+			++n;
+		}
+
+		if (!n)
+			break;
+
+		r = poll(pfdv, n, SHARD_POLL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err = errno;
+			goto out;
+		}
+
+		for (i=0; i<n; i++) {
+
+			if (pfdv[i].revents & (POLLIN | POLLHUP | POLLERR))
+				shard_recv(pshv[i], resultv);
+		}
+	}
+
+	for (i=0; i<nshards; i++)
+		restarts += shardv[i].restarts;
+
+	for (i=0; i<ARRAY_SIZE(tests); i++) {
+		allocs += resultv[i].allocs;
+		bytes  += resultv[i].bytes;
+	}
+
+	err = report_results(resultv, verbose, &sum);
+
+	re_fprintf(stderr, "%u shards: %.2f sec wall, %.2f sec test time,"
+		   " %llu allocs, %llu bytes, %u restarts  ",
+		   nshards, (test_nanoseconds() - start) / 1e9, sum / 1e9,
+		   (unsigned long long)allocs, (unsigned long long)bytes,
+		   restarts);
+
+ out:
+	/* clean up any remaining children on error */
+	for (i=0; i<nshards; i++) {
+
+		struct shard *sh = &shardv[i];
+
+		if (sh->fd < 0)
+			continue;
+
+		(void)kill(sh->pid, SIGKILL);
+		(void)close(sh->fd);
+		(void)waitpid(sh->pid, NULL, 0);
+	}
+
+	mem_deref(shardv);
+
+	return err;
+}
+#endif
+
+
+/* run one testcase, with event-loop statistics if enabled */
+static int testcase_exec(const struct test *test, struct loopstat *ls)
+{
+	int err;
+
+	if (!ls)
+		return test_exec(test);
+
+	loopstat_reset(ls);
+	loopstat_enable(ls);
+
+	err = test_exec(test);
+
+	loopstat_enable(NULL);
+
+	if (!loopstat_isempty(ls)) {
+		re_printf("  %s: event loop\n%H", test->name,
+			  loopstat_print, ls);
+	}
+
+	return err;
+}
+
+
+static int test_unit(const char *name, bool verbose)
+{
+	size_t skipv[ARRAY_SIZE(tests)] = {0};
+	struct loopstat *ls = NULL;
+	size_t i;
+	int err = 0;
+
+	/* only for testcases that run on this thread */
+	if (loopstat_enabled &&
+	    (name || (parallel_shards <= 1 && parallel_jobs <= 1))) {
+		err = loopstat_alloc(&ls);
+		if (err)
+			return err;
+	}
+
+	if (name) {
+		const struct test *test = find_test(name);
+		if (!test) {
+			(void)re_fprintf(stderr, "no such test: %s\n", name);
+			err = ENOENT;
+			goto out;
+		}
+
+		err = testcase_exec(test, ls);
+		if (err) {
+			DEBUG_WARNING("%s: test failed (%m)\n", name, err);
+			goto out;
+		}
+	}
+	else if (parallel_shards > 1) {
+#if defined (HAVE_FORK) && defined (HAVE_PTHREAD)
+		err = test_unit_fork(parallel_shards, verbose);
+#else
+		(void)re_fprintf(stderr, "no support for fork\n");
+		err = ENOSYS;
+#endif
+	}
+	else if (parallel_jobs > 1) {
+#ifdef HAVE_PTHREAD
+		err = test_unit_parallel(parallel_jobs, verbose);
+#else
+		(void)re_fprintf(stderr, "no support for threads\n");
+		err = ENOSYS;
+#endif
+	}
+	else {
+		struct alloc_stat statv[ARRAY_SIZE(tests)];
+		unsigned n_skipped = 0;
+
+		memset(statv, 0, sizeof(statv));
+
+		for (i=0; i<ARRAY_SIZE(tests); i++) {
+
+			struct memprof mp_start, mp_stop;
+
+			if (verbose) {
+				re_printf("test %u -- %s\n",
+					  i, tests[i].name);
+			}
+
+			memprof_reset_peak();
+			memprof_get(&mp_start);
+
+			err = testcase_exec(&tests[i], ls);
+
+			memprof_get(&mp_stop);
+
+			statv[i].name   = tests[i].name;
+			statv[i].allocs = (double)(mp_stop.allocs -
+						   mp_start.allocs);
+			statv[i].bytes  = (double)(mp_stop.bytes -
+						   mp_start.bytes);
+			statv[i].peak   = peak_bytes(&mp_start, &mp_stop);
+
+			if (err) {
+				if (err == ESKIPPED || err == ENOSYS) {
+
+					skipv[n_skipped] = i;
+
+					++n_skipped;
+					err = 0;
+					continue;
+				}
+
+				DEBUG_WARNING("%s: test failed (%m)\n",
+					      tests[i].name, err);
+				goto out;
+			}
+		}
+
+		print_skipped(skipv, n_skipped);
+
+		if (verbose)
+			print_alloc_table(statv, ARRAY_SIZE(statv));
+	}
+
+ out:
+	mem_deref(ls);
+
+	return err;
+}
+
+
+uint64_t test_nanoseconds(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec now;
+
+	if (0 != clock_gettime(CLOCK_MONOTONIC, &now)) {
+		DEBUG_WARNING("clock_gettime() failed (%m)\n", errno);
+		return 0;
+	}
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#else
+	struct timeval now;
+
+	if (0 != gettimeofday(&now, NULL)) {
+		DEBUG_WARNING("gettimeofday() failed (%m)\n", errno);
+		return 0;
+	}
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_usec * 1000ULL;
+#endif
+}
+
+
+/* CPU time of the calling thread, or 0 if not supported */
+uint64_t test_cpu_nanoseconds(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec now;
+
+	if (0 != clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now))
+		return 0;
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+
+struct timing {
+	const struct test *test;
+	uint64_t nsec_avg;
+	uint64_t nsec_p99;
+	unsigned repeats;
+	struct alloc_stat alloc;
+};
+
+
+/*
+ * baseunits here is [nsec] (nano-seconds)
+ *
+ * Every iteration is timed with the monotonic clock and recorded
+ * in a histogram, so that the tail latency is visible. If counters
+ * are given they are only enabled around the testcase itself.
+ */
+static int testcase_perf(const struct test *test, struct timing *tim,
+			 struct perf_report *rep, struct perfcnt *pc)
+{
+#define DRYRUN_MIN        2
+#define DRYRUN_MAX      100
+#define DRYRUN_NSEC  10*1000*1000
+
+#define REPEATS_MIN         3
+#define REPEATS_MAX     10000
+#define REPEATS_NSEC 100*1000*1000
+
+	struct hist *hist = NULL;
+	struct memprof mp_start, mp_stop;
+	struct alloc_stat alloc;
+	uint64_t nsec_start, nsec_stop = 0;
+	double nsec_avg;
+	size_t i, n;
+	int err = 0;
+
+	err = hist_alloc(&hist);
+	if (err)
+		return err;
+
+	/* dry run */
+	test_rand_stream(test->name, 0);
+	nsec_start = test_nanoseconds();
+	for (i = 1; i <= DRYRUN_MAX; i++) {
+
+		err = test->exec();
+		if (err)
+			goto out;
+
+		nsec_stop = test_nanoseconds();
+
+		if ((nsec_stop - nsec_start) > DRYRUN_NSEC)
+			break;
+	}
+
+	nsec_avg = 1.0 * (nsec_stop - nsec_start) / (double)i;
+
+	n = nsec_avg ? (REPEATS_NSEC / nsec_avg) : 0;
+	n = min(REPEATS_MAX, max(n, REPEATS_MIN));
+
+	/* now for the real measurement */
+	test_rand_stream(test->name, 0);
+	perfcnt_reset(pc);
+	memprof_reset_peak();
+	memprof_get(&mp_start);
+	profile_set_label(test->name);
+	for (i=0; i<n; i++) {
+
+		perfcnt_enable(pc);
+		nsec_start = test_nanoseconds();
+
+		err = test->exec();
+
+		nsec_stop = test_nanoseconds();
+		perfcnt_disable(pc);
+
+		if (err) {
+			profile_set_label(NULL);
+			goto out;
+		}
+
+		hist_record(hist, nsec_stop - nsec_start);
+	}
+	profile_set_label(NULL);
+	memprof_get(&mp_stop);
+
+	if (hist_max(hist) == 0) {
+		DEBUG_WARNING("perf: cannot measure, test is too fast\n");
+		err = EINVAL;
+		goto out;
+	}
+
+	alloc.name   = test->name;
+	alloc.allocs = (double)(mp_stop.allocs - mp_start.allocs) / (double)n;
+	alloc.bytes  = (double)(mp_stop.bytes - mp_start.bytes) / (double)n;
+	alloc.peak   = peak_bytes(&mp_start, &mp_stop);
+
+	if (tim) {
+		nsec_avg = hist_mean(hist);
+
+		tim->nsec_avg = (uint64_t)nsec_avg;
+		tim->nsec_p99 = hist_percentile(hist, 99.0);
+		tim->repeats  = (unsigned)hist_count(hist);
+		tim->alloc    = alloc;
+	}
+
+	if (rep) {
+		err = perf_report_add(rep, test->name, hist, alloc.allocs,
+				      alloc.bytes, alloc.peak);
+		if (err)
+			goto out;
+	}
+
+	re_printf("%-32s:  %10.2f usec  [%6u repeats]  %H usec\n",
+		  test->name, hist_mean(hist) / 1000.0,
+		  (unsigned)hist_count(hist), hist_print, hist);
+
+	if (pc) {
+		struct perfcnt_val val;
+
+		err = perfcnt_read(pc, &val);
+		if (err) {
+			DEBUG_WARNING("perf: could not read counters (%m)\n",
+				      err);
+			goto out;
+		}
+
+		re_printf("%-32s   %H\n", "",
+			  perfcnt_print, &val, (uint64_t)n);
+
+		if (rep) {
+			err = perf_report_add_counters(rep, &val, n);
+			if (err)
+				goto out;
+		}
+	}
+
+ out:
+	mem_deref(hist);
+
+	return err;
+}
+
+
+/*
+ * The comparison function must return an integer less than, equal to,
+ * or greater than zero if the first argument  is  considered to  be
+ * respectively  less  than,  equal  to, or greater than the second.
+ *
+ * If two members compare as equal, their order in the sorted array
+ * is undefined.
+ */
+static int timing_cmp(const void *p1, const void *p2)
+{
+	const struct timing *v1 = p1;
+	const struct timing *v2 = p2;
+
+	if (v1->nsec_avg < v2->nsec_avg)
+		return 1;
+	else if (v1->nsec_avg > v2->nsec_avg)
+		return -1;
+	else
+		return 0;
+}
+
+
+/* write the report and compare it with the baseline, if configured */
+static int perf_report_finish(const struct perf_report *rep)
+{
+	int err;
+
+	if (!rep)
+		return 0;
+
+	if (perf_cfg.json) {
+		err = perf_report_write(rep, perf_cfg.json);
+		if (err)
+			return err;
+
+		re_fprintf(stderr, "performance report written to %s\n",
+			   perf_cfg.json);
+	}
+
+	if (perf_cfg.baseline) {
+		unsigned nreg = 0;
+
+		err = perf_report_compare(rep, perf_cfg.baseline,
+					  perf_cfg.threshold, &nreg);
+		if (err)
+			return err;
+
+		if (nreg) {
+			re_fprintf(stderr, "%u performance regressions"
+				   " (more than %.1f%% slower)\n",
+				   nreg, perf_cfg.threshold);
+			return ERANGE;
+		}
+	}
+
+	return 0;
+}
+
+
+int test_perf(const char *name, bool verbose)
+{
+	struct perf_report *rep = NULL;
+	struct perfcnt *pc = NULL;
+	const bool budgets = test_budget_enabled();
+	bool profiling = false;
+	int err = 0;
+	unsigned i;
+	(void)verbose;
+
+	if (perf_cfg.json || perf_cfg.baseline) {
+		err = perf_report_alloc(&rep);
+		if (err)
+			return err;
+	}
+
+	/* the cost budgets of the testcases apply in the perf mode */
+	test_budget_enable(true);
+
+	if (perf_cfg.counters) {
+		err = perfcnt_alloc(&pc);
+		if (err) {
+			(void)re_fprintf(stderr, "performance counters"
+					 " not available (%m)\n", err);
+			goto out;
+		}
+	}
+
+	if (perf_cfg.profile) {
+		err = profile_start(PROFILE_HZ);
+		if (err) {
+			(void)re_fprintf(stderr, "profiler not available"
+					 " (%m)\n", err);
+			goto out;
+		}
+
+		profiling = true;
+	}
+
+	if (name) {
+		const struct test *test;
+
+		test = find_test(name);
+		if (!test) {
+			(void)re_fprintf(stderr, "no such test: %s\n", name);
+			err = ENOENT;
+			goto out;
+		}
+
+		err = testcase_perf(test, NULL, rep, pc);
+		if (err)
+			goto out;
+	}
+	else {
+		struct timing timingv[ARRAY_SIZE(tests)];
+
+		memset(&timingv, 0, sizeof(timingv));
+
+		/* All test cases */
+		for (i=0; i<ARRAY_SIZE(tests); i++) {
+
+			struct timing *tim = &timingv[i];
+
+			tim->test = &tests[i];
+
+			err = testcase_perf(&tests[i], tim, rep, pc);
+			if (err) {
+				if (err == ESKIPPED || err == ENOSYS) {
+					re_printf("skipped: %s\n",
+						  tests[i].name);
+					tim->test = NULL;
+					err = 0;
+					continue;
+				}
+				DEBUG_WARNING("perf: %s failed (%m)\n",
+					      tests[i].name, err);
+				goto out;
+			}
+		}
+
+		/* sort the timing table by average time */
+		qsort(timingv, ARRAY_SIZE(timingv), sizeof(timingv[0]),
+		      timing_cmp);
+
+		re_fprintf(stderr,
+			   "\nsorted by average timing (slowest on top):\n");
+
+		for (i=0; i<ARRAY_SIZE(timingv); i++) {
+
+			struct timing *tim = &timingv[i];
+			double usec_avg = tim->nsec_avg / 1000.0;
+			double usec_p99 = tim->nsec_p99 / 1000.0;
+
+			if (!tim->test)
+				continue;
+
+			re_fprintf(stderr, "%-32s: %10.2f usec"
+				   "  (p99 %10.2f usec)\n",
+				   tim->test->name, usec_avg, usec_p99);
+		}
+		re_fprintf(stderr, "\n");
+
+		{
+			struct alloc_stat statv[ARRAY_SIZE(tests)];
+
+			for (i=0; i<ARRAY_SIZE(tests); i++)
+				statv[i] = timingv[i].alloc;
+
+			print_alloc_table(statv, ARRAY_SIZE(statv));
+		}
+	}
+
+	err = perf_report_finish(rep);
+	if (err)
+		goto out;
+
+ out:
+	/* do not overwrite the file if the profiler never ran */
+	if (profiling) {
+		int e = profile_write(perf_cfg.profile);
+		if (!err)
+			err = e;
+	}
+
+	test_budget_enable(budgets);
+
+	mem_deref(pc);
+	mem_deref(rep);
+
+	return err;
+}
+
+
+/**
+ * Set the output and baseline files for the performance tests
+ *
+ * @param json      Write the results as JSON to this file (optional)
+ * @param baseline  Compare the results with this JSON file (optional)
+ * @param threshold Max allowed slowdown vs. the baseline in percent
+ */
+void test_perf_set_report(const char *json, const char *baseline,
+			  double threshold)
+{
+	perf_cfg.json      = json;
+	perf_cfg.baseline  = baseline;
+	perf_cfg.threshold = threshold;
+}
+
+
+/**
+ * Run a sampling profiler during the performance tests
+ *
+ * @param filename Output file for the folded stacks, NULL to disable
+ */
+void test_perf_set_profile(const char *filename)
+{
+	perf_cfg.profile = filename;
+}
+
+
+/**
+ * Collect performance counters for the performance tests
+ *
+ * @param enable True to enable counters
+ */
+void test_perf_set_counters(bool enable)
+{
+	perf_cfg.counters = enable;
+}
+
+
+/*
+ * Microbenchmarks
+ *
+ * The run handler is calibrated on one thread until it takes at least
+ * BENCH_CALIB_NSEC, and then sampled BENCH_SAMPLES times with the
+ * same number of iterations on every thread. The histogram holds the
+ * time per iteration of each sample. With performance counters, the
+ * single-threaded runs also report the CPU cycles per byte.
+ */
+
+enum {
+	BENCH_CALIB_NSEC  = 10*1000*1000,
+	BENCH_SAMPLE_NSEC = 20*1000*1000,
+	BENCH_SAMPLES     = 10,
+	BENCH_PARAM_MUL   = 4,
+	BENCH_OUT_EXTRA   = 4096,
+};
+
+
+struct bench_start {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+	unsigned variant;
+	size_t param;
+	void *shared;          /* from the shared handler of the bench */
+	uint64_t iterations;   /* calibrated by the first thread */
+	unsigned ready;
+	bool go;
+};
+
+struct bench_thread {
+	const struct bench *bench;
+	unsigned ix;
+	struct bench_state st;
+	struct bench_start *start;
+	struct hist *hist;
+	struct memprof mp_start;
+	struct memprof mp_stop;
+	uint64_t nsec;
+	uint64_t iters;
+#ifdef HAVE_PTHREAD
+	pthread_t tid;
+#endif
+	int err;
+};
+
+
+static volatile uintptr_t bench_sinkv;
+
+
+/* used by BENCH_SINK if the compiler has no inline assembly */
+void bench_sink(uintptr_t v)
+{
+	bench_sinkv = v;
+}
+
+
+static int bench_state_init(struct bench_state *st, const struct bench *b,
+			    unsigned variant, size_t param, unsigned thread,
+			    void *shared)
+{
+	memset(st, 0, sizeof(*st));
+
+	st->shared   = shared;
+	st->param    = param;
+	st->variant  = variant;
+	st->thread   = thread;
+	st->bytes    = param;
+	st->items    = 1;
+	st->out_size = 2 * param + BENCH_OUT_EXTRA;
+
+	st->in  = mem_alloc(param + 1, NULL);
+	st->out = mem_alloc(st->out_size, NULL);
+	if (!st->in || !st->out)
+		return ENOMEM;
+
+	test_rand_stream(b->name, (uint32_t)thread);
+	test_rand_bytes(st->in, param);
+
+	return b->setup ? b->setup(st) : 0;
+}
+
+
+static void bench_state_close(struct bench_state *st, const struct bench *b)
+{
+	if (b->teardown)
+		b->teardown(st);
+
+	st->arg = mem_deref(st->arg);
+	st->in  = mem_deref(st->in);
+	st->out = mem_deref(st->out);
+}
+
+
+/* find the number of iterations for one sample */
+static int bench_calibrate(const struct bench *b, struct bench_state *st)
+{
+	uint64_t n = 1;
+
+	for (;;) {
+		uint64_t start, nsec;
+		int err;
+
+		st->iterations = n;
+
+		start = test_nanoseconds();
+		err = b->run(st);
+		if (err)
+			return err;
+		nsec = test_nanoseconds() - start;
+
+		if (nsec >= BENCH_CALIB_NSEC || n >= (1ULL << 32)) {
+			uint64_t iters;
+
+			iters = n * BENCH_SAMPLE_NSEC / max(nsec, 1ULL);
+
+			st->iterations = max(iters, 1ULL);
+			return 0;
+		}
+
+		n *= 2;
+	}
+}
+
+
+static void bench_sample(struct bench_thread *bt)
+{
+	unsigned i;
+
+	memprof_reset_peak();
+	memprof_get(&bt->mp_start);
+
+	for (i=0; i<BENCH_SAMPLES; i++) {
+
+		uint64_t start, nsec;
+
+		start = test_nanoseconds();
+		bt->err = bt->bench->run(&bt->st);
+		nsec = test_nanoseconds() - start;
+
+		if (bt->err)
+			break;
+
+		hist_record(bt->hist, nsec / bt->st.iterations);
+
+		bt->nsec  += nsec;
+		bt->iters += bt->st.iterations;
+	}
+
+	memprof_get(&bt->mp_stop);
+}
+
+
+#ifdef HAVE_PTHREAD
+/*
+ * The setup and teardown run on this thread, like the run handler, so
+ * that objects bound to the event loop of the thread stay on it. The
+ * first thread calibrates, the others take its number of iterations.
+ */
+static void *bench_thread_handler(void *arg)
+{
+	struct bench_thread *bt = arg;
+	struct bench_start *start = bt->start;
+	int err;
+
+	/* for benchmarks that run an event loop */
+	err = re_thread_init();
+	if (err) {
+		bt->err = err;
+		goto wait;
+	}
+
+	bt->err = bench_state_init(&bt->st, bt->bench, start->variant,
+				   start->param, bt->ix, start->shared);
+	if (!bt->err && bt->ix == 0)
+		bt->err = bench_calibrate(bt->bench, &bt->st);
+
+ wait:
+	pthread_mutex_lock(&start->mutex);
+	if (bt->ix == 0 && !bt->err)
+		start->iterations = bt->st.iterations;
+	++start->ready;
+	pthread_cond_broadcast(&start->cond);
+	while (!start->go)
+		pthread_cond_wait(&start->cond, &start->mutex);
+	pthread_mutex_unlock(&start->mutex);
+
+	if (err)
+		return NULL;
+
+	/* the first thread failed and has the error */
+	if (!bt->err && !start->iterations)
+		bt->err = ECANCELED;
+
+	if (!bt->err) {
+		bt->st.iterations = start->iterations;
+		bench_sample(bt);
+	}
+
+	bench_state_close(&bt->st, bt->bench);
+
+	re_thread_close();
+
+	return NULL;
+}
+#endif
+
+
+static int bench_run(const struct bench *b, unsigned variant, size_t param,
+		     unsigned nthreads, struct perf_report *rep,
+		     struct perfcnt *pc, bool verbose)
+{
+	struct bench_thread *btv;
+	struct bench_start start;
+	struct perfcnt_val val;
+	struct hist *hist = NULL;
+	uint64_t wall, iters = 0, allocs = 0, bytes = 0;
+	char label[64];
+	unsigned i, nstarted = 0;
+	double nsec, thru_b, thru_i;
+	int err;
+
+	memset(&start, 0, sizeof(start));
+
+	start.variant = variant;
+	start.param   = param;
+
+	btv = mem_zalloc(nthreads * sizeof(*btv), NULL);
+	if (!btv)
+		return ENOMEM;
+
+	err = hist_alloc(&hist);
+	if (err)
+		goto out;
+
+	for (i=0; i<nthreads; i++) {
+
+		struct bench_thread *bt = &btv[i];
+
+		bt->bench = b;
+		bt->ix    = i;
+		bt->start = &start;
+
+		err = hist_alloc(&bt->hist);
+		if (err)
+			goto out;
+	}
+
+	if (b->shared) {
+		err = b->shared(&start.shared, param);
+		if (err)
+			goto out;
+	}
+
+	if (nthreads == 1) {
+
+		err = bench_state_init(&btv[0].st, b, variant, param, 0,
+				       start.shared);
+		if (err)
+			goto out;
+
+		err = bench_calibrate(b, &btv[0].st);
+		if (err)
+			goto out;
+	}
+
+	wall = test_nanoseconds();
+
+	profile_set_label(b->name);
+
+	/* the counters are per thread */
+	if (nthreads > 1)
+		pc = NULL;
+
+	if (nthreads == 1) {
+		perfcnt_reset(pc);
+		perfcnt_enable(pc);
+		bench_sample(&btv[0]);
+		perfcnt_disable(pc);
+	}
+	else {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_init(&start.mutex, NULL);
+		pthread_cond_init(&start.cond, NULL);
+
+		for (i=0; i<nthreads; i++) {
+
+			err = pthread_create(&btv[i].tid, NULL,
+					     bench_thread_handler, &btv[i]);
+			if (err)
+				break;
+
+			++nstarted;
+		}
+
+		/* start all threads at once, when they are set up */
+		pthread_mutex_lock(&start.mutex);
+		while (start.ready < nstarted)
+			pthread_cond_wait(&start.cond, &start.mutex);
+		start.go = true;
+		wall = test_nanoseconds();
+		pthread_cond_broadcast(&start.cond);
+		pthread_mutex_unlock(&start.mutex);
+
+		for (i=0; i<nstarted; i++)
+			pthread_join(btv[i].tid, NULL);
+
+		pthread_cond_destroy(&start.cond);
+		pthread_mutex_destroy(&start.mutex);
+#else
+		err = ENOSYS;
+#endif
+	}
+
+	profile_set_label(NULL);
+
+	if (err)
+		goto out;
+
+	wall = test_nanoseconds() - wall;
+
+	for (i=0; i<nthreads; i++) {
+
+		struct bench_thread *bt = &btv[i];
+
+		if (bt->err) {
+			err = bt->err;
+			goto out;
+		}
+
+		hist_merge(hist, bt->hist);
+
+		iters  += bt->iters;
+		allocs += bt->mp_stop.allocs - bt->mp_start.allocs;
+		bytes  += bt->mp_stop.bytes - bt->mp_start.bytes;
+	}
+
+	if (!iters) {
+		err = EINVAL;
+		goto out;
+	}
+
+	/* single thread: time in the run handler, otherwise wall time */
+	nsec = (double)(nthreads == 1 ? btv[0].nsec : wall);
+
+	thru_b = (double)btv[0].st.bytes * (double)iters / nsec * 1e9;
+	thru_i = (double)btv[0].st.items * (double)iters / nsec * 1e9;
+
+	if (b->variantv) {
+		re_snprintf(label, sizeof(label), "%s/%s/%zu/%ut", b->name,
+			    b->variantv[variant], param, nthreads);
+	}
+	else {
+		re_snprintf(label, sizeof(label), "%s/%zu/%ut", b->name,
+			    param, nthreads);
+	}
+
+	memset(&val, 0, sizeof(val));
+
+	if (pc) {
+		err = perfcnt_read(pc, &val);
+		if (err) {
+			DEBUG_WARNING("bench: could not read counters (%m)\n",
+				      err);
+			goto out;
+		}
+	}
+
+	re_printf("%-44s: %10.1f ns/iter  %10.2f MB/s  %7.3f Gbit/s"
+		  "  %10.3f Mitems/s", label, hist_mean(hist),
+		  thru_b / 1e6, thru_b * 8 / 1e9, thru_i / 1e6);
+
+	if (val.valid[PERFCNT_CYCLES] && btv[0].st.bytes) {
+		re_printf("  %8.2f cycles/B",
+			  (double)val.v[PERFCNT_CYCLES] /
+			  ((double)btv[0].st.bytes * (double)iters));
+	}
+
+	re_printf("\n");
+
+	if (verbose)
+		re_printf("%-44s  %H usec\n", "", hist_print, hist);
+
+	if (rep) {
+		err = perf_report_add(rep, label, hist,
+				      (double)allocs / (double)iters,
+				      (double)bytes / (double)iters,
+				      peak_bytes(&btv[0].mp_start,
+						 &btv[0].mp_stop));
+		if (err)
+			goto out;
+
+		if (pc) {
+			err = perf_report_add_counters(rep, &val, iters);
+			if (err)
+				goto out;
+		}
+	}
+
+ out:
+	/* the threads have closed their own state */
+	if (nthreads == 1)
+		bench_state_close(&btv[0].st, b);
+
+	for (i=0; i<nthreads; i++)
+		mem_deref(btv[i].hist);
+
+	mem_deref(start.shared);
+	mem_deref(btv);
+	mem_deref(hist);
+
+	return err;
+}
+
+
+static unsigned bench_max_threads(const struct bench *b)
+{
+#ifdef HAVE_PTHREAD
+	long ncpu = 1;
+
+	if (b->threads)
+		return b->threads;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return (unsigned)max(ncpu, 1L);
+#else
+	(void)b;
+
+	return 1;
+#endif
+}
+
+
+static int bench_sweep(const struct bench *b, unsigned variant,
+		       struct perf_report *rep, struct perfcnt *pc,
+		       bool verbose)
+{
+	const unsigned tmax = bench_max_threads(b);
+	size_t param = b->param_min;
+	int err = 0;
+
+	for (;;) {
+		unsigned n = 1;
+
+		for (;;) {
+			err = bench_run(b, variant, param, n, rep, pc,
+					verbose);
+			if (err)
+				return err;
+
+			if (n >= tmax)
+				break;
+
+			n = min(n * 2, tmax);
+		}
+
+		if (!param || param >= b->param_max)
+			break;
+
+		/* the last step is param_max, also if it is not 4^n */
+		param = min(param * BENCH_PARAM_MUL, b->param_max);
+	}
+
+	return err;
+}
+
+
+static int testcase_bench(const struct bench *b, struct perf_report *rep,
+			  struct perfcnt *pc, bool verbose)
+{
+	unsigned v;
+	int err;
+
+	if (!b->variantv)
+		return bench_sweep(b, 0, rep, pc, verbose);
+
+	/* a variant that is not supported, e.g. a cipher, is skipped */
+	for (v=0; b->variantv[v]; v++) {
+
+		err = bench_sweep(b, v, rep, pc, verbose);
+		if (err == ESKIPPED || err == ENOSYS) {
+			re_printf("skipped: %s/%s\n", b->name,
+				  b->variantv[v]);
+			continue;
+		}
+		else if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Run the microbenchmarks
+ *
+ * @param name    Run only benchmarks starting with this name (optional)
+ * @param verbose True for the latency distribution of each run
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_bench(const char *name, bool verbose)
+{
+	struct perf_report *rep = NULL;
+	struct perfcnt *pc = NULL;
+	unsigned nrun = 0;
+	size_t i;
+	bool profiling = false;
+	int err = 0;
+
+	if (perf_cfg.json || perf_cfg.baseline) {
+		err = perf_report_alloc(&rep);
+		if (err)
+			return err;
+	}
+
+	if (perf_cfg.counters) {
+		err = perfcnt_alloc(&pc);
+		if (err) {
+			(void)re_fprintf(stderr, "performance counters"
+					 " not available (%m)\n", err);
+			goto out;
+		}
+	}
+
+	if (perf_cfg.profile) {
+		err = profile_start(PROFILE_HZ);
+		if (err) {
+			(void)re_fprintf(stderr, "profiler not available"
+					 " (%m)\n", err);
+			goto out;
+		}
+
+		profiling = true;
+	}
+
+	(void)re_fprintf(stderr, "benchmarks:\n");
+
+	for (i=0; i<ARRAY_SIZE(benches); i++) {
+
+		const struct bench *b = &benches[i];
+
+		if (name && 0 != strncmp(b->name, name, str_len(name)))
+			continue;
+
+		++nrun;
+
+		err = testcase_bench(b, rep, pc, verbose);
+		if (err == ESKIPPED || err == ENOSYS) {
+			re_printf("skipped: %s\n", b->name);
+			err = 0;
+			continue;
+		}
+		else if (err) {
+			DEBUG_WARNING("bench: %s failed (%m)\n", b->name, err);
+			goto out;
+		}
+	}
+
+	if (name && !nrun) {
+		(void)re_fprintf(stderr, "no such benchmark: %s\n", name);
+		err = ENOENT;
+		goto out;
+	}
+
+	err = perf_report_finish(rep);
+
+ out:
+	/* do not overwrite the file if the profiler never ran */
+	if (profiling) {
+		int e = profile_write(perf_cfg.profile);
+		if (!err)
+			err = e;
+	}
+
+	mem_deref(pc);
+	mem_deref(rep);
+
+	return err;
+}
+
+
+int test_reg(const char *name, bool verbose)
+{
+	int err;
+
+	timeout_override = 10000;
+
+	(void)re_fprintf(stderr, "regular tests:       ");
+	err = test_unit(name, verbose);
+	if (err)
+		return err;
+	(void)re_fprintf(stderr, "\x1b[32mOK\x1b[;m\n");
+
+	return err;
+}
+
+
+/* the UDP testcases that opt in with fuzz_attach_udpsock() */
+static const struct {
+	const char *name;
+	fuzz_test_h *exec;
+} fuzz_udp_tests[] = {
+	{"test_ice_loop",  test_ice_loop_fuzz},
+	{"test_turn",      test_turn_fuzz},
+#ifdef USE_TLS
+	{"test_dtls_srtp", test_dtls_srtp_fuzz},
+#endif
+};
+
+
+/**
+ * Loop the UDP testcases with fuzzed packets until the duration is up.
+ * Failing testcases are expected, leaks are not.
+ *
+ * @param duration Duration in seconds
+ * @param rate     Percent of packets to mutate
+ * @param verbose  Print each failing run
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_fuzz_udp(double duration, unsigned rate, bool verbose)
+{
+	struct fuzz_ctx ctx;
+	const uint64_t nsec = (uint64_t)(duration * 1e9);
+	uint64_t start;
+	unsigned runs = 0, failed = 0;
+	size_t i;
+	int err = 0;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	ctx.conf.rate       = rate;
+	ctx.conf.strategies = FUZZ_ALL;
+
+	timeout_override = 0;
+
+	start = test_nanoseconds();
+
+	while (!err && test_nanoseconds() - start < nsec) {
+
+		for (i=0; i<ARRAY_SIZE(fuzz_udp_tests); i++) {
+
+			const char *name = fuzz_udp_tests[i].name;
+			struct memstat ms_start, ms_stop;
+			int terr;
+
+			memset(&ms_start, 0, sizeof(ms_start));
+			memset(&ms_stop, 0, sizeof(ms_stop));
+
+			(void)mem_get_stat(&ms_start);
+
+			test_rand_stream(name, runs);
+			terr = fuzz_udp_tests[i].exec(&ctx);
+
+			(void)mem_get_stat(&ms_stop);
+
+			++runs;
+
+			if (terr && terr != ESKIPPED) {
+				++failed;
+				if (verbose) {
+					(void)re_printf("%s: %m\n",
+							name, terr);
+				}
+			}
+
+			if (ms_stop.blocks_cur != ms_start.blocks_cur) {
+				(void)re_fprintf(stderr, "%s: leaked memory"
+						 " -- replay with -s %llu\n",
+						 name,
+						 (unsigned long long)
+						 test_rand_seed());
+				mem_debug();
+				err = ENOMEM;
+				break;
+			}
+		}
+
+		if (!runs) {
+			(void)re_fprintf(stderr, "no UDP testcases\n");
+			err = ENOENT;
+		}
+	}
+
+	duration = (double)(test_nanoseconds() - start) * 1e-9;
+
+	(void)re_printf("fuzzed %u runs (%u failed) in %.1f s:"
+			" %llu packets (%llu mutated), %.0f packets/s\n",
+			runs, failed, duration,
+			(unsigned long long)ctx.packets,
+			(unsigned long long)ctx.mutated,
+			(double)ctx.packets / duration);
+
+	return err;
+}
+
+
+/*
+ * Soak mode: loop long-running testcases for hours, and sample the
+ * resident set size, open file descriptors, the libre memory counters
+ * and the iteration latency at intervals. The first quarter of the
+ * samples is warm-up. After that, a counter that never decreases and
+ * ends above its tolerance is a leak, and a median latency in the last
+ * quarter that is SOAK_DRIFT percent above the second quarter is drift.
+ */
+
+enum {
+	SOAK_SAMPLES_MAX = 4096,
+	SOAK_SAMPLES_MIN = 8,
+	SOAK_DRIFT       = 50,          /* [%] */
+	SOAK_RSS_TOL     = 1048576,     /* [bytes] */
+};
+
+static const char * const soak_tests[] = {
+	"test_sipsess",
+	"test_turn",
+	"test_http_loop",
+	"test_websock",
+};
+
+struct soak_sample {
+	uint64_t t;                /* [ns] */
+	uint64_t iterations;
+	uint64_t rss;              /* [bytes], 0 if unknown */
+	uint64_t fds;
+	uint64_t blocks;
+	uint64_t bytes;
+	uint64_t p50;              /* iteration latency [ns] */
+	uint64_t p99;
+};
+
+
+/* current resident set size, not the peak */
+static uint64_t soak_rss(void)
+{
+#ifdef __linux__
+	unsigned long size, resident;
+	FILE *f;
+	int n;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	n = fscanf(f, "%lu %lu", &size, &resident);
+	(void)fclose(f);
+
+	if (n != 2)
+		return 0;
+
+	return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
+}
+
+
+static uint64_t soak_fds(void)
+{
+#if defined(HAVE_UNISTD_H) && !defined(WIN32)
+	uint64_t n = 0;
+	int fd;
+
+	for (fd=0; fd<(int)fd_limit; fd++) {
+		if (fcntl(fd, F_GETFD) != -1)
+			++n;
+	}
+
+	return n;
+#else
+	return 0;
+#endif
+}
+
+
+enum soak_metric {
+	SOAK_RSS,
+	SOAK_FDS,
+	SOAK_BLOCKS,
+};
+
+
+static uint64_t soak_get(const struct soak_sample *s, enum soak_metric m)
+{
+	switch (m) {
+
+	case SOAK_RSS:    return s->rss;
+	case SOAK_FDS:    return s->fds;
+	case SOAK_BLOCKS: return s->blocks;
+	default:          return 0;
+	}
+}
+
+
+/* never decreasing after the warm-up, and grown beyond the tolerance */
+static bool soak_growth(const struct soak_sample *sv, size_t n,
+			enum soak_metric m, uint64_t tol)
+{
+	const size_t warmup = n / 4;
+	uint64_t prev, first;
+	size_t i;
+
+	first = soak_get(&sv[warmup], m);
+	prev  = first;
+
+	for (i=warmup+1; i<n; i++) {
+
+		const uint64_t v = soak_get(&sv[i], m);
+
+		if (v < prev)
+			return false;
+
+		prev = v;
+	}
+
+	return prev > first + tol;
+}
+
+
+static uint64_t soak_median_p50(const struct soak_sample *sv, size_t lo,
+				size_t hi)
+{
+	uint64_t v[SOAK_SAMPLES_MAX];
+	size_t i, j, n = 0;
+
+	for (i=lo; i<hi; i++) {
+
+		uint64_t x = sv[i].p50;
+
+		/* insertion sort, the quarters are short */
+		for (j=n++; j > 0 && v[j-1] > x; j--)
+			v[j] = v[j-1];
+		v[j] = x;
+	}
+
+	return n ? v[n / 2] : 0;
+}
+
+
+static int soak_verdict(const struct soak_sample *sv, size_t n)
+{
+	const size_t q = n / 4;
+	uint64_t early, late;
+	int err = 0;
+
+	if (n < SOAK_SAMPLES_MIN) {
+		(void)re_fprintf(stderr, "soak: only %zu samples, need %u"
+				 " -- use a longer duration\n",
+				 n, SOAK_SAMPLES_MIN);
+		return 0;
+	}
+
+	if (sv[0].rss && soak_growth(sv, n, SOAK_RSS, SOAK_RSS_TOL)) {
+		(void)re_fprintf(stderr, "soak: RSS grows\n");
+		err = ENOMEM;
+	}
+
+	if (soak_growth(sv, n, SOAK_FDS, 0)) {
+		(void)re_fprintf(stderr, "soak: open fds grow\n");
+		err = EMFILE;
+	}
+
+	if (soak_growth(sv, n, SOAK_BLOCKS, 0)) {
+		(void)re_fprintf(stderr, "soak: memory blocks grow\n");
+		err = ENOMEM;
+	}
+
+	early = soak_median_p50(sv, q, 2 * q);
+	late  = soak_median_p50(sv, n - q, n);
+
+	if (early && late * 100 > early * (100 + SOAK_DRIFT)) {
+		(void)re_fprintf(stderr, "soak: latency drift, median"
+				 " %.1f -> %.1f usec\n",
+				 early / 1000.0, late / 1000.0);
+		err = ETIMEDOUT;
+	}
+
+	return err;
+}
+
+
+static void soak_print(const struct soak_sample *s)
+{
+	(void)re_printf("%8.0f s  %8llu iter  rss %8llu KB  fds %4llu"
+			"  mem %7llu blocks %10llu bytes"
+			"  p50 %8.1f  p99 %8.1f usec\n",
+			s->t * 1e-9,
+			(unsigned long long)s->iterations,
+			(unsigned long long)s->rss / 1024,
+			(unsigned long long)s->fds,
+			(unsigned long long)s->blocks,
+			(unsigned long long)s->bytes,
+			s->p50 / 1000.0, s->p99 / 1000.0);
+}
+
+
+/**
+ * Loop testcases for a long time and check for growth and drift
+ *
+ * @param name     Testcase, or NULL for the default soak set
+ * @param duration Duration in seconds
+ * @param interval Sampling interval in seconds, 0 for 1/32 of duration
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_soak(const char *name, double duration, double interval)
+{
+	const uint64_t nsec = (uint64_t)(duration * 1e9);
+	const struct test *testv[ARRAY_SIZE(soak_tests)];
+	struct soak_sample *sv = NULL;
+	struct hist *hist = NULL;
+	uint64_t start, next, step, iterations = 0;
+	size_t i, testc = 0, n = 0;
+	int err;
+
+	if (name) {
+		testv[testc] = find_test(name);
+		if (!testv[testc]) {
+			(void)re_fprintf(stderr, "no such test: %s\n", name);
+			return ENOENT;
+		}
+		++testc;
+	}
+	else {
+		for (i=0; i<ARRAY_SIZE(soak_tests); i++) {
+
+			testv[testc] = find_test(soak_tests[i]);
+			if (testv[testc])
+				++testc;
+		}
+	}
+
+	if (interval <= 0)
+		interval = max(duration / 32, 1.0);
+
+	step = (uint64_t)(interval * 1e9);
+
+	sv = mem_zalloc(SOAK_SAMPLES_MAX * sizeof(*sv), NULL);
+	if (!sv)
+		return ENOMEM;
+
+	err = hist_alloc(&hist);
+	if (err)
+		goto out;
+
+	timeout_override = 0;
+
+	(void)re_printf("soak: %zu testcases for %.0f s, sampled every"
+			" %.0f s\n", testc, duration, interval);
+
+	start = test_nanoseconds();
+	next  = start + step;
+
+	while (test_nanoseconds() - start < nsec) {
+
+		for (i=0; i<testc; i++) {
+
+			const uint64_t t0 = test_nanoseconds();
+
+			test_rand_stream(testv[i]->name, (uint32_t)iterations);
+
+			err = testv[i]->exec();
+			if (err == ESKIPPED)
+				err = 0;
+			if (err) {
+				(void)re_fprintf(stderr, "%s failed after %llu"
+						 " iterations (%m)\n",
+						 testv[i]->name,
+						 (unsigned long long)
+						 iterations, err);
+				goto out;
+			}
+
+			hist_record(hist, test_nanoseconds() - t0);
+			++iterations;
+		}
+
+		if (test_nanoseconds() >= next && n < SOAK_SAMPLES_MAX) {
+
+			struct soak_sample *s = &sv[n++];
+			struct memstat mstat;
+
+			memset(&mstat, 0, sizeof(mstat));
+			(void)mem_get_stat(&mstat);
+
+			s->t          = test_nanoseconds() - start;
+			s->iterations = iterations;
+			s->rss        = soak_rss();
+			s->fds        = soak_fds();
+			s->blocks     = mstat.blocks_cur;
+			s->bytes      = mstat.bytes_cur;
+			s->p50        = hist_percentile(hist, 50.0);
+			s->p99        = hist_percentile(hist, 99.0);
+
+			soak_print(s);
+
+			hist_reset(hist);
+
+			/* no burst of samples after a slow iteration */
+			next = max(next + step, test_nanoseconds());
+		}
+	}
+
+	err = soak_verdict(sv, n);
+
+ out:
+	mem_deref(hist);
+	mem_deref(sv);
+
+	return err;
+}
+
+
+#ifdef HAVE_PTHREAD
+struct thread {
+	const struct test *test;
+	pthread_t tid;
+	int err;
+};
+
+
+static void *thread_handler(void *arg)
+{
+	struct thread *thr = arg;
+	int err;
+
+	err = re_thread_init();
+	if (err) {
+		DEBUG_WARNING("thread: re_thread_init failed %m\n", err);
+		thr->err = err;
+		return NULL;
+	}
+
+	err = test_exec(thr->test);
+	if (err) {
+		if (err == ESKIPPED) {
+			err = 0;
+		}
+		else {
 			DEBUG_WARNING("%s: test failed (%m)\n",
 					thr->test->name, err);
 		}
@@ -668,6 +3187,329 @@ int test_multithread(void)
 
 	return err;
 }
+
+/*
+ * Scaling mode
+ *
+ * One testcase or benchmark runs in 1, 2, 4 .. N threads at the same
+ * time, for a fixed duration per step. Every thread has its own re
+ * context and stops by itself at the deadline, so that the threads
+ * share nothing but what the code under test shares.
+ */
+
+struct scale_thread {
+	const struct test *test;
+	const struct bench *bench;
+	struct bench_state st;
+	struct bench_start *start;
+	uint64_t iterations;
+	uint64_t deadline;
+	uint64_t ops;
+	uint64_t nsec;
+	unsigned ix;
+	int cpu;                       /* -1 if not pinned */
+	pthread_t tid;
+	int err;
+};
+
+
+static void scale_pin(int cpu)
+{
+#if defined (__linux__) && defined (CPU_SET)
+	cpu_set_t set;
+	int err;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err) {
+		DEBUG_WARNING("scale: could not pin to cpu %d (%m)\n",
+			      cpu, err);
+	}
+#else
+	(void)cpu;
+#endif
+}
+
+
+static void *scale_thread_handler(void *arg)
+{
+	struct scale_thread *thr = arg;
+	struct bench_start *start = thr->start;
+	uint64_t t0;
+	int err;
+
+	if (thr->cpu >= 0)
+		scale_pin(thr->cpu);
+
+	err = re_thread_init();
+	if (err) {
+		thr->err = err;
+		goto wait;
+	}
+
+	/* the bench is set up on its own thread, with one random
+	   stream per thread */
+	if (thr->bench) {
+		thr->err = bench_state_init(&thr->st, thr->bench, 0,
+					    thr->bench->param_min, thr->ix,
+					    start->shared);
+		thr->st.iterations = thr->iterations;
+	}
+	else {
+		test_rand_stream(thr->test->name, thr->ix);
+	}
+
+ wait:
+	pthread_mutex_lock(&start->mutex);
+	++start->ready;
+	pthread_cond_broadcast(&start->cond);
+	while (!start->go)
+		pthread_cond_wait(&start->cond, &start->mutex);
+	pthread_mutex_unlock(&start->mutex);
+
+	if (err)
+		return NULL;
+
+	if (thr->err)
+		goto out;
+
+	t0 = test_nanoseconds();
+
+	do {
+		if (thr->bench) {
+			err = thr->bench->run(&thr->st);
+			thr->ops += thr->st.iterations;
+		}
+		else {
+			err = thr->test->exec();
+			++thr->ops;
+		}
+
+		if (err)
+			break;
+
+	} while (test_nanoseconds() < thr->deadline);
+
+	thr->nsec = test_nanoseconds() - t0;
+	thr->err  = err;
+
+ out:
+	if (thr->bench)
+		bench_state_close(&thr->st, thr->bench);
+
+	re_thread_close();
+
+	return NULL;
+}
+
+
+/* run n threads for one step, returns the aggregate ops/s */
+static int scale_step(const struct test *test, const struct bench *bench,
+		      void *shared, uint64_t iterations, unsigned n,
+		      double *opsp)
+{
+	struct scale_thread *thrv;
+	struct bench_start start;
+	unsigned i, nstarted = 0;
+	double ops = 0;
+	int err = 0;
+
+	thrv = mem_zalloc(n * sizeof(*thrv), NULL);
+	if (!thrv)
+		return ENOMEM;
+
+	memset(&start, 0, sizeof(start));
+	pthread_mutex_init(&start.mutex, NULL);
+	pthread_cond_init(&start.cond, NULL);
+
+	start.shared = shared;
+
+	for (i=0; i<n; i++) {
+
+		struct scale_thread *thr = &thrv[i];
+
+		thr->test  = test;
+		thr->bench = bench;
+		thr->start = &start;
+		thr->ix    = i;
+		thr->cpu   = scale_cfg.pin ? (int)(i % scale_cfg.ncpu) : -1;
+
+		thr->iterations = iterations;
+	}
+
+	for (i=0; i<n; i++) {
+
+		err = pthread_create(&thrv[i].tid, NULL,
+				     scale_thread_handler, &thrv[i]);
+		if (err) {
+			DEBUG_WARNING("pthread_create failed (%m)\n", err);
+			break;
+		}
+
+		++nstarted;
+	}
+
+	/* the deadline starts when all threads are set up */
+	pthread_mutex_lock(&start.mutex);
+	while (start.ready < nstarted)
+		pthread_cond_wait(&start.cond, &start.mutex);
+	for (i=0; i<nstarted; i++)
+		thrv[i].deadline = test_nanoseconds() +
+			scale_cfg.duration_ms * 1000000ULL;
+	start.go = true;
+	pthread_cond_broadcast(&start.cond);
+	pthread_mutex_unlock(&start.mutex);
+
+	for (i=0; i<nstarted; i++)
+		pthread_join(thrv[i].tid, NULL);
+
+	if (err)
+		goto out;
+
+	for (i=0; i<n; i++) {
+
+		struct scale_thread *thr = &thrv[i];
+
+		if (thr->err) {
+			err = thr->err;
+			goto out;
+		}
+
+		if (thr->nsec)
+			ops += (double)thr->ops * 1e9 / (double)thr->nsec;
+	}
+
+	*opsp = ops;
+
+ out:
+	pthread_cond_destroy(&start.cond);
+	pthread_mutex_destroy(&start.mutex);
+	mem_deref(thrv);
+
+	return err;
+}
+
+
+/**
+ * Run one testcase or benchmark in an increasing number of threads
+ *
+ * @param name    Name of the testcase or benchmark
+ * @param verbose Verbose output
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int test_scaling(const char *name, bool verbose)
+{
+	const struct test *test = NULL;
+	const struct bench *bench = NULL;
+	uint64_t iterations = 0;
+	void *shared = NULL;
+	unsigned n, nmax;
+	double ops1 = 0;
+	size_t i;
+	int err = 0;
+	(void)verbose;
+
+	if (!name)
+		return EINVAL;
+
+	for (i=0; i<ARRAY_SIZE(benches); i++) {
+		if (0 == str_casecmp(name, benches[i].name))
+			bench = &benches[i];
+	}
+
+	if (!bench) {
+		test = find_test(name);
+		if (!test) {
+			(void)re_fprintf(stderr, "no such test or benchmark:"
+					 " %s\n", name);
+			return ENOENT;
+		}
+	}
+
+	scale_cfg.ncpu = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+	scale_cfg.ncpu = (unsigned)max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+#endif
+	nmax = parallel_jobs > 1 ? parallel_jobs : scale_cfg.ncpu;
+
+	/* the benchmark declares how many threads it supports */
+	if (bench && bench->threads == 1) {
+		(void)re_fprintf(stderr, "%s runs in one thread only\n",
+				 name);
+		return EINVAL;
+	}
+	else if (bench && bench->threads) {
+		nmax = min(nmax, bench->threads);
+	}
+
+	timeout_override = 10000;
+
+	/* all steps share one object of the shared handler */
+	if (bench && bench->shared) {
+		err = bench->shared(&shared, bench->param_min);
+		if (err)
+			goto out;
+	}
+
+	/* calibrate the benchmark to about 1 ms per call */
+	if (bench) {
+		struct bench_state st;
+
+		err = bench_state_init(&st, bench, 0, bench->param_min, 0,
+				       shared);
+		if (!err)
+			err = bench_calibrate(bench, &st);
+
+		iterations = max(st.iterations * 1000000 / BENCH_SAMPLE_NSEC,
+				 1ULL);
+
+		bench_state_close(&st, bench);
+
+		if (err)
+			goto out;
+	}
+
+	(void)re_fprintf(stderr, "scaling %s (%.1f sec per step%s):\n",
+			 name, scale_cfg.duration_ms / 1000.0,
+			 scale_cfg.pin ? ", pinned" : "");
+	(void)re_fprintf(stderr, "%8s  %14s  %14s  %10s\n",
+			 "threads", "ops/s", "ops/s/thread", "efficiency");
+
+	for (n=1; ; n = min(n * 2, nmax)) {
+
+		double ops = 0;
+
+		err = scale_step(test, bench, shared, iterations, n, &ops);
+		if (err)
+			goto out;
+
+		if (n == 1)
+			ops1 = ops;
+
+		(void)re_fprintf(stderr, "%8u  %14.1f  %14.1f  %9.1f%%\n",
+				 n, ops, ops / n,
+				 ops1 > 0 ? 100.0 * ops / (n * ops1) : 0.0);
+
+		if (n >= nmax)
+			break;
+	}
+
+ out:
+	if (err == ESKIPPED || err == ENOSYS) {
+		(void)re_fprintf(stderr, "skipped: %s\n", name);
+		err = 0;
+	}
+	else if (err) {
+		DEBUG_WARNING("scale: %s failed (%m)\n", name, err);
+	}
+
+	mem_deref(shared);
+
+	return err;
+}
 #endif
 
 
@@ -692,6 +3534,16 @@ void test_listcases(void)
 		re_printf("\n");
 	}
 
+	(void)re_printf("\n%u benchmarks:\n", ARRAY_SIZE(benches));
+
+	for (i=0; i<ARRAY_SIZE(benches); i++) {
+
+		const struct bench *b = &benches[i];
+
+		re_printf("    %-32s    %zu..%zu\n", b->name,
+			  b->param_min, b->param_max);
+	}
+
 	(void)re_printf("\n");
 }
 
@@ -793,8 +3645,10 @@ int re_main_timeout(uint32_t timeout_ms)
 #endif
 
 	tmr_start(&tmr, timeout_ms, oom_watchdog_timeout, &err);
+	loopstat_probe_start();
 	(void)re_main(signal_handler);
 
+	loopstat_probe_stop();
 	tmr_cancel(&tmr);
 	return err;
 }
@@ -830,7 +3684,7 @@ int test_load_file(struct mbuf *mb, const char *filename)
 
 int test_write_file(struct mbuf *mb, const char *filename)
 {
-	int err = 0, fd = open(filename, O_CREAT | O_WRONLY, 0644);
+	int err = 0, fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0644);
 	if (fd < 0)
 		return errno;
 
@@ -862,6 +3716,93 @@ int test_write_file(struct mbuf *mb, const char *filename)
 }
 
 
+/**
+ * Set the number of worker threads for the regular tests
+ *
+ * @param jobs Number of worker threads, 1 runs the tests serially
+ */
+void test_set_jobs(unsigned jobs)
+{
+	parallel_jobs = max(jobs, 1U);
+}
+
+
+/**
+ * Set the number of forked shards for the regular tests
+ *
+ * @param shards Number of child processes, 1 runs the tests in-process
+ */
+void test_set_shards(unsigned shards)
+{
+	parallel_shards = max(shards, 1U);
+}
+
+
+/**
+ * Configure the scaling mode
+ *
+ * @param duration Duration of each step in seconds
+ * @param pin      True to pin every thread to one CPU
+ */
+void test_scaling_set(double duration, bool pin)
+{
+	if (duration > 0)
+		scale_cfg.duration_ms = (uint32_t)(duration * 1000);
+
+	scale_cfg.pin = pin;
+}
+
+
+/**
+ * Record event-loop statistics for the regular tests
+ *
+ * @param enable True to enable
+ */
+void test_set_loopstat(bool enable)
+{
+	loopstat_enabled = enable;
+}
+
+
+/**
+ * Raise the limit of open files, must be called before the main loop
+ * of libre is set up, i.e. before poll_method_set()
+ *
+ * @param maxfds Number of file descriptors
+ */
+void test_set_fd_limit(unsigned maxfds)
+{
+#ifdef HAVE_SETRLIMIT
+	struct rlimit rlim;
+
+	if (0 != getrlimit(RLIMIT_NOFILE, &rlim))
+		return;
+
+	if (rlim.rlim_max != RLIM_INFINITY && rlim.rlim_max < maxfds)
+		maxfds = (unsigned)rlim.rlim_max;
+
+	rlim.rlim_cur = maxfds;
+
+	if (0 != setrlimit(RLIMIT_NOFILE, &rlim)) {
+		DEBUG_WARNING("could not raise open files to %u (%m)\n",
+			      maxfds, errno);
+		return;
+	}
+
+	if (0 == fd_setsize((int)maxfds))
+		fd_limit = maxfds;
+#else
+	(void)maxfds;
+#endif
+}
+
+
+unsigned test_fd_limit(void)
+{
+	return fd_limit;
+}
+
+
 void test_set_datapath(const char *path)
 {
 	str_ncpy(datapath, path, sizeof(datapath));
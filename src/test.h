@@ -103,6 +103,101 @@
 		goto out;						\
 	}
 
+/*
+ * Cost budgets of a region, checked in the perf mode or with --budgets:
+ *
+ *     struct test_budget bud;
+ *
+ *     TEST_BUDGET_BEGIN(bud);
+ *     err = sip_msg_decode(&msg, mb);
+ *     TEST_ALLOC_MAX(bud, 16);
+ *
+ * A time budget is a single wall-clock sample, so it does not belong
+ * in a regular testcase. Use it only in dedicated perf checks that
+ * time a robust statistic, e.g. the median of many runs.
+ */
+#define TEST_BUDGET_BEGIN(b)  test_budget_begin(&(b))
+
+#define TEST_BUDGET_MAX(b, kind, max)					\
+	if (!test_budget_check(&(b), (kind), (max),			\
+			       __FILE__, __LINE__)) {			\
+		err = E2BIG;						\
+		goto out;						\
+	}
+
+#define TEST_ALLOC_MAX(b, max)   TEST_BUDGET_MAX(b, BUDGET_ALLOCS, max)
+#define TEST_BYTES_MAX(b, max)   TEST_BUDGET_MAX(b, BUDGET_BYTES, max)
+#define TEST_SYSCALL_MAX(b, max) TEST_BUDGET_MAX(b, BUDGET_SYSCALLS, max)
+#define TEST_TIME_MAX(b, nsec)   TEST_BUDGET_MAX(b, BUDGET_NSEC, nsec)
+
+
+/*
+ * Microbenchmarks
+ *
+ * The setup and teardown handlers run outside of the timed region,
+ * on the thread that runs the bench, so that they can use its event
+ * loop.
+ * The run handler does the work st->iterations times in BENCH_LOOP
+ * and passes the results to BENCH_SINK, so that the compiler cannot
+ * optimize the work away. The parameter is swept from param_min to
+ * param_max in steps of 4x, the threads from 1 to max in steps of 2x.
+ * A benchmark with variants, e.g. crypto suites, repeats the sweep
+ * for each name in variantv.
+ *
+ * The optional shared handler allocates one object per run, before
+ * the threads are set up, and the threads find it in st->shared. It
+ * is dereferenced when all threads are torn down.
+ */
+
+struct bench_state {
+	size_t param;          /**< Parameter value, e.g. payload size  */
+	unsigned variant;      /**< Index into the variantv of the bench */
+	unsigned thread;       /**< Index of this thread                 */
+	uint64_t iterations;   /**< Number of iterations in BENCH_LOOP   */
+	uint64_t i;            /**< Current iteration                    */
+	uint8_t *in;           /**< Input, param bytes of random data    */
+	uint8_t *out;          /**< Output buffer, out_size bytes        */
+	size_t out_size;
+	uint64_t bytes;        /**< Bytes per iteration, default param   */
+	uint64_t items;        /**< Items per iteration, default 1       */
+	void *arg;             /**< Private data, dereferenced after run */
+	void *shared;          /**< Data shared by the threads of a run  */
+};
+
+typedef int  (bench_h)(struct bench_state *st);
+typedef void (bench_teardown_h)(struct bench_state *st);
+typedef int  (bench_shared_h)(void **sharedp, size_t param);
+
+struct bench {
+	const char *name;
+	bench_h *run;
+	bench_h *setup;                /**< Optional setup handler     */
+	bench_teardown_h *teardown;    /**< Optional teardown handler  */
+	size_t param_min;
+	size_t param_max;
+	unsigned threads;              /**< Max threads, 0 is all CPUs */
+	const char * const *variantv;  /**< Optional, NULL-terminated  */
+	bench_shared_h *shared;        /**< Optional shared handler    */
+};
+
+#define BENCH(a, setup, teardown, pmin, pmax, threads)	\
+	{#a, a, setup, teardown, pmin, pmax, threads, NULL, NULL}
+#define BENCH_VARIANTS(a, setup, teardown, pmin, pmax, threads, v)	\
+	{#a, a, setup, teardown, pmin, pmax, threads, v, NULL}
+#define BENCH_SHARED(a, shared, setup, teardown, pmin, pmax, threads)	\
+	{#a, a, setup, teardown, pmin, pmax, threads, NULL, shared}
+
+#define BENCH_LOOP(st)							\
+	for ((st)->i = 0; (st)->i < (st)->iterations; ++(st)->i)
+
+#if defined (__GNUC__) || defined (__clang__)
+#define BENCH_SINK(x)  __asm__ __volatile__("" : : "g"(x) : "memory")
+#else
+#define BENCH_SINK(x)  bench_sink((uintptr_t)(x))
+#endif
+
+void bench_sink(uintptr_t v);
+
 
 /* Module API */
 int test_aac(void);
@@ -135,6 +230,7 @@ int test_fmt_str(void);
 int test_fmt_str_error(void);
 int test_fmt_unicode(void);
 int test_fmt_unicode_decode(void);
+int test_fuzzer(void);
 int test_g711_alaw(void);
 int test_g711_ulaw(void);
 int test_h264(void);
@@ -168,6 +264,7 @@ int test_mem_secure(void);
 int test_mqueue(void);
 int test_odict(void);
 int test_odict_array(void);
+int test_pcap(void);
 int test_remain(void);
 int test_rtmp_play(void);
 int test_rtmp_publish(void);
@@ -199,6 +296,7 @@ int test_sip_via(void);
 int test_sipevent(void);
 int test_sipreg_udp(void);
 int test_sipreg_tcp(void);
+int test_sipreg_load(void);
 #ifdef USE_TLS
 int test_sipreg_tls(void);
 #endif
@@ -207,19 +305,24 @@ int test_srtp(void);
 int test_srtcp(void);
 int test_srtp_gcm(void);
 int test_srtcp_gcm(void);
+int test_srtp_burst(void);
 int test_stun_req(void);
 int test_stun_resp(void);
 int test_stun_reqltc(void);
 int test_stun(void);
+int test_stun_nat(void);
 int test_sys_div(void);
 int test_sys_endian(void);
 int test_sys_rand(void);
 int test_tcp(void);
+int test_tcp_echo(void);
 int test_telev(void);
 int test_tmr(void);
 int test_turn(void);
 int test_turn_tcp(void);
+int test_turn_load(void);
 int test_udp(void);
+int test_udp_netem(void);
 int test_uri(void);
 int test_uri_encode(void);
 int test_uri_headers(void);
@@ -251,11 +354,65 @@ extern const char test_certificate_ecdsa[];
 #endif
 
 
+/* Module benchmarks */
+int bench_base64_encode(struct bench_state *st);
+int bench_base64_decode(struct bench_state *st);
+int bench_base64_decode_setup(struct bench_state *st);
+int bench_crc32(struct bench_state *st);
+int bench_g711_alaw_encode(struct bench_state *st);
+int bench_g711_ulaw_decode(struct bench_state *st);
+int bench_hmac_sha1(struct bench_state *st);
+int bench_hmac_sha256(struct bench_state *st);
+int bench_hmac_sha256_setup(struct bench_state *st);
+int bench_pcap_decode(struct bench_state *st);
+int bench_pcap_setup(struct bench_state *st);
+int bench_sipreg_udp(struct bench_state *st);
+int bench_sipreg_tcp(struct bench_state *st);
+#ifdef USE_TLS
+int bench_sipreg_tls(struct bench_state *st);
+#endif
+int bench_sipreg_setup(struct bench_state *st);
+void bench_sipreg_teardown(struct bench_state *st);
+int bench_srtcp_decrypt(struct bench_state *st);
+int bench_srtcp_decrypt_setup(struct bench_state *st);
+int bench_srtcp_encrypt(struct bench_state *st);
+int bench_srtcp_setup(struct bench_state *st);
+int bench_srtp_burst_decrypt(struct bench_state *st);
+int bench_srtp_burst_decrypt_setup(struct bench_state *st);
+int bench_srtp_burst_encrypt(struct bench_state *st);
+int bench_srtp_burst_setup(struct bench_state *st);
+int bench_srtp_decrypt(struct bench_state *st);
+int bench_srtp_decrypt_setup(struct bench_state *st);
+int bench_srtp_encrypt(struct bench_state *st);
+int bench_srtp_setup(struct bench_state *st);
+extern const char * const bench_srtp_suitev[];
+int bench_stun_binding(struct bench_state *st);
+int bench_stun_binding_mi(struct bench_state *st);
+int bench_stun_setup(struct bench_state *st);
+int bench_stun_shared(void **sharedp, size_t param);
+void bench_stun_teardown(struct bench_state *st);
+int bench_tcp_bulk(struct bench_state *st);
+int bench_tcp_bulk_setup(struct bench_state *st);
+int bench_tcp_conns(struct bench_state *st);
+int bench_tcp_conns_setup(struct bench_state *st);
+void bench_tcp_teardown(struct bench_state *st);
+int bench_vidconv(struct bench_state *st);
+int bench_vidconv_setup(struct bench_state *st);
+
+
 /* High-level API */
 int  test_reg(const char *name, bool verbose);
+int  test_fuzz_udp(double duration, unsigned rate, bool verbose);
+int  test_soak(const char *name, double duration, double interval);
 int  test_oom(const char *name, bool verbose);
+int  test_oom_index(const char *name, bool verbose);
 int  test_perf(const char *name, bool verbose);
+int  test_bench(const char *name, bool verbose);
+void test_perf_set_report(const char *json, const char *baseline,
+			  double threshold);
 int  test_multithread(void);
+int  test_scaling(const char *name, bool verbose);
+void test_scaling_set(double duration, bool pin);
 void test_listcases(void);
 
 
@@ -263,8 +420,17 @@ void test_hexdump_dual(FILE *f,
 		       const void *ep, size_t elen,
 		       const void *ap, size_t alen);
 int re_main_timeout(uint32_t timeout_ms);
+uint64_t test_nanoseconds(void);
+uint64_t test_cpu_nanoseconds(void);
 int test_load_file(struct mbuf *mb, const char *filename);
 int test_write_file(struct mbuf *mb, const char *filename);
+void test_set_jobs(unsigned jobs);
+void test_set_shards(unsigned shards);
+void test_set_loopstat(bool enable);
+void test_set_fd_limit(unsigned maxfds);
+unsigned test_fd_limit(void);
+void test_perf_set_counters(bool enable);
+void test_perf_set_profile(const char *filename);
 void test_set_datapath(const char *path);
 const char *test_datapath(void);
 
@@ -273,6 +439,160 @@ const char *test_datapath(void);
 bool odict_compare(const struct odict *dict1, const struct odict *dict2);
 
 
+/*
+ * Seeded randomness
+ */
+
+void     test_rand_set_seed(uint64_t seed);
+uint64_t test_rand_seed(void);
+void     test_rand_stream(const char *name, uint32_t ix);
+uint64_t test_rand_u64(void);
+uint32_t test_rand_u32(void);
+uint16_t test_rand_u16(void);
+void     test_rand_bytes(uint8_t *p, size_t size);
+void     test_rand_str(char *str, size_t size);
+
+
+/*
+ * Latency histogram
+ */
+
+struct hist;
+
+int      hist_alloc(struct hist **histp);
+void     hist_reset(struct hist *hist);
+void     hist_record(struct hist *hist, uint64_t value);
+void     hist_merge(struct hist *dst, const struct hist *src);
+uint64_t hist_count(const struct hist *hist);
+uint64_t hist_min(const struct hist *hist);
+uint64_t hist_max(const struct hist *hist);
+double   hist_mean(const struct hist *hist);
+double   hist_stddev(const struct hist *hist);
+uint64_t hist_percentile(const struct hist *hist, double pct);
+int      hist_print(struct re_printf *pf, const struct hist *hist);
+
+
+/*
+ * Allocation profile
+ */
+
+struct memprof {
+	uint64_t allocs;      /**< Number of allocations        */
+	uint64_t bytes;       /**< Number of bytes allocated    */
+	uint64_t frees;       /**< Number of blocks freed       */
+	int64_t cur;          /**< Live bytes on this thread    */
+	int64_t peak;         /**< Peak of live bytes           */
+};
+
+bool memprof_supported(void);
+void memprof_get(struct memprof *mp);
+void memprof_reset_peak(void);
+void memprof_fail_at(uint64_t n);
+bool memprof_fail_hit(void);
+
+bool     syscount_supported(void);
+uint64_t syscount_get(void);
+
+
+/*
+ * Cost budgets
+ */
+
+enum test_budget_kind {
+	BUDGET_ALLOCS,
+	BUDGET_BYTES,
+	BUDGET_SYSCALLS,
+	BUDGET_NSEC,
+};
+
+struct test_budget {
+	struct memprof mp;
+	uint64_t syscalls;
+	uint64_t nsec;
+};
+
+void test_budget_enable(bool enable);
+bool test_budget_enabled(void);
+void test_budget_begin(struct test_budget *b);
+bool test_budget_check(const struct test_budget *b,
+		       enum test_budget_kind kind, uint64_t max,
+		       const char *file, unsigned line);
+
+
+/*
+ * Performance counters
+ */
+
+enum perfcnt_id {
+	PERFCNT_CYCLES = 0,
+	PERFCNT_INSTRUCTIONS,
+	PERFCNT_L1D_MISSES,
+	PERFCNT_LLC_MISSES,
+	PERFCNT_BRANCH_MISSES,
+	PERFCNT_TASK_CLOCK,
+	PERFCNT_CTX_SWITCHES,
+	PERFCNT_PAGE_FAULTS,
+
+	PERFCNT_MAX
+};
+
+struct perfcnt_val {
+	uint64_t v[PERFCNT_MAX];
+	bool valid[PERFCNT_MAX];
+};
+
+struct perfcnt;
+
+int  perfcnt_alloc(struct perfcnt **pcp);
+void perfcnt_reset(struct perfcnt *pc);
+void perfcnt_enable(struct perfcnt *pc);
+void perfcnt_disable(struct perfcnt *pc);
+int  perfcnt_read(const struct perfcnt *pc, struct perfcnt_val *val);
+const char *perfcnt_name(enum perfcnt_id id);
+int  perfcnt_print(struct re_printf *pf, const struct perfcnt_val *val,
+		   uint64_t n);
+
+
+/*
+ * Event-loop statistics
+ */
+
+struct loopstat;
+
+int      loopstat_alloc(struct loopstat **lsp);
+void     loopstat_reset(struct loopstat *ls);
+void     loopstat_enable(struct loopstat *ls);
+bool     loopstat_isempty(const struct loopstat *ls);
+void     loopstat_probe_start(void);
+void     loopstat_probe_stop(void);
+int      loopstat_print(struct re_printf *pf, const struct loopstat *ls);
+
+/*
+ * Sampling profiler
+ */
+
+int  profile_start(unsigned hz);
+void profile_stop(void);
+void profile_set_label(const char *label);
+int  profile_write(const char *filename);
+
+/*
+ * Performance report
+ */
+
+struct perf_report;
+
+int perf_report_alloc(struct perf_report **repp);
+int perf_report_add(struct perf_report *rep, const char *name,
+		    const struct hist *hist, double allocs, double bytes,
+		    uint64_t peak);
+int perf_report_add_counters(struct perf_report *rep,
+			     const struct perfcnt_val *val, uint64_t n);
+int perf_report_write(const struct perf_report *rep, const char *filename);
+int perf_report_compare(const struct perf_report *rep, const char *filename,
+			double threshold, unsigned *nregp);
+
+
 /*
  * Mock objects
  */
@@ -295,6 +615,8 @@ struct stunserver {
 	struct sa laddr;
 	struct sa laddr_tcp;
 	struct sa paddr;
+	const uint8_t *key;        /* MESSAGE-INTEGRITY key, optional */
+	size_t keylen;
 	uint32_t nrecv;
 	int err;
 };
@@ -302,34 +624,46 @@ struct stunserver {
 int stunserver_alloc(struct stunserver **stunp);
 const struct sa *stunserver_addr(const struct stunserver *stun, int proto);
 
+struct stunsrv_thread;
+
+struct stunserver_mt {
+	struct stunsrv_thread *thrv;
+	unsigned nthreads;
+	struct sa laddr;           /* shared by all threads */
+	const uint8_t *key;
+	size_t keylen;
+	volatile bool stop;
+
+	/* valid after stunserver_mt_stop() */
+	uint64_t nrecv;
+	uint64_t cpu_nsec;
+	int err;
+};
+
+int  stunserver_mt_alloc(struct stunserver_mt **mtp, unsigned nthreads,
+			 const uint8_t *key, size_t keylen);
+void stunserver_mt_stop(struct stunserver_mt *mt);
+
 
 struct turnserver {
 	struct udp_sock *us;
 	struct sa laddr;
 	struct tcp_sock *ts;
 	struct sa laddr_tcp;
-	struct tcp_conn *tc;
-	struct sa paddr;
-	struct mbuf *mb;
-	struct udp_sock *us_relay;
-	struct sa cli;
-	struct sa relay;
-
-	struct channel {
-		uint16_t nr;
-		struct sa peer;
-	} chanv[4];
-	size_t chanc;
-
-	struct sa permv[4];
-	size_t permc;
+	struct list tcl;           /* TCP connections */
+	struct hash *ht_alloc;     /* allocations, by client address */
+	size_t allocc;
+	struct sa relay;           /* relay address of the last allocation */
 
 	size_t n_allocate;
+	size_t n_refresh;
+	size_t n_expired;
 	size_t n_createperm;
 	size_t n_chanbind;
 	size_t n_send;
 	size_t n_raw;
 	size_t n_recv;
+	size_t n_noperm;           /* relayed packets without permission */
 };
 
 int turnserver_alloc(struct turnserver **turnp);
@@ -340,23 +674,88 @@ enum natbox_type {
 	NAT_FIREWALL,
 };
 
+/** Mapping and filtering behaviour, RFC 4787 */
+enum nat_behaviour {
+	NAT_ENDPOINT_INDEPENDENT = 0,
+	NAT_ADDR_DEPENDENT,
+	NAT_ADDR_PORT_DEPENDENT,
+};
+
 /**
- * A simple NAT-box that can be hooked onto a UDP-socket.
+ * A NAT-box that can be hooked onto one or more UDP-sockets.
  *
- * The NAT behaviour is port-preserving and will rewrite the source
- * IP-address to the public address.
+ * The NAT will rewrite the source IP-address to the public address,
+ * and keeps the source port if it is free. By default the mapping and
+ * filtering are endpoint-independent and the bindings do not expire.
  */
 struct nat {
 	enum natbox_type type;
+	enum nat_behaviour mapping;
+	enum nat_behaviour filtering;
 	struct sa public_addr;
+	struct list sockl;         /* attached sockets */
+	struct hash *ht_int;       /* bindings by internal endpoint */
+	struct hash *ht_ext;       /* bindings by external port */
+	struct tmr tmr;
+	uint32_t timeout;          /* binding timeout [ms], 0 for none */
+	uint16_t port_next;
+	size_t bindingc;
+	size_t n_filtered;
+	size_t n_expired;
+};
+
+int  nat_alloc(struct nat **natp, enum natbox_type type,
+	       struct udp_sock *us, const struct sa *public_addr);
+int  nat_attach(struct nat *nat, struct udp_sock *us);
+void nat_set_behaviour(struct nat *nat, enum nat_behaviour mapping,
+		       enum nat_behaviour filtering);
+void nat_set_timeout(struct nat *nat, uint32_t timeout);
+
+
+/*
+ * Network impairment (egress)
+ */
+
+enum netem_dist {
+	NETEM_UNIFORM = 0,
+	NETEM_NORMAL,
+};
+
+struct netem_conf {
+	uint32_t delay;            /**< One-way delay [ms]                  */
+	uint32_t jitter;           /**< Jitter, max or std. deviation [ms]  */
+	enum netem_dist dist;      /**< Jitter distribution                 */
+	double reorder;            /**< Probability to skip the delay       */
+	double dup;                /**< Probability to duplicate a packet   */
+	double loss_p;             /**< Gilbert-Elliott P(good -> bad)      */
+	double loss_r;             /**< Gilbert-Elliott P(bad -> good)      */
+	double loss_good;          /**< Loss probability in good state      */
+	double loss_bad;           /**< Loss probability in bad state       */
+	uint32_t rate;             /**< Rate limit [bit/s], 0 for none      */
+	uint32_t burst;            /**< Token bucket size [bytes]           */
+	uint32_t limit;            /**< Max queued packets, 0 for default   */
+};
+
+struct netem {
 	struct udp_helper *uh;
 	struct udp_sock *us;
-	struct sa bindingv[16];
-	size_t bindingc;
+	struct netem_conf conf;
+	struct list pktl;          /* queued packets, by departure time */
+	struct tmr tmr;
+	double tokens;             /* token bucket [bytes] */
+	uint64_t tb_last;
+	bool bad;                  /* Gilbert-Elliott state */
+
+	size_t n_sent;
+	size_t n_lost;
+	size_t n_dropped;          /* queue overflow */
+	size_t n_duplicated;
+	size_t n_reordered;
 };
 
-int nat_alloc(struct nat **natp, enum natbox_type type,
-	      struct udp_sock *us, const struct sa *public_addr);
+int  netem_alloc(struct netem **nep, struct udp_sock *us,
+		 const struct netem_conf *conf);
+void netem_set(struct netem *ne, const struct netem_conf *conf);
 
 
 /*
@@ -365,13 +764,22 @@ int nat_alloc(struct nat **natp, enum natbox_type type,
 
 enum behavior {
 	BEHAVIOR_NORMAL,
-	BEHAVIOR_REJECT
+	BEHAVIOR_REJECT,
+	BEHAVIOR_ECHO,             /* send back everything received */
+	BEHAVIOR_SINK,             /* count and discard */
 };
 
 struct tcp_server {
 	struct tcp_sock *ts;
 	enum behavior behavior;
 	struct sa laddr;
+	struct list connl;         /* accepted connections */
+	size_t connc;
+
+	uint64_t n_accept;
+	uint64_t n_recv;           /* receive handler calls */
+	uint64_t n_send;           /* tcp_send() calls */
+	uint64_t bytes;            /* bytes received */
 };
 
 int tcp_server_alloc(struct tcp_server **srvp, enum behavior behavior);
@@ -384,9 +792,14 @@ int tcp_server_alloc(struct tcp_server **srvp, enum behavior behavior);
 struct sip_server {
 	struct sip *sip;
 	struct sip_lsnr *lsnr;
+	struct hash *ht_aor;        /* location table, AOR -> bindings */
 	bool terminate;
 
+	unsigned bindingc;
+
 	unsigned n_register_req;
+	unsigned n_retrans;
+	unsigned n_expired;
 };
 
 int sip_server_alloc(struct sip_server **srvp);
@@ -400,4 +813,98 @@ int sip_server_uri(struct sip_server *srv, char *uri, size_t sz,
 
 struct fuzz;
 
-int fuzz_register_tcpconn(struct fuzz **fuzzp, struct tcp_conn *tc);
+enum fuzz_strategy {
+	FUZZ_BITFLIP   = 1 << 0,
+	FUZZ_TRUNCATE  = 1 << 1,
+	FUZZ_DUPLICATE = 1 << 2,   /* outgoing packets only */
+	FUZZ_LENGTH    = 1 << 3,   /* tamper with a 16-bit length field */
+	FUZZ_SPLICE    = 1 << 4,   /* bytes from the previous packet */
+
+	FUZZ_COUNT     = 5,
+	FUZZ_ALL       = (1 << FUZZ_COUNT) - 1,
+};
+
+struct fuzz_conf {
+	unsigned rate;             /* percent of packets to mutate */
+	unsigned strategies;       /* mask of FUZZ_*, 0 for all */
+};
+
+/* passed by the run mode, a fuzzer adds its counts when freed */
+struct fuzz_ctx {
+	struct fuzz_conf conf;
+	uint64_t packets;
+	uint64_t mutated;
+};
+
+typedef int (fuzz_test_h)(struct fuzz_ctx *ctx);
+
+int  fuzz_register_tcpconn(struct fuzz **fuzzp, struct tcp_conn *tc);
+int  fuzz_register_udpsock(struct fuzz **fuzzp, struct udp_sock *us,
+			   const struct fuzz_conf *conf);
+int  fuzz_attach_udpsock(struct fuzz **fuzzp, struct udp_sock *us,
+			 struct fuzz_ctx *ctx);
+
+/* UDP testcases that take a fuzzing context */
+int test_ice_loop_fuzz(struct fuzz_ctx *ctx);
+int test_turn_fuzz(struct fuzz_ctx *ctx);
+#ifdef USE_TLS
+int test_dtls_srtp_fuzz(struct fuzz_ctx *ctx);
+#endif
+
+
+/*
+ * Packet capture replay
+ */
+
+enum pcap_proto {
+	PCAP_STUN,
+	PCAP_DTLS,
+	PCAP_RTP,
+	PCAP_RTCP,
+	PCAP_SIP,
+	PCAP_OTHER,
+
+	PCAP_PROTO_COUNT
+};
+
+struct pcap_pkt {
+	struct le le;
+	uint64_t ts;               /* capture time [ns] */
+	struct mbuf *mb;           /* UDP payload */
+	enum pcap_proto proto;
+};
+
+struct pcap {
+	struct list pktl;
+	unsigned pktc;
+	unsigned n_skipped;        /* not UDP, fragments, unknown links */
+	bool truncated;
+	uint64_t bytes;
+	unsigned countv[PCAP_PROTO_COUNT];
+
+	/* results of the last replay */
+	struct hist *histv[PCAP_PROTO_COUNT];   /* decode latency [ns] */
+	unsigned errv[PCAP_PROTO_COUNT];
+	unsigned n_recv;
+};
+
+int  pcap_alloc(struct pcap **pcapp, const uint8_t *buf, size_t len);
+int  pcap_load(struct pcap **pcapp, const char *filename);
+int  pcap_replay_decode(struct pcap *pcap);
+int  pcap_replay_socket(struct pcap *pcap, double scale, struct hist *lagp);
+int  pcap_report(struct re_printf *pf, const struct pcap *pcap);
+enum pcap_proto pcap_classify(const uint8_t *p, size_t len);
+const char *pcap_proto_name(enum pcap_proto proto);
+int  test_pcap_replay(const char *filename, double scale);
+void test_pcap_set_file(const char *filename);
+
+
+/*
+ * Decoder fuzzing
+ */
+
+int  fuzzer_exec(const char *name, const uint8_t *data, size_t size);
+int  fuzzer_replay(const char *name, char * const *pathv, int pathc,
+		   double duration);
+int  fuzzer_write_seeds(const char *dir);
+void fuzzer_list(void);
@@ -18,6 +18,8 @@ struct turntest {
 	struct turnserver *turnsrv;
 	struct udp_sock *us_cli;
 	struct udp_sock *us_peer;
+	struct fuzz *fuzz_cli;
+	struct fuzz *fuzz_peer;
 	struct tcp_conn *tc;
 	struct sa cli;
 	struct sa peer;
@@ -41,6 +43,8 @@ static void destructor(void *arg)
 	/* NOTE: must be derefed before udp socket */
 	mem_deref(tt->turnc);
 
+	mem_deref(tt->fuzz_cli);
+	mem_deref(tt->fuzz_peer);
 	mem_deref(tt->us_cli);
 	mem_deref(tt->us_peer);
 	mem_deref(tt->tc);
@@ -304,7 +308,8 @@ static void tcp_close_handler(int err, void *arg)
 }
 
 
-static int turntest_alloc(struct turntest **ttp, int proto)
+static int turntest_alloc(struct turntest **ttp, int proto,
+			  struct fuzz_ctx *fuzz)
 {
 	struct turntest *tt;
 	struct sa laddr;
@@ -328,6 +333,10 @@ static int turntest_alloc(struct turntest **ttp, int proto)
 		err = udp_local_get(tt->us_cli, &tt->cli);
 		if (err)
 			goto out;
+
+		err = fuzz_attach_udpsock(&tt->fuzz_cli, tt->us_cli, fuzz);
+		if (err)
+			goto out;
 	}
 
 	err = udp_listen(&tt->us_peer, &laddr, peer_udp_recv, tt);
@@ -338,6 +347,10 @@ static int turntest_alloc(struct turntest **ttp, int proto)
 	if (err)
 		goto out;
 
+	err = fuzz_attach_udpsock(&tt->fuzz_peer, tt->us_peer, fuzz);
+	if (err)
+		goto out;
+
 	err = turnserver_alloc(&tt->turnsrv);
 	if (err)
 		goto out;
@@ -370,12 +383,12 @@ static int turntest_alloc(struct turntest **ttp, int proto)
 }
 
 
-int test_turn(void)
+static int turn_udp(struct fuzz_ctx *fuzz)
 {
 	struct turntest *tt;
 	int err;
 
-	err = turntest_alloc(&tt, IPPROTO_UDP);
+	err = turntest_alloc(&tt, IPPROTO_UDP, fuzz);
 	if (err)
 		return err;
 
@@ -406,12 +419,24 @@ int test_turn(void)
 }
 
 
+int test_turn(void)
+{
+	return turn_udp(NULL);
+}
+
+
+int test_turn_fuzz(struct fuzz_ctx *ctx)
+{
+	return turn_udp(ctx);
+}
+
+
 int test_turn_tcp(void)
 {
 	struct turntest *tt;
 	int err;
 
-	err = turntest_alloc(&tt, IPPROTO_TCP);
+	err = turntest_alloc(&tt, IPPROTO_TCP, NULL);
 	if (err)
 		return err;
 
@@ -440,3 +465,196 @@ int test_turn_tcp(void)
 
 	return err;
 }
+
+
+/*
+ * Many TURN clients on one server. Each client allocates, binds a
+ * channel to the peer and sends a payload, which the peer echoes back
+ * through the relay socket of that client.
+ */
+
+enum {
+	LOAD_CLIENTS = 64,
+};
+
+struct turnload;
+
+struct loadcli {
+	struct turnload *tl;
+	struct turnc *turnc;
+	struct udp_sock *us;
+	bool echoed;
+};
+
+struct turnload {
+	struct turnserver *turnsrv;
+	struct udp_sock *us_peer;
+	struct sa peer;
+	struct loadcli cliv[LOAD_CLIENTS];
+	size_t n_chan;
+	size_t n_echo;
+	int err;
+};
+
+
+static void load_destructor(void *arg)
+{
+	struct turnload *tl = arg;
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(tl->cliv); i++) {
+		mem_deref(tl->cliv[i].turnc);
+		mem_deref(tl->cliv[i].us);
+	}
+
+	mem_deref(tl->us_peer);
+	mem_deref(tl->turnsrv);
+}
+
+
+static void load_complete(struct turnload *tl, int err)
+{
+	tl->err = err;
+	re_cancel();
+}
+
+
+static void load_chan_handler(void *arg)
+{
+	struct loadcli *cli = arg;
+	struct turnload *tl = cli->tl;
+	struct mbuf *mb;
+	int err;
+
+	++tl->n_chan;
+
+	mb = mbuf_alloc(4 + str_len(test_payload));
+	if (!mb) {
+		load_complete(tl, ENOMEM);
+		return;
+	}
+
+	mb->pos = 4;
+	err = mbuf_write_str(mb, test_payload);
+	mb->pos = 4;
+
+	err |= udp_send(cli->us, &tl->peer, mb);
+	if (err)
+		load_complete(tl, err);
+
+	mem_deref(mb);
+}
+
+
+static void load_turnc_handler(int err, uint16_t scode, const char *reason,
+			       const struct sa *relay_addr,
+			       const struct sa *mapped_addr,
+			       const struct stun_msg *msg,
+			       void *arg)
+{
+	struct loadcli *cli = arg;
+	(void)reason;
+	(void)relay_addr;
+	(void)mapped_addr;
+	(void)msg;
+
+	if (!err && scode)
+		err = EPROTO;
+
+	if (!err)
+		err = turnc_add_chan(cli->turnc, &cli->tl->peer,
+				     load_chan_handler, cli);
+
+	if (err)
+		load_complete(cli->tl, err);
+}
+
+
+/* the peer echoes everything back to the relay address */
+static void load_peer_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct turnload *tl = arg;
+	int err;
+
+	err = udp_send(tl->us_peer, src, mb);
+	if (err)
+		load_complete(tl, err);
+}
+
+
+static void load_cli_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct loadcli *cli = arg;
+	struct turnload *tl = cli->tl;
+	int err = 0;
+
+	TEST_SACMP(&tl->peer, src, SA_ALL);
+	TEST_MEMCMP(test_payload, strlen(test_payload),
+		    mbuf_buf(mb), mbuf_get_left(mb));
+
+	if (!cli->echoed) {
+		cli->echoed = true;
+		++tl->n_echo;
+	}
+
+ out:
+	if (err || tl->n_echo >= LOAD_CLIENTS)
+		load_complete(tl, err);
+}
+
+
+int test_turn_load(void)
+{
+	struct turnload *tl;
+	struct sa laddr;
+	size_t i;
+	int err;
+
+	tl = mem_zalloc(sizeof(*tl), load_destructor);
+	if (!tl)
+		return ENOMEM;
+
+	err = sa_set_str(&laddr, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err = turnserver_alloc(&tl->turnsrv);
+	TEST_ERR(err);
+
+	err = udp_listen(&tl->us_peer, &laddr, load_peer_recv, tl);
+	TEST_ERR(err);
+
+	err = udp_local_get(tl->us_peer, &tl->peer);
+	TEST_ERR(err);
+
+	for (i=0; i<ARRAY_SIZE(tl->cliv); i++) {
+
+		struct loadcli *cli = &tl->cliv[i];
+
+		cli->tl = tl;
+
+		err = udp_listen(&cli->us, &laddr, load_cli_recv, cli);
+		TEST_ERR(err);
+
+		err = turnc_alloc(&cli->turnc, NULL, IPPROTO_UDP, cli->us,
+				  0, &tl->turnsrv->laddr,
+				  "username", "password", 600,
+				  load_turnc_handler, cli);
+		TEST_ERR(err);
+	}
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	err = tl->err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(LOAD_CLIENTS, tl->turnsrv->allocc);
+	TEST_EQUALS(LOAD_CLIENTS, tl->n_chan);
+	TEST_EQUALS(LOAD_CLIENTS, tl->n_echo);
+	TEST_EQUALS(0, tl->turnsrv->n_noperm);
+
+ out:
+	mem_deref(tl);
+
+	return err;
+}
@@ -152,6 +152,7 @@ int test_udp(void)
 {
 	struct udp_sock *uss2;
 	struct udp_test *ut;
+	struct test_budget bud;
 	int layer = 0;
 	int err;
 
@@ -197,6 +198,8 @@ int test_udp(void)
 		goto out;
 
 	/* Start test */
+	TEST_BUDGET_BEGIN(bud);
+
 	err = send_data(ut->usc, &ut->srv, data0);
 	if (err)
 		goto out;
@@ -205,11 +208,135 @@ int test_udp(void)
 	if (err)
 		goto out;
 
-	if (ut->err)
+	if (ut->err) {
 		err = ut->err;
+		goto out;
+	}
+
+	/* one datagram each way, a send and a receive on each side */
+	TEST_SYSCALL_MAX(bud, 8);
 
  out:
 	mem_deref(ut);
 
 	return err;
 }
+
+
+/*
+ * Network impairment on the client socket: every packet that is not
+ * lost must arrive after the minimum delay, and duplicates too.
+ */
+
+enum {
+	NETEM_PACKETS = 100,
+	NETEM_DELAY   = 20,       /* [ms] */
+	NETEM_JITTER  = 5,        /* [ms] */
+};
+
+struct netem_test {
+	struct udp_sock *usc;
+	struct udp_sock *uss;
+	struct netem *ne;
+	uint64_t start;
+	size_t n_recv;
+	int err;
+};
+
+
+static void netem_test_destructor(void *arg)
+{
+	struct netem_test *nt = arg;
+
+	mem_deref(nt->ne);
+	mem_deref(nt->usc);
+	mem_deref(nt->uss);
+}
+
+
+static void netem_recv(const struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct netem_test *nt = arg;
+	int err = 0;
+	(void)src;
+
+	++nt->n_recv;
+
+	TEST_ASSERT(mbuf_compare(mb, data0));
+	TEST_ASSERT(tmr_jiffies() - nt->start >= NETEM_DELAY - NETEM_JITTER);
+
+ out:
+	if (err) {
+		nt->err = err;
+		re_cancel();
+	}
+	else if (list_isempty(&nt->ne->pktl) &&
+		 nt->n_recv >= nt->ne->n_sent) {
+		re_cancel();
+	}
+}
+
+
+int test_udp_netem(void)
+{
+	struct netem_test *nt;
+	struct netem_conf conf;
+	struct sa srv;
+	unsigned i;
+	int err;
+
+	nt = mem_zalloc(sizeof(*nt), netem_test_destructor);
+	if (!nt)
+		return ENOMEM;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.delay     = NETEM_DELAY;
+	conf.jitter    = NETEM_JITTER;
+	conf.dist      = NETEM_UNIFORM;
+	conf.dup       = 0.05;
+	conf.loss_p    = 0.05;
+	conf.loss_r    = 0.5;
+	conf.loss_good = 0.02;
+	conf.loss_bad  = 0.5;
+
+	err = sa_set_str(&srv, "127.0.0.1", 0);
+	TEST_ERR(err);
+
+	err  = udp_listen(&nt->usc, &srv, NULL, NULL);
+	err |= udp_listen(&nt->uss, &srv, netem_recv, nt);
+	TEST_ERR(err);
+
+	err = udp_local_get(nt->uss, &srv);
+	TEST_ERR(err);
+
+	err = netem_alloc(&nt->ne, nt->usc, &conf);
+	TEST_ERR(err);
+
+	nt->start = tmr_jiffies();
+
+	for (i=0; i<NETEM_PACKETS; i++) {
+		err = send_data(nt->usc, &srv, data0);
+		TEST_ERR(err);
+	}
+
+	TEST_EQUALS(NETEM_PACKETS + nt->ne->n_duplicated,
+		    nt->ne->n_lost + list_count(&nt->ne->pktl));
+
+	/* nothing leaves before the minimum delay */
+	TEST_EQUALS(0, nt->ne->n_sent);
+
+	err = re_main_timeout(500);
+	TEST_ERR(err);
+
+	err = nt->err;
+	TEST_ERR(err);
+
+	TEST_EQUALS(NETEM_PACKETS + nt->ne->n_duplicated - nt->ne->n_lost,
+		    nt->ne->n_sent);
+	TEST_EQUALS(nt->ne->n_sent, nt->n_recv);
+
+ out:
+	mem_deref(nt);
+
+	return err;
+}
@@ -389,3 +389,73 @@ int test_vidconv_scaling(void)
 
 	return err;
 }
+
+
+struct bench_vidconv {
+	struct vidframe *src;
+	struct vidframe *dst;
+};
+
+
+static void bench_vidconv_destructor(void *arg)
+{
+	struct bench_vidconv *bv = arg;
+
+	mem_deref(bv->dst);
+	mem_deref(bv->src);
+}
+
+
+/* the parameter is the frame width, with a 16:9 aspect ratio */
+int bench_vidconv_setup(struct bench_state *st)
+{
+	struct bench_vidconv *bv;
+	struct vidsz size;
+	int i, err;
+
+	size.w = (unsigned)st->param & ~1U;
+	size.h = (size.w * 9 / 16) & ~1U;
+
+	bv = mem_zalloc(sizeof(*bv), bench_vidconv_destructor);
+	if (!bv)
+		return ENOMEM;
+
+	err  = vidframe_alloc(&bv->src, VID_FMT_YUV420P, &size);
+	err |= vidframe_alloc(&bv->dst, VID_FMT_NV12, &size);
+	if (err)
+		goto out;
+
+	/* Y plane and the subsampled U/V planes */
+	for (i=0; i<3; i++) {
+
+		const unsigned h = i ? size.h / 2 : size.h;
+
+		write_pattern(bv->src->data[i], bv->src->linesize[i] * h);
+	}
+
+	st->bytes = vidframe_size(VID_FMT_YUV420P, &size);
+
+ out:
+	if (err)
+		mem_deref(bv);
+	else
+		st->arg = bv;
+
+	return err;
+}
+
+
+/* convert a YUV420P frame to NV12 per iteration */
+int bench_vidconv(struct bench_state *st)
+{
+	struct bench_vidconv *bv = st->arg;
+
+	BENCH_LOOP(st) {
+
+		vidconv(bv->dst, bv->src, NULL);
+
+		BENCH_SINK(bv->dst->data[0]);
+	}
+
+	return 0;
+}